@@ -33,4 +33,7 @@ void app_init(void);
 // Callback function used to indicate that UART is closed
 void app_handle_uart_closed(void);
 
+// Callback function used to indicate that a new IMU sample is available
+void app_handle_imu_sample(void);
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -76,3 +76,31 @@ void cmdctrl_simhijack(bool hijack);
  * Send heartbeat message
  */
 void cmdctrl_send_heartbeat(void);
+
+/**
+ * Select format of status messages sent to the PC
+ * @param enable True to use compact protocol (opcodes), false to use message names
+ */
+void cmdctrl_set_compact(bool enable);
+
+/**
+ * Check if the control loop is synchronized to IMU samples
+ * @return true if control loop runs each time there is a new IMU sample (instead of at fixed rate)
+ */
+bool cmdctrl_control_imu_sync(void);
+
+/**
+ * Get period of the fixed rate control loop (see cmdctrl_control_tick)
+ * @return Period in ms
+ */
+unsigned int cmdctrl_control_period_ms(void);
+
+/**
+ * Run one iteration of the fixed rate control loop
+ * Closed loop modes (GLOBAL, SASSIST, OHOLD) are only applied here so that
+ * PIDs are updated at a constant rate regardless of PC traffic
+ * Called by the control task once every cmdctrl_control_period_ms() ms
+ * (or on each new IMU sample if cmdctrl_control_imu_sync())
+ * @param late True if this iteration did not start on time (missed deadline)
+ */
+void cmdctrl_control_tick(bool late);
@@ -37,6 +37,10 @@ typedef struct{
     //     not be provided.
     float pressure_pa;
     float temperature_c;
+
+    // Sample info (set by depth_read, not sensor drivers)
+    uint32_t seq;                   // Incremented for each new sample (0 = no sample yet)
+    uint32_t timestamp_ms;          // RTOS time when sample was read
 } depth_data_t;
 
 
@@ -62,4 +66,17 @@ depth_data_t depth_get_data(void);
  * Get the currently active depth sensor. Thread safe.
  * @return uint8_t ID of the active sensor (DEPTH_xyz)
  */
-uint8_t depth_get_sensor(void); 
+uint8_t depth_get_sensor(void);
+
+/**
+ * Get number of depth_get_data calls that had to retry because new data was published during the read
+ * @return Number of retries since startup
+ */
+uint32_t depth_get_read_retries(void);
+
+/**
+ * Get achieved depth sample rate (successful reads per second). Thread safe.
+ * Measured over windows of about one second.
+ * @return Sample rate in Hz (zero if no recent samples)
+ */
+float depth_get_sample_rate(void);
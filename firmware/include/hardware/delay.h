@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 /**
  * Initialize mechanism for delays (must call before using delay functions)
  */
@@ -33,3 +35,17 @@ void delay_us(unsigned int us);
  */
 void delay_ms(unsigned int ms);
 
+/**
+ * Get a high resolution timestamp (units are target specific; wraps around)
+ * Use delay_elapsed_us to get time between two timestamps
+ */
+uint32_t delay_timestamp(void);
+
+/**
+ * Get time in us between two timestamps (from delay_timestamp)
+ * Only valid for durations of up to 1 second
+ * @param start Earlier timestamp
+ * @param end Later timestamp
+ * @return Elapsed time in us
+ */
+uint32_t delay_elapsed_us(uint32_t start, uint32_t end);
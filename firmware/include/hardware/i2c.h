@@ -24,7 +24,24 @@
 #include <task.h>
 
 
-typedef struct {
+// Transaction priority classes
+// When multiple transactions are queued, higher priority transactions are performed first
+// Transactions are never interrupted, so a transaction waits for at most the one in progress
+#define I2C_PRIO_LOW            0
+#define I2C_PRIO_NORMAL         1
+#define I2C_PRIO_HIGH           2
+#define I2C_PRIO_COUNT          3
+
+typedef struct i2c_trans i2c_trans;
+
+/**
+ * Called (from I2C task) when a transaction submitted with i2c_submit finishes
+ * @param trans Transaction that finished (may be submitted again from callback)
+ * @param success true if transaction succeeded
+ */
+typedef void (*i2c_done_fn)(i2c_trans *trans, bool success);
+
+struct i2c_trans {
     // Address of device for transaction
     uint8_t address;
     
@@ -37,16 +54,56 @@ typedef struct {
     // Count is number of bytes to read (set before perform)
     uint8_t *read_buf;
     unsigned int read_count;
-} i2c_trans;
+
+    // Priority class (I2C_PRIO_xyz). Typically set once per device.
+    uint8_t priority;
+
+    // Called when transaction submitted with i2c_submit finishes (may be NULL)
+    i2c_done_fn done;
+    void *arg;
+
+    // Used by transaction queue (do not modify; must be zero before first use)
+    struct i2c_trans *next;
+    TaskHandle_t waiter;
+    volatile uint8_t state;
+    volatile bool success;
+    uint32_t queued_at;
+};
+
+// Statistics for transactions with one device (see i2c_get_device_stats)
+typedef struct {
+    uint32_t transactions;      // Transactions performed on the bus (including failed)
+    uint32_t failures;          // Transactions performed on the bus that failed
+    uint32_t rejected;          // Transactions failed without using the bus (circuit breaker open)
+    uint32_t retries;           // Retries by i2c_perform_retries
+    uint32_t recoveries;        // Bus recoveries after failed transactions
+    uint32_t breaker_trips;     // Times the circuit breaker opened
+    uint32_t avg_latency_us;    // Average time from queued to finished (transactions performed on the bus)
+    uint32_t max_latency_us;    // Max time from queued to finished
+    bool breaker_open;          // true if circuit breaker is currently open
+} i2c_device_stats_t;
 
 /**
  * Initialize I2C bus in master mode
  */
 void i2c_init(void);
 
+/**
+ * Perform queued transactions. Only returns after performing at least one transaction.
+ * Must be called repeatedly by the (single) I2C task.
+ */
+void i2c_process(void);
+
+/**
+ * Queue a transaction to be performed by the I2C task. Does not wait for it to be performed.
+ * trans (and its buffers) must not be modified until the transaction finishes (trans->done called).
+ * @param trans Pointer to transaction to perform
+ * @return true if queued; false if the transaction is already queued or in progress
+ */
+bool i2c_submit(i2c_trans *trans);
 
 /**
- * Perform an i2c transaction
+ * Perform an i2c transaction (queue and wait for it to finish)
  * @param trans Pointer to transaction to perform
  * @return true on success, false on failure
  */
@@ -54,11 +111,74 @@ bool i2c_perform(i2c_trans *trans);
 
 
 /**
- * Perform an i2c transactions with multiple attempts if it fails
+ * Perform an i2c transaction with multiple attempts if it fails
+ * The delay between attempts starts short and doubles after each failure, so brief glitches cost little
+ * while a device that keeps failing is not hammered. No attempt is started after the timeout expires.
+ * Attempts stop early if the device's circuit breaker is open (too many consecutive failures).
  * 
  * @param trans Pointer to transaction to perform
- * @param delay_ms Time in milliseconds between retries
- * @param max_retires Max number of attempts
- * @return true on success; false if all retries fail
+ * @param timeout_ms Time in milliseconds after which no more attempts are started
+ * @param attempts Where to store number of attempts made (may be NULL)
+ * @return true on success; false if all attempts fail
  */
-bool i2c_perform_retries(i2c_trans *trans, unsigned int delay_ms, unsigned int max_retires);
+bool i2c_perform_retries(i2c_trans *trans, unsigned int timeout_ms, unsigned int *attempts);
+
+/**
+ * Get number of transactions performed since startup (including failed transactions)
+ * @return Transaction count
+ */
+uint32_t i2c_get_transaction_count(void);
+
+/**
+ * Get statistics for transactions with a device (since startup)
+ * @param address Address of device
+ * @param stats Where to store statistics
+ * @return true on success; false if no transactions with the device have been performed
+ */
+bool i2c_get_device_stats(uint8_t address, i2c_device_stats_t *stats);
+
+/**
+ * Select whether DMA is used for I2C data transfers (v2 only). Short transfers always use interrupts.
+ * @param enable true to use DMA; false to use an interrupt per byte
+ * @return true on success; false if DMA is not supported
+ */
+bool i2c_set_dma(bool enable);
+
+/**
+ * Check if DMA is used for I2C data transfers
+ * @return true if DMA is enabled
+ */
+bool i2c_get_dma(void);
+
+/**
+ * Get number of I2C (and I2C DMA) interrupts and time spent handling them since startup
+ * @param count Where to store number of interrupts handled
+ * @param time_us Where to store total time spent in interrupt handlers (microseconds)
+ */
+void i2c_get_isr_stats(uint32_t *count, uint32_t *time_us);
+
+/**
+ * Record time spent in an I2C interrupt handler. Only call from I2C interrupt handlers.
+ * @param start delay_timestamp() at start of interrupt handler
+ */
+void i2c_isr_record(uint32_t start);
+
+#ifdef CONTROL_BOARD_SIM
+
+/**
+ * Called to perform a transaction with a device on SimCB's fake I2C bus
+ * @param trans Transaction addressed to the device (fill read_buf for reads)
+ * @return true if the device acknowledged the transaction
+ */
+typedef bool (*i2c_sim_device_fn)(i2c_trans *trans);
+
+/**
+ * Attach a fake device to SimCB's fake I2C bus. No devices are attached by default, so transactions fail
+ * as if no sensors were connected.
+ * @param address Address of device
+ * @param handler Function to perform transactions with device
+ * @return true on success; false if too many devices are attached
+ */
+bool i2c_sim_attach(uint8_t address, i2c_sim_device_fn handler);
+
+#endif // CONTROL_BOARD_SIM
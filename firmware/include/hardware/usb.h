@@ -52,12 +52,27 @@ unsigned int usb_avail(void);
  */
 uint8_t usb_read(void);
 
+/**
+ * Read multiple bytes from USB (as many as are available, up to len)
+ * @param buf Buffer to read data into
+ * @param len Max number of bytes to read
+ * @return Number of bytes actually read
+ */
+unsigned int usb_read_multiple(uint8_t *buf, unsigned int len);
+
 /**
  * Write one byte via USB
  * @param b Byte to write
  */
 void usb_write(uint8_t b);
 
+/**
+ * Write multiple bytes via USB
+ * @param buf Data to write
+ * @param len Number of bytes to write
+ */
+void usb_write_multiple(const uint8_t *buf, unsigned int len);
+
 /**
  * Flush USB output buffers now
  */
@@ -65,6 +80,22 @@ void usb_flush(void);
 
 #ifdef CONTROL_BOARD_SIM
 #include <stdio.h>
+
+// SimCB socket I/O statistics (since startup)
+typedef struct {
+    uint32_t rx_syscalls;       // System calls made to wait for and read received data
+    uint32_t rx_bytes;          // Bytes received
+    uint32_t rx_irqs;           // Simulated interrupts for received data
+    uint32_t tx_syscalls;       // System calls made to send data
+    uint32_t tx_bytes;          // Bytes sent
+} usb_sim_stats_t;
+
 bool usb_setup_socket(FILE *f, int port);
 void usb_sim_interrupts(void);
+
+/**
+ * Get SimCB socket I/O statistics
+ * @param stats Where to store statistics
+ */
+void usb_sim_get_stats(usb_sim_stats_t *stats);
 #endif
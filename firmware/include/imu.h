@@ -45,6 +45,10 @@ typedef struct{
     // Raw gyro and accel data may not be provided by all IMUs (eg sim IMU doesn't provide)
     gyro_data_t raw_gyro;
     accel_data_t raw_accel;
+
+    // Sample info (set by imu_read, not IMU drivers)
+    uint32_t seq;                   // Incremented for each new sample (0 = no sample yet)
+    uint32_t timestamp_ms;          // RTOS time when sample was read
 } imu_data_t;
 
 
@@ -69,6 +73,7 @@ imu_data_t imu_get_data(void);
 /**
  * Reset old IMU data (really only matters for accumulated angles)
  * Should be called by IMU drivers when the sensor's definition of axes changes.
+ * Thread safe. Data is reset by the IMU task before its next read.
  */
 void imu_reset_data(void);
 
@@ -77,3 +82,9 @@ void imu_reset_data(void);
  * @return uint8_t ID of the active sensor (IMU_xyz)
  */
 uint8_t imu_get_sensor(void); 
+
+/**
+ * Get number of imu_get_data calls that had to retry because new data was published during the read
+ * @return Number of retries since startup
+ */
+uint32_t imu_get_read_retries(void);
@@ -21,6 +21,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <util/angles.h>
+#include <imu.h>
+
+// Thrust allocation methods (how DoF speeds become thruster speeds in LOCAL mode and modes built on it)
+typedef enum {
+    MC_ALLOC_DOF = 0,       // Thruster speeds directly from DoF matrix. Overlapping thrusters scaled down together.
+    MC_ALLOC_PINV = 1       // Least squares (pseudo-inverse). Saturated thrusters' share redistributed to others.
+} mc_alloc_t;
 
 typedef struct {
     float x, y, z, xrot, yrot, zrot;
@@ -43,6 +50,24 @@ typedef struct {
     bool use_yaw_pid;
 } mc_sassist_target_t;
 
+// PID tuning for SASSIST / OHOLD mode PIDs
+// ki and kd are relative to a 20ms step (for compatibility with tunings from the fixed 50Hz loop).
+// They are scaled by the measured time between PID updates, so behavior does not depend on control rate.
+// Feed-forward input and measurement of each PID:
+//   Depth: rate target depth changes (m / sec); depth (m)
+//   Rotation (xrot, yrot, zrot): none (kf must be zero); rotation since PID reset integrated from gyro (rad)
+//   Rate (xrate, yrate, zrate): rate setpoint from rotation PID; angular rate from gyro (rad / sec)
+typedef struct {
+    float kp;               // Proportional gain
+    float ki;               // Integral gain
+    float kd;               // Derivative gain
+    float kf;               // Feed-forward gain (multiplies feed-forward input)
+    float limit;            // Magnitude of max PID output (max = limit, min = -limit). Must be positive
+    bool invert;            // True to negate PID output
+    float d_filter;         // Time constant (seconds) of derivative low pass filter. Zero to disable.
+    bool d_on_meas;         // True to calculate derivative from measurement (not error)
+} mc_pid_tune_t;
+
 
 
 
@@ -77,6 +102,23 @@ void mc_set_dof_matrix(unsigned int thruster_num, float *row_data);
  */
 void mc_recalc(void);
 
+/**
+ * Set thrust allocation method
+ * @param alloc Allocation method to use
+ */
+void mc_set_alloc(mc_alloc_t alloc);
+
+/**
+ * Select cascaded attitude control per rotation axis (SASSIST / OHOLD modes)
+ * When enabled for an axis, the axis's rotation PID (outer loop) calculates an angular rate setpoint
+ * (rad / sec) from orientation error and the axis's rate PID (inner loop) calculates the
+ * speed from the rate setpoint and IMU gyro rate. Otherwise, the rotation PID calculates the speed.
+ * @param xrot True to use cascaded control for x rotation
+ * @param yrot True to use cascaded control for y rotation
+ * @param zrot True to use cascaded control for z rotation
+ */
+void mc_set_cascade(bool xrot, bool yrot, bool zrot);
+
 /**
  * Check if motors are killed by watchdog
  * @return true Motors are killed by motor watchdog
@@ -92,43 +134,45 @@ bool mc_wdog_feed(void);
 
 /**
  * Tune stability assist mode x rotation pid
- * @param kp Proportional gain
- * @param ki Integral gain
- * @param kd Derivative gain
- * @param limit Magnitude of max PID output (max = limit, min = -limit). Must be positive
- * @param invert True to negate PID output
+ * @param tune PID tuning
  */
-void mc_sassist_tune_xrot(float kp, float ki, float kd, float limit, bool invert);
+void mc_sassist_tune_xrot(const mc_pid_tune_t tune);
 
 /**
  * Tune stability assist mode y rotation pid
- * @param kp Proportional gain
- * @param ki Integral gain
- * @param kd Derivative gain
- * @param limit Magnitude of max PID output (max = limit, min = -limit). Must be positive
- * @param invert True to negate PID output
+ * @param tune PID tuning
  */
-void mc_sassist_tune_yrot(float kp, float ki, float kd, float limit, bool invert);
+void mc_sassist_tune_yrot(const mc_pid_tune_t tune);
 
 /**
  * Tune stability assist mode z rotation pid
- * @param kp Proportional gain
- * @param ki Integral gain
- * @param kd Derivative gain
- * @param limit Magnitude of max PID output (max = limit, min = -limit). Must be positive
- * @param invert True to negate PID output
+ * @param tune PID tuning
  */
-void mc_sassist_tune_zrot(float kp, float ki, float kd, float limit, bool invert);
+void mc_sassist_tune_zrot(const mc_pid_tune_t tune);
 
 /**
  * Tune stability assist mode depth pid
- * @param kp Proportional gain
- * @param ki Integral gain
- * @param kd Derivative gain
- * @param limit Magnitude of max PID output (max = limit, min = -limit). Must be positive
- * @param invert True to negate PID output
+ * @param tune PID tuning
+ */
+void mc_sassist_tune_depth(const mc_pid_tune_t tune);
+
+/**
+ * Tune x rotation rate pid (inner loop of cascaded attitude control)
+ * @param tune PID tuning
+ */
+void mc_sassist_tune_xrate(const mc_pid_tune_t tune);
+
+/**
+ * Tune y rotation rate pid (inner loop of cascaded attitude control)
+ * @param tune PID tuning
+ */
+void mc_sassist_tune_yrate(const mc_pid_tune_t tune);
+
+/**
+ * Tune z rotation rate pid (inner loop of cascaded attitude control)
+ * @param tune PID tuning
  */
-void mc_sassist_tune_depth(float kp, float ki, float kd, float limit, bool invert);
+void mc_sassist_tune_zrate(const mc_pid_tune_t tune);
 
 /**
  * Set motor speeds in RAW mode
@@ -176,9 +220,10 @@ void mc_set_global(const mc_global_target_t target, const quaternion_t curr_quat
  *      target_depth Target vehicle depth (meters, negative is below surface)
  *      use_yaw_pid If true, closed loop control is used for yaw not a speed
  * @param curr_quat Current orientation quaternion
+ * @param curr_gyro Current angular rates from IMU (only used for cascaded control)
  * @param curr_depth Current depth in meters (negative below surface)
  */
-void mc_set_sassist(const mc_sassist_target_t target, const quaternion_t curr_quat, const float curr_depth);
+void mc_set_sassist(const mc_sassist_target_t target, const quaternion_t curr_quat, const gyro_data_t curr_gyro, const float curr_depth);
 
 /**
  * Set motor speeds in ORIENTATION_HOLD (OHOLD) mode. Like SASSIST, but a speed is provided by depth
@@ -193,5 +238,6 @@ void mc_set_sassist(const mc_sassist_target_t target, const quaternion_t curr_qu
  *      target_euler Target orientation (ZYX euler; yaw is ignored if use_yaw_pid is false)
  *      use_yaw_pid If true, closed loop control is used for yaw not a speed
  * @param curr_quat Current orientation quaternion
+ * @param curr_gyro Current angular rates from IMU (only used for cascaded control)
  */
-void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat);
+void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat, const gyro_data_t curr_gyro);
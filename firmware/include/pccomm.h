@@ -24,7 +24,29 @@
 // Maximum message size in bytes
 #define PCCOMM_MAX_MSG_LEN          96
 
-// Buffer to hold a message currently being read / parsed
+// Number of received messages that can be queued (parsed, but not yet handled)
+#define PCCOMM_RX_QUEUE_LEN         8
+
+// Communication statistics (since boot)
+typedef struct {
+    uint32_t rx_msgs;           // Valid messages received
+    uint32_t rx_invalid;        // Messages discarded (bad CRC or too short)
+    uint32_t rx_truncated;      // Messages discarded (too long; data did not fit)
+    uint32_t rx_queue_full;     // Number of times parsing paused because rx queue was full
+    uint32_t rx_queue_max;      // Max number of messages in rx queue at once
+    uint32_t tx_dropped;        // Messages not sent (too long)
+} pccomm_stats_t;
+
+// Fragment of a message being written (see pccomm_writev)
+typedef struct {
+    const uint8_t *data;
+    unsigned int len;
+} pccomm_frag_t;
+
+// Only modified by pccomm_read_and_parse (rx) and pccomm_writev (tx)
+extern pccomm_stats_t pccomm_stats;
+
+// Buffer to hold the message currently being handled (oldest message from rx queue)
 // (size = max_len + 4 because of 2 bytes for CRC16 and 2 bytes for message ID)
 extern uint8_t pccomm_read_buf[PCCOMM_MAX_MSG_LEN + 4];
 extern unsigned int pccomm_read_len;
@@ -39,15 +61,29 @@ extern uint16_t pccomm_read_crc;
 void pccomm_init(void);
 
 /**
- * Read data from the PC and parse the message.
- * @return true if a complete, valid message has been received
+ * Read data from the PC and parse messages. Complete, valid messages are queued.
+ * If any message is queued, the oldest one is moved into pccomm_read_buf.
+ * @return true if a complete, valid message is now in pccomm_read_buf
  */
 bool pccomm_read_and_parse(void);
 
 /**
  * Write a message to the PC (with correct format)
  * Note that write may not necessarily be instant (will be written into buffer)
+ * Messages longer than PCCOMM_MAX_MSG_LEN are not sent (counted in pccomm_stats.tx_dropped)
  * @param msg The raw message to send (payload)
  * @param len Length of raw message
+ * @return false if the message was not sent because it is too long
+ */
+bool pccomm_write(uint8_t *msg, unsigned int len);
+
+/**
+ * Write a message to the PC (with correct format) from multiple fragments
+ * Fragments are written one after another as a single message (payload)
+ * The whole frame is built (escaped and CRC calculated) then written to usb at once
+ * Messages longer than PCCOMM_MAX_MSG_LEN (total of all fragments) are not sent (counted in pccomm_stats.tx_dropped)
+ * @param frags Fragments of the raw message to send (payload)
+ * @param count Number of fragments
+ * @return false if the message was not sent because it is too long
  */
-void pccomm_write(uint8_t *msg, unsigned int len);
+bool pccomm_writev(const pccomm_frag_t *frags, unsigned int count);
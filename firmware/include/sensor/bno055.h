@@ -69,6 +69,28 @@ bool bno055_set_axis(uint8_t mode);
  */
 bool bno055_read(imu_data_t *data);
 
+/**
+ * Select how data is read by bno055_read
+ * @param enable true to read quaternion, gyro, and accel data in a single burst transaction (default)
+ *               false to use one transaction for each
+ */
+void bno055_set_burst_read(bool enable);
+
+/**
+ * Check if burst reads are used by bno055_read
+ * @return true if burst read is enabled
+ */
+bool bno055_get_burst_read(void);
+
+/**
+ * Get statistics for bno055_read since startup
+ * Average transactions per sample is transactions / samples
+ * @param samples Where to store number of successful reads
+ * @param transactions Where to store number of I2C transactions attempted by reads (including retries and failed reads)
+ * @param failures Where to store number of failed reads
+ */
+void bno055_get_read_stats(uint32_t *samples, uint32_t *transactions, uint32_t *failures);
+
 /**
  * Get calibration status value from BNO055
  * @param status Where to store status byte
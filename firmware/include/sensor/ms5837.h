@@ -19,8 +19,17 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <depth.h>
 
+// Oversampling ratios (higher is lower noise, but longer conversion)
+#define MS5837_OSR_256          0
+#define MS5837_OSR_512          1
+#define MS5837_OSR_1024         2
+#define MS5837_OSR_2048         3
+#define MS5837_OSR_4096         4
+#define MS5837_OSR_8192         5
+
 
 
 /**
@@ -37,9 +46,27 @@ bool ms5837_configure(void);
 
 /**
  * Read data from sensor. Must be configured before running
+ * Conversions are pipelined (next conversion started when a result is read). Only waits
+ * (without holding the sensor) if the pending conversion is not complete.
+ * Temperature is converted once every few pressure samples.
  * 
  * @param data Pointer to struct to store data in (only valid if returns true)
  * @return true On success; false on error
  */
 bool ms5837_read(depth_data_t *data);
 
+/**
+ * Set oversampling ratio for pressure and temperature conversions
+ * @param d1_osr Pressure (D1) OSR (MS5837_OSR_xyz)
+ * @param d2_osr Temperature (D2) OSR (MS5837_OSR_xyz)
+ * @return true on success; false if an OSR is invalid
+ */
+bool ms5837_set_osr(uint8_t d1_osr, uint8_t d2_osr);
+
+/**
+ * Get oversampling ratio for pressure and temperature conversions
+ * @param d1_osr Where to store pressure (D1) OSR (MS5837_OSR_xyz)
+ * @param d2_osr Where to store temperature (D2) OSR (MS5837_OSR_xyz)
+ */
+void ms5837_get_osr(uint8_t *d1_osr, uint8_t *d2_osr);
+
@@ -123,3 +123,38 @@ void quat_flip_y(quaternion_t *src, const quaternion_t *dest);
  * Flip z axis of quaternion
  */
 void quat_flip_z(quaternion_t *src, const quaternion_t *dest);
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Rotation matrix operations
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Convert quaternion to rotation matrix (row major, dest[row][col])
+ * dest * v is the same as rotating v by src (src * v * src^*)
+ * Column i of dest is the unit vector along axis i rotated by src
+ * @param dest Matrix to store data in
+ * @param src Quaternion to read and convert
+ */
+void quat_to_rotmat(float dest[3][3], const quaternion_t *src);
+
+/**
+ * Get a column of a rotation matrix (rotated x, y, or z axis)
+ * @param dest Vector to store column in
+ * @param m Rotation matrix
+ * @param col Column to read (0 = x, 1 = y, 2 = z)
+ */
+void rotmat_col(float dest[3], const float m[3][3], unsigned int col);
+
+/**
+ * Rotate a vector by a rotation matrix
+ * dest = m * src (dest may be the same as src)
+ */
+void rotmat_rotate(float dest[3], const float m[3][3], const float src[3]);
+
+/**
+ * Rotate a vector by the inverse of a rotation matrix
+ * dest = transpose(m) * src (dest may be the same as src)
+ */
+void rotmat_rotate_inv(float dest[3], const float m[3][3], const float src[3]);
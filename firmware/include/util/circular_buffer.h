@@ -80,3 +80,21 @@ bool cb_write(volatile circular_buffer *cb, uint8_t src);
  * @return false If buffer is empty
  */
 bool cb_read(volatile circular_buffer *cb, uint8_t *dest);
+
+/**
+ * Write multiple bytes into the buffer (as many as will fit)
+ * @param cb Buffer to write into
+ * @param src Bytes to write
+ * @param len Number of bytes to write
+ * @return Number of bytes actually written
+ */
+unsigned int cb_write_multiple(volatile circular_buffer *cb, const uint8_t *src, unsigned int len);
+
+/**
+ * Read multiple bytes from the buffer (as many as are available, up to len)
+ * @param cb Circular buffer to read from
+ * @param dest Destination to move read bytes into
+ * @param len Max number of bytes to read
+ * @return Number of bytes actually read
+ */
+unsigned int cb_read_multiple(volatile circular_buffer *cb, uint8_t *dest, unsigned int len);
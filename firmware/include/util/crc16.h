@@ -0,0 +1,57 @@
+/*
+ * Copyright 2022 Marcus Behel
+ * 
+ * This file is part of AUVControlBoard-Firmware.
+ * 
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU 
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your 
+ * option) any later version.
+ * 
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even 
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see 
+ * <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// CRC16 (CCITT-FALSE) implementations
+//   BITWISE: One bit at a time. No tables (smallest, slowest)
+//   TABLE:   One byte at a time using a 256 entry table (512 bytes of flash)
+//   SLICE4:  Four bytes at a time using four 256 entry tables (2kB of flash)
+// All implementations produce identical results. Select with CMake option CBOARD_CRC16_IMPL (or -DCRC16_IMPL=...)
+#define CRC16_IMPL_BITWISE          0
+#define CRC16_IMPL_TABLE            1
+#define CRC16_IMPL_SLICE4           2
+
+#ifndef CRC16_IMPL
+#define CRC16_IMPL                  CRC16_IMPL_TABLE
+#endif
+
+// Calculate CRC16 (CCITT-FALSE) of a complete data set
+#define crc16_ccitt_false(data, len)      crc16_ccitt_false_partial((data), (len), 0xFFFF)
+
+
+/**
+ * Calculate 16-bit CRC (CCITT-FALSE) of the given data using the implementation selected by CRC16_IMPL
+ * @param data Data to calculate crc of
+ * @param len Length of data
+ * @param initial Initial value to use in calc. Useful for fragmented data sets. 65535 for "default"
+ * @return uint16_t Calculated crc
+ */
+uint16_t crc16_ccitt_false_partial(const uint8_t *data, unsigned int len, uint16_t initial);
+
+/**
+ * Calculate 16-bit CRC (CCITT-FALSE) one bit at a time.
+ * Always available (reference implementation).
+ * @param data Data to calculate crc of
+ * @param len Length of data
+ * @param initial Initial value to use in calc. 65535 for "default"
+ * @return uint16_t Calculated crc
+ */
+uint16_t crc16_ccitt_false_bitwise(const uint8_t *data, unsigned int len, uint16_t initial);
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2022 Marcus Behel
+ * 
+ * This file is part of AUVControlBoard-Firmware.
+ * 
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU 
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your 
+ * option) any later version.
+ * 
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even 
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see 
+ * <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+#pragma once
+
+#include <math.h>
+
+// Math functions used by the control math (angles.c, motor_control.c)
+// By default these are the standard library functions
+// If CONTROL_BOARD_FAST_MATH is defined (CBOARD_FAST_MATH cmake option), approximations are used instead
+// Approximations (absolute error vs standard library)
+//     fmath_atan2    ~1e-5 rad (polynomial)
+//     fmath_asin     ~1e-5 rad (from fmath_atan2)
+//     fmath_sincos   ~5e-7 for |x| < 2pi (grows with |x| due to range reduction)
+//     fmath_sqrt     exact (FPU vsqrt instruction on ARM targets)
+//     fmath_inv_sqrt exact (1 / fmath_sqrt)
+
+
+#if defined(CONTROL_BOARD_FAST_MATH)
+
+/**
+ * Angle of the vector (x, y) from +x axis
+ * @param y Y component
+ * @param x X component
+ * @return Angle in radians (-pi to pi)
+ */
+float fmath_atan2(float y, float x);
+
+/**
+ * Inverse sine
+ * @param x Value to take inverse sine of (clamped to -1 to 1)
+ * @return Angle in radians (-pi/2 to pi/2)
+ */
+float fmath_asin(float x);
+
+/**
+ * Calculate sine and cosine of the same angle
+ * @param x Angle in radians
+ * @param s Pointer to store sine in
+ * @param c Pointer to store cosine in
+ */
+void fmath_sincos(float x, float *s, float *c);
+
+/**
+ * Square root
+ * @param x Value to take square root of (must be non-negative)
+ * @return sqrt(x)
+ */
+float fmath_sqrt(float x);
+
+/**
+ * Inverse square root
+ * @param x Value to take inverse square root of (must be positive)
+ * @return 1 / sqrt(x)
+ */
+float fmath_inv_sqrt(float x);
+
+#else
+
+static inline float fmath_atan2(float y, float x){
+    return atan2f(y, x);
+}
+
+static inline float fmath_asin(float x){
+    if(x > 1.0f)
+        x = 1.0f;
+    if(x < -1.0f)
+        x = -1.0f;
+    return asinf(x);
+}
+
+static inline void fmath_sincos(float x, float *s, float *c){
+    *s = sinf(x);
+    *c = cosf(x);
+}
+
+static inline float fmath_sqrt(float x){
+    return sqrtf(x);
+}
+
+static inline float fmath_inv_sqrt(float x){
+    return 1.0f / sqrtf(x);
+}
+
+#endif
@@ -22,10 +22,11 @@
 
 
 typedef struct{
-    // Gains
+    // Gains (time in seconds)
     float kP;
     float kI;
     float kD;
+    float kF;               // Feed-forward (multiplies feed-forward input)
 
     // Output limits
     float min;
@@ -34,20 +35,37 @@ typedef struct{
     // True to negate output
     bool invert;
 
-    // State info (zero to reset)
+    // Time constant of derivative low pass filter (seconds). Zero for no filter.
+    float d_tau;
+
+    // True to calculate derivative from measurement instead of error
+    // Avoids derivative "kick" when setpoint changes
+    bool d_on_meas;
+
+    // State info (reset using PID_RESET)
     float integral;
     float last_error;
+    float last_meas;
+    float deriv;            // Filtered derivative
+    bool has_last;          // False until first calculation after reset
 } pid_controller_t;
 
 
 
 // Reset a PID controller
-#define PID_RESET(pid)          (pid).integral = 0; (pid).last_error = 0
+#define PID_RESET(pid)          (pid).integral = 0; (pid).last_error = 0; (pid).last_meas = 0; \
+                                (pid).deriv = 0; (pid).has_last = false
 
 
 /**
  * Calculate current PID output
+ * Integral is not accumulated while the output is saturated in the direction of the error (anti-windup)
+ * Derivative is zero on the first calculation after reset
  * @param pid PID controller
- * @param curr_error Current error
+ * @param setpoint Target value
+ * @param meas Current measurement (error = setpoint - meas)
+ * @param ff Feed-forward input (output includes kF * ff)
+ * @param dt Time since last calculation (seconds)
+ * @return PID output
  */
-float pid_calculate(pid_controller_t *pid, float curr_error);
+float pid_calculate(pid_controller_t *pid, float setpoint, float meas, float ff, float dt);
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2022 Marcus Behel
+ * 
+ * This file is part of AUVControlBoard-Firmware.
+ * 
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU 
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your 
+ * option) any later version.
+ * 
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even 
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see 
+ * <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Double buffered sequence lock
+// Publishes data from a single writer to any number of readers without blocking either.
+// The writer fills the buffer readers are not using, then publishes it by incrementing gen.
+// Readers copy the published buffer and retry if gen changed while copying.
+// Since the writer never modifies the published buffer, a reader that preempts the writer
+// never has to wait for the writer to finish (unlike a single buffer seqlock).
+//
+// Usage (writer):
+//     buf[seqlock_write_index(&lock)] = data;
+//     seqlock_write_publish(&lock);
+//
+// Usage (reader):
+//     uint32_t gen;
+//     do{
+//         gen = seqlock_read_begin(&lock);
+//         copy = buf[SEQLOCK_INDEX(gen)];
+//     }while(seqlock_read_retry(&lock, gen));
+
+////////////////////////////////////////////////////////////////////////////////
+/// Typedefs
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    volatile uint32_t gen;          // Number of times data has been published
+    volatile uint32_t retries;      // Number of reads retried due to concurrent write (contention)
+} seqlock_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Macros
+////////////////////////////////////////////////////////////////////////////////
+
+// Index of published buffer for a generation (from seqlock_read_begin)
+#define SEQLOCK_INDEX(gen)      ((gen) & 1)
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initialize a sequence lock (buffer 0 is published)
+ * @param lock Lock to initialize
+ */
+void seqlock_init(seqlock_t *lock);
+
+/**
+ * Get index of buffer the writer should write next (not the published buffer)
+ * Only call from the writer
+ * @param lock Lock for the buffers
+ * @return Index of buffer to write (0 or 1)
+ */
+unsigned int seqlock_write_index(seqlock_t *lock);
+
+/**
+ * Publish the buffer written by the writer (see seqlock_write_index)
+ * Only call from the writer
+ * @param lock Lock for the buffers
+ */
+void seqlock_write_publish(seqlock_t *lock);
+
+/**
+ * Start reading the published buffer
+ * @param lock Lock for the buffers
+ * @return Generation. Read buffer SEQLOCK_INDEX(gen)
+ */
+uint32_t seqlock_read_begin(seqlock_t *lock);
+
+/**
+ * Check if a read must be retried (data was published while reading)
+ * @param lock Lock for the buffers
+ * @param gen Generation from seqlock_read_begin
+ * @return true if data read may be mixed and read must be retried
+ */
+bool seqlock_read_retry(seqlock_t *lock, uint32_t gen);
@@ -22,6 +22,7 @@
 #include <cmdctrl.h>
 #include <imu.h>
 #include <depth.h>
+#include <hardware/i2c.h>
 #include <hardware/wdt.h>
 #include <FreeRTOSConfig.h>
 #include <FreeRTOS.h>
@@ -48,12 +49,26 @@
 #define TASK_CMDCTRL_SSIZE                  768
 #define TASK_IMU_SSIZE                      768
 #define TASK_DEPTH_SSZIE                    768
+#define TASK_CONTROL_SSIZE                  768
+#define TASK_I2C_SSIZE                      512
 
 // Task priorities
 #define TASK_USB_PRIORITY                   (configMAX_PRIORITIES - 1)      // Must happen quickly for TUSB to work
+#define TASK_CONTROL_PRIORITY               (configMAX_PRIORITIES - 1)      // Fixed rate. Must not be delayed by comms
 #define TASK_CMDCTRL_PRIORITY               (configMAX_PRIORITIES - 2)      // Comms more important than sensor data
 #define TASK_IMU_PRIORITY                   (configMAX_PRIORITIES - 3)      // Sensor data acquisition less critical
 #define TASK_DEPTH_PRIORITY                 (configMAX_PRIORITIES - 3)      // Sensor data acquisition less critical
+#define TASK_I2C_PRIORITY                   (configMAX_PRIORITIES - 2)      // Start queued transactions as soon as bus is free
+
+// Max time control loop waits for an IMU sample when synchronized to IMU samples
+// Ensures control loop still runs (and counts stale samples) if IMU samples stop
+#define CONTROL_SYNC_TIMEOUT                100     // ms
+
+// Period of IMU reads (BNO055 fusion data output rate is 100Hz)
+#define IMU_READ_PERIOD_MS                  10      // ms
+
+// Period of depth sensor reads
+#define DEPTH_READ_PERIOD_MS                20      // ms
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -68,6 +83,8 @@ static TaskHandle_t usb_task;
 static TaskHandle_t cmdctrl_task;
 static TaskHandle_t imu_task;
 static TaskHandle_t depth_task;
+static TaskHandle_t control_task;
+static TaskHandle_t i2c_task;
 
 // Timers
 static TimerHandle_t wdt_feed_timer;
@@ -122,6 +139,14 @@ static void cmdctrl_task_func(void *argument){
         // ---------------------------------------------------------------------
         // Handle any notifications (can be multiple at a time)
         // ---------------------------------------------------------------------
+        if(notification & NOTIF_UART_CLOSE){
+            // UART connection closed. Revert out of simhijack and compact protocol
+            // (next program to connect may not use either)
+            // Handled before data, which may be from the next program to connect
+            if(cmdctrl_sim_hijacked)
+                cmdctrl_simhijack(false);
+            cmdctrl_set_compact(false);
+        }
         if(notification & NOTIF_PCDATA){
             // There is data to handle from the PC
             // Read and parse the data. 
@@ -141,10 +166,6 @@ static void cmdctrl_task_func(void *argument){
             // Timer indicates it is time to feed watchdog
             wdt_feed();
         }
-        if(notification & NOTIF_UART_CLOSE){
-            // UART connection closed. Revert out of simhijack
-            cmdctrl_simhijack(false);
-        }
         if(notification & NOTIF_SEND_HEARTBEAT){
             // Heartbeat serves two purposes
             //   1. Ensures USB traffic periodically. This is important for SimCB where usb is
@@ -159,42 +180,89 @@ static void cmdctrl_task_func(void *argument){
     }
 }
 
+/**
+ * Thread running the control loop (closed loop motor control modes)
+ * Runs at a fixed rate or each time there is a new IMU sample
+ */
+static void control_task_func(void *argument){
+    (void)argument;
+
+    TickType_t last_wake = xTaskGetTickCount();
+    while(1){
+        if(cmdctrl_control_imu_sync()){
+            // Run each time there is a new IMU sample (see app_handle_imu_sample)
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONTROL_SYNC_TIMEOUT));
+            last_wake = xTaskGetTickCount();
+            cmdctrl_control_tick(false);
+        }else{
+            // Period is read every iteration so rate changes take effect on the next iteration
+            // Returns pdFALSE if no delay occurred (deadline already passed)
+            BaseType_t on_time = xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(cmdctrl_control_period_ms()));
+            cmdctrl_control_tick(on_time == pdFALSE);
+        }
+    }
+}
+
+/**
+ * Thread to perform I2C transactions (for all sensors)
+ * Sensor tasks queue transactions, which are performed in priority order
+ */
+static void i2c_task_func(void *argument){
+    (void)argument;
+
+    while(1){
+        i2c_process();
+    }
+}
+
 /**
  * Thread to handle IMU data
- * I2C functions are thread safe (by mutex), so thread will block
- * until it has I2C
+ * I2C functions are thread safe (by transaction queue), so thread will block
+ * until its transactions are performed
  */
 static void imu_task_func(void *argument){
     (void)argument;
 
     imu_init();
+    TickType_t last_wake = xTaskGetTickCount();
     while(1){
         if(imu_read()){
-            // Wait 15ms between reads
-            vTaskDelay(pdMS_TO_TICKS(15));
-        }else if(imu_get_sensor() == IMU_NONE){
-            // Read failed b/c no IMU connected. Delay longer before trying again.
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            // Read at fixed rate
+            xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(IMU_READ_PERIOD_MS));
+        }else{
+            if(imu_get_sensor() == IMU_NONE){
+                // Read failed b/c no IMU connected. Delay longer before trying again.
+                vTaskDelay(pdMS_TO_TICKS(1000));
+            }
+
+            // Don't try to catch up on missed reads
+            last_wake = xTaskGetTickCount();
         }
     }
 }
 
 /**
  * Thread to handle depth sensor data
- * I2C functions are thread safe (by mutex), so thread will block
- * until it has I2C
+ * I2C functions are thread safe (by transaction queue), so thread will block
+ * until its transactions are performed
  */
 static void depth_task_func(void *argument){
     (void)argument;
 
     depth_init();
+    TickType_t last_wake = xTaskGetTickCount();
     while(1){
         if(depth_read()){
-            // Wait 15ms between reads
-            vTaskDelay(pdMS_TO_TICKS(15));
-        }else if(depth_get_sensor() == IMU_NONE){
-            // Read failed b/c no IMU connected. Delay longer before trying again.
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            // Read at fixed rate (sensor converts the next sample while this task waits)
+            xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(DEPTH_READ_PERIOD_MS));
+        }else{
+            if(depth_get_sensor() == DEPTH_NONE){
+                // Read failed b/c no depth sensor connected. Delay longer before trying again.
+                vTaskDelay(pdMS_TO_TICKS(1000));
+            }
+
+            // Don't try to catch up on missed reads
+            last_wake = xTaskGetTickCount();
         }
     }
 }
@@ -271,11 +339,30 @@ void app_init(void){
         TASK_DEPTH_PRIORITY,
         &depth_task
     );
+    xTaskCreate(
+        control_task_func,
+        "control_task",
+        TASK_CONTROL_SSIZE,
+        NULL,
+        TASK_CONTROL_PRIORITY,
+        &control_task
+    );
+    xTaskCreate(
+        i2c_task_func,
+        "i2c_task",
+        TASK_I2C_SSIZE,
+        NULL,
+        TASK_I2C_PRIORITY,
+        &i2c_task
+    );
 }
 
 void app_handle_uart_closed(void){
-    if(cmdctrl_sim_hijacked)
-        xTaskNotify(cmdctrl_task, NOTIF_UART_CLOSE, eSetBits);
+    xTaskNotify(cmdctrl_task, NOTIF_UART_CLOSE, eSetBits);
+}
+
+void app_handle_imu_sample(void){
+    xTaskNotifyGive(control_task);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
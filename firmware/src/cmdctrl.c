@@ -25,12 +25,17 @@
 #include <semphr.h>
 #include <timers.h>
 #include <sensor/bno055.h>
+#include <sensor/ms5837.h>
 #include <hardware/wdt.h>
 #include <hardware/thruster.h>
+#include <hardware/delay.h>
+#include <hardware/i2c.h>
+#include <hardware/usb.h>
 #include <debug.h>
 #include <calibration.h>
 #include <metadata.h>
 #include <math.h>
+#include <string.h>
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -81,8 +86,20 @@
 
 
 
+// Compact protocol opcodes for messages sent to the PC
+// (opcodes for messages received from the PC are in the dispatch table)
+#define OP_ACK                          0xE0
+#define OP_WDGS                         0xE1
+#define OP_IMUD                         0xE2
+#define OP_DEPTHD                       0xE3
+#define OP_HEARTBEAT                    0xE4
+
 #define SENSOR_DATA_PERIOD              20      // ms
-#define SPEED_PERIOD                    20      // ms
+
+// Fixed rate control loop (see cmdctrl_control_tick)
+#define CONTROL_RATE_DEFAULT            50      // Hz
+#define CONTROL_RATE_MIN                1       // Hz
+#define CONTROL_RATE_MAX                500     // Hz
 
 
 // Restrict to range -1.0 to 1.0
@@ -141,8 +158,35 @@ static bool periodic_imu;
 static bool periodic_depth;
 static TimerHandle_t sensor_read_timer;
 
-// Used to periodically re-apply speeds in modes where necessary
-static TimerHandle_t periodic_speed_timer;
+// Protects mode, targets, and control loop settings (written by cmdctrl task, read by control task)
+static SemaphoreHandle_t target_mutex;
+
+// Fixed rate control loop
+// Settings (rate, sync, reset request) are protected by target_mutex
+// Statistics are only modified by the control task (cmdctrl_control_tick)
+static unsigned int control_rate;               // Hz
+static bool control_imu_sync;                   // True to run on each new IMU sample instead of at control_rate
+static bool control_stats_reset;                // Set to reset statistics on next tick (cleared by control task)
+static uint32_t control_last_ts;                // delay_timestamp at start of previous tick
+static uint32_t control_ticks;                  // Ticks since statistics reset
+static uint32_t control_overruns;               // Ticks that started late (missed deadline)
+static uint32_t control_max_jitter;             // Max difference from nominal period (us)
+static uint64_t control_jitter_sum;             // Sum of differences from nominal period (us)
+static uint32_t control_max_exec;               // Max time to apply speeds (us)
+static uint32_t control_imu_seq;                // Last IMU sample used (0 = none since reset)
+static uint32_t control_imu_stale;              // Ticks that reused an already used IMU sample
+static uint32_t control_imu_skipped;            // IMU samples never used
+static uint32_t control_depth_seq;              // Last depth sample used (0 = none since reset)
+static uint32_t control_depth_stale;            // Ticks that reused an already used depth sample
+static uint32_t control_depth_skipped;          // Depth samples never used
+
+// True if status messages to the PC should use compact protocol (opcodes instead of names)
+// Messages from the PC are accepted in either format regardless
+// Acknowledgements always use the same format as the message being acknowledged
+static bool compact;
+
+// True if the message currently being handled used compact protocol
+static bool msg_compact;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -151,6 +195,20 @@ static TimerHandle_t periodic_speed_timer;
 /// CMDCTRL functions / implementation
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * Get the name of a message being sent to the PC (or its opcode if using compact protocol)
+ * as a message fragment (see pccomm_writev)
+ * @param name Message name
+ * @param opcode Compact protocol opcode for the message (must remain valid until message is written)
+ * @param use_opcode True to use opcode instead of name
+ * @return Fragment containing name or opcode
+ */
+static pccomm_frag_t cmdctrl_msg_name(const char *name, const uint8_t *opcode, bool use_opcode){
+    if(use_opcode)
+        return (pccomm_frag_t){.data = opcode, .len = 1};
+    return (pccomm_frag_t){.data = (const uint8_t*)name, .len = strlen(name)};
+}
+
 static void send_sensor_data(TimerHandle_t timer){
     (void)timer;
     
@@ -160,40 +218,44 @@ static void send_sensor_data(TimerHandle_t timer){
         imu_data_t dat = imu_get_data();
 
         // Construct message
-        uint8_t imu_data_msg[33];
-        imu_data_msg[0] = 'I';
-        imu_data_msg[1] = 'M';
-        imu_data_msg[2] = 'U';
-        imu_data_msg[3] = 'D';
-        conversions_float_to_data(dat.quat.w, &imu_data_msg[4], true);
-        conversions_float_to_data(dat.quat.x, &imu_data_msg[8], true);
-        conversions_float_to_data(dat.quat.y, &imu_data_msg[12], true);
-        conversions_float_to_data(dat.quat.z, &imu_data_msg[16], true);
-        conversions_float_to_data(dat.accum_angles.pitch, &imu_data_msg[20], true);
-        conversions_float_to_data(dat.accum_angles.roll, &imu_data_msg[24], true);
-        conversions_float_to_data(dat.accum_angles.yaw, &imu_data_msg[28], true);
+        // Named IMUD messages have always been sent as 35 bytes (3 unused bytes at the end)
+        // Keep that size so existing interface scripts still accept it
+        static const uint8_t imu_data_pad[3] = {0};
+        uint8_t op = OP_IMUD;
+        uint8_t imu_data[28];
+        conversions_float_to_data(dat.quat.w, &imu_data[0], true);
+        conversions_float_to_data(dat.quat.x, &imu_data[4], true);
+        conversions_float_to_data(dat.quat.y, &imu_data[8], true);
+        conversions_float_to_data(dat.quat.z, &imu_data[12], true);
+        conversions_float_to_data(dat.accum_angles.pitch, &imu_data[16], true);
+        conversions_float_to_data(dat.accum_angles.roll, &imu_data[20], true);
+        conversions_float_to_data(dat.accum_angles.yaw, &imu_data[24], true);
+        pccomm_frag_t frags[3] = {
+            cmdctrl_msg_name("IMUD", &op, compact),
+            {.data = imu_data, .len = 28},
+            {.data = imu_data_pad, .len = compact ? 0 : 3}
+        };
 
         // Send message (status message from CB to PC)
-        pccomm_write(imu_data_msg, 35);
+        pccomm_writev(frags, 3);
     }
     if(periodic_depth & (depth_get_sensor() != DEPTH_NONE)){
         // Store current readings
         depth_data_t dat = depth_get_data();
 
         // Construct message
-        uint8_t depth_data[18];
-        depth_data[0] = 'D';
-        depth_data[1] = 'E';
-        depth_data[2] = 'P';
-        depth_data[3] = 'T';
-        depth_data[4] = 'H';
-        depth_data[5] = 'D';
-        conversions_float_to_data(dat.depth_m, &depth_data[6], true);
-        conversions_float_to_data(dat.pressure_pa, &depth_data[10], true);
-        conversions_float_to_data(dat.temperature_c, &depth_data[14], true);
+        uint8_t op = OP_DEPTHD;
+        uint8_t depth_data[12];
+        conversions_float_to_data(dat.depth_m, &depth_data[0], true);
+        conversions_float_to_data(dat.pressure_pa, &depth_data[4], true);
+        conversions_float_to_data(dat.temperature_c, &depth_data[8], true);
+        pccomm_frag_t frags[2] = {
+            cmdctrl_msg_name("DEPTHD", &op, compact),
+            {.data = depth_data, .len = 12}
+        };
 
         // Send message (status message from CB to PC)
-        pccomm_write(depth_data, 18);
+        pccomm_writev(frags, 2);
     }
 
     // Not using auto reload so that any time taken to
@@ -201,20 +263,8 @@ static void send_sensor_data(TimerHandle_t timer){
     xTimerStart(sensor_read_timer, portMAX_DELAY);
 }
 
-static void cmdctrl_apply_speed(void);
-
-static void periodic_reapply_speed(TimerHandle_t timer){
-    (void)timer;
-
-    // Modes using sensor data (which may change) need to be periodically reapplied
-    if(mode == MODE_GLOBAL || mode == MODE_SASSIST || mode == MODE_OHOLD){
-        cmdctrl_apply_speed();
-    }
-
-    // Not using auto reload so that any time taken to
-    // enforce a duration between sets, not a rate of setting speeds
-    xTimerStart(periodic_speed_timer, portMAX_DELAY);
-}
+static void cmdctrl_apply_closed_loop(void);
+static void cmdctrl_build_dispatch(void);
 
 void cmdctrl_init(void){
     // Initialize targets for all modes to result in no motion
@@ -237,29 +287,101 @@ void cmdctrl_init(void){
     );
     xTimerStart(sensor_read_timer, portMAX_DELAY);
 
-    // Periodic speed reapply
-    periodic_speed_timer = xTimerCreate(
-        "periodic_speed",
-        pdMS_TO_TICKS(SPEED_PERIOD),
-        pdFALSE,
-        NULL,
-        periodic_reapply_speed
-    );
-    xTimerStart(periodic_speed_timer, portMAX_DELAY);
+    // Fixed rate control loop
+    target_mutex = xSemaphoreCreateMutex();
+    control_rate = CONTROL_RATE_DEFAULT;
+    control_imu_sync = false;
+    control_stats_reset = true;
 
     // Default to raw mode
     mode = MODE_RAW;
     led_set(COLOR_RAW);
+
+    // Named (legacy) messages until PC selects compact protocol
+    compact = false;
+
+    // Lookup structures for message handlers
+    cmdctrl_build_dispatch();
+}
+
+/**
+ * Convert control loop rate to period
+ * @param rate Rate in Hz
+ * @return Period in ms (rounded to nearest ms / RTOS tick)
+ */
+static unsigned int cmdctrl_rate_to_period_ms(unsigned int rate){
+    return (1000 + rate / 2) / rate;
+}
+
+bool cmdctrl_control_imu_sync(void){
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    bool imu_sync = control_imu_sync;
+    xSemaphoreGive(target_mutex);
+    return imu_sync;
+}
+
+unsigned int cmdctrl_control_period_ms(void){
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    unsigned int rate = control_rate;
+    xSemaphoreGive(target_mutex);
+    return cmdctrl_rate_to_period_ms(rate);
+}
+
+void cmdctrl_control_tick(bool late){
+    uint32_t start = delay_timestamp();
+
+    // Settings may be changed by the cmdctrl task at any time
+    // Reset request is read and cleared together so a reset requested meanwhile is not lost
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    bool stats_reset = control_stats_reset;
+    control_stats_reset = false;
+    bool imu_sync = control_imu_sync;
+    uint32_t nominal = cmdctrl_rate_to_period_ms(control_rate) * 1000;
+    xSemaphoreGive(target_mutex);
+
+    // Timing statistics
+    if(stats_reset){
+        control_ticks = 0;
+        control_overruns = 0;
+        control_max_jitter = 0;
+        control_jitter_sum = 0;
+        control_max_exec = 0;
+        control_imu_seq = 0;
+        control_imu_stale = 0;
+        control_imu_skipped = 0;
+        control_depth_seq = 0;
+        control_depth_stale = 0;
+        control_depth_skipped = 0;
+    }
+    if(control_ticks != 0 && !imu_sync){
+        // Jitter is only meaningful when running at a fixed rate
+        uint32_t period = delay_elapsed_us(control_last_ts, start);
+        uint32_t jitter = (period > nominal) ? (period - nominal) : (nominal - period);
+        if(jitter > control_max_jitter)
+            control_max_jitter = jitter;
+        control_jitter_sum += jitter;
+    }
+    if(late)
+        control_overruns++;
+    control_ticks++;
+    control_last_ts = start;
+
+    // Closed loop modes are only applied here
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    cmdctrl_apply_closed_loop();
+    xSemaphoreGive(target_mutex);
+
+    uint32_t exec = delay_elapsed_us(start, delay_timestamp());
+    if(exec > control_max_exec)
+        control_max_exec = exec;
 }
 
 /**
  * Apply speed based on current mode and stored targets
- * @return true if successful. False if mode unknown or sensors are not valid for the selected mode
+ * Only applies open loop modes (RAW, LOCAL). Closed loop modes are applied by the control
+ * loop (cmdctrl_control_tick) so that PIDs are updated at a constant rate.
  */
 static void cmdctrl_apply_speed(void){
-    quaternion_t m_quat;
-    float m_depth;
-
     switch (mode){
     case MODE_RAW:
         mc_set_raw(raw_target);
@@ -267,19 +389,52 @@ static void cmdctrl_apply_speed(void){
     case MODE_LOCAL:
         mc_set_local(local_target);
         break;
+    }
+}
+
+/**
+ * Track sensor samples used by the control loop
+ * @param seq Sequence number of sample being used
+ * @param last_seq Sequence number of last sample used (updated)
+ * @param stale Incremented if this sample was already used
+ * @param skipped Incremented by number of samples between last_seq and seq (never used)
+ */
+static void cmdctrl_use_sample(uint32_t seq, uint32_t *last_seq, uint32_t *stale, uint32_t *skipped){
+    if(seq == *last_seq){
+        (*stale)++;
+    }else{
+        if(*last_seq != 0 && seq > *last_seq + 1)
+            *skipped += seq - *last_seq - 1;
+        *last_seq = seq;
+    }
+}
+
+/**
+ * Apply speed for closed loop modes based on current mode, stored targets, and sensor data
+ * Must hold target_mutex
+ */
+static void cmdctrl_apply_closed_loop(void){
+    imu_data_t m_imu;
+    depth_data_t m_depth;
+    quaternion_t m_quat;
+
+    switch (mode){
     case MODE_GLOBAL:
-        m_quat = imu_get_data().quat;
+        m_imu = imu_get_data();
+        m_quat = m_imu.quat;
         if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
             // Cannot apply real speed b/c sensor data not available or invalid
             // Thus, stop the thrusters
             mc_set_local((mc_local_target_t){.x=0, .y=0, .z=0, .xrot=0, .yrot=0, .zrot=0});
         }else{
+            cmdctrl_use_sample(m_imu.seq, &control_imu_seq, &control_imu_stale, &control_imu_skipped);
             mc_set_global(global_target, m_quat);
         }
         break;
     case MODE_SASSIST:
-        m_quat = imu_get_data().quat;
-        m_depth = depth_get_data().depth_m;
+        m_imu = imu_get_data();
+        m_quat = m_imu.quat;
+        m_depth = depth_get_data();
         if((imu_get_sensor() == IMU_NONE) || 
                 (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0) || 
                 (depth_get_sensor() == DEPTH_NONE)){
@@ -287,18 +442,22 @@ static void cmdctrl_apply_speed(void){
             // Thus, stop the thrusters
             mc_set_local((mc_local_target_t){.x=0, .y=0, .z=0, .xrot=0, .yrot=0, .zrot=0});
         }else{
-            mc_set_sassist(sassist_target, m_quat, m_depth);
+            cmdctrl_use_sample(m_imu.seq, &control_imu_seq, &control_imu_stale, &control_imu_skipped);
+            cmdctrl_use_sample(m_depth.seq, &control_depth_seq, &control_depth_stale, &control_depth_skipped);
+            mc_set_sassist(sassist_target, m_quat, m_imu.raw_gyro, m_depth.depth_m);
         }
         break;
     case MODE_OHOLD:
-        m_quat = imu_get_data().quat;
+        m_imu = imu_get_data();
+        m_quat = m_imu.quat;
         if((imu_get_sensor() == IMU_NONE) || 
                 (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
             // Cannot apply real speed b/c sensor data not available or invalid
             // Thus, stop the thrusters
             mc_set_local((mc_local_target_t){.x=0, .y=0, .z=0, .xrot=0, .yrot=0, .zrot=0});
         }else{
-            mc_set_ohold(ohold_target, m_quat);
+            cmdctrl_use_sample(m_imu.seq, &control_imu_seq, &control_imu_stale, &control_imu_skipped);
+            mc_set_ohold(ohold_target, m_quat, m_imu.raw_gyro);
         }
         break;
     }
@@ -315,1003 +474,1482 @@ static void cmdctrl_acknowledge(uint16_t msg_id, uint8_t error_code, uint8_t *re
     // A, C, K, [message_id], [error_code], [response]
     // [message_id] is a 16-bit number big endian
     // [response] is arbitrary data
-    uint8_t *data = pvPortMalloc(sizeof(uint8_t) * (6 + result_len));
-    data[0] = 'A';
-    data[1] = 'C';
-    data[2] = 'K';
-    conversions_int16_to_data(msg_id, &data[3], false);
-    data[5] = error_code;
-    for(unsigned int i = 0; i < result_len; ++i)
-        data[6 + i] = result[i];
-    pccomm_write(data, 6 + result_len);
-    vPortFree(data);
+    // If the message being acknowledged used compact protocol, A, C, K is replaced by a single opcode
+    // The result is written directly from the caller's buffer (no copy / allocation)
+    uint8_t op = OP_ACK;
+    uint8_t header[3];
+    conversions_int16_to_data(msg_id, &header[0], false);
+    header[2] = error_code;
+    pccomm_frag_t frags[3] = {
+        cmdctrl_msg_name("ACK", &op, msg_compact),
+        {.data = header, .len = 3},
+        {.data = result, .len = result_len}
+    };
+    pccomm_writev(frags, 3);
 }
 
-/**
- * Check if message starts with the given prefix
- */
-static bool message_starts_with(const uint8_t *msg, const unsigned int msg_len, const uint8_t *prefix, const unsigned int prefix_len){
-    if(msg_len < prefix_len)
-        return false;
-    for(unsigned int i = 0; i < prefix_len; ++i){
-        if(msg[i] != prefix[i])
-            return false;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Message handlers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Each handler is called with the message arguments (args; the bytes after the message name or compact opcode) and
+// their length (len). Length is already checked against the handler's table entry.
+
+// -----------------------------------------------------------------------------------------------------------------
+// Motor motion commands
+// -----------------------------------------------------------------------------------------------------------------
+
+static void cmdctrl_handle_raw(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // RAW speed set command
+    // R, A, W, [speed_0], [speed_1], [speed_2], [speed_3], [speed_4], [speed_5], [speed_6], [speed_7]
+    // [speed_i] is a 32-bit float (little endian)
+
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+    // Get speeds from message
+    raw_target[0] = conversions_data_to_float(&args[0], true);
+    raw_target[1] = conversions_data_to_float(&args[4], true);
+    raw_target[2] = conversions_data_to_float(&args[8], true);
+    raw_target[3] = conversions_data_to_float(&args[12], true);
+    raw_target[4] = conversions_data_to_float(&args[16], true);
+    raw_target[5] = conversions_data_to_float(&args[20], true);
+    raw_target[6] = conversions_data_to_float(&args[24], true);
+    raw_target[7] = conversions_data_to_float(&args[28], true);
+
+    // Ensure speeds are in valid range
+    for(unsigned int i = 0; i < 8; ++i){
+        LIMIT(raw_target[i]);
     }
-    return true;
-}
 
-/**
- * Check if message matches the given data
- */
-static bool message_equals(const uint8_t *msg, const unsigned int msg_len, const uint8_t *match, const unsigned int match_len){
-    if(msg_len != match_len)
-        return false;
-    for(unsigned int i = 0; i < msg_len; ++i){
-        if(msg[i] != match[i])
-            return false;
+    // Update mode variable and LED color (if needed)
+    if(mode != MODE_RAW){
+        mode = MODE_RAW;
+        led_set(COLOR_RAW);
     }
-    return true;
+    xSemaphoreGive(target_mutex);
+
+    // Feed watchdog when speeds are set
+    // Important to call before speed set function in case currently killed
+    mc_wdog_feed();
+
+    // Update motor speeds
+    cmdctrl_apply_speed();
+
+    // Acknowledge message w/ no error.
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
 }
 
-#define message_starts_with_str(msg, msg_len, prefix_str)       message_starts_with(msg, msg_len, (uint8_t*)(prefix_str), (sizeof(prefix_str) - 1))
-#define message_equals_str(msg, msg_len, match_str)             message_equals(msg, msg_len, (uint8_t*)(match_str), (sizeof(match_str) - 1))
+static void cmdctrl_handle_local(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // LOCAL Speed Set
+    // L, O, C, A, L, [x], [y], [z], [xrot], [yrot], [zrot]
+    // [x], [y], [z], [xrot], [yrot], [zrot]  are 32-bit floats (little endian)
+
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+    // Get speeds from message
+    local_target.x = conversions_data_to_float(&args[0], true);
+    local_target.y = conversions_data_to_float(&args[4], true);
+    local_target.z = conversions_data_to_float(&args[8], true);
+    local_target.xrot = conversions_data_to_float(&args[12], true);
+    local_target.yrot = conversions_data_to_float(&args[16], true);
+    local_target.zrot = conversions_data_to_float(&args[20], true);
+
+    // Ensure speeds are in valid range
+    LIMIT(local_target.x);
+    LIMIT(local_target.y);
+    LIMIT(local_target.z);
+    LIMIT(local_target.xrot);
+    LIMIT(local_target.yrot);
+    LIMIT(local_target.zrot);
+
+    // Update mode variable and LED color (if needed)
+    if(mode != MODE_LOCAL){
+        mode = MODE_LOCAL;
+        led_set(COLOR_LOCAL);
+    }
+    xSemaphoreGive(target_mutex);
 
+    // Feed watchdog when speeds are set
+    // Important to call before speed set function in case currently killed
+    mc_wdog_feed();
 
+    // Update motor speeds
+    cmdctrl_apply_speed();
 
-void cmdctrl_handle_message(void){
-    // Skip first 2 bytes of pccomm_read_buf (these are message ID)
-    // Also skip last 2 bytes (these are CRC)
-    uint8_t *msg = &pccomm_read_buf[2];
-    unsigned int len = pccomm_read_len - 4;
+    // Acknowledge message w/ no error.
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
 
-    // msg_id is first two bytes (unsigned 16-bit int big endian)
-    uint16_t msg_id = conversions_data_to_int16(pccomm_read_buf, false);
+static void cmdctrl_handle_global(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // GLOBAL speed set
+    // G, L, O, B, A, L, [x], [y], [z], [pitch_spd], [roll_spd], [yaw_spd]
+    // [x], [y], [z], [pitch_spd], [roll_spd], [yaw_spd]  are 32-bit floats (little endian)
 
-    // -----------------------------------------------------------------------------------------------------------------
-    // Motor motion commands (check these first as they are expected to be most frequently used)
-    // -----------------------------------------------------------------------------------------------------------------
-    if(message_starts_with_str(msg, len, "RAW")){
-        // RAW speed set command
-        // R, A, W, [speed_0], [speed_1], [speed_2], [speed_3], [speed_4], [speed_5], [speed_6], [speed_7]
-        // [speed_i] is a 32-bit float (little endian)
-
-        if(len != 35){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-
-            // Get speeds from message
-            raw_target[0] = conversions_data_to_float(&msg[3], true);
-            raw_target[1] = conversions_data_to_float(&msg[7], true);
-            raw_target[2] = conversions_data_to_float(&msg[11], true);
-            raw_target[3] = conversions_data_to_float(&msg[15], true);
-            raw_target[4] = conversions_data_to_float(&msg[19], true);
-            raw_target[5] = conversions_data_to_float(&msg[23], true);
-            raw_target[6] = conversions_data_to_float(&msg[27], true);
-            raw_target[7] = conversions_data_to_float(&msg[31], true);
-
-            // Ensure speeds are in valid range
-            for(unsigned int i = 0; i < 8; ++i){
-                LIMIT(raw_target[i]);
-            }
+    quaternion_t m_quat = imu_get_data().quat;
 
-            // Reset time until periodic speed set
-            xTimerReset(periodic_speed_timer, portMAX_DELAY);
+    if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
+        // Need IMU data to use global mode.
+        // If not ready, then this command is invalid at this time
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+        // Get speeds from message
+        global_target.x = conversions_data_to_float(&args[0], true);
+        global_target.y = conversions_data_to_float(&args[4], true);
+        global_target.z = conversions_data_to_float(&args[8], true);
+        global_target.pitch_spd = conversions_data_to_float(&args[12], true);
+        global_target.roll_spd = conversions_data_to_float(&args[16], true);
+        global_target.yaw_spd = conversions_data_to_float(&args[20], true);
+
+        // Ensure speeds are in valid range
+        LIMIT(global_target.x);
+        LIMIT(global_target.y);
+        LIMIT(global_target.z);
+        LIMIT(global_target.pitch_spd);
+        LIMIT(global_target.roll_spd);
+        LIMIT(global_target.yaw_spd);
+
+        // Update mode variable and LED color (if needed)
+        if(mode != MODE_GLOBAL){
+            mode = MODE_GLOBAL;
+            led_set(COLOR_GLOBAL);
+        }
+        xSemaphoreGive(target_mutex);
 
-            // Update mode variable and LED color (if needed)
-            if(mode != MODE_RAW){
-                mode = MODE_RAW;
-                led_set(COLOR_RAW);
-            }
+        // Feed watchdog when speeds are set
+        // Motor speeds are updated by the control loop (cmdctrl_control_tick)
+        mc_wdog_feed();
 
-            // Feed watchdog when speeds are set
-            // Important to call before speed set function in case currently killed
-            mc_wdog_feed();
+        // Acknowledge message w/ no error.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    }
+}
+
+static void cmdctrl_handle_sassist1(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // STABILITY ASSIST speed set variant 1
+    // S, A, S, S, I, S, T, 1, [x], [y], [yaw_spd], [target_pitch], [target_roll], [target_depth]
+    // [x], [y], [yaw_spd], [target_pitch], [target_roll], [target_depth] are 32-bit floats (little endian)
 
-            // Update motor speeds
-            cmdctrl_apply_speed();
+    quaternion_t m_quat = imu_get_data().quat;
 
-            // Acknowledge message w/ no error.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    if((imu_get_sensor() == IMU_NONE) || 
+            (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0) || 
+            (depth_get_sensor() == DEPTH_NONE)){
+        // Need both IMU and depth sensor for this mode.
+        // If not ready, then this command is invalid at this time
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+        // Get arguments from message
+        sassist_target.x = conversions_data_to_float(&args[0], true);
+        sassist_target.y = conversions_data_to_float(&args[4], true);
+        sassist_target.yaw_spd = conversions_data_to_float(&args[8], true);
+        sassist_target.target_euler.pitch = conversions_data_to_float(&args[12], true);
+        sassist_target.target_euler.roll = conversions_data_to_float(&args[16], true);
+        sassist_target.target_euler.is_deg = true;
+        sassist_target.target_depth = conversions_data_to_float(&args[20], true);
+        sassist_target.use_yaw_pid = false;
+
+        // Ensure speeds are in valid range
+        LIMIT(sassist_target.x);
+        LIMIT(sassist_target.y);
+        LIMIT(sassist_target.yaw_spd);
+
+        // Update mode variable and LED color (if needed)
+        if(mode != MODE_SASSIST){
+            mode = MODE_SASSIST;
+            led_set(COLOR_SASSIST);
         }
-    }else if(message_starts_with_str(msg, len, "LOCAL")){
-        // LOCAL Speed Set
-        // L, O, C, A, L, [x], [y], [z], [xrot], [yrot], [zrot]
-        // [x], [y], [z], [xrot], [yrot], [zrot]  are 32-bit floats (little endian)
-
-        if(len != 29){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-
-            // Get speeds from message
-            local_target.x = conversions_data_to_float(&msg[5], true);
-            local_target.y = conversions_data_to_float(&msg[9], true);
-            local_target.z = conversions_data_to_float(&msg[13], true);
-            local_target.xrot = conversions_data_to_float(&msg[17], true);
-            local_target.yrot = conversions_data_to_float(&msg[21], true);
-            local_target.zrot = conversions_data_to_float(&msg[25], true);
-
-            // Ensure speeds are in valid range
-            LIMIT(local_target.x);
-            LIMIT(local_target.y);
-            LIMIT(local_target.z);
-            LIMIT(local_target.xrot);
-            LIMIT(local_target.yrot);
-            LIMIT(local_target.zrot);
-
-            // Reset time until periodic speed set
-            xTimerReset(periodic_speed_timer, portMAX_DELAY);
-
-            // Update mode variable and LED color (if needed)
-            if(mode != MODE_LOCAL){
-                mode = MODE_LOCAL;
-                led_set(COLOR_LOCAL);
-            }
+        xSemaphoreGive(target_mutex);
 
-            // Feed watchdog when speeds are set
-            // Important to call before speed set function in case currently killed
-            mc_wdog_feed();
+        // Feed watchdog when speeds are set
+        // Motor speeds are updated by the control loop (cmdctrl_control_tick)
+        mc_wdog_feed();
 
-            // Update motor speeds
-            cmdctrl_apply_speed();
+        // Acknowledge message w/ no error.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    }
+}
 
-            // Acknowledge message w/ no error.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
-    }else if(message_starts_with_str(msg, len, "GLOBAL")){
-        // GLOBAL speed set
-        // G, L, O, B, A, L, [x], [y], [z], [pitch_spd], [roll_spd], [yaw_spd]
-        // [x], [y], [z], [pitch_spd], [roll_spd], [yaw_spd]  are 32-bit floats (little endian)
-        if(len != 30){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            quaternion_t m_quat = imu_get_data().quat;
-
-            if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
-                // Need IMU data to use global mode.
-                // If not ready, then this command is invalid at this time
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                // Get speeds from message
-                global_target.x = conversions_data_to_float(&msg[6], true);
-                global_target.y = conversions_data_to_float(&msg[10], true);
-                global_target.z = conversions_data_to_float(&msg[14], true);
-                global_target.pitch_spd = conversions_data_to_float(&msg[18], true);
-                global_target.roll_spd = conversions_data_to_float(&msg[22], true);
-                global_target.yaw_spd = conversions_data_to_float(&msg[26], true);
-
-                // Ensure speeds are in valid range
-                LIMIT(global_target.x);
-                LIMIT(global_target.y);
-                LIMIT(global_target.z);
-                LIMIT(global_target.pitch_spd);
-                LIMIT(global_target.roll_spd);
-                LIMIT(global_target.yaw_spd);
-
-                // Reset time until periodic speed set
-                xTimerReset(periodic_speed_timer, portMAX_DELAY);
-
-                // Update mode variable and LED color (if needed)
-                if(mode != MODE_GLOBAL){
-                    mode = MODE_GLOBAL;
-                    led_set(COLOR_GLOBAL);
-                }
-
-                // Feed watchdog when speeds are set
-                // Important to call before speed set function in case currently killed
-                mc_wdog_feed();
-
-                // Update motor speeds
-                cmdctrl_apply_speed();
-
-                // Acknowledge message w/ no error.
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
-    }else if(message_starts_with_str(msg, len, "SASSIST1")){
-        // STABILITY ASSIST speed set variant 1
-        // S, A, S, S, I, S, T, 1, [x], [y], [yaw_spd], [target_pitch], [target_roll], [target_depth]
-        // [x], [y], [yaw_spd], [target_pitch], [target_roll], [target_depth] are 32-bit floats (little endian)
-        if(len != 32){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            quaternion_t m_quat = imu_get_data().quat;
-
-            if((imu_get_sensor() == IMU_NONE) || 
-                    (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0) || 
-                    (depth_get_sensor() == DEPTH_NONE)){
-                // Need both IMU and depth sensor for this mode.
-                // If not ready, then this command is invalid at this time
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                // Get arguments from message
-                sassist_target.x = conversions_data_to_float(&msg[8], true);
-                sassist_target.y = conversions_data_to_float(&msg[12], true);
-                sassist_target.yaw_spd = conversions_data_to_float(&msg[16], true);
-                sassist_target.target_euler.pitch = conversions_data_to_float(&msg[20], true);
-                sassist_target.target_euler.roll = conversions_data_to_float(&msg[24], true);
-                sassist_target.target_euler.is_deg = true;
-                sassist_target.target_depth = conversions_data_to_float(&msg[28], true);
-                sassist_target.use_yaw_pid = false;
-
-                // Ensure speeds are in valid range
-                LIMIT(sassist_target.x);
-                LIMIT(sassist_target.y);
-                LIMIT(sassist_target.yaw_spd);
-
-                // Reset time until periodic speed set
-                xTimerReset(periodic_speed_timer, portMAX_DELAY);
-
-                // Update mode variable and LED color (if needed)
-                if(mode != MODE_SASSIST){
-                    mode = MODE_SASSIST;
-                    led_set(COLOR_SASSIST);
-                }
-
-                // Feed watchdog when speeds are set
-                // Important to call before speed set function in case currently killed
-                mc_wdog_feed();
-
-                // Update motor speeds
-                cmdctrl_apply_speed();
-
-                // Acknowledge message w/ no error.
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
-    }else if(message_starts_with_str(msg, len, "SASSIST2")){
-        // STABILITY ASSIST speed set variant 2
-        // S, A, S, S, I, S, T, 2, [x], [y], [target_pitch], [target_roll], [target_yaw], [target_depth]
-        // [x], [y], [target_pitch], [target_roll], [target_yaw], [target_depth] are 32-bit floats (little endian)
-        if(len != 32){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            quaternion_t m_quat = imu_get_data().quat;
-
-            if((imu_get_sensor() == IMU_NONE) || 
-                    (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0) || 
-                    (depth_get_sensor() == DEPTH_NONE)){
-                // Need depth and IMU for this mode
-                // If not ready, then this command is invalid at this time
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                // Get arguments from message
-                sassist_target.x = conversions_data_to_float(&msg[8], true);
-                sassist_target.y = conversions_data_to_float(&msg[12], true);
-                sassist_target.target_euler.pitch = conversions_data_to_float(&msg[16], true);
-                sassist_target.target_euler.roll = conversions_data_to_float(&msg[20], true);
-                sassist_target.target_euler.yaw = conversions_data_to_float(&msg[24], true);
-                sassist_target.target_euler.is_deg = true;
-                sassist_target.target_depth = conversions_data_to_float(&msg[28], true);
-                sassist_target.use_yaw_pid = true;
-
-                // Ensure speeds are in valid range
-                LIMIT(sassist_target.x);
-                LIMIT(sassist_target.y);
-                LIMIT(sassist_target.yaw_spd);
-
-                // Reset time until periodic speed set
-                xTimerReset(periodic_speed_timer, portMAX_DELAY);
-
-                // Update mode variable and LED color (if needed)
-                if(mode != MODE_SASSIST){
-                    mode = MODE_SASSIST;
-                    led_set(COLOR_SASSIST);
-                }
-
-                // Feed watchdog when speeds are set
-                // Important to call before speed set function in case currently killed
-                mc_wdog_feed();
-
-                // Update motor speeds
-                cmdctrl_apply_speed();
-
-                // Acknowledge message w/ no error.
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
-    }else if(message_starts_with_str(msg, len, "OHOLD1")){
-        // ORIENTATION HOLD speed set variant 1
-        // O, H, O, L, D, 1 [x], [y], [z], [yaw_spd], [target_pitch], [target_roll]
-        // [x], [y], [z], [yaw_spd], [target_pitch], [target_roll] are 32-bit floats (little endian)
-        if(len != 30){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            quaternion_t m_quat = imu_get_data().quat;
-
-            if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
-                // Need IMU data to use ohold mode.
-                // If not ready, then this command is invalid at this time
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                // Get arguments from message
-                ohold_target.x = conversions_data_to_float(&msg[6], true);
-                ohold_target.y = conversions_data_to_float(&msg[10], true);
-                ohold_target.z = conversions_data_to_float(&msg[14], true);
-                ohold_target.yaw_spd = conversions_data_to_float(&msg[18], true);
-                ohold_target.target_euler.pitch = conversions_data_to_float(&msg[22], true);
-                ohold_target.target_euler.roll = conversions_data_to_float(&msg[26], true);
-                ohold_target.target_euler.is_deg = true;
-                ohold_target.use_yaw_pid = false;
-
-                // Ensure speeds are in valid range
-                LIMIT(ohold_target.x);
-                LIMIT(ohold_target.y);
-                LIMIT(ohold_target.z);
-                LIMIT(ohold_target.yaw_spd);
-
-                // Reset time until periodic speed set
-                xTimerReset(periodic_speed_timer, portMAX_DELAY);
-
-                // Update mode variable and LED color (if needed)
-                if(mode != MODE_OHOLD){
-                    mode = MODE_OHOLD;
-                    led_set(COLOR_OHOLD);
-                }
-
-                // Feed watchdog when speeds are set
-                // Important to call before speed set function in case currently killed
-                mc_wdog_feed();
-
-                // Update motor speeds
-                cmdctrl_apply_speed();
-
-                // Acknowledge message w/ no error.
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
-    }else if(message_starts_with_str(msg, len, "OHOLD2")){
-        // ORIENTATION HOLD speed set variant 2
-        // O, H, O, L, D, 2, [x], [y], [z], [target_pitch], [target_roll], [target_yaw]
-        // [x], [y], [z], [target_pitch], [target_roll], [target_yaw] are 32-bit floats (little endian)
-        if(len != 30){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            quaternion_t m_quat = imu_get_data().quat;
-
-            if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
-                // Need IMU data to use ohold mode.
-                // If not ready, then this command is invalid at this time
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                // Get arguments from message
-                ohold_target.x = conversions_data_to_float(&msg[6], true);
-                ohold_target.y = conversions_data_to_float(&msg[10], true);
-                ohold_target.z = conversions_data_to_float(&msg[14], true);
-                ohold_target.target_euler.pitch = conversions_data_to_float(&msg[18], true);
-                ohold_target.target_euler.roll = conversions_data_to_float(&msg[22], true);
-                ohold_target.target_euler.yaw = conversions_data_to_float(&msg[26], true);
-                ohold_target.target_euler.is_deg = true;
-                ohold_target.use_yaw_pid = true;
-
-                // Ensure speeds are in valid range
-                LIMIT(ohold_target.x);
-                LIMIT(ohold_target.y);
-                LIMIT(ohold_target.z);
-
-                // Reset time until periodic speed set
-                xTimerReset(periodic_speed_timer, portMAX_DELAY);
-
-                // Update mode variable and LED color (if needed)
-                if(mode != MODE_OHOLD){
-                    mode = MODE_OHOLD;
-                    led_set(COLOR_OHOLD);
-                }
-
-                // Feed watchdog when speeds are set
-                // Important to call before speed set function in case currently killed
-                mc_wdog_feed();
-
-                // Update motor speeds
-                cmdctrl_apply_speed();
-
-                // Acknowledge message w/ no error.
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
-    }else if(message_equals_str(msg, len, "WDGF")){
-        // Feed motor watchdog command
-        // W, D, G, F
+static void cmdctrl_handle_sassist2(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // STABILITY ASSIST speed set variant 2
+    // S, A, S, S, I, S, T, 2, [x], [y], [target_pitch], [target_roll], [target_yaw], [target_depth]
+    // [x], [y], [target_pitch], [target_roll], [target_yaw], [target_depth] are 32-bit floats (little endian)
+
+    quaternion_t m_quat = imu_get_data().quat;
 
-        // Feed watchdog (as requested)
-        bool was_killed = mc_wdog_feed();
+    if((imu_get_sensor() == IMU_NONE) || 
+            (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0) || 
+            (depth_get_sensor() == DEPTH_NONE)){
+        // Need depth and IMU for this mode
+        // If not ready, then this command is invalid at this time
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+        // Get arguments from message
+        sassist_target.x = conversions_data_to_float(&args[0], true);
+        sassist_target.y = conversions_data_to_float(&args[4], true);
+        sassist_target.target_euler.pitch = conversions_data_to_float(&args[8], true);
+        sassist_target.target_euler.roll = conversions_data_to_float(&args[12], true);
+        sassist_target.target_euler.yaw = conversions_data_to_float(&args[16], true);
+        sassist_target.target_euler.is_deg = true;
+        sassist_target.target_depth = conversions_data_to_float(&args[20], true);
+        sassist_target.use_yaw_pid = true;
+
+        // Ensure speeds are in valid range
+        LIMIT(sassist_target.x);
+        LIMIT(sassist_target.y);
+        LIMIT(sassist_target.yaw_spd);
+
+        // Update mode variable and LED color (if needed)
+        if(mode != MODE_SASSIST){
+            mode = MODE_SASSIST;
+            led_set(COLOR_SASSIST);
+        }
+        xSemaphoreGive(target_mutex);
 
-        // Restore last set speed if previously killed
-        if(was_killed)
-            cmdctrl_apply_speed();
+        // Feed watchdog when speeds are set
+        // Motor speeds are updated by the control loop (cmdctrl_control_tick)
+        mc_wdog_feed();
 
         // Acknowledge message w/ no error.
         cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
     }
-    // -----------------------------------------------------------------------------------------------------------------
-
-    // -----------------------------------------------------------------------------------------------------------------
-    // Vehicle configuration commands
-    // -----------------------------------------------------------------------------------------------------------------
-    else if(message_starts_with_str(msg, len, "TPWM")){
-        // Thruster PWM parameter set command
-        // T, P, W, M, [pwm_period], [pwm_zero], [pwm_range]
-        // All 3 values are 16-bit integers (unsigned, little endian)
-
-        if(len != 10){
-            // Incorrect size.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Correct size. Handle it.
-            thr_params_t p;
-            p.pwm_period = conversions_data_to_int16(&msg[4], true);
-            p.pwm_zero = conversions_data_to_int16(&msg[6], true);
-            p.pwm_range = conversions_data_to_int16(&msg[8], true);
+}
 
-            // Apply settings
-            thruster_config(p);
+static void cmdctrl_handle_ohold1(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // ORIENTATION HOLD speed set variant 1
+    // O, H, O, L, D, 1 [x], [y], [z], [yaw_spd], [target_pitch], [target_roll]
+    // [x], [y], [z], [yaw_spd], [target_pitch], [target_roll] are 32-bit floats (little endian)
 
-            // Apply saved speed properly for newly configured ESCs
-            // Note that this is not a speed set, thus does not feed watchdog
-            cmdctrl_apply_speed();
+    quaternion_t m_quat = imu_get_data().quat;
 
-            // No error
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
+        // Need IMU data to use ohold mode.
+        // If not ready, then this command is invalid at this time
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+        // Get arguments from message
+        ohold_target.x = conversions_data_to_float(&args[0], true);
+        ohold_target.y = conversions_data_to_float(&args[4], true);
+        ohold_target.z = conversions_data_to_float(&args[8], true);
+        ohold_target.yaw_spd = conversions_data_to_float(&args[12], true);
+        ohold_target.target_euler.pitch = conversions_data_to_float(&args[16], true);
+        ohold_target.target_euler.roll = conversions_data_to_float(&args[20], true);
+        ohold_target.target_euler.is_deg = true;
+        ohold_target.use_yaw_pid = false;
+
+        // Ensure speeds are in valid range
+        LIMIT(ohold_target.x);
+        LIMIT(ohold_target.y);
+        LIMIT(ohold_target.z);
+        LIMIT(ohold_target.yaw_spd);
+
+        // Update mode variable and LED color (if needed)
+        if(mode != MODE_OHOLD){
+            mode = MODE_OHOLD;
+            led_set(COLOR_OHOLD);
         }
-    }else if(message_starts_with_str(msg, len, "TINV")){
-        // Thruster inversion set command
-        // T, I, N, V, [inv]
-        // [inv] is an 8-bit int where MSB corresponds to thruster 8 and LSB thruster 1
-        //       1 = inverted. 0 = not inverted
-        
-        if(len != 5){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            uint8_t inv_byte = msg[4];
-            bool invert[8];
-            for(unsigned int i = 0; i < 8; ++i){
-                invert[i] = inv_byte & 1;
-                inv_byte >>= 1;
-            }
-            mc_set_tinv(invert);
+        xSemaphoreGive(target_mutex);
 
-            // Reapply saved speed when inversions change
-            cmdctrl_apply_speed();
+        // Feed watchdog when speeds are set
+        // Motor speeds are updated by the control loop (cmdctrl_control_tick)
+        mc_wdog_feed();
 
-            // Acknowledge message w/ no error.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
-    }else if(message_starts_with_str(msg, len, "RELDOF")){
-        // Relative DoF speed set command
-        // R, E, L, D, O, F, [x], [y], [z], [xrot], [yrot], [zrot]
-        // Each value is a little endian float (32-bit)
-
-        if(len != 30){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            float x = conversions_data_to_float(&msg[6], true);
-            float y = conversions_data_to_float(&msg[10], true);
-            float z = conversions_data_to_float(&msg[14], true);
-            float xrot = conversions_data_to_float(&msg[18], true);
-            float yrot = conversions_data_to_float(&msg[22], true);
-            float zrot = conversions_data_to_float(&msg[26], true);
-
-            // Restrict to 0.0 - 1.0
-            LIMIT_POS(x);
-            LIMIT_POS(y);
-            LIMIT_POS(z);
-            LIMIT_POS(xrot);
-            LIMIT_POS(yrot);
-            LIMIT_POS(zrot);
-
-            float mc_relscale[6];
-
-            // Linear scale DOWN factors
-            //  x = min(x, y, z) / x
-            //  y = min(x, y, z) / y
-            //  z = min(x, y, z) / z
-            mc_relscale[0] = x == 0.0f ? 1.0f : MIN(x, MIN(y, z)) / x;
-            mc_relscale[1] = y == 0.0f ? 1.0f : MIN(x, MIN(y, z)) / y;
-            mc_relscale[2] = z == 0.0f ? 1.0f : MIN(x, MIN(y, z)) / z;
-
-            // Angular scale DOWN factors
-            //  xrot = min(xrot, yrot, zrot) / xrot
-            //  yrot = min(xrot, yrot, zrot) / yrot
-            //  zrot = min(xrot, yrot, zrot) / zrot
-            mc_relscale[3] = xrot == 0.0f ? 1.0f : MIN(xrot, MIN(yrot, zrot)) / xrot;
-            mc_relscale[4] = yrot == 0.0f ? 1.0f : MIN(xrot, MIN(yrot, zrot)) / yrot;
-            mc_relscale[5] = zrot == 0.0f ? 1.0f : MIN(xrot, MIN(yrot, zrot)) / zrot;
-
-            mc_set_relscale(mc_relscale);
-
-            // Reapply saved speed when scale factors change
-            cmdctrl_apply_speed();
-
-            // Acknowledge message w/ no error
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
+        // Acknowledge message w/ no error.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    }
+}
 
-    }else if(message_starts_with_str(msg, len, "MMATS")){
-        // Set Motor Matrix Row command
-        // M, M, A, T, S, [thruster_num], [data]
-        // [thruster_num] is an 8-bit int from 1-8 (inclusive on both ends)
-        // [data] is a set of 6 32-bit floats (24 bytes)
-        //        Lowest indices are lowest thruster number (little endian floats)
+static void cmdctrl_handle_ohold2(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // ORIENTATION HOLD speed set variant 2
+    // O, H, O, L, D, 2, [x], [y], [z], [target_pitch], [target_roll], [target_yaw]
+    // [x], [y], [z], [target_pitch], [target_roll], [target_yaw] are 32-bit floats (little endian)
 
-        if(len != 30){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size
-            
-            if(msg[5] > 8 || msg[5] < 1){
-                // Invalid thruster number
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-            }else{
-                // Construct data array
-                // Note: there is no validation of motor matrix data
-                float data[6];
-                data[0] = conversions_data_to_float(&msg[6], true);
-                data[1] = conversions_data_to_float(&msg[10], true);
-                data[2] = conversions_data_to_float(&msg[14], true);
-                data[3] = conversions_data_to_float(&msg[18], true);
-                data[4] = conversions_data_to_float(&msg[22], true);
-                data[5] = conversions_data_to_float(&msg[26], true);
-
-                // Set the data
-                mc_set_dof_matrix(msg[5], data);
-
-                // Acknowledge message w/ no error.
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
+    quaternion_t m_quat = imu_get_data().quat;
+
+    if((imu_get_sensor() == IMU_NONE) || (m_quat.w == 0 && m_quat.x == 0 && m_quat.y == 0 && m_quat.z == 0)){
+        // Need IMU data to use ohold mode.
+        // If not ready, then this command is invalid at this time
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
+
+        // Get arguments from message
+        ohold_target.x = conversions_data_to_float(&args[0], true);
+        ohold_target.y = conversions_data_to_float(&args[4], true);
+        ohold_target.z = conversions_data_to_float(&args[8], true);
+        ohold_target.target_euler.pitch = conversions_data_to_float(&args[12], true);
+        ohold_target.target_euler.roll = conversions_data_to_float(&args[16], true);
+        ohold_target.target_euler.yaw = conversions_data_to_float(&args[20], true);
+        ohold_target.target_euler.is_deg = true;
+        ohold_target.use_yaw_pid = true;
+
+        // Ensure speeds are in valid range
+        LIMIT(ohold_target.x);
+        LIMIT(ohold_target.y);
+        LIMIT(ohold_target.z);
+
+        // Update mode variable and LED color (if needed)
+        if(mode != MODE_OHOLD){
+            mode = MODE_OHOLD;
+            led_set(COLOR_OHOLD);
         }
-    }else if(message_starts_with_str(msg, len, "MMATU")){
-        // Motor Matrix Update command (call after all rows written)
-        // M, M, A, T, U
+        xSemaphoreGive(target_mutex);
+
+        // Feed watchdog when speeds are set
+        // Motor speeds are updated by the control loop (cmdctrl_control_tick)
+        mc_wdog_feed();
+
+        // Acknowledge message w/ no error.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    }
+}
+
+static void cmdctrl_handle_wdgf(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Feed motor watchdog command
+    // W, D, G, F
 
-        // Recalc things after motor matrix is fully updated
-        mc_recalc();
+    // Feed watchdog (as requested)
+    bool was_killed = mc_wdog_feed();
 
-        // Need to re-apply speeds if motor matrix changes
+    // Restore last set speed if previously killed
+    if(was_killed)
         cmdctrl_apply_speed();
 
+    // Acknowledge message w/ no error.
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+// Vehicle configuration commands
+// -----------------------------------------------------------------------------------------------------------------
+
+static void cmdctrl_handle_tpwm(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Thruster PWM parameter set command
+    // T, P, W, M, [pwm_period], [pwm_zero], [pwm_range]
+    // All 3 values are 16-bit integers (unsigned, little endian)
+
+    // Correct size. Handle it.
+    thr_params_t p;
+    p.pwm_period = conversions_data_to_int16(&args[0], true);
+    p.pwm_zero = conversions_data_to_int16(&args[2], true);
+    p.pwm_range = conversions_data_to_int16(&args[4], true);
+
+    // Apply settings
+    thruster_config(p);
+
+    // Apply saved speed properly for newly configured ESCs
+    // Note that this is not a speed set, thus does not feed watchdog
+    cmdctrl_apply_speed();
+
+    // No error
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_tinv(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Thruster inversion set command
+    // T, I, N, V, [inv]
+    // [inv] is an 8-bit int where MSB corresponds to thruster 8 and LSB thruster 1
+    //       1 = inverted. 0 = not inverted
+
+    uint8_t inv_byte = args[0];
+    bool invert[8];
+    for(unsigned int i = 0; i < 8; ++i){
+        invert[i] = inv_byte & 1;
+        inv_byte >>= 1;
+    }
+
+    // Inversions are used by the control loop
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    mc_set_tinv(invert);
+    xSemaphoreGive(target_mutex);
+
+    // Reapply saved speed when inversions change
+    cmdctrl_apply_speed();
+
+    // Acknowledge message w/ no error.
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_reldof(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Relative DoF speed set command
+    // R, E, L, D, O, F, [x], [y], [z], [xrot], [yrot], [zrot]
+    // Each value is a little endian float (32-bit)
+
+    float x = conversions_data_to_float(&args[0], true);
+    float y = conversions_data_to_float(&args[4], true);
+    float z = conversions_data_to_float(&args[8], true);
+    float xrot = conversions_data_to_float(&args[12], true);
+    float yrot = conversions_data_to_float(&args[16], true);
+    float zrot = conversions_data_to_float(&args[20], true);
+
+    // Restrict to 0.0 - 1.0
+    LIMIT_POS(x);
+    LIMIT_POS(y);
+    LIMIT_POS(z);
+    LIMIT_POS(xrot);
+    LIMIT_POS(yrot);
+    LIMIT_POS(zrot);
+
+    float mc_relscale[6];
+
+    // Linear scale DOWN factors
+    //  x = min(x, y, z) / x
+    //  y = min(x, y, z) / y
+    //  z = min(x, y, z) / z
+    mc_relscale[0] = x == 0.0f ? 1.0f : MIN(x, MIN(y, z)) / x;
+    mc_relscale[1] = y == 0.0f ? 1.0f : MIN(x, MIN(y, z)) / y;
+    mc_relscale[2] = z == 0.0f ? 1.0f : MIN(x, MIN(y, z)) / z;
+
+    // Angular scale DOWN factors
+    //  xrot = min(xrot, yrot, zrot) / xrot
+    //  yrot = min(xrot, yrot, zrot) / yrot
+    //  zrot = min(xrot, yrot, zrot) / zrot
+    mc_relscale[3] = xrot == 0.0f ? 1.0f : MIN(xrot, MIN(yrot, zrot)) / xrot;
+    mc_relscale[4] = yrot == 0.0f ? 1.0f : MIN(xrot, MIN(yrot, zrot)) / yrot;
+    mc_relscale[5] = zrot == 0.0f ? 1.0f : MIN(xrot, MIN(yrot, zrot)) / zrot;
+
+    // Scale factors are used by the control loop
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    mc_set_relscale(mc_relscale);
+    xSemaphoreGive(target_mutex);
+
+    // Reapply saved speed when scale factors change
+    cmdctrl_apply_speed();
+
+    // Acknowledge message w/ no error
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_mmats(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Set Motor Matrix Row command
+    // M, M, A, T, S, [thruster_num], [data]
+    // [thruster_num] is an 8-bit int from 1-8 (inclusive on both ends)
+    // [data] is a set of 6 32-bit floats (24 bytes)
+    //        Lowest indices are lowest thruster number (little endian floats)
+
+    if(args[0] > 8 || args[0] < 1){
+        // Invalid thruster number
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+    }else{
+        // Construct data array
+        // Note: there is no validation of motor matrix data
+        float data[6];
+        data[0] = conversions_data_to_float(&args[1], true);
+        data[1] = conversions_data_to_float(&args[5], true);
+        data[2] = conversions_data_to_float(&args[9], true);
+        data[3] = conversions_data_to_float(&args[13], true);
+        data[4] = conversions_data_to_float(&args[17], true);
+        data[5] = conversions_data_to_float(&args[21], true);
+
+        // Set the data (DoF matrix is used by the control loop)
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
+        mc_set_dof_matrix(args[0], data);
+        xSemaphoreGive(target_mutex);
+
         // Acknowledge message w/ no error.
         cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-    }else if(message_starts_with_str(msg, len, "PIDTN")){
-        // Tune PID
-        // P, I, D, T, N, [which], [kp], [ki], [kd], [limit], [invert]
-        // Each gain value (kp, ki, kd) is a 32-bit little endian float
-        // which = what PID to tune X (xrot), Y (yrot), Z (zrot), D (depth) (one byte, ASCII char)
-        // kp, ki, kd are gains. limit is max output of PID (magnitude, must be positive)
-        // invert == 1 negates the default PID output (single byte 1 or 0)
-        if(len != 23){
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            float kp = conversions_data_to_float(&msg[6], true);
-            float ki = conversions_data_to_float(&msg[10], true);
-            float kd = conversions_data_to_float(&msg[14], true);
-            float limit = conversions_data_to_float(&msg[18], true);
-            bool invert = msg[22];
-            switch(msg[5]){
-            case 'X':
-                mc_sassist_tune_xrot(kp, ki, kd, limit, invert);
-                break;
-            case 'Y':
-                mc_sassist_tune_yrot(kp, ki, kd, limit, invert);
-                break;
-            case 'Z':
-                mc_sassist_tune_zrot(kp, ki, kd, limit, invert);
-                break;
-            case 'D':
-                mc_sassist_tune_depth(kp, ki, kd, limit, invert);
-                break;
-            }
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
     }
-    // -----------------------------------------------------------------------------------------------------------------
+}
 
-    // -----------------------------------------------------------------------------------------------------------------
-    // Sensor data commands / queries
-    // -----------------------------------------------------------------------------------------------------------------
-    else if(message_equals_str(msg, len, "SSTAT")){
-        // Sensor status query
-        // S, S, T, A, T
-        // ACK contains data in the following format [imu_status],[depth_status]
-        // each [sensor_status] is an 8-bit int where each bit indicates if a sensor in use. 
-        // A value of 0 indicates no sensor. Any non-zero value indicates a specific IMU or depth sensor is available
-
-        uint8_t response[2];
-        response[0] = imu_get_sensor();
-        response[1] = depth_get_sensor();
-
-        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 2);
-    }else if(message_equals_str(msg, len, "IMUR")){
-        // One-shot read of IMU data
-        // I, M, U, R
-        // Response contains [quat_w], [quat_x], [quat_y], [quat_z], [accum_pitch], [accum_roll], [accum_yaw]
-        // where each value is a 32-bit float little endian
-
-        if(imu_get_sensor() == IMU_NONE){
-            // Sensor not ready. This command is not valid right now.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-        }else{
-            // Store current readings
-            imu_data_t dat = imu_get_data();
-
-            // Construct response data
-            uint8_t response_data[28];
-            conversions_float_to_data(dat.quat.w, &response_data[0], true);
-            conversions_float_to_data(dat.quat.x, &response_data[4], true);
-            conversions_float_to_data(dat.quat.y, &response_data[8], true);
-            conversions_float_to_data(dat.quat.z, &response_data[12], true);
-            conversions_float_to_data(dat.accum_angles.pitch, &response_data[16], true);
-            conversions_float_to_data(dat.accum_angles.roll, &response_data[20], true);
-            conversions_float_to_data(dat.accum_angles.yaw, &response_data[24], true);
-
-            // Send ack with response data
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response_data, 28);
-        }
-    }else if(message_equals_str(msg, len, "IMUW")){
-        // Read IMU RAW data
-        // I, M, U, W
-        // Response contains [accel_x], [accel_y], [accel_z], [gyro_x], [gyro_y], [gyro_z]
-        // where each value is a 32-bit float little endian
-
-        if(imu_get_sensor() == IMU_NONE){
-            // Sensor not ready. This command is not valid right now.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-        }else{
-            // Store current readings
-            imu_data_t data = imu_get_data();
-
-            // Construct response data
-            uint8_t response_data[24];
-            conversions_float_to_data(data.raw_accel.x, &response_data[0], true);
-            conversions_float_to_data(data.raw_accel.y, &response_data[4], true);
-            conversions_float_to_data(data.raw_accel.z, &response_data[8], true);
-            conversions_float_to_data(data.raw_gyro.x, &response_data[12], true);
-            conversions_float_to_data(data.raw_gyro.y, &response_data[16], true);
-            conversions_float_to_data(data.raw_gyro.z, &response_data[20], true);
-
-            // Send ack with response data
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response_data, 24);
-        }
-    }else if(message_starts_with_str(msg, len, "IMUP")){
-        // IMU periodic read configure
-        // I, M, U, P, [enable]
-        // [enable] is 1 or 0 (8-bit int) 1 = true (periodic read enabled). 0 = false (not enabled)
-        
-        if(len != 5){
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            periodic_imu = msg[4];
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
-    }else if(message_equals_str(msg, len, "DEPTHR")){
-        // One-shot read of BNO055 data (all data)
-        // D, E, P, T, H, R
-        // Response contains [depth_m], [pressure], [temp]
-        // where each value is a 32-bit float little endian
-
-        if(depth_get_sensor() == DEPTH_NONE){
-            // Sensor not ready. This command is not valid right now.
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-        }else{
-            // Store current readings
-            depth_data_t dat = depth_get_data();
+static void cmdctrl_handle_mmatu(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Motor Matrix Update command (call after all rows written)
+    // M, M, A, T, U
 
-            // Construct response data
-            uint8_t response_data[12];
-            conversions_float_to_data(dat.depth_m, &response_data[0], true);
-            conversions_float_to_data(dat.pressure_pa, &response_data[4], true);
-            conversions_float_to_data(dat.temperature_c, &response_data[8], true);
+    // Recalc things after motor matrix is fully updated
+    // Control loop must not use partially recalculated data
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    mc_recalc();
+    xSemaphoreGive(target_mutex);
 
-            // Send ack with response data
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response_data, 12);
-        }
-    }else if(message_starts_with_str(msg, len, "DEPTHP")){
-        // MS5837 periodic read configure
-        // D, E, P, T, H, P, [enable]
-        // [enable] is 1 or 0 (8-bit int) 1 = true (periodic read enabled). 0 = false (not enabled)
-        
-        if(len != 7){
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            periodic_depth = msg[6];
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
+    // Need to re-apply speeds if motor matrix changes
+    cmdctrl_apply_speed();
+
+    // Acknowledge message w/ no error.
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_pidtn(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Tune PID
+    // P, I, D, T, N, [which], [kp], [ki], [kd], [limit], [invert], ([kf], [d_filter], [d_on_meas])
+    // Each gain value (kp, ki, kd, kf) is a 32-bit little endian float
+    // which = what PID to tune X (xrot), Y (yrot), Z (zrot), D (depth) (one byte, ASCII char)
+    //         or x, y, z for xrot, yrot, zrot rate PIDs (inner loop of cascaded control; see CASC)
+    // kp, ki, kd are gains. limit is max output of PID (magnitude, must be positive)
+    // invert == 1 negates the default PID output (single byte 1 or 0)
+    // Optional (extended form): kf is feed-forward gain, d_filter is derivative filter time constant
+    // in seconds (32-bit little endian float), d_on_meas == 1 takes derivative of measurement not error (byte)
+    // kf multiplies target depth rate (D) or rate setpoint (x, y, z). It must be zero for X, Y, Z.
+    // All floats must be finite
+
+    if(len != 18 && len != 27){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
     }
-    // -----------------------------------------------------------------------------------------------------------------
-
-
-    // -----------------------------------------------------------------------------------------------------------------
-    // BNO055 Configuration Commands & Queries
-    // -----------------------------------------------------------------------------------------------------------------
-    else if(message_starts_with_str(msg, len, "BNO055A")){
-        // BNO055 Axis config command: sets axis remap for BNO055 IMU
-        // B, N, O, 0, 5, 5, A, [mode]
-        // [mode] is a single byte with value 0-7 for BNO055 axis config P0 to P7
-        // Modes are described in sensor's datasheet
-        if(len != 8){
-            // Wrong length
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Message is correct size. Handle it.
-            if(msg[7] > 7){
-                // Invalid mode
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-            }else{
-                // Valid mode. Set it.
-                bno055_set_axis(msg[7]);
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
-    }else if(message_equals_str(msg, len, "SCBNO055R")){
-        // S, C, B, N, O, 0, 5, 5, R
-        // Read stored calibration constants for BNO055
-        // ACK contains the following data
-        // [valid], [accel_offset_x], [accel_offset_y], [accel_offset_z], [accel_radius], [gyro_offset_x], [gyro_offset_y], [gyro_offset_z]
-        // Valid is a single byte. 0 = invalid, 1 = valid data
-        // All other values are 16-bit little endian integers. If data is valid these will be calibration constants.
-        
-        // Calibration constants are loaded on program startup (and will not change)
-        // so no reason to call calibration_load_bno055 again
-        uint8_t buf[15];
-        buf[0] = calibration_bno055.valid ? 1 : 0;
-        conversions_int16_to_data(calibration_bno055.accel_offset_x, &buf[1], true);
-        conversions_int16_to_data(calibration_bno055.accel_offset_y, &buf[3], true);
-        conversions_int16_to_data(calibration_bno055.accel_offset_z, &buf[5], true);
-        conversions_int16_to_data(calibration_bno055.accel_radius, &buf[7], true);
-        conversions_int16_to_data(calibration_bno055.gyro_offset_x, &buf[9], true);
-        conversions_int16_to_data(calibration_bno055.gyro_offset_y, &buf[11], true);
-        conversions_int16_to_data(calibration_bno055.gyro_offset_z, &buf[13], true);
-        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, buf, 15);
-    }else if(message_equals_str(msg, len, "SCBNO055E")){
-        // S, C, B, N, O, 0, 5, 5, E
-        // Erase stored calibration constants for BNO055
-        // Then reset the sensor (so it loosed the ones programmed earlier)
-        calibration_erase_bno055();
-        if(imu_get_sensor() == IMU_BNO055)
-            bno055_configure();   // This will reset the sensor as a part of configuration process
+    mc_pid_tune_t tune = {
+        .kp = conversions_data_to_float(&args[1], true),
+        .ki = conversions_data_to_float(&args[5], true),
+        .kd = conversions_data_to_float(&args[9], true),
+        .kf = 0.0f,
+        .limit = conversions_data_to_float(&args[13], true),
+        .invert = args[17],
+        .d_filter = 0.0f,
+        .d_on_meas = false
+    };
+    if(len == 27){
+        tune.kf = conversions_data_to_float(&args[18], true);
+        tune.d_filter = conversions_data_to_float(&args[22], true);
+        tune.d_on_meas = args[26];
+    }
+    if(!isfinite(tune.kp) || !isfinite(tune.ki) || !isfinite(tune.kd) || !isfinite(tune.kf) ||
+            !isfinite(tune.limit) || !isfinite(tune.d_filter) || tune.d_filter < 0.0f){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+    if(tune.kf != 0.0f && (args[0] == 'X' || args[0] == 'Y' || args[0] == 'Z')){
+        // Rotation PIDs have no feed-forward input
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+
+    // PIDs are used by the control loop
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    switch(args[0]){
+    case 'X':
+        mc_sassist_tune_xrot(tune);
+        break;
+    case 'Y':
+        mc_sassist_tune_yrot(tune);
+        break;
+    case 'Z':
+        mc_sassist_tune_zrot(tune);
+        break;
+    case 'D':
+        mc_sassist_tune_depth(tune);
+        break;
+    case 'x':
+        mc_sassist_tune_xrate(tune);
+        break;
+    case 'y':
+        mc_sassist_tune_yrate(tune);
+        break;
+    case 'z':
+        mc_sassist_tune_zrate(tune);
+        break;
+    }
+    xSemaphoreGive(target_mutex);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_alloc(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Thrust allocation method set command
+    // A, L, L, O, C, [method]
+    // method = 0 (DoF matrix) or 1 (pseudo-inverse) (single byte)
+
+    if(args[0] > MC_ALLOC_PINV){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+
+    // Allocation method is used by the control loop
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    mc_set_alloc((mc_alloc_t)args[0]);
+    xSemaphoreGive(target_mutex);
+
+    // Need to re-apply speeds if allocation method changes
+    cmdctrl_apply_speed();
+
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_ctrlrate(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Control loop rate set command
+    // C, T, R, L, R, A, T, E, [rate]
+    // [rate] is a 16-bit unsigned integer (little endian) in Hz
+    // Period is rounded to a whole number of ms
+
+    uint16_t rate = conversions_data_to_int16(&args[0], true);
+    if(rate < CONTROL_RATE_MIN || rate > CONTROL_RATE_MAX){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+
+    // Used by control task starting with next iteration
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    control_rate = rate;
+    control_stats_reset = true;
+    xSemaphoreGive(target_mutex);
+
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_ctrlsync(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Control loop IMU synchronization set command
+    // C, T, R, L, S, Y, N, C, [enable]
+    // [enable] 1 = run control loop each time there is a new IMU sample
+    //          0 = run control loop at fixed rate (see CTRLRATE)
+
+    if(args[0] > 1){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+
+    // Used by control task starting with next iteration
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    control_imu_sync = args[0];
+    control_stats_reset = true;
+    xSemaphoreGive(target_mutex);
+
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_casc(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Cascaded attitude control set command
+    // C, A, S, C, [xrot], [yrot], [zrot]
+    // Each is a single byte 1 = cascaded control (angle PID then rate PID) for the axis
+    //                       0 = single loop control (angle PID only)
+
+    if(args[0] > 1 || args[1] > 1 || args[2] > 1){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+
+    // PIDs are used by the control loop
+    xSemaphoreTake(target_mutex, portMAX_DELAY);
+    mc_set_cascade(args[0], args[1], args[2]);
+    xSemaphoreGive(target_mutex);
+
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+// Sensor data commands / queries
+// -----------------------------------------------------------------------------------------------------------------
+
+static void cmdctrl_handle_sstat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Sensor status query
+    // S, S, T, A, T
+    // ACK contains data in the following format [imu_status],[depth_status]
+    // each [sensor_status] is an 8-bit int where each bit indicates if a sensor in use. 
+    // A value of 0 indicates no sensor. Any non-zero value indicates a specific IMU or depth sensor is available
+
+    uint8_t response[2];
+    response[0] = imu_get_sensor();
+    response[1] = depth_get_sensor();
+
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 2);
+}
+
+static void cmdctrl_handle_imur(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // One-shot read of IMU data
+    // I, M, U, R
+    // Response contains [quat_w], [quat_x], [quat_y], [quat_z], [accum_pitch], [accum_roll], [accum_yaw]
+    // where each value is a 32-bit float little endian
+
+    if(imu_get_sensor() == IMU_NONE){
+        // Sensor not ready. This command is not valid right now.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        // Store current readings
+        imu_data_t dat = imu_get_data();
+
+        // Construct response data
+        uint8_t response_data[28];
+        conversions_float_to_data(dat.quat.w, &response_data[0], true);
+        conversions_float_to_data(dat.quat.x, &response_data[4], true);
+        conversions_float_to_data(dat.quat.y, &response_data[8], true);
+        conversions_float_to_data(dat.quat.z, &response_data[12], true);
+        conversions_float_to_data(dat.accum_angles.pitch, &response_data[16], true);
+        conversions_float_to_data(dat.accum_angles.roll, &response_data[20], true);
+        conversions_float_to_data(dat.accum_angles.yaw, &response_data[24], true);
+
+        // Send ack with response data
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response_data, 28);
+    }
+}
+
+static void cmdctrl_handle_imuw(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Read IMU RAW data
+    // I, M, U, W
+    // Response contains [accel_x], [accel_y], [accel_z], [gyro_x], [gyro_y], [gyro_z]
+    // where each value is a 32-bit float little endian
+
+    if(imu_get_sensor() == IMU_NONE){
+        // Sensor not ready. This command is not valid right now.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        // Store current readings
+        imu_data_t data = imu_get_data();
+
+        // Construct response data
+        uint8_t response_data[24];
+        conversions_float_to_data(data.raw_accel.x, &response_data[0], true);
+        conversions_float_to_data(data.raw_accel.y, &response_data[4], true);
+        conversions_float_to_data(data.raw_accel.z, &response_data[8], true);
+        conversions_float_to_data(data.raw_gyro.x, &response_data[12], true);
+        conversions_float_to_data(data.raw_gyro.y, &response_data[16], true);
+        conversions_float_to_data(data.raw_gyro.z, &response_data[20], true);
+
+        // Send ack with response data
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response_data, 24);
+    }
+}
+
+static void cmdctrl_handle_imup(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // IMU periodic read configure
+    // I, M, U, P, [enable]
+    // [enable] is 1 or 0 (8-bit int) 1 = true (periodic read enabled). 0 = false (not enabled)
+
+    periodic_imu = args[0];
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_depthr(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // One-shot read of BNO055 data (all data)
+    // D, E, P, T, H, R
+    // Response contains [depth_m], [pressure], [temp]
+    // where each value is a 32-bit float little endian
+
+    if(depth_get_sensor() == DEPTH_NONE){
+        // Sensor not ready. This command is not valid right now.
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        // Store current readings
+        depth_data_t dat = depth_get_data();
+
+        // Construct response data
+        uint8_t response_data[12];
+        conversions_float_to_data(dat.depth_m, &response_data[0], true);
+        conversions_float_to_data(dat.pressure_pa, &response_data[4], true);
+        conversions_float_to_data(dat.temperature_c, &response_data[8], true);
+
+        // Send ack with response data
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response_data, 12);
+    }
+}
+
+static void cmdctrl_handle_depthp(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // MS5837 periodic read configure
+    // D, E, P, T, H, P, [enable]
+    // [enable] is 1 or 0 (8-bit int) 1 = true (periodic read enabled). 0 = false (not enabled)
+
+    periodic_depth = args[0];
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_depthstat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // D, E, P, T, H, S, T, A, T
+    // Depth sensor status query
+    // ACK contains [rate], [samples]
+    // rate: Achieved sample rate (Hz) as a little endian 32-bit float (zero if no recent samples)
+    // samples: Samples read since startup as a little endian unsigned 32-bit integer
+
+    uint8_t response[8];
+    conversions_float_to_data(depth_get_sample_rate(), &response[0], true);
+    conversions_int32_to_data(depth_get_data().seq, &response[4], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 8);
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+// BNO055 commands / queries
+// -----------------------------------------------------------------------------------------------------------------
+
+static void cmdctrl_handle_bno055a(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // BNO055 Axis config command: sets axis remap for BNO055 IMU
+    // B, N, O, 0, 5, 5, A, [mode]
+    // [mode] is a single byte with value 0-7 for BNO055 axis config P0 to P7
+    // Modes are described in sensor's datasheet
+
+    if(args[0] > 7){
+        // Invalid mode
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+    }else{
+        // Valid mode. Set it.
+        bno055_set_axis(args[0]);
         cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-    }else if(message_starts_with_str(msg, len, "SCBNO055S")){
-        // S, C, B, N, O, 0, 5, 5, S, [accel_offset_x], [accel_offset_y], [accel_offset_z], [accel_radius], [gyro_offset_x], [gyro_offset_y], [gyro_offset_z]
-        // Write stored calibration constants for BNO055
-        // All values are 16-bit little endian integers (calibration values)
-        if(len != 23){
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            bno055_cal_t new_cal;
-            new_cal.accel_offset_x = conversions_data_to_int16(&msg[9], true);
-            new_cal.accel_offset_y = conversions_data_to_int16(&msg[11], true);
-            new_cal.accel_offset_z = conversions_data_to_int16(&msg[13], true);
-            new_cal.accel_radius = conversions_data_to_int16(&msg[15], true);
-            new_cal.gyro_offset_x = conversions_data_to_int16(&msg[17], true);
-            new_cal.gyro_offset_y = conversions_data_to_int16(&msg[19], true);
-            new_cal.gyro_offset_z = conversions_data_to_int16(&msg[21], true);
-            calibration_store_bno055(new_cal);
-            if(imu_get_sensor() == IMU_BNO055)
-                bno055_configure();     // Reconfigure bno055 will reset the sensor and apply the stored calibration
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
-    }else if(message_equals_str(msg, len, "BNO055CS")){
-        // Get current BNO055 calibration status (from the sensor itself)
-        // ACK will contain the following
-        // [status] an 8-bit integer with the value of the sensor's CALIB_STAT register
-        if(imu_get_sensor() != IMU_BNO055){
-            // Cannot read status if sensor not ready
+    }
+}
+
+static void cmdctrl_handle_scbno055r(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // S, C, B, N, O, 0, 5, 5, R
+    // Read stored calibration constants for BNO055
+    // ACK contains the following data
+    // [valid], [accel_offset_x], [accel_offset_y], [accel_offset_z], [accel_radius], [gyro_offset_x], [gyro_offset_y], [gyro_offset_z]
+    // Valid is a single byte. 0 = invalid, 1 = valid data
+    // All other values are 16-bit little endian integers. If data is valid these will be calibration constants.
+
+    // Calibration constants are loaded on program startup (and will not change)
+    // so no reason to call calibration_load_bno055 again
+    uint8_t buf[15];
+    buf[0] = calibration_bno055.valid ? 1 : 0;
+    conversions_int16_to_data(calibration_bno055.accel_offset_x, &buf[1], true);
+    conversions_int16_to_data(calibration_bno055.accel_offset_y, &buf[3], true);
+    conversions_int16_to_data(calibration_bno055.accel_offset_z, &buf[5], true);
+    conversions_int16_to_data(calibration_bno055.accel_radius, &buf[7], true);
+    conversions_int16_to_data(calibration_bno055.gyro_offset_x, &buf[9], true);
+    conversions_int16_to_data(calibration_bno055.gyro_offset_y, &buf[11], true);
+    conversions_int16_to_data(calibration_bno055.gyro_offset_z, &buf[13], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, buf, 15);
+}
+
+static void cmdctrl_handle_scbno055e(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // S, C, B, N, O, 0, 5, 5, E
+    // Erase stored calibration constants for BNO055
+    // Then reset the sensor (so it loosed the ones programmed earlier)
+
+    calibration_erase_bno055();
+    if(imu_get_sensor() == IMU_BNO055)
+        bno055_configure();   // This will reset the sensor as a part of configuration process
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_scbno055s(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // S, C, B, N, O, 0, 5, 5, S, [accel_offset_x], [accel_offset_y], [accel_offset_z], [accel_radius], [gyro_offset_x], [gyro_offset_y], [gyro_offset_z]
+    // Write stored calibration constants for BNO055
+    // All values are 16-bit little endian integers (calibration values)
+
+    bno055_cal_t new_cal;
+    new_cal.accel_offset_x = conversions_data_to_int16(&args[0], true);
+    new_cal.accel_offset_y = conversions_data_to_int16(&args[2], true);
+    new_cal.accel_offset_z = conversions_data_to_int16(&args[4], true);
+    new_cal.accel_radius = conversions_data_to_int16(&args[6], true);
+    new_cal.gyro_offset_x = conversions_data_to_int16(&args[8], true);
+    new_cal.gyro_offset_y = conversions_data_to_int16(&args[10], true);
+    new_cal.gyro_offset_z = conversions_data_to_int16(&args[12], true);
+    calibration_store_bno055(new_cal);
+    if(imu_get_sensor() == IMU_BNO055)
+        bno055_configure();     // Reconfigure bno055 will reset the sensor and apply the stored calibration
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_bno055cs(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Get current BNO055 calibration status (from the sensor itself)
+    // ACK will contain the following
+    // [status] an 8-bit integer with the value of the sensor's CALIB_STAT register
+
+    if(imu_get_sensor() != IMU_BNO055){
+        // Cannot read status if sensor not ready
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        uint8_t status;
+        bool res = bno055_read_calibration_status(&status);
+        if(!res){
+            // If this fails, sensor is probably not connected anymore
             cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
         }else{
-            uint8_t status;
-            bool res = bno055_read_calibration_status(&status);
-            if(!res){
-                // If this fails, sensor is probably not connected anymore
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, &status, 1);
-            }
+            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, &status, 1);
         }
-    }else if(message_equals_str(msg, len, "BNO055CV")){
-        // Get current BNO055 calibration values (from the sensor itself)
-        // ACK will contain the following
-        // [accel_offset_x], [accel_offset_y], [accel_offset_z], [accel_radius], [gyro_offset_x], [gyro_offset_y], [gyro_offset_z]
-        //All are little endian 16-bit integers (signed)
-        
-        if(imu_get_sensor() != IMU_BNO055){
-            // Cannot read status if sensor not ready
+    }
+}
+
+static void cmdctrl_handle_bno055cv(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Get current BNO055 calibration values (from the sensor itself)
+    // ACK will contain the following
+    // [accel_offset_x], [accel_offset_y], [accel_offset_z], [accel_radius], [gyro_offset_x], [gyro_offset_y], [gyro_offset_z]
+    //All are little endian 16-bit integers (signed)
+
+    if(imu_get_sensor() != IMU_BNO055){
+        // Cannot read status if sensor not ready
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        int16_t acc_offset_x, acc_offset_y, acc_offset_z, acc_radius;
+        int16_t gyr_offset_x, gyr_offset_y, gyr_offset_z;
+        bool res = bno055_read_calibration(&acc_offset_x, &acc_offset_y, &acc_offset_z, &acc_radius,
+                &gyr_offset_x, &gyr_offset_y, &gyr_offset_z);
+        if(!res){
+            // If this fails, sensor is probably not connected anymore
             cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
         }else{
-            int16_t acc_offset_x, acc_offset_y, acc_offset_z, acc_radius;
-            int16_t gyr_offset_x, gyr_offset_y, gyr_offset_z;
-            bool res = bno055_read_calibration(&acc_offset_x, &acc_offset_y, &acc_offset_z, &acc_radius,
-                    &gyr_offset_x, &gyr_offset_y, &gyr_offset_z);
-            if(!res){
-                // If this fails, sensor is probably not connected anymore
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                uint8_t buf[14];
-                conversions_int16_to_data(acc_offset_x, &buf[0], true);
-                conversions_int16_to_data(acc_offset_y, &buf[2], true);
-                conversions_int16_to_data(acc_offset_z, &buf[4], true);
-                conversions_int16_to_data(acc_radius, &buf[6], true);
-                conversions_int16_to_data(gyr_offset_x, &buf[8], true);
-                conversions_int16_to_data(gyr_offset_y, &buf[10], true);
-                conversions_int16_to_data(gyr_offset_z, &buf[12], true);
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, buf, 14);
-            }
+            uint8_t buf[14];
+            conversions_int16_to_data(acc_offset_x, &buf[0], true);
+            conversions_int16_to_data(acc_offset_y, &buf[2], true);
+            conversions_int16_to_data(acc_offset_z, &buf[4], true);
+            conversions_int16_to_data(acc_radius, &buf[6], true);
+            conversions_int16_to_data(gyr_offset_x, &buf[8], true);
+            conversions_int16_to_data(gyr_offset_y, &buf[10], true);
+            conversions_int16_to_data(gyr_offset_z, &buf[12], true);
+            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, buf, 14);
         }
-    }else if(message_equals_str(msg, len, "BNO055RST")){
-        // B, N, O, 0, 5, 5, R, S, T
-        // BNO055 reset / reconfigure
-        // This is typically used to clear auto generated calibration constants when
-        // no calibration is stored.
-        bno055_configure();
+    }
+}
+
+static void cmdctrl_handle_bno055rst(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // B, N, O, 0, 5, 5, R, S, T
+    // BNO055 reset / reconfigure
+    // This is typically used to clear auto generated calibration constants when
+    // no calibration is stored.
+
+    bno055_configure();
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_bno055burst(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // B, N, O, 0, 5, 5, B, U, R, S, T, [enable]
+    // BNO055 burst read mode set
+    // [enable] 1 = read quaternion, gyro, and accel data in one I2C transaction (default)
+    //          0 = use one I2C transaction for each
+
+    if(args[0] > 1){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+    bno055_set_burst_read(args[0]);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_bno055stat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // B, N, O, 0, 5, 5, S, T, A, T
+    // BNO055 read statistics query
+    // ACK contains [burst], [samples], [transactions], [failures]
+    // burst is a single byte (1 if burst read enabled)
+    // Others are unsigned 32-bit integers (little endian) counted since startup
+    // samples: Successful data reads
+    // transactions: I2C transactions attempted by data reads (including retries)
+    // failures: Failed data reads
+
+    uint32_t samples, transactions, failures;
+    bno055_get_read_stats(&samples, &transactions, &failures);
+
+    uint8_t response[13];
+    response[0] = bno055_get_burst_read() ? 1 : 0;
+    conversions_int32_to_data(samples, &response[1], true);
+    conversions_int32_to_data(transactions, &response[5], true);
+    conversions_int32_to_data(failures, &response[9], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 13);
+}
+
+static void cmdctrl_handle_i2cdev(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // I, 2, C, D, E, V, [address]
+    // I2C device statistics query
+    // ACK contains [breaker_open], [transactions], [failures], [rejected], [retries], [recoveries], [breaker_trips],
+    //     [avg_latency], [max_latency]
+    // breaker_open is a single byte (1 if transactions with the device are currently rejected)
+    // Others are unsigned 32-bit integers (little endian) counted since startup (latency in microseconds)
+    // Acknowledged with INVALID_ARGS if no transactions with the device have been performed
+
+    i2c_device_stats_t stats;
+    if(!i2c_get_device_stats(args[0], &stats)){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+        return;
+    }
+
+    uint8_t response[33];
+    response[0] = stats.breaker_open ? 1 : 0;
+    conversions_int32_to_data(stats.transactions, &response[1], true);
+    conversions_int32_to_data(stats.failures, &response[5], true);
+    conversions_int32_to_data(stats.rejected, &response[9], true);
+    conversions_int32_to_data(stats.retries, &response[13], true);
+    conversions_int32_to_data(stats.recoveries, &response[17], true);
+    conversions_int32_to_data(stats.breaker_trips, &response[21], true);
+    conversions_int32_to_data(stats.avg_latency_us, &response[25], true);
+    conversions_int32_to_data(stats.max_latency_us, &response[29], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 33);
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+// MS5837 commands / queries
+// -----------------------------------------------------------------------------------------------------------------
+
+static void cmdctrl_handle_ms5837calg(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // M, S, 5, 8, 3, 7, C, A, L, G
+    // Read MS5837 calibration
+    // ACK contains [atm_pressure], [fluid_density]
+    // Each is a little endian 32-bit float
+
+    if(depth_get_sensor() != DEPTH_MS5837){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        uint8_t buf[8];
+        conversions_float_to_data(calibration_ms5837.atm_pressure, &buf[0], true);
+        conversions_float_to_data(calibration_ms5837.fluid_density, &buf[4], true);
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, buf, 8);
+    }
+}
+
+static void cmdctrl_handle_ms5837cals(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // M, S, 5, 8, 3, 7, C, A, L, S, [atm_pressure], [fluid_density]
+    // Set MS5837 calibration
+    // Both values are little endian 32-bit floats
+
+    if(depth_get_sensor() != DEPTH_MS5837){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        calibration_ms5837.atm_pressure = conversions_data_to_float(&args[0], true);
+        calibration_ms5837.fluid_density = conversions_data_to_float(&args[4], true);
         cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-    }// -----------------------------------------------------------------------------------------------------------------
-    // -----------------------------------------------------------------------------------------------------------------
-
-    // -----------------------------------------------------------------------------------------------------------------
-    // MS5837 Configuration Commands & Queries
-    // -----------------------------------------------------------------------------------------------------------------
-    else if(message_equals_str(msg, len, "MS5837CALG")){
-        // M, S, 5, 8, 3, 7, C, A, L, G
-        // Read MS5837 calibration
-        // ACK contains [atm_pressure], [fluid_density]
-        // Each is a little endian 32-bit float
-        if(depth_get_sensor() != DEPTH_MS5837){
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-        }else{
-            uint8_t buf[8];
-            conversions_float_to_data(calibration_ms5837.atm_pressure, &buf[0], true);
-            conversions_float_to_data(calibration_ms5837.fluid_density, &buf[4], true);
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, buf, 8);
-        }
-    }else if(message_starts_with_str(msg, len, "MS5837CALS")){
-        // M, S, 5, 8, 3, 7, C, A, L, S, [atm_pressure], [fluid_density]
-        // Set MS5837 calibration
-        // Both values are little endian 32-bit floats
-        if(len != 18){
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            if(depth_get_sensor() != DEPTH_MS5837){
-                cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
-            }else{
-                calibration_ms5837.atm_pressure = conversions_data_to_float(&msg[10], true);
-                calibration_ms5837.fluid_density = conversions_data_to_float(&msg[14], true);
-                cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-            }
-        }
     }
-    // -----------------------------------------------------------------------------------------------------------------
+}
 
+static void cmdctrl_handle_ms5837osr(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // M, S, 5, 8, 3, 7, O, S, R, [pressure_osr], [temperature_osr]
+    // Set MS5837 oversampling ratio for pressure and temperature conversions
+    // Each is an 8-bit int: 0 = 256, 1 = 512, 2 = 1024 (default), 3 = 2048, 4 = 4096, 5 = 8192
+    // Higher OSR has lower noise, but conversions take longer
+
+    if(!ms5837_set_osr(args[0], args[1])){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+    }else{
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+// Misc commands & queries
+// -----------------------------------------------------------------------------------------------------------------
+
+static void cmdctrl_handle_reset(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Reset control board command
+    // R, E, S, E, T, 0x0D, 0x1E
 
-    // -----------------------------------------------------------------------------------------------------------------
-    // Misc commands & queries
-    // -----------------------------------------------------------------------------------------------------------------
-    else if(message_equals(msg, len, (uint8_t[]){'R', 'E', 'S', 'E', 'T', 0x0D, 0x1E}, 7)){
-        // Reset control board command
-        // R, E, S, E, T, 0x0D, 0x1E
 #if defined(CONTROL_BOARD_V1) || defined(CONTROL_BOARD_V2)
-        NVIC_SystemReset();
-        while(1);
+    NVIC_SystemReset();
+    while(1);
 #endif
-        // Not acknowledged. Board resets!
-    }else if(message_equals_str(msg, len, "RSTWHY")){
-        // R, S, T, W, H, Y
-        // ACK contains a 32-bit integer (signed, little endian)
-        // indicating one of the HALT_EC codes in debug.h
-        uint8_t response[4];
-        conversions_int32_to_data(reset_cause, response, true);
-        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 4);
-    }else if(message_starts_with_str(msg, len, "SIMHIJACK")){
-        // S, I, M, H, I, J, A, C, K, [hijack]
-        // [hijack] is an 8-bit int (unsigned) 0 = release, 1 = hijack
-        if(len != 10){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            cmdctrl_simhijack(msg[9]);
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
-    }else if(message_starts_with_str(msg, len, "SIMDAT")){
-        // S, I, M, D, A, T, [w], [x], [y], [z], [depth]
-        // All values are little endian floats (32-bit)
-        // x, y, z, w are current quaternion (BNO055 data)
-        // depth is current depth (MS5837 data)
-        if(len != 26){
-            // Message is incorrect size
-            cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
-        }else{
-            // Parse received data
-            cmdctrl_sim_quat.w = conversions_data_to_float(&msg[6], true);
-            cmdctrl_sim_quat.x = conversions_data_to_float(&msg[10], true);
-            cmdctrl_sim_quat.y = conversions_data_to_float(&msg[14], true);
-            cmdctrl_sim_quat.z = conversions_data_to_float(&msg[18], true);
-            cmdctrl_sim_depth = conversions_data_to_float(&msg[22], true);
-
-            // Message handled successfully
-            cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
-        }
-    }else if(message_equals_str(msg, len, "CBVER")){
-        // Control board version info query
-        // C, B, V, E, R
-        // Responds with
-        // [CB_VER], [FW_MAJOR], [FW_MINOR], [FW_REV], [FW_TYPE], [FW_BUILD]
-        // All values are unsigned 8-bit integers
-        // CB_VER = control board version (v1 or v2 hardware)
-        // FW_MAJOR = Firmware major version
-        // FW_MINOR = Firmware minor version
-        // FW_REV = Firmware revision version
-        // FW_TYPE = Firmware type (ASCII: a = alpha, b = beta, c = release candidate, ' ' = full release)
-        // FW_BUILD = Firmware build version (if type is not ' '). If type is ' ' this will be 0.
-        uint8_t response[6];
-        #if defined(CONTROL_BOARD_V1)
-            response[0] = 1;
-        #elif defined(CONTROL_BOARD_V2)
-            response[0] = 2;
-        #elif defined(CONTROL_BOARD_SIM)
-            response[0] = 0;
-        #else
-            response[0] = 255;
-        #endif
-        response[1] = FW_VER_MAJOR;
-        response[2] = FW_VER_MINOR;
-        response[3] = FW_VER_REVISION;
-        response[4] = FW_VER_TYPE;
-        response[5] = (FW_VER_TYPE == ' ') ? 0 : FW_VER_BUILD;
-        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 6);
+    // Not acknowledged. Board resets!
+}
+
+static void cmdctrl_handle_rstwhy(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // R, S, T, W, H, Y
+    // ACK contains a 32-bit integer (signed, little endian)
+    // indicating one of the HALT_EC codes in debug.h
+
+    uint8_t response[4];
+    conversions_int32_to_data(reset_cause, response, true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 4);
+}
+
+static void cmdctrl_handle_simhijack(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // S, I, M, H, I, J, A, C, K, [hijack]
+    // [hijack] is an 8-bit int (unsigned) 0 = release, 1 = hijack
+
+    cmdctrl_simhijack(args[0]);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_simdat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // S, I, M, D, A, T, [w], [x], [y], [z], [depth]
+    // All values are little endian floats (32-bit)
+    // x, y, z, w are current quaternion (BNO055 data)
+    // depth is current depth (MS5837 data)
+
+    // Parse received data
+    cmdctrl_sim_quat.w = conversions_data_to_float(&args[0], true);
+    cmdctrl_sim_quat.x = conversions_data_to_float(&args[4], true);
+    cmdctrl_sim_quat.y = conversions_data_to_float(&args[8], true);
+    cmdctrl_sim_quat.z = conversions_data_to_float(&args[12], true);
+    cmdctrl_sim_depth = conversions_data_to_float(&args[16], true);
+
+    // Message handled successfully
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_cbver(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Control board version info query
+    // C, B, V, E, R
+    // Responds with
+    // [CB_VER], [FW_MAJOR], [FW_MINOR], [FW_REV], [FW_TYPE], [FW_BUILD]
+    // All values are unsigned 8-bit integers
+    // CB_VER = control board version (v1 or v2 hardware)
+    // FW_MAJOR = Firmware major version
+    // FW_MINOR = Firmware minor version
+    // FW_REV = Firmware revision version
+    // FW_TYPE = Firmware type (ASCII: a = alpha, b = beta, c = release candidate, ' ' = full release)
+    // FW_BUILD = Firmware build version (if type is not ' '). If type is ' ' this will be 0.
+
+    uint8_t response[6];
+    #if defined(CONTROL_BOARD_V1)
+        response[0] = 1;
+    #elif defined(CONTROL_BOARD_V2)
+        response[0] = 2;
+    #elif defined(CONTROL_BOARD_SIM)
+        response[0] = 0;
+    #else
+        response[0] = 255;
+    #endif
+    response[1] = FW_VER_MAJOR;
+    response[2] = FW_VER_MINOR;
+    response[3] = FW_VER_REVISION;
+    response[4] = FW_VER_TYPE;
+    response[5] = (FW_VER_TYPE == ' ') ? 0 : FW_VER_BUILD;
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 6);
+}
+
+static void cmdctrl_handle_compact(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Compact protocol select command
+    // C, O, M, P, A, C, T, [enable]
+    // [enable] is an 8-bit int (unsigned) 1 = compact (opcodes), 0 = legacy (names)
+    // Selects format of status messages sent to the PC (IMUD, DEPTHD, WDGS, HEARTBEAT)
+    // Messages from the PC may use either format at any time
+    cmdctrl_set_compact(args[0]);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
+}
+
+static void cmdctrl_handle_pcstat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // PC communication statistics query
+    // P, C, S, T, A, T
+    // Responds with
+    // [rx_msgs], [rx_invalid], [rx_truncated], [rx_queue_full], [rx_queue_max], [tx_dropped]
+    // All values are unsigned 32-bit integers (little endian)
+    // See pccomm_stats_t in pccomm.h for meanings
+
+    uint8_t response[24];
+    conversions_int32_to_data(pccomm_stats.rx_msgs, &response[0], true);
+    conversions_int32_to_data(pccomm_stats.rx_invalid, &response[4], true);
+    conversions_int32_to_data(pccomm_stats.rx_truncated, &response[8], true);
+    conversions_int32_to_data(pccomm_stats.rx_queue_full, &response[12], true);
+    conversions_int32_to_data(pccomm_stats.rx_queue_max, &response[16], true);
+    conversions_int32_to_data(pccomm_stats.tx_dropped, &response[20], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 24);
+}
+
+static void cmdctrl_handle_heapstat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Heap statistics query
+    // H, E, A, P, S, T, A, T
+    // Responds with
+    // [free], [min_free], [allocs], [frees]
+    // All values are unsigned 32-bit integers (little endian)
+    // free: Bytes currently free in FreeRTOS heap
+    // min_free: Fewest bytes that have been free in FreeRTOS heap since boot
+    // allocs: Number of successful allocations since boot
+    // frees: Number of successful frees since boot
+    // allocs and frees should not change while the board is operating normally (no dynamic allocations)
+
+    HeapStats_t heap_stats;
+    vPortGetHeapStats(&heap_stats);
+    uint8_t response[16];
+    conversions_int32_to_data(heap_stats.xAvailableHeapSpaceInBytes, &response[0], true);
+    conversions_int32_to_data(heap_stats.xMinimumEverFreeBytesRemaining, &response[4], true);
+    conversions_int32_to_data(heap_stats.xNumberOfSuccessfulAllocations, &response[8], true);
+    conversions_int32_to_data(heap_stats.xNumberOfSuccessfulFrees, &response[12], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 16);
+}
+
+static void cmdctrl_handle_ctrlstat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // Control loop statistics query
+    // C, T, R, L, S, T, A, T
+    // Responds with
+    // [period], [ticks], [overruns], [max_jitter], [avg_jitter], [max_exec],
+    //     [imu_stale], [imu_skipped], [depth_stale], [depth_skipped], [imu_retries], [depth_retries]
+    // All values are unsigned 32-bit integers (little endian)
+    // period: Nominal control loop period (us; 0 if synchronized to IMU samples)
+    // ticks: Control loop iterations since rate / sync was last set (or boot)
+    // overruns: Iterations that started late (missed deadline)
+    // max_jitter, avg_jitter: Max / average difference between actual and nominal period (us)
+    // max_exec: Max time to apply speeds in one iteration (us)
+    // imu_stale, depth_stale: Iterations that reused a sample already used by a previous iteration
+    // imu_skipped, depth_skipped: Samples never used by the control loop
+    // imu_retries, depth_retries: Sensor data reads retried due to concurrent publish (since boot; not reset)
+
+    // Copy (statistics are modified by the control task)
+    uint32_t ticks = control_ticks;
+    uint64_t jitter_sum = control_jitter_sum;
+    uint32_t avg_jitter = (ticks > 1) ? (uint32_t)(jitter_sum / (ticks - 1)) : 0;
+
+    uint8_t response[48];
+    // Settings are only written by this task (no need to lock)
+    uint32_t period_us = control_imu_sync ? 0 : cmdctrl_rate_to_period_ms(control_rate) * 1000;
+    conversions_int32_to_data(period_us, &response[0], true);
+    conversions_int32_to_data(ticks, &response[4], true);
+    conversions_int32_to_data(control_overruns, &response[8], true);
+    conversions_int32_to_data(control_max_jitter, &response[12], true);
+    conversions_int32_to_data(avg_jitter, &response[16], true);
+    conversions_int32_to_data(control_max_exec, &response[20], true);
+    conversions_int32_to_data(control_imu_stale, &response[24], true);
+    conversions_int32_to_data(control_imu_skipped, &response[28], true);
+    conversions_int32_to_data(control_depth_stale, &response[32], true);
+    conversions_int32_to_data(control_depth_skipped, &response[36], true);
+    conversions_int32_to_data(imu_get_read_retries(), &response[40], true);
+    conversions_int32_to_data(depth_get_read_retries(), &response[44], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 48);
+}
+
+static void cmdctrl_handle_i2cdma(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // I, 2, C, D, M, A, [enable]
+    // Select I2C transfer mode
+    // [enable] 1 = use DMA for data transfers, 0 = interrupt per byte (default)
+    // Only supported on v2. Other boards acknowledge enable with INVALID_CMD.
+
+    if(args[0] > 1){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+    }else if(!i2c_set_dma(args[0])){
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    }else{
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, NULL, 0);
     }
-    // -----------------------------------------------------------------------------------------------------------------
+}
+
+static void cmdctrl_handle_i2cstat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // I, 2, C, S, T, A, T
+    // I2C statistics query
+    // ACK contains [dma], [transactions], [isr_count], [isr_time]
+    // dma is a single byte (1 if DMA transfers enabled)
+    // Others are unsigned 32-bit integers (little endian) counted since startup
+    // transactions: Transactions performed (including failed)
+    // isr_count: I2C (and I2C DMA) interrupts handled
+    // isr_time: Time spent in I2C (and I2C DMA) interrupt handlers (microseconds)
+
+    uint32_t isr_count, isr_time;
+    i2c_get_isr_stats(&isr_count, &isr_time);
+
+    uint8_t response[13];
+    response[0] = i2c_get_dma() ? 1 : 0;
+    conversions_int32_to_data(i2c_get_transaction_count(), &response[1], true);
+    conversions_int32_to_data(isr_count, &response[5], true);
+    conversions_int32_to_data(isr_time, &response[9], true);
+    cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 13);
+}
+
+static void cmdctrl_handle_simiostat(uint16_t msg_id, uint8_t *args, unsigned int len){
+    // S, I, M, I, O, S, T, A, T
+    // SimCB socket I/O statistics query
+    // ACK contains [rx_syscalls], [rx_bytes], [rx_irqs], [tx_syscalls], [tx_bytes]
+    // All are unsigned 32-bit integers (little endian) counted since startup
+    // rx_syscalls: System calls made to wait for and read data from the socket
+    // rx_bytes: Bytes read from the socket
+    // rx_irqs: Simulated interrupts for received data
+    // tx_syscalls: System calls made to send data to the socket
+    // tx_bytes: Bytes sent to the socket
+    // Only supported by SimCB. Other boards acknowledge with INVALID_CMD.
+
+    #if defined(CONTROL_BOARD_SIM)
+        usb_sim_stats_t stats;
+        usb_sim_get_stats(&stats);
+
+        uint8_t response[20];
+        conversions_int32_to_data(stats.rx_syscalls, &response[0], true);
+        conversions_int32_to_data(stats.rx_bytes, &response[4], true);
+        conversions_int32_to_data(stats.rx_irqs, &response[8], true);
+        conversions_int32_to_data(stats.tx_syscalls, &response[12], true);
+        conversions_int32_to_data(stats.tx_bytes, &response[16], true);
+        cmdctrl_acknowledge(msg_id, ACK_ERR_NONE, response, 20);
+    #else
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_CMD, NULL, 0);
+    #endif
+}
 
 
-    else{
-        // This is an unrecognized message
-        cmdctrl_acknowledge(msg_id, ACK_ERR_UNKNOWN_MSG, NULL, 0);
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Message dispatch
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Handler for a message (args and len are the arguments after the name or opcode)
+typedef void (*cmdctrl_handler_t)(uint16_t msg_id, uint8_t *args, unsigned int len);
+
+// Entry in message dispatch table
+typedef struct {
+    const char *name;               // Message name (prefix identifying the message)
+    unsigned int name_len;          // Length of name
+    int len;                        // Expected message length (including name) or CMD_LEN_*
+    uint8_t opcode;                 // Compact protocol opcode (replaces name) or CMD_OP_NONE
+    cmdctrl_handler_t handler;      // Function to handle the message
+} cmdctrl_cmd_t;
+
+// Message length is not checked during dispatch
+#define CMD_LEN_ANY                 -1
+
+// Message must be exactly the name (no arguments). Otherwise, it is not recognized.
+#define CMD_LEN_NAME                -2
+
+// Message has no compact protocol opcode (must be sent with its name)
+#define CMD_OP_NONE                 0
+
+// Compact protocol opcodes are in range [CMD_OP_FIRST, 252]
+// This range is never the first byte of a name and does not need to be escaped
+#define CMD_OP_FIRST                0x80
+#define CMD_OP_LAST                 252
+
+#define CMD(name, len, op, handler) { (name), sizeof(name) - 1, (len), (op), (handler) }
+
+// Handlers for each message
+static const cmdctrl_cmd_t cmdctrl_cmds[] = {
+    // Motor motion commands
+    CMD("RAW",            35,            0x80,         cmdctrl_handle_raw),
+    CMD("LOCAL",          29,            0x81,         cmdctrl_handle_local),
+    CMD("GLOBAL",         30,            0x82,         cmdctrl_handle_global),
+    CMD("SASSIST1",       32,            0x83,         cmdctrl_handle_sassist1),
+    CMD("SASSIST2",       32,            0x84,         cmdctrl_handle_sassist2),
+    CMD("OHOLD1",         30,            0x85,         cmdctrl_handle_ohold1),
+    CMD("OHOLD2",         30,            0x86,         cmdctrl_handle_ohold2),
+    CMD("WDGF",           CMD_LEN_NAME,  0x87,         cmdctrl_handle_wdgf),
+
+    // Vehicle configuration commands
+    CMD("TPWM",           10,            0x90,         cmdctrl_handle_tpwm),
+    CMD("TINV",           5,             0x91,         cmdctrl_handle_tinv),
+    CMD("RELDOF",         30,            0x92,         cmdctrl_handle_reldof),
+    CMD("MMATS",          30,            0x93,         cmdctrl_handle_mmats),
+    CMD("MMATU",          CMD_LEN_ANY,   0x94,         cmdctrl_handle_mmatu),
+    CMD("PIDTN",          CMD_LEN_ANY,   0x95,         cmdctrl_handle_pidtn),
+    CMD("ALLOC",          6,             0x96,         cmdctrl_handle_alloc),
+    CMD("CTRLRATE",       10,            0x97,         cmdctrl_handle_ctrlrate),
+    CMD("CTRLSYNC",       9,             0x98,         cmdctrl_handle_ctrlsync),
+    CMD("CASC",           7,             0x99,         cmdctrl_handle_casc),
+
+    // Sensor data commands / queries
+    CMD("SSTAT",          CMD_LEN_NAME,  0xA0,         cmdctrl_handle_sstat),
+    CMD("IMUR",           CMD_LEN_NAME,  0xA1,         cmdctrl_handle_imur),
+    CMD("IMUW",           CMD_LEN_NAME,  0xA2,         cmdctrl_handle_imuw),
+    CMD("IMUP",           5,             0xA3,         cmdctrl_handle_imup),
+    CMD("DEPTHR",         CMD_LEN_NAME,  0xA4,         cmdctrl_handle_depthr),
+    CMD("DEPTHP",         7,             0xA5,         cmdctrl_handle_depthp),
+    CMD("DEPTHSTAT",      CMD_LEN_NAME,  0xA6,         cmdctrl_handle_depthstat),
+
+    // BNO055 commands / queries
+    CMD("BNO055A",        8,             0xB0,         cmdctrl_handle_bno055a),
+    CMD("SCBNO055R",      CMD_LEN_NAME,  0xB1,         cmdctrl_handle_scbno055r),
+    CMD("SCBNO055E",      CMD_LEN_NAME,  0xB2,         cmdctrl_handle_scbno055e),
+    CMD("SCBNO055S",      23,            0xB3,         cmdctrl_handle_scbno055s),
+    CMD("BNO055CS",       CMD_LEN_NAME,  0xB4,         cmdctrl_handle_bno055cs),
+    CMD("BNO055CV",       CMD_LEN_NAME,  0xB5,         cmdctrl_handle_bno055cv),
+    CMD("BNO055RST",      CMD_LEN_NAME,  0xB6,         cmdctrl_handle_bno055rst),
+    CMD("BNO055BURST",    12,            0xB7,         cmdctrl_handle_bno055burst),
+    CMD("BNO055STAT",     CMD_LEN_NAME,  0xB8,         cmdctrl_handle_bno055stat),
+
+    // MS5837 commands / queries
+    CMD("MS5837CALG",     CMD_LEN_NAME,  0xC0,         cmdctrl_handle_ms5837calg),
+    CMD("MS5837CALS",     18,            0xC1,         cmdctrl_handle_ms5837cals),
+    CMD("MS5837OSR",      11,            0xC2,         cmdctrl_handle_ms5837osr),
+
+    // Misc commands & queries
+    CMD("RESET\x0D\x1E",  CMD_LEN_NAME,  CMD_OP_NONE,  cmdctrl_handle_reset),
+    CMD("RSTWHY",         CMD_LEN_NAME,  0xD0,         cmdctrl_handle_rstwhy),
+    CMD("SIMHIJACK",      10,            0xD1,         cmdctrl_handle_simhijack),
+    CMD("SIMDAT",         26,            0xD2,         cmdctrl_handle_simdat),
+    CMD("CBVER",          CMD_LEN_NAME,  0xD3,         cmdctrl_handle_cbver),
+    CMD("PCSTAT",         CMD_LEN_NAME,  0xD4,         cmdctrl_handle_pcstat),
+    CMD("COMPACT",        8,             0xD5,         cmdctrl_handle_compact),
+    CMD("HEAPSTAT",       CMD_LEN_NAME,  0xD6,         cmdctrl_handle_heapstat),
+    CMD("CTRLSTAT",       CMD_LEN_NAME,  0xD7,         cmdctrl_handle_ctrlstat),
+    CMD("I2CDMA",         7,             0xD8,         cmdctrl_handle_i2cdma),
+    CMD("I2CSTAT",        CMD_LEN_NAME,  0xD9,         cmdctrl_handle_i2cstat),
+    CMD("I2CDEV",         7,             0xDA,         cmdctrl_handle_i2cdev),
+    CMD("SIMIOSTAT",      CMD_LEN_NAME,  0xDB,         cmdctrl_handle_simiostat),
+};
+
+#define CMD_COUNT           (sizeof(cmdctrl_cmds) / sizeof(cmdctrl_cmds[0]))
+
+// Messages are looked up using a hash of their first CMD_MIN_NAME_LEN bytes
+// Each bucket holds a chain of indices into cmdctrl_cmds (built by cmdctrl_build_dispatch)
+#define CMD_MIN_NAME_LEN    3
+#define CMD_BUCKETS         64
+#define CMD_HASH(m)         ((((unsigned int)(m)[0] * 31 + (m)[1]) * 31 + (m)[2]) % CMD_BUCKETS)
+#define CMD_NONE            0xFF        // End of chain (so there can be at most 255 messages)
+
+static uint8_t cmd_bucket_head[CMD_BUCKETS];
+static uint8_t cmd_next[CMD_COUNT];
+
+// Index into cmdctrl_cmds for each compact protocol opcode (indexed by opcode - CMD_OP_FIRST)
+static uint8_t cmd_by_opcode[CMD_OP_LAST - CMD_OP_FIRST + 1];
+
+static void cmdctrl_build_dispatch(void){
+    for(unsigned int i = 0; i < CMD_BUCKETS; ++i)
+        cmd_bucket_head[i] = CMD_NONE;
+    for(unsigned int i = 0; i < sizeof(cmd_by_opcode); ++i)
+        cmd_by_opcode[i] = CMD_NONE;
+
+    // Insert in reverse so each chain is in table order
+    for(unsigned int i = CMD_COUNT; i > 0; --i){
+        unsigned int h = CMD_HASH((const uint8_t*)cmdctrl_cmds[i - 1].name);
+        cmd_next[i - 1] = cmd_bucket_head[h];
+        cmd_bucket_head[h] = i - 1;
+
+        if(cmdctrl_cmds[i - 1].opcode != CMD_OP_NONE)
+            cmd_by_opcode[cmdctrl_cmds[i - 1].opcode - CMD_OP_FIRST] = i - 1;
     }
 }
 
+/**
+ * Check message length and call the handler for a message
+ * Named and compact messages are handled the same way (handlers only get the arguments)
+ * @param cmd Table entry for the message
+ * @param msg_id ID of the message
+ * @param args Message arguments (after name or opcode)
+ * @param args_len Length of arguments
+ * @return true if handled (or acknowledged as invalid). False if message does not match cmd.
+ */
+static bool cmdctrl_dispatch(const cmdctrl_cmd_t *cmd, uint16_t msg_id, uint8_t *args, unsigned int args_len){
+    if(cmd->len == CMD_LEN_NAME && args_len != 0){
+        // Not this message (message must be exactly the name)
+        return false;
+    }else if(cmd->len >= 0 && cmd->name_len + args_len != (unsigned int)cmd->len){
+        // Message is incorrect size (table length includes name)
+        cmdctrl_acknowledge(msg_id, ACK_ERR_INVALID_ARGS, NULL, 0);
+    }else{
+        cmd->handler(msg_id, args, args_len);
+    }
+    return true;
+}
+
+void cmdctrl_handle_message(void){
+    // Skip first 2 bytes of pccomm_read_buf (these are message ID)
+    // Also skip last 2 bytes (these are CRC)
+    uint8_t *msg = &pccomm_read_buf[2];
+    unsigned int len = pccomm_read_len - 4;
+
+    // msg_id is first two bytes (unsigned 16-bit int big endian)
+    uint16_t msg_id = conversions_data_to_int16(pccomm_read_buf, false);
+
+    msg_compact = (len >= 1 && msg[0] >= CMD_OP_FIRST && msg[0] <= CMD_OP_LAST);
+    if(msg_compact){
+        // Compact protocol message. Opcode replaces name.
+        uint8_t i = cmd_by_opcode[msg[0] - CMD_OP_FIRST];
+        if(i != CMD_NONE && cmdctrl_dispatch(&cmdctrl_cmds[i], msg_id, &msg[1], len - 1))
+            return;
+    }else if(len >= CMD_MIN_NAME_LEN){
+        // Named message
+        uint8_t i = cmd_bucket_head[CMD_HASH(msg)];
+        while(i != CMD_NONE){
+            const cmdctrl_cmd_t *cmd = &cmdctrl_cmds[i];
+            if(len >= cmd->name_len && memcmp(msg, cmd->name, cmd->name_len) == 0){
+                if(cmdctrl_dispatch(cmd, msg_id, &msg[cmd->name_len], len - cmd->name_len))
+                    return;
+            }
+            i = cmd_next[i];
+        }
+    }
+
+    // This is an unrecognized message
+    cmdctrl_acknowledge(msg_id, ACK_ERR_UNKNOWN_MSG, NULL, 0);
+}
+
 void cmdctrl_send_mwodg_status(bool me){
-    pccomm_write((uint8_t[]){'W', 'D', 'G', 'S', me}, 5);
+    uint8_t op = OP_WDGS;
+    uint8_t status = me;
+    pccomm_frag_t frags[2] = {
+        cmdctrl_msg_name("WDGS", &op, compact),
+        {.data = &status, .len = 1}
+    };
+    pccomm_writev(frags, 2);
 }
 
 void cmdctrl_send_simstat(void){
-    uint8_t simstat[41];
-    simstat[0] = 'S';
-    simstat[1] = 'I';
-    simstat[2] = 'M';
-    simstat[3] = 'S';
-    simstat[4] = 'T';
-    simstat[5] = 'A';
-    simstat[6] = 'T';
-    conversions_float_to_data(cmdctrl_sim_speeds[0], &simstat[7], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[1], &simstat[11], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[2], &simstat[15], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[3], &simstat[19], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[4], &simstat[23], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[5], &simstat[27], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[6], &simstat[31], true);
-    conversions_float_to_data(cmdctrl_sim_speeds[7], &simstat[35], true);
-    simstat[39] = mode & 0xFF;
-    simstat[40] = mc_wdog_is_killed() ? 1 : 0;
-    pccomm_write(simstat, 41);
+    // Always uses message name (simulator does not use compact protocol)
+    uint8_t simstat[34];
+    for(unsigned int i = 0; i < 8; ++i)
+        conversions_float_to_data(cmdctrl_sim_speeds[i], &simstat[i * 4], true);
+    simstat[32] = mode & 0xFF;
+    simstat[33] = mc_wdog_is_killed() ? 1 : 0;
+    pccomm_frag_t frags[2] = {
+        {.data = (const uint8_t*)"SIMSTAT", .len = 7},
+        {.data = simstat, .len = 34}
+    };
+    pccomm_writev(frags, 2);
 }
 
 void cmdctrl_send_heartbeat(void){
-    uint8_t msg[] = {'H', 'E', 'A', 'R', 'T', 'B', 'E', 'A', 'T'};
-    pccomm_write(msg, sizeof(msg));
+    uint8_t op = OP_HEARTBEAT;
+    pccomm_frag_t frag = cmdctrl_msg_name("HEARTBEAT", &op, compact);
+    pccomm_writev(&frag, 1);
+}
+
+void cmdctrl_set_compact(bool enable){
+    compact = enable;
 }
 
 void cmdctrl_simhijack(bool hijack){
@@ -1336,6 +1974,7 @@ void cmdctrl_simhijack(bool hijack){
         cmdctrl_sim_speeds[7] = 0;
 
         // Revert to a stoped state
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
         mode = MODE_RAW;
         led_set(COLOR_RAW);
         raw_target[0] = 0.0f;
@@ -1347,6 +1986,7 @@ void cmdctrl_simhijack(bool hijack){
         raw_target[6] = 0.0f;
         raw_target[7] = 0.0f;
         mc_set_raw(raw_target);
+        xSemaphoreGive(target_mutex);
 
         // Do this last so set_local (above) uses real thrusters
         cmdctrl_sim_hijacked = true;
@@ -1355,6 +1995,7 @@ void cmdctrl_simhijack(bool hijack){
         cmdctrl_sim_hijacked = false;
 
         // Revert to a stoped state
+        xSemaphoreTake(target_mutex, portMAX_DELAY);
         mode = MODE_RAW;
         led_set(COLOR_RAW);
         raw_target[0] = 0.0f;
@@ -1366,6 +2007,7 @@ void cmdctrl_simhijack(bool hijack){
         raw_target[6] = 0.0f;
         raw_target[7] = 0.0f;
         mc_set_raw(raw_target);
+        xSemaphoreGive(target_mutex);
     }
 }
 
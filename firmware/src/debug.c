@@ -97,18 +97,14 @@ void debug_log(const char *msg){
 #endif
 
     // Only enable logging for debug builds
-    uint8_t buf[PCCOMM_MAX_MSG_LEN];
-    buf[0] = 'D';
-    buf[1] = 'E';
-    buf[2] = 'B';
-    buf[3] = 'U';
-    buf[4] = 'G';
     unsigned int len = strlen(msg);
     if(len > (PCCOMM_MAX_MSG_LEN - 5))
         len = PCCOMM_MAX_MSG_LEN - 5;
-    for(unsigned int i = 0; i < len; ++i)
-        buf[5+i] = msg[i];
-    pccomm_write(buf, len + 5);
+    pccomm_frag_t frags[2] = {
+        {.data = (const uint8_t*)"DEBUG", .len = 5},
+        {.data = (const uint8_t*)msg, .len = len}
+    };
+    pccomm_writev(frags, 2);
 #else
     (void)msg;
 #endif
@@ -120,18 +116,13 @@ void debug_log_data(uint8_t *msg, unsigned int len){
         return;
     
     // Only enable logging for debug builds
-    uint8_t buf[PCCOMM_MAX_MSG_LEN];
-    buf[0] = 'D';
-    buf[1] = 'B';
-    buf[2] = 'G';
-    buf[3] = 'D';
-    buf[4] = 'A';
-    buf[5] = 'T';
     if(len > (PCCOMM_MAX_MSG_LEN - 6))
         len = PCCOMM_MAX_MSG_LEN - 6;
-    for(unsigned int i = 0; i < len; ++i)
-        buf[6+i] = msg[i];
-    pccomm_write(buf, len + 6);
+    pccomm_frag_t frags[2] = {
+        {.data = (const uint8_t*)"DBGDAT", .len = 6},
+        {.data = msg, .len = len}
+    };
+    pccomm_writev(frags, 2);
 #else
     (void)msg;
     (void)len;
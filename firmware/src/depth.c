@@ -19,27 +19,43 @@
 #include <depth.h>
 #include <sensor/ms5837.h>
 #include <cmdctrl.h>
+#include <util/seqlock.h>
 #include <FreeRTOS.h>
-#include <semphr.h>
+#include <task.h>
+
+// Sample rate is measured over windows of at least this long
+#define DEPTH_RATE_WINDOW_MS        1000
 
 
 static uint8_t depth_which;
-static depth_data_t depth_data;
+static depth_data_t depth_data;             // Latest data (only used by depth task)
 static depth_data_t new_data;
 static unsigned int read_failures;
-SemaphoreHandle_t depth_mutex;
+
+// Published copies of depth_data (read by other tasks; see depth_get_data)
+static depth_data_t depth_data_pub[2];
+static seqlock_t depth_lock;
+
+// Sample rate measurement
+static uint32_t rate_window_start_ms;       // Timestamp of first sample in current window
+static uint32_t rate_window_seq;            // Sequence number of first sample in current window
+static volatile float sample_rate;          // Samples per second (last complete window)
 
 
 void depth_init(void){
     // Default / initial values
     read_failures = 0;
+    sample_rate = 0.0f;
     depth_data.depth_m = 0;
     depth_data.pressure_pa = 0;
     depth_data.temperature_c = 0;
+    depth_data.seq = 0;
+    depth_data.timestamp_ms = 0;
 
     // Reading depth_data is multiple read operations
-    // Want to ensure a write of depth_data cannot interrupt a read causing mixed data
-    depth_mutex = xSemaphoreCreateMutex();
+    // Other tasks read a published copy (seqlock) so a write cannot interrupt a read causing mixed data
+    seqlock_init(&depth_lock);
+    depth_data_pub[SEQLOCK_INDEX(0)] = depth_data;
 
     // Init code for all supported depth sensors
     ms5837_init();
@@ -106,11 +122,23 @@ bool depth_read(void){
     }
 
     if(success){
-        // Update depth_data while holding mutex
-        xSemaphoreTake(depth_mutex, portMAX_DELAY);
+        // Update and publish depth_data
+        new_data.seq = depth_data.seq + 1;
+        new_data.timestamp_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
         depth_data = new_data;
-        xSemaphoreGive(depth_mutex);
-
+        depth_data_pub[seqlock_write_index(&depth_lock)] = depth_data;
+        seqlock_write_publish(&depth_lock);
+
+        // Measure achieved sample rate
+        uint32_t elapsed_ms = depth_data.timestamp_ms - rate_window_start_ms;
+        if(depth_data.seq == 1){
+            rate_window_start_ms = depth_data.timestamp_ms;
+            rate_window_seq = depth_data.seq;
+        }else if(elapsed_ms >= DEPTH_RATE_WINDOW_MS){
+            sample_rate = (depth_data.seq - rate_window_seq) * 1000.0f / elapsed_ms;
+            rate_window_start_ms = depth_data.timestamp_ms;
+            rate_window_seq = depth_data.seq;
+        }
     }else{
         read_failures++;
     }
@@ -121,16 +149,30 @@ bool depth_read(void){
 depth_data_t depth_get_data(void){
     depth_data_t ret_data;
 
-    // Read under mutex because reading a struct is multiple reads
-    // If reading from one thread and writing depth_data (via depth_read() function) on another thread
-    // depth_data could change part way through the read here.
-    xSemaphoreTake(depth_mutex, portMAX_DELAY);
-    ret_data = depth_data;
-    xSemaphoreGive(depth_mutex);
+    // Reading a struct is multiple reads. If the depth task publishes new data part way through
+    // the read here, the read is retried (seqlock). Never blocks the reader or the depth task.
+    uint32_t gen;
+    do{
+        gen = seqlock_read_begin(&depth_lock);
+        ret_data = depth_data_pub[SEQLOCK_INDEX(gen)];
+    }while(seqlock_read_retry(&depth_lock, gen));
 
     return ret_data;
 }
 
+uint32_t depth_get_read_retries(void){
+    return depth_lock.retries;
+}
+
+float depth_get_sample_rate(void){
+    // If samples stopped, the last measured rate is no longer meaningful
+    uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if(now_ms - depth_get_data().timestamp_ms > 2 * DEPTH_RATE_WINDOW_MS){
+        return 0.0f;
+    }
+    return sample_rate;
+}
+
 uint8_t depth_get_sensor(void){
     return depth_which;
 }
\ No newline at end of file
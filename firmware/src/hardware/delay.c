@@ -44,6 +44,14 @@ void delay_ms(unsigned int ms){
     while ((DWT->CYCCNT - start) < ms);
 }
 
+uint32_t delay_timestamp(void){
+    return DWT->CYCCNT;
+}
+
+uint32_t delay_elapsed_us(uint32_t start, uint32_t end){
+    return (end - start) / (SystemCoreClock / 1000000);
+}
+
 #endif // CONTROL_BOARD_V1 || CONTROL_BOARD_V2
 
 #if defined(CONTROL_BOARD_SIM_LINUX) || defined(CONTROL_BOARD_SIM_MACOS)
@@ -97,6 +105,17 @@ void delay_ms(unsigned int ms){
     }
 }
 
+uint32_t delay_timestamp(void){
+    // Nanoseconds (wraps every ~4 seconds)
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)((uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec);
+}
+
+uint32_t delay_elapsed_us(uint32_t start, uint32_t end){
+    return (end - start) / 1000;
+}
+
 #endif // CONTROL_BOARD_SIM_LINUX || CONTROL_BOARD_SIM_MACOS
 
 #if defined(CONTROL_BOARD_SIM_WIN)
@@ -124,4 +143,17 @@ void delay_ms(unsigned int ms){
     Sleep((DWORD)ms);
 }
 
+uint32_t delay_timestamp(void){
+    // Performance counter ticks
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint32_t)t.QuadPart;
+}
+
+uint32_t delay_elapsed_us(uint32_t start, uint32_t end){
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return (uint32_t)((uint64_t)(end - start) * 1000000ULL / (uint64_t)freq.QuadPart);
+}
+
 #endif // CONTROL_BOARD_SIM_WIN
\ No newline at end of file
@@ -19,16 +19,41 @@
 
 #include <hardware/i2c.h>
 #include <framework.h>
+#include <hardware/delay.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include <semphr.h>
 
 
-#ifdef CONTROL_BOARD_V1
+// Set by hardware layer when the bus needs to be recovered (SDA freed and peripheral re-initialized)
+// Recovery is performed by the I2C task after the transaction (see i2c_recover)
+static bool recovery_needed = false;
 
-#include <hardware/delay.h>
+
+#if defined(CONTROL_BOARD_V1) || defined(CONTROL_BOARD_V2)
+
+// Max clock cycles bit-banged to free SDA. A device holding SDA low is partway through sending a byte,
+// so 9 cycles (8 bits + ACK) release it. Extra cycles in case a device starts another byte.
+#define I2C_RECOVERY_MAX_CYCLES     16
+
+/**
+ * Wait during bus recovery. Blocks instead of busy waiting once the scheduler is running, so
+ * lower priority tasks still run while the I2C task recovers the bus.
+ * @param ms Time to wait in milliseconds
+ */
+static void i2c_recovery_wait_ms(unsigned int ms){
+    if(xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+        delay_ms(ms);
+    else
+        vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+#endif // CONTROL_BOARD_V1 || CONTROL_BOARD_V2
+
+
+#ifdef CONTROL_BOARD_V1
 
 
-static SemaphoreHandle_t i2c_mutex;
 static SemaphoreHandle_t i2c_done_signal;
 
 
@@ -54,14 +79,13 @@ static void i2c_fix_sda_low(void){
     PORT_GroupInputEnable(PORT_GROUP_0, 1 << 12);
     PORT_PinGPIOConfig(PORT_PIN_PA13);
     PORT_GroupOutputEnable(PORT_GROUP_0, 1 << 13);
-    delay_ms(1);
+    i2c_recovery_wait_ms(1);
 
     // Bit-bang clock cycles while SDA remains low (~100kHz clock frequency)
     // Limit max cycles to ensure this is never an infinite loop (eg if external pullups missing)
-    // In reality, should never take more than 10 clock cycles
     unsigned int cycles = 0;
     while((PORT_GroupRead(PORT_GROUP_0) & (1 << 12))){
-        if(cycles++ > 100)
+        if(cycles++ > I2C_RECOVERY_MAX_CYCLES)
             break;
         PORT_GroupSet(PORT_GROUP_0, 1 << 13);
         delay_us(10);
@@ -72,7 +96,7 @@ static void i2c_fix_sda_low(void){
     // Set pins to I2C mode (SDA and SCL modes; same as generated code does)
     PORT_PinPeripheralFunctionConfig(PORT_PIN_PA12, PERIPHERAL_FUNCTION_C);
     PORT_PinPeripheralFunctionConfig(PORT_PIN_PA13, PERIPHERAL_FUNCTION_C);
-    delay_ms(5);
+    i2c_recovery_wait_ms(5);
 
     // Need to re-initialize I2C SERCOM after doing this or it won't work
     // May have to do with I2C SERCOM hardware getting in a bad state when pinmux changed
@@ -80,7 +104,7 @@ static void i2c_fix_sda_low(void){
     SERCOM2_I2C_Initialize();
 }
 
-void i2c_init(){
+static void i2c_hw_init(void){
     // Sometimes (when device is reset at wrong time) a slave may be holding SDA low
     // Best option in this case is to send clock pulses until it releases it
     // This could be fixed in the case of the BNO055 using the reset pin to reset the IMU
@@ -88,9 +112,6 @@ void i2c_init(){
     // for both devices instead.
     i2c_fix_sda_low();
 
-    // Mutex used to ensure i2c API is thread-safe
-    i2c_mutex = xSemaphoreCreateMutex();
-
     // Used to block perform until transfer complete
     // Value after create is zero (must be given before take succeeds)
     i2c_done_signal = xSemaphoreCreateBinary();
@@ -109,22 +130,7 @@ void i2c_init(){
     SERCOM2_I2C_CallbackRegister(i2c_done_callback, 0);
 }
 
-bool i2c_perform(i2c_trans *trans){
-    // I2C runs at 100kHz clock
-    // A transaction with 64 bytes read and write each would be 128*8=1024 bits
-    // 1/100kHz = 10us per bit
-    // 1024 * 10 = 10240us bit transfer time = 1.024ms
-    // Assume some clock stretching and delays with ACK up to 30us per byte
-    // 128*30 = 3.840ms
-    // Thus a "large" transaction should finish within 5ms
-    // Assume it is possible for a few to be queued up.
-    // Thus wait for at most 25ms (5 queued large transactions)
-    // If this fails, something is probably stuck and will never release the mutex
-    // This is also a small enough amount of time to not fully break most threads
-    // calling this function
-    if(xSemaphoreTake(i2c_mutex, pdMS_TO_TICKS(25)) == pdFALSE)
-        return false;
-
+static bool i2c_hw_perform(i2c_trans *trans){
     if(SERCOM2_I2C_IsBusy()){
         if ((SERCOM2_REGS->I2CM.SERCOM_STATUS & SERCOM_I2CM_STATUS_BUSSTATE_Msk) == SERCOM_I2CM_STATUS_BUSSTATE(0x03U)){
             // Busy state indicates that some other master owns the bus
@@ -136,12 +142,10 @@ bool i2c_perform(i2c_trans *trans){
             // SERCOM2_I2C_TransferAbort();
 
             // Note that this can occur while a sensor is holding SDA low. In this case, it is necessary to re-init i2c entirely
-            // including the bit-banged i2c low fix
-            i2c_fix_sda_low();
-            // SERCOM2_I2C_Initialize();    // Already called by i2c_fix_sda_low
+            // including the bit-banged i2c low fix (see i2c_hw_recover)
+            recovery_needed = true;
         }
 
-        xSemaphoreGive(i2c_mutex);
         return false;
     }
 
@@ -151,30 +155,26 @@ bool i2c_perform(i2c_trans *trans){
     if(trans->write_count > 0 && trans->read_count > 0){
         // Both write and read
         if(!SERCOM2_I2C_WriteRead(trans->address, trans->write_buf, trans->write_count, trans->read_buf, trans->read_count)){
-            xSemaphoreGive(i2c_mutex);
             return false;
         }
     }else if(trans->write_count == 0 && trans->read_count > 0){
         // Read only
         if(!SERCOM2_I2C_Read(trans->address, trans->read_buf, trans->read_count)){
-            xSemaphoreGive(i2c_mutex);
             return false;
         }
     }else if(trans->write_count > 0 && trans->read_count == 0){
         // Write only
         if(!SERCOM2_I2C_Write(trans->address, trans->write_buf, trans->write_count)){
-            xSemaphoreGive(i2c_mutex);
             return false;
         }
     }else{
         // Empty transaction
-        xSemaphoreGive(i2c_mutex);
         return true;
     }
 
     // Wait for transaction to finish
     // A timeout is used to ensure that even if something is configured very wrong (such that transmit appears to start
-    // but interrupt never occurs), this won't hold the i2c mutex forever
+    // but interrupt never occurs), this won't hold the i2c bus forever
     // The timeout is far longer than the operation should take.
     // With a 100kHz clock, each bit takes 10us to transmit. Thus expected time is 10us*(read_count+write_count)*8
     // However, clock stretching can occur. To account for this, allow 50us between bytes. Thus
@@ -188,7 +188,6 @@ bool i2c_perform(i2c_trans *trans){
         // Timed out while waiting for transfer done signal
         SERCOM2_I2C_TransferAbort();                            // Interrupt won't occur after this is done running
         while(xSemaphoreTake(i2c_done_signal, 0) == pdTRUE);    // Zero the semaphore (may have been given before abort)
-        xSemaphoreGive(i2c_mutex);
         return false;
     }
 
@@ -198,15 +197,27 @@ bool i2c_perform(i2c_trans *trans){
     if(result == SERCOM_I2C_ERROR_BUS){
         // Bus error occurs when hardware gets in a bad state
         // Only known solution is to re-initialize
-        // Also, need to handle the case where sda is low when this happens, thus fix sda low is called
-        i2c_fix_sda_low();
-        // SERCOM2_I2C_Initialize();
+        // Also, need to handle the case where sda is low when this happens, thus fix sda low is used
+        recovery_needed = true;
     }
 
-    xSemaphoreGive(i2c_mutex);
     return result == SERCOM_I2C_ERROR_NONE;
 }
 
+static void i2c_hw_recover(void){
+    i2c_fix_sda_low();
+    // SERCOM2_I2C_Initialize();    // Already called by i2c_fix_sda_low
+}
+
+bool i2c_set_dma(bool enable){
+    // DMA transfers not supported
+    return !enable;
+}
+
+bool i2c_get_dma(void){
+    return false;
+}
+
 #endif // CONTROL_BOARD_V1
 
 
@@ -217,12 +228,51 @@ bool i2c_perform(i2c_trans *trans){
 
 extern I2C_HandleTypeDef hi2c1;
 
+// DMA streams for I2C1 (DMA1 channel 1; see reference manual DMA1 request mapping)
+DMA_HandleTypeDef hdma_i2c1_rx;     // Stream 0
+DMA_HandleTypeDef hdma_i2c1_tx;     // Stream 6
+
 static volatile bool i2c_success = false;
 
 
-static SemaphoreHandle_t i2c_mutex;
 static SemaphoreHandle_t i2c_done_signal;
 
+// Transfers of at least this many bytes use DMA (if enabled)
+// DMA saves one interrupt per byte, but the address, completion, and stop interrupts remain.
+// Thus, short transfers (eg register address writes) are not worth setting up DMA for.
+#define I2C_DMA_MIN_COUNT       4
+
+// Functions to start a transfer (HAL sequential transfer API)
+typedef HAL_StatusTypeDef (*i2c_xfer_fn)(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t XferOptions);
+
+typedef struct {
+    i2c_xfer_fn seq_transmit;
+    i2c_xfer_fn seq_receive;
+} i2c_ops_t;
+
+// Interrupt driven transfers (interrupt per byte)
+static const i2c_ops_t i2c_ops_it = {
+    .seq_transmit = HAL_I2C_Master_Seq_Transmit_IT,
+    .seq_receive = HAL_I2C_Master_Seq_Receive_IT
+};
+
+// DMA transfers (data moved by DMA; interrupts only for address, completion, and stop)
+static const i2c_ops_t i2c_ops_dma = {
+    .seq_transmit = HAL_I2C_Master_Seq_Transmit_DMA,
+    .seq_receive = HAL_I2C_Master_Seq_Receive_DMA
+};
+
+static volatile bool dma_enabled = false;
+
+/**
+ * Get functions to use for a transfer
+ * @param count Number of bytes in transfer
+ * @return Transfer functions (interrupt or DMA)
+ */
+static inline const i2c_ops_t *i2c_ops(unsigned int count){
+    return (dma_enabled && count >= I2C_DMA_MIN_COUNT) ? &i2c_ops_dma : &i2c_ops_it;
+}
+
 
 
 void HAL_I2C_MasterTxCpltCallback (I2C_HandleTypeDef * hi2c){
@@ -281,14 +331,13 @@ static void i2c_fix_sda_low(void){
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
-    delay_ms(5);
+    i2c_recovery_wait_ms(5);
 
     // Bit-bang clock cycles while SDA remains low (~100kHz clock frequency)
     // Limit max cycles to ensure this is never an infinite loop (eg if external pullups missing)
-    // In reality, should never take more than 10 clock cycles
     unsigned int cycles = 0;
     while(HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_9) == GPIO_PIN_RESET){
-        if(cycles++ > 100)
+        if(cycles++ > I2C_RECOVERY_MAX_CYCLES)
             break;
         HAL_GPIO_WritePin(GPIOB, GPIO_PIN_8, GPIO_PIN_SET);
         delay_us(10);
@@ -303,7 +352,7 @@ static void i2c_fix_sda_low(void){
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
     GPIO_InitStruct.Alternate = GPIO_AF4_I2C1;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
-    delay_ms(5);
+    i2c_recovery_wait_ms(5);
 }
 
 static void i2c_reinit(void){
@@ -316,7 +365,7 @@ static void i2c_reinit(void){
     NVIC_EnableIRQ(I2C1_ER_IRQn);
 }
 
-void i2c_init(void){
+static void i2c_hw_init(void){
 
     // Sometimes (when device is reset at wrong time) a slave may be holding SDA low
     // Best option in this case is to send clock pulses until it releases it
@@ -325,9 +374,6 @@ void i2c_init(void){
     // for both devices instead.
     i2c_fix_sda_low();
 
-    // Mutex used to ensure i2c API is thread-safe
-    i2c_mutex = xSemaphoreCreateMutex();
-
     // Used to block perform until transfer complete
     // Value after create is zero (must be given before take succeeds)
     i2c_done_signal = xSemaphoreCreateBinary();
@@ -341,44 +387,88 @@ void i2c_init(void){
 
     // Framework init initializes I2C1
     // Clock and pin config also handled by generator project
+
+    // DMA streams (only used for DMA transfers; see i2c_set_dma)
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    hdma_i2c1_rx.Instance = DMA1_Stream0;
+    hdma_i2c1_rx.Init.Channel = DMA_CHANNEL_1;
+    hdma_i2c1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_i2c1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_i2c1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_i2c1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.Mode = DMA_NORMAL;
+    hdma_i2c1_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_i2c1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    HAL_DMA_Init(&hdma_i2c1_rx);
+    __HAL_LINKDMA(&hi2c1, hdmarx, hdma_i2c1_rx);
+    hdma_i2c1_tx.Instance = DMA1_Stream6;
+    hdma_i2c1_tx.Init = hdma_i2c1_rx.Init;
+    hdma_i2c1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    HAL_DMA_Init(&hdma_i2c1_tx);
+    __HAL_LINKDMA(&hi2c1, hdmatx, hdma_i2c1_tx);
+
+    // DMA IRQ handlers run HAL callbacks (same as I2C IRQ handlers)
+    NVIC_SetPriority(DMA1_Stream0_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(DMA1_Stream6_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+    NVIC_EnableIRQ(DMA1_Stream6_IRQn);
 }
 
-bool i2c_perform(i2c_trans *trans){
-    HAL_StatusTypeDef status;
+// When waiting on semaphore signaling i2c finish from interrupt
+// a timeout is used to ensure that even if something is configured very wrong (such that transmit appears to start
+// but interrupt never occurs), this won't hold the i2c bus forever
+// The timeout is far longer than the operation should take.
+// With a 100kHz clock, each bit takes 10us to transmit. Thus expected time is 10us*(read_count+write_count)*8
+// However, clock stretching can occur. To account for this, allow 50us between bytes. Thus
+// max_time = 50us*(read_count+write_count) + 10us*(read_count+write_count)*8 = 130us*(read_count+write_count)
+// For a safety margin, round up to 200us per byte. Thus timeout in ms = ceil(200*(read_count+write_count)/1000)
+// = ceil((read_count+write_count)/5) = floor((read_count+write_count+4)/5) 
+// = integer division of (read_count+write_count+4) by 5
+// Then for extra margin, add 5ms
+#define TIMEOUT_FOR_COUNT(count)        ((((uint32_t)(count + 4)) / 5) + 5)
+
+/**
+ * Start a transfer, then wait for it to finish
+ * @param xfer HAL function to start transfer (interrupt or DMA version)
+ * @param address Device address
+ * @param buf Data to write or buffer for read data
+ * @param count Number of bytes
+ * @param options Sequential transfer options (I2C_xyz_FRAME)
+ * @return true on success; false on failure
+ */
+static bool i2c_hw_transfer(i2c_xfer_fn xfer, uint8_t address, uint8_t *buf, unsigned int count, uint32_t options){
+    HAL_StatusTypeDef status = xfer(&hi2c1, address << 1, buf, count, options);
+
+    if(status != HAL_OK){
+
+        if(__HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_BUSY) != RESET){
+            // This occurs when timeout waiting for the bus to no longer be in busy state
+            // The only reason this would be in a busy state is if another master were using the bus
+            // This is not possible in this system. Thus, this happens due to noise on I2C lines
+            // usually from hot-plugging sensors. Thus, this should be ignored by manually clearing the flag.
+            // BUSY flag cannot be written (it is only able to be cleared by hardware)
+            // So the only solution is to reset the I2C peripheral...
+            // Unfortunately, this noise may have also caused a sensor to get stuck holding SDA low
+            // Thus, need to handle that too (see i2c_hw_recover).
+            recovery_needed = true;
+        }
 
+        return false;
+    }
 
-    // When waiting on semaphore signaling i2c finish from interrupt
-    // a timeout is used to ensure that even if something is configured very wrong (such that transmit appears to start
-    // but interrupt never occurs), this won't hold the i2c mutex forever
-    // The timeout is far longer than the operation should take.
-    // With a 100kHz clock, each bit takes 10us to transmit. Thus expected time is 10us*(read_count+write_count)*8
-    // However, clock stretching can occur. To account for this, allow 50us between bytes. Thus
-    // max_time = 50us*(read_count+write_count) + 10us*(read_count+write_count)*8 = 130us*(read_count+write_count)
-    // For a safety margin, round up to 200us per byte. Thus timeout in ms = ceil(200*(read_count+write_count)/1000)
-    // = ceil((read_count+write_count)/5) = floor((read_count+write_count+4)/5) 
-    // = integer division of (read_count+write_count+4) by 5
-    // Then for extra margin, add 5ms
-    #define TIMEOUT_FOR_COUNT(count)        ((((uint32_t)(count + 4)) / 5) + 5)
-
-
-    // I2C runs at 100kHz clock
-    // A transaction with 64 bytes read and write each would be 128*8=1024 bits
-    // 1/100kHz = 10us per bit
-    // 1024 * 10 = 10240us bit transfer time = 1.024ms
-    // Assume some clock stretching and delays with ACK up to 30us per byte
-    // 128*30 = 3.840ms
-    // Thus a "large" transaction should finish within 5ms
-    // Assume it is possible for a few to be queued up.
-    // Thus wait for at most 25ms (5 queued large transactions)
-    // If this fails, something is probably stuck and will never release the mutex
-    // This is also a small enough amount of time to not fully break most threads
-    // calling this function
-    if(xSemaphoreTake(i2c_mutex, pdMS_TO_TICKS(25)) == pdFALSE)
+    // Wait for transfer to finish
+    if(xSemaphoreTake(i2c_done_signal, pdMS_TO_TICKS(TIMEOUT_FOR_COUNT(count))) == pdFALSE){
+        HAL_I2C_Master_Abort_IT(&hi2c1, address << 1);          // Aborts transfer. Calls callback directly
+        while(xSemaphoreTake(i2c_done_signal, 0) == pdTRUE);    // Zero semaphore (may have been given before abort)
         return false;
+    }
 
+    return i2c_success;
+}
 
+static bool i2c_hw_perform(i2c_trans *trans){
     if(HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY){
-        xSemaphoreGive(i2c_mutex);
         return false;
     }
 
@@ -389,194 +479,492 @@ bool i2c_perform(i2c_trans *trans){
 
     if(trans->write_count > 0 && trans->read_count > 0){
         // Write then read (repeated start between)
-        
-        // Perform write (no stop after)
-        status = HAL_I2C_Master_Seq_Transmit_IT(&hi2c1, 
-            trans->address << 1, 
-            trans->write_buf, 
-            trans->write_count,
-            I2C_FIRST_FRAME);
-
-        if(status != HAL_OK){
-
-            if(__HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_BUSY) != RESET){
-                // This occurs when timeout waiting for the bus to no longer be in busy state
-                // The only reason this would be in a busy state is if another master were using the bus
-                // This is not possible in this system. Thus, this happens due to noise on I2C lines
-                // usually from hot-plugging sensors. Thus, this should be ignored by manually clearing the flag.
-                // BUSY flag cannot be written (it is only able to be cleared by hardware)
-                // So the only solution is to reset the I2C peripheral...
-                // Unfortunately, this noise may have also caused a sensor to get stuck holding SDA low
-                // Thus, need to handle that too here.
-                i2c_fix_sda_low();
-                i2c_reinit();
-            }
-
-            xSemaphoreGive(i2c_mutex);
+        // Write has no stop after
+        if(!i2c_hw_transfer(i2c_ops(trans->write_count)->seq_transmit, trans->address, trans->write_buf, trans->write_count, I2C_FIRST_FRAME))
             return false;
-        }
+        return i2c_hw_transfer(i2c_ops(trans->read_count)->seq_receive, trans->address, trans->read_buf, trans->read_count, I2C_LAST_FRAME);
+    }else if(trans->read_count > 0){
+        // Perform read only
+        return i2c_hw_transfer(i2c_ops(trans->read_count)->seq_receive, trans->address, trans->read_buf, trans->read_count, I2C_FIRST_AND_LAST_FRAME);
+    }else if(trans->write_count > 0){
+        // Perform write only
+        return i2c_hw_transfer(i2c_ops(trans->write_count)->seq_transmit, trans->address, trans->write_buf, trans->write_count, I2C_FIRST_AND_LAST_FRAME);
+    }
 
-        // Wait for write to finish
-        if(xSemaphoreTake(i2c_done_signal, pdMS_TO_TICKS(TIMEOUT_FOR_COUNT(trans->write_count))) == pdFALSE){
-            HAL_I2C_Master_Abort_IT(&hi2c1, trans->address << 1);   // Aborts transfer. Calls callback directly
-            while(xSemaphoreTake(i2c_done_signal, 0) == pdTRUE);    // Zero semaphore (may have been given before abort)
-            xSemaphoreGive(i2c_mutex);
-            return false;
-        }
-        
-        // If write fails, exit here
-        if(!i2c_success){
-            // Must store copy of i2c_success before unlocking
-            // Otherwise it is possible it would be modified again
-            // before return actually happens
-            bool ret = i2c_success;
-            xSemaphoreGive(i2c_mutex);
-            return ret;
-        }
+    // Only gets here if empty transaction
+    return true;
+}
 
-        // Perform read
-        status = HAL_I2C_Master_Seq_Receive_IT(&hi2c1,
-            trans->address << 1,
-            trans->read_buf,
-            trans->read_count,
-            I2C_LAST_FRAME);
-
-        if(status != HAL_OK){
-
-            if(__HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_BUSY) != RESET){
-                // This occurs when timeout waiting for the bus to no longer be in busy state
-                // The only reason this would be in a busy state is if another master were using the bus
-                // This is not possible in this system. Thus, this happens due to noise on I2C lines
-                // usually from hot-plugging sensors. Thus, this should be ignored by manually clearing the flag.
-                // Unfortunately, this noise may have also caused a sensor to get stuck holding SDA low
-                // Thus, need to handle that too here.
-                i2c_fix_sda_low();
-                i2c_reinit();
-            }
+static void i2c_hw_recover(void){
+    i2c_fix_sda_low();
+    i2c_reinit();
+}
 
-            xSemaphoreGive(i2c_mutex);
-            return false;
-        }
+bool i2c_set_dma(bool enable){
+    // Used starting with the next transfer
+    dma_enabled = enable;
+    return true;
+}
 
-        // Wait for read to finish
-        if(xSemaphoreTake(i2c_done_signal, pdMS_TO_TICKS(TIMEOUT_FOR_COUNT(trans->read_count))) == pdFALSE){
-            HAL_I2C_Master_Abort_IT(&hi2c1, trans->address << 1);   // Aborts transfer. Calls callback directly
-            while(xSemaphoreTake(i2c_done_signal, 0) == pdTRUE);    // Zero semaphore (may have been given before abort)
-            xSemaphoreGive(i2c_mutex);
-            return false;
-        }
+bool i2c_get_dma(void){
+    return dma_enabled;
+}
 
-        // Must store copy of i2c_success before unlocking
-        // Otherwise it is possible it would be modified again
-        // before return actually happens
-        bool ret = i2c_success;
-        xSemaphoreGive(i2c_mutex);
-        return ret;
-    }else if(trans->read_count > 0){
-        // Perform read only.
-        status = HAL_I2C_Master_Receive_IT(&hi2c1,
-            trans->address << 1,
-            trans->read_buf,
-            trans->read_count);
-
-        if(status != HAL_OK){
-
-            if(__HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_BUSY) != RESET){
-                // This occurs when timeout waiting for the bus to no longer be in busy state
-                // The only reason this would be in a busy state is if another master were using the bus
-                // This is not possible in this system. Thus, this happens due to noise on I2C lines
-                // usually from hot-plugging sensors. Thus, this should be ignored by manually clearing the flag.
-                // Unfortunately, this noise may have also caused a sensor to get stuck holding SDA low
-                // Thus, need to handle that too here.
-                i2c_fix_sda_low();
-                i2c_reinit();
-            }
+#endif // CONTROL_BOARD_V2
 
-            xSemaphoreGive(i2c_mutex);
-            return false;
-        }
 
-        // Wait for read to finish
-        if(xSemaphoreTake(i2c_done_signal, pdMS_TO_TICKS(TIMEOUT_FOR_COUNT(trans->read_count))) == pdFALSE){
-            HAL_I2C_Master_Abort_IT(&hi2c1, trans->address << 1);   // Aborts transfer. Calls callback directly
-            while(xSemaphoreTake(i2c_done_signal, 0) == pdTRUE);    // Zero semaphore (may have been given before abort)
-            xSemaphoreGive(i2c_mutex);
-            return false;
-        }
+#if defined(CONTROL_BOARD_V1) || defined(CONTROL_BOARD_V2)
 
-        // Must store copy of i2c_success before unlocking
-        // Otherwise it is possible it would be modified again
-        // before return actually happens
-        bool ret = i2c_success;
-        xSemaphoreGive(i2c_mutex);
-        return ret;
-    }else if(trans->write_count > 0){
-        // Perform write only
-        status = HAL_I2C_Master_Transmit_IT(&hi2c1,
-            trans->address << 1,
-            trans->write_buf,
-            trans->write_count);
-
-        if(status != HAL_OK){
-
-            if(__HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_BUSY) != RESET){
-                // This occurs when timeout waiting for the bus to no longer be in busy state
-                // The only reason this would be in a busy state is if another master were using the bus
-                // This is not possible in this system. Thus, this happens due to noise on I2C lines
-                // usually from hot-plugging sensors. Thus, this should be ignored by manually clearing the flag.
-                // Unfortunately, this noise may have also caused a sensor to get stuck holding SDA low
-                // Thus, need to handle that too here.
-                i2c_fix_sda_low();
-                i2c_reinit();
-            }
+// Time spent in I2C (and I2C DMA) interrupt handlers
+static volatile uint32_t isr_count = 0;
+static volatile uint64_t isr_cycles = 0;
 
-            xSemaphoreGive(i2c_mutex);
-            return false;
-        }
+void i2c_isr_record(uint32_t start){
+    isr_count++;
+    isr_cycles += delay_timestamp() - start;
+}
 
-        // Wait for write to finish
-        if(xSemaphoreTake(i2c_done_signal, pdMS_TO_TICKS(TIMEOUT_FOR_COUNT(trans->write_count))) == pdFALSE){
-            HAL_I2C_Master_Abort_IT(&hi2c1, trans->address << 1);   // Aborts transfer. Calls callback directly
-            while(xSemaphoreTake(i2c_done_signal, 0) == pdTRUE);    // Zero semaphore (may have been given before abort)
-            xSemaphoreGive(i2c_mutex);
-            return false;
+void i2c_get_isr_stats(uint32_t *count, uint32_t *time_us){
+    // 64-bit read is not atomic
+    taskENTER_CRITICAL();
+    uint32_t c = isr_count;
+    uint64_t cycles = isr_cycles;
+    taskEXIT_CRITICAL();
+    *count = c;
+    *time_us = cycles / (SystemCoreClock / 1000000);
+}
+
+#endif // CONTROL_BOARD_V1 || CONTROL_BOARD_V2
+
+
+
+#ifdef CONTROL_BOARD_SIM
+
+// Fake I2C bus. Transactions take about as long as they would on a 100kHz bus.
+// Transactions to addresses with no attached device fail (not acknowledged).
+
+#define I2C_SIM_MAX_DEVICES     4
+
+typedef struct {
+    uint8_t address;
+    i2c_sim_device_fn handler;
+} i2c_sim_device_t;
+
+static i2c_sim_device_t sim_devices[I2C_SIM_MAX_DEVICES];
+static unsigned int sim_device_count = 0;
+
+static void i2c_hw_init(void){
+    // Nothing here
+}
+
+static bool i2c_hw_perform(i2c_trans *trans){
+    i2c_sim_device_fn handler = NULL;
+    for(unsigned int i = 0; i < sim_device_count; ++i){
+        if(sim_devices[i].address == trans->address){
+            handler = sim_devices[i].handler;
+            break;
         }
+    }
 
-        // Must store copy of i2c_success before unlocking
-        // Otherwise it is possible it would be modified again
-        // before return actually happens
-        bool ret = i2c_success;
-        xSemaphoreGive(i2c_mutex);
-        return ret;
+    // Each byte (including address) is 9 clock cycles (8 bits + ACK). 10us per clock cycle at 100kHz.
+    // A transaction to a missing device ends after the address byte (not acknowledged)
+    unsigned int bytes = 1;
+    if(handler != NULL){
+        bytes += trans->write_count + trans->read_count;
+        if(trans->write_count > 0 && trans->read_count > 0)
+            bytes++;    // Address byte again after repeated start
     }
+    vTaskDelay(pdMS_TO_TICKS((bytes * 90 + 999) / 1000));
 
-    // Only gets here if empty transaction
-    xSemaphoreGive(i2c_mutex);
+    if(handler == NULL)
+        return false;
+    return handler(trans);
+}
+
+static void i2c_hw_recover(void){
+    // Fake bus never needs recovery
+}
+
+bool i2c_set_dma(bool enable){
+    // DMA transfers not supported
+    return !enable;
+}
+
+bool i2c_get_dma(void){
+    return false;
+}
+
+void i2c_get_isr_stats(uint32_t *count, uint32_t *time_us){
+    // No interrupts
+    *count = 0;
+    *time_us = 0;
+}
+
+bool i2c_sim_attach(uint8_t address, i2c_sim_device_fn handler){
+    if(sim_device_count >= I2C_SIM_MAX_DEVICES)
+        return false;
+    sim_devices[sim_device_count].address = address;
+    sim_devices[sim_device_count].handler = handler;
+    sim_device_count++;
     return true;
 }
 
-#endif // CONTROL_BOARD_V2
+#endif // CONTROL_BOARD_SIM
 
 
-#ifdef CONTROL_BOARD_SIM
 
-// Dummy implementation that always fails.
+// Transaction states
+#define I2C_STATE_IDLE          0       // Not queued (or finished)
+#define I2C_STATE_QUEUED        1       // Waiting to be performed
+#define I2C_STATE_ACTIVE        2       // Being performed by I2C task
+
+// Task notification index used to signal i2c_perform callers that their transaction finished
+// Index 0 is left for application use (eg cmdctrl task notifications)
+#define I2C_NOTIFY_INDEX        1
+
+// Max time a transaction waits in the queue before i2c_perform gives up (if it has not started)
+// A "large" transaction (64 bytes read and write) takes about 1ms at 100kHz or up to 5ms with
+// clock stretching. 25ms allows several large transactions to be queued ahead. If this fails
+// something is probably stuck. This is also a small enough amount of time to not fully break
+// most threads calling i2c_perform.
+#define I2C_QUEUE_TIMEOUT_MS    25
+
+// Queue of transactions for each priority class (linked through trans->next)
+// Only accessed in critical sections
+static i2c_trans *queue_head[I2C_PRIO_COUNT];
+static i2c_trans *queue_tail[I2C_PRIO_COUNT];
+
+// Given when a transaction is queued (wakes I2C task)
+static SemaphoreHandle_t queue_signal;
+
+// Transactions performed since startup (including failed)
+static volatile uint32_t trans_count = 0;
+
+// Bus recovery is performed at most once per interval. Recovery keeps the bus busy for ~10ms, so recovering
+// after every failure while a connector is flaky (or a device is unplugged) would starve other devices.
+// Recovery that is rate limited remains pending until a later failed transaction (or a successful transaction
+// shows it is no longer needed).
+#define I2C_RECOVERY_INTERVAL_MS    100
+
+// Circuit breaker: after this many consecutive failed transactions with a device, transactions with the device
+// fail immediately (without using the bus) for I2C_BREAKER_OPEN_MS. Then one transaction (probe) is performed.
+// Others are still rejected until it completes. If it succeeds, the breaker closes. Otherwise, it remains open
+// for another I2C_BREAKER_OPEN_MS.
+#define I2C_BREAKER_THRESHOLD       16
+#define I2C_BREAKER_OPEN_MS         200
+
+// Delay between attempts in i2c_perform_retries. Doubles after each failed attempt (up to max).
+#define I2C_RETRY_MIN_DELAY_MS      1
+#define I2C_RETRY_MAX_DELAY_MS      16
+
+// Max number of devices with statistics and a circuit breaker
+#define I2C_MAX_DEVICES             4
+
+typedef struct {
+    uint8_t address;
+    i2c_device_stats_t stats;           // avg_latency_us calculated when stats are read
+    uint64_t latency_total_us;
+    unsigned int consecutive_failures;
+    TickType_t breaker_opened;          // Tick when breaker was (last) opened
+    bool probe_pending;                 // Breaker open and a probe transaction has been allowed (not recorded yet)
+} i2c_device_t;
+
+// Devices are added by the I2C task (first transaction with a device). Fields modified in critical sections.
+static i2c_device_t devices[I2C_MAX_DEVICES];
+static volatile unsigned int device_count = 0;
+
+// Tick of last bus recovery
+static TickType_t last_recovery;
+static bool recovered = false;
+
 
 void i2c_init(void){
-    // Nothing here
+    queue_signal = xSemaphoreCreateBinary();
+    i2c_hw_init();
+}
+
+/**
+ * Remove highest priority transaction from queue (and mark it active)
+ * @return Transaction or NULL if queue is empty
+ */
+static i2c_trans *i2c_dequeue(void){
+    i2c_trans *trans = NULL;
+    taskENTER_CRITICAL();
+    for(int prio = I2C_PRIO_COUNT - 1; prio >= 0; --prio){
+        if(queue_head[prio] != NULL){
+            trans = queue_head[prio];
+            queue_head[prio] = trans->next;
+            if(queue_head[prio] == NULL)
+                queue_tail[prio] = NULL;
+            trans->state = I2C_STATE_ACTIVE;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+    return trans;
+}
+
+/**
+ * Add transaction to end of queue for its priority class
+ * @param trans Transaction to queue
+ * @param waiter Task to notify when finished (NULL for none)
+ * @return true if queued; false if already queued or in progress
+ */
+static bool i2c_enqueue(i2c_trans *trans, TaskHandle_t waiter){
+    uint8_t prio = trans->priority < I2C_PRIO_COUNT ? trans->priority : I2C_PRIO_COUNT - 1;
+    taskENTER_CRITICAL();
+    if(trans->state != I2C_STATE_IDLE){
+        taskEXIT_CRITICAL();
+        return false;
+    }
+    trans->state = I2C_STATE_QUEUED;
+    trans->waiter = waiter;
+    trans->next = NULL;
+    trans->queued_at = delay_timestamp();
+    if(queue_tail[prio] == NULL){
+        queue_head[prio] = trans;
+    }else{
+        queue_tail[prio]->next = trans;
+    }
+    queue_tail[prio] = trans;
+    taskEXIT_CRITICAL();
+    xSemaphoreGive(queue_signal);
+    return true;
+}
+
+/**
+ * Remove a transaction from the queue if it has not started
+ * @param trans Transaction to remove
+ * @return true if removed; false if in progress or finished
+ */
+static bool i2c_cancel(i2c_trans *trans){
+    bool removed = false;
+    uint8_t prio = trans->priority < I2C_PRIO_COUNT ? trans->priority : I2C_PRIO_COUNT - 1;
+    taskENTER_CRITICAL();
+    if(trans->state == I2C_STATE_QUEUED){
+        i2c_trans *prev = NULL;
+        for(i2c_trans *t = queue_head[prio]; t != NULL; prev = t, t = t->next){
+            if(t == trans){
+                if(prev == NULL)
+                    queue_head[prio] = t->next;
+                else
+                    prev->next = t->next;
+                if(queue_tail[prio] == t)
+                    queue_tail[prio] = prev;
+                break;
+            }
+        }
+        trans->state = I2C_STATE_IDLE;
+        removed = true;
+    }
+    taskEXIT_CRITICAL();
+    return removed;
+}
+
+/**
+ * Find a device
+ * @param address Address of device
+ * @return Device or NULL if no transactions with the device have been performed
+ */
+static i2c_device_t *i2c_find_device(uint8_t address){
+    unsigned int count = device_count;
+    for(unsigned int i = 0; i < count; ++i){
+        if(devices[i].address == address)
+            return &devices[i];
+    }
+    return NULL;
+}
+
+/**
+ * Find a device, adding it if it has not been seen before. Only call from I2C task.
+ * @param address Address of device
+ * @return Device or NULL if too many devices
+ */
+static i2c_device_t *i2c_get_device(uint8_t address){
+    i2c_device_t *dev = i2c_find_device(address);
+    if(dev == NULL && device_count < I2C_MAX_DEVICES){
+        taskENTER_CRITICAL();
+        dev = &devices[device_count];
+        dev->address = address;
+        device_count++;
+        taskEXIT_CRITICAL();
+    }
+    return dev;
+}
+
+/**
+ * Check if a device's circuit breaker is open (transactions with the device rejected)
+ * If the open time has elapsed, the first transaction checked is allowed (as a probe) and later ones
+ * are rejected until the probe's result is recorded by i2c_record.
+ * @param dev Device (may be NULL)
+ * @return true if transactions with the device should fail without using the bus
+ */
+static bool i2c_breaker_rejects(i2c_device_t *dev){
+    if(dev == NULL || !dev->stats.breaker_open)
+        return false;
+    bool reject = true;
+    taskENTER_CRITICAL();
+    if(!dev->probe_pending && (xTaskGetTickCount() - dev->breaker_opened) >= pdMS_TO_TICKS(I2C_BREAKER_OPEN_MS)){
+        dev->probe_pending = true;
+        reject = false;
+    }
+    taskEXIT_CRITICAL();
+    return reject;
+}
+
+/**
+ * Update device statistics and circuit breaker after a transaction is performed on the bus
+ * @param dev Device (may be NULL)
+ * @param trans Transaction that was performed
+ * @param success Whether the transaction succeeded
+ */
+static void i2c_record(i2c_device_t *dev, i2c_trans *trans, bool success){
+    if(dev == NULL)
+        return;
+    uint32_t latency = delay_elapsed_us(trans->queued_at, delay_timestamp());
+    taskENTER_CRITICAL();
+    dev->stats.transactions++;
+    dev->latency_total_us += latency;
+    if(latency > dev->stats.max_latency_us)
+        dev->stats.max_latency_us = latency;
+    dev->probe_pending = false;
+    if(success){
+        dev->consecutive_failures = 0;
+        dev->stats.breaker_open = false;
+    }else{
+        dev->stats.failures++;
+        dev->consecutive_failures++;
+        if(dev->stats.breaker_open){
+            // Transaction allowed after open time failed. Stay open.
+            dev->breaker_opened = xTaskGetTickCount();
+        }else if(dev->consecutive_failures >= I2C_BREAKER_THRESHOLD){
+            dev->stats.breaker_open = true;
+            dev->stats.breaker_trips++;
+            dev->breaker_opened = xTaskGetTickCount();
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Recover the bus if the hardware layer requested it (rate limited)
+ * @param dev Device the failed transaction was with (may be NULL)
+ */
+static void i2c_recover(i2c_device_t *dev){
+    if(recovered && (xTaskGetTickCount() - last_recovery) < pdMS_TO_TICKS(I2C_RECOVERY_INTERVAL_MS))
+        return;
+    i2c_hw_recover();
+    recovery_needed = false;
+    recovered = true;
+    last_recovery = xTaskGetTickCount();
+    if(dev != NULL){
+        taskENTER_CRITICAL();
+        dev->stats.recoveries++;
+        taskEXIT_CRITICAL();
+    }
+}
+
+void i2c_process(void){
+    xSemaphoreTake(queue_signal, portMAX_DELAY);
+
+    // Higher priority transactions queued while one is in progress are performed next
+    i2c_trans *trans;
+    while((trans = i2c_dequeue()) != NULL){
+        i2c_device_t *dev = i2c_get_device(trans->address);
+        bool success = false;
+        if(i2c_breaker_rejects(dev)){
+            taskENTER_CRITICAL();
+            dev->stats.rejected++;
+            taskEXIT_CRITICAL();
+        }else{
+            success = i2c_hw_perform(trans);
+            trans_count++;
+            if(success)
+                recovery_needed = false;
+            else if(recovery_needed)
+                i2c_recover(dev);
+            i2c_record(dev, trans, success);
+        }
+
+        // Caller may reuse trans as soon as it is idle, so copy what is needed first
+        i2c_done_fn done = trans->done;
+        TaskHandle_t waiter = trans->waiter;
+        trans->success = success;
+        trans->state = I2C_STATE_IDLE;
+        if(waiter != NULL){
+            xTaskNotifyGiveIndexed(waiter, I2C_NOTIFY_INDEX);
+        }else if(done != NULL){
+            done(trans, success);
+        }
+    }
+}
+
+bool i2c_submit(i2c_trans *trans){
+    return i2c_enqueue(trans, NULL);
 }
 
 bool i2c_perform(i2c_trans *trans){
-    return false;
+    ulTaskNotifyValueClearIndexed(NULL, I2C_NOTIFY_INDEX, UINT32_MAX);
+    if(!i2c_enqueue(trans, xTaskGetCurrentTaskHandle()))
+        return false;
+
+    if(ulTaskNotifyTakeIndexed(I2C_NOTIFY_INDEX, pdTRUE, pdMS_TO_TICKS(I2C_QUEUE_TIMEOUT_MS)) == 0){
+        // Give up if not started yet. Otherwise, the I2C task is using trans (and its buffers), so
+        // must wait for it to finish (the hardware layer has its own timeouts)
+        if(i2c_cancel(trans))
+            return false;
+        ulTaskNotifyTakeIndexed(I2C_NOTIFY_INDEX, pdTRUE, portMAX_DELAY);
+    }
+    return trans->success;
 }
 
-#endif // CONTROL_BOARD_SIM
+uint32_t i2c_get_transaction_count(void){
+    return trans_count;
+}
+
+bool i2c_perform_retries(i2c_trans *trans, unsigned int timeout_ms, unsigned int *attempts){
+    TickType_t start = xTaskGetTickCount();
+    unsigned int delay_ms = I2C_RETRY_MIN_DELAY_MS;
+    unsigned int count = 0;
+    bool success;
+    while(1){
+        count++;
+        success = i2c_perform(trans);
+        if(success)
+            break;
 
-bool i2c_perform_retries(i2c_trans *trans, unsigned int delay_ms, unsigned int max_retires){
-    for(unsigned int i = 0; i < max_retires; ++i){
-        if(i2c_perform(trans))
-            return true;
+        // No point retrying while breaker rejects transactions
+        i2c_device_t *dev = i2c_find_device(trans->address);
+        if(dev != NULL && dev->stats.breaker_open)
+            break;
+
+        // Don't start another attempt after the timeout
+        if((xTaskGetTickCount() - start) + pdMS_TO_TICKS(delay_ms) > pdMS_TO_TICKS(timeout_ms))
+            break;
         vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        delay_ms *= 2;
+        if(delay_ms > I2C_RETRY_MAX_DELAY_MS)
+            delay_ms = I2C_RETRY_MAX_DELAY_MS;
+
+        if(dev != NULL){
+            taskENTER_CRITICAL();
+            dev->stats.retries++;
+            taskEXIT_CRITICAL();
+        }
     }
-    return false;
+    if(attempts != NULL)
+        *attempts = count;
+    return success;
+}
+
+bool i2c_get_device_stats(uint8_t address, i2c_device_stats_t *stats){
+    i2c_device_t *dev = i2c_find_device(address);
+    if(dev == NULL)
+        return false;
+    taskENTER_CRITICAL();
+    *stats = dev->stats;
+    uint64_t latency_total = dev->latency_total_us;
+    taskEXIT_CRITICAL();
+    stats->avg_latency_us = stats->transactions == 0 ? 0 : (uint32_t)(latency_total / stats->transactions);
+    return true;
 }
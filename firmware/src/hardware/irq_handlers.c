@@ -18,6 +18,8 @@
 
 
 #include <framework.h>
+#include <hardware/i2c.h>
+#include <hardware/delay.h>
 
 
 #ifdef CONTROL_BOARD_V1
@@ -74,19 +76,27 @@ void USB_TRCPT1_Handler (void){
 }
 
 void SERCOM2_0_Handler(void){
+    uint32_t start = delay_timestamp();
     SERCOM2_I2C_InterruptHandler();
+    i2c_isr_record(start);
 }
 
 void SERCOM2_1_Handler(void){
+    uint32_t start = delay_timestamp();
     SERCOM2_I2C_InterruptHandler();
+    i2c_isr_record(start);
 }
 
 void SERCOM2_2_Handler(void){
+    uint32_t start = delay_timestamp();
     SERCOM2_I2C_InterruptHandler();
+    i2c_isr_record(start);
 }
 
 void SERCOM2_OTHER_Handler(void){
+    uint32_t start = delay_timestamp();
     SERCOM2_I2C_InterruptHandler();
+    i2c_isr_record(start);
 }
 
 #endif // CONTROL_BOARD_V1
@@ -99,6 +109,8 @@ void SERCOM2_OTHER_Handler(void){
 extern TIM_HandleTypeDef htim11;
 extern TIM_HandleTypeDef htim1;
 extern I2C_HandleTypeDef hi2c1;
+extern DMA_HandleTypeDef hdma_i2c1_rx;
+extern DMA_HandleTypeDef hdma_i2c1_tx;
 
 void NMI_Handler(void){
     debug_halt(HALT_EC_FAULTIRQ);
@@ -141,11 +153,27 @@ void OTG_FS_IRQHandler(void){
 }
 
 void I2C1_EV_IRQHandler(void){
+    uint32_t start = delay_timestamp();
     HAL_I2C_EV_IRQHandler(&hi2c1);
+    i2c_isr_record(start);
 }
 
 void I2C1_ER_IRQHandler(void){
+    uint32_t start = delay_timestamp();
     HAL_I2C_ER_IRQHandler(&hi2c1);
+    i2c_isr_record(start);
+}
+
+void DMA1_Stream0_IRQHandler(void){
+    uint32_t start = delay_timestamp();
+    HAL_DMA_IRQHandler(&hdma_i2c1_rx);
+    i2c_isr_record(start);
+}
+
+void DMA1_Stream6_IRQHandler(void){
+    uint32_t start = delay_timestamp();
+    HAL_DMA_IRQHandler(&hdma_i2c1_tx);
+    i2c_isr_record(start);
 }
 
 
@@ -87,6 +87,10 @@ uint8_t usb_read(void){
     return tud_cdc_read_char();
 }
 
+unsigned int usb_read_multiple(uint8_t *buf, unsigned int len){
+    return tud_cdc_read(buf, len);
+}
+
 void usb_write(uint8_t b){
     if(!tud_cdc_write_char(b)){
         tud_cdc_write_flush();
@@ -94,6 +98,18 @@ void usb_write(uint8_t b){
     }
 }
 
+void usb_write_multiple(const uint8_t *buf, unsigned int len){
+    while(len > 0){
+        uint32_t count = tud_cdc_write(buf, len);
+        buf += count;
+        len -= count;
+        if(len > 0 && tud_cdc_write_flush() == 0 && count == 0){
+            // No space and nothing could be sent (not connected)
+            break;
+        }
+    }
+}
+
 void usb_flush(void){
     tud_cdc_write_flush();
 }
@@ -152,68 +168,176 @@ void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts){
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <util/circular_buffer.h>
+#include <stdatomic.h>
+#include <task.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/poll.h>
 #include <pthread.h>
-#include <sys/ioctl.h>
 
 
 // Buffers
 // Write buffer is linear (it is always emptied in full)
-// Read buffer is circular (ring) buffer
+// Read buffer is a lock-free single producer (socket thread), single consumer (pccomm task) ring buffer
+// Head and tail are free running counts (only socket thread writes head; only reading task writes tail)
 #define USB_WB_SIZE 128
-#define USB_RB_SIZE 128
+#define USB_RB_SIZE 4096            // Must be a power of 2
 static uint8_t write_buf[USB_WB_SIZE];
 static unsigned int write_buf_pos;
 static uint8_t read_buf_arr[USB_RB_SIZE];
-static circular_buffer read_buf;
+static atomic_uint read_head;
+static atomic_uint read_tail;
 static SemaphoreHandle_t avail_to_read_sem;
 
+// Simulated interrupt raised by socket thread when data is added to the read buffer
+// The FreeRTOS POSIX port simulates the tick interrupt with SIGALRM in the same way. The signal is handled by the
+// thread running the current task (all other threads block all signals) and is blocked in critical sections.
+// SIGUSR1 is used by the port to resume threads.
+#define USB_SIM_IRQ_SIGNAL  SIGUSR2
+static atomic_bool irq_pending;
+
 // Socket & thread stuff
+// Client socket is only closed by the socket thread. Writers hold client_lock while sending, so the socket is not
+// closed (and its descriptor reused by the next connection) while in use. On errors, writers only set write_failed.
+// When a connection is closed, closed_pending is set and reported by usb_process (like CDC line state changes).
 static int server_fd;
 static int client_fd = -1;
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool write_failed;
+static atomic_bool closed_pending;
 static struct sockaddr_in client_addr;
 static socklen_t client_addr_len;
 static pthread_t tid_socket;
-static bool socket_has_data;
+
+// SIGPIPE (other side disconnected) would terminate the program
+// Linux suppresses it per call (MSG_NOSIGNAL). macOS / *BSD suppress it per socket (SO_NOSIGPIPE).
+#ifdef MSG_NOSIGNAL
+#define USB_SEND_FLAGS      MSG_NOSIGNAL
+#else
+#define USB_SEND_FLAGS      0
+#endif
+
+// I/O statistics. Rx counts only written by socket thread. Tx counts only written by task holding pccomm write lock.
+static volatile usb_sim_stats_t usb_sim_stats;
+
+static void usb_sim_irq_handler(int sig){
+    (void)sig;
+
+    // Treat as ISR. Signals are blocked in handler. Critical nesting must be non-zero while
+    // yielding, otherwise leaving the critical section in vPortYield unblocks signals in the handler.
+    taskENTER_CRITICAL();
+    atomic_store(&irq_pending, false);
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    xSemaphoreGiveFromISR(avail_to_read_sem, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Raise simulated interrupt (unless one is already pending)
+ */
+static void usb_sim_raise_irq(void){
+    if(!atomic_exchange(&irq_pending, true)){
+        kill(getpid(), USB_SIM_IRQ_SIGNAL);
+        usb_sim_stats.rx_syscalls++;
+        usb_sim_stats.rx_irqs++;
+    }
+}
+
+/**
+ * Close client socket and report closed connection (socket thread only)
+ */
+static void usb_socket_disconnect(void){
+    pthread_mutex_lock(&client_lock);
+    close(client_fd);
+    client_fd = -1;
+    pthread_mutex_unlock(&client_lock);
+    atomic_store(&write_failed, false);
+    atomic_store(&closed_pending, true);
+    usb_sim_raise_irq();
+}
+
+/**
+ * Read available data from client socket into read buffer (socket thread only)
+ * @return false if connection lost
+ */
+static bool usb_socket_read(void){
+    unsigned int head = atomic_load_explicit(&read_head, memory_order_relaxed);
+    unsigned int space = USB_RB_SIZE - (head - atomic_load_explicit(&read_tail, memory_order_acquire));
+    if(space == 0){
+        // Full. Data stays in the socket until the pccomm task catches up.
+        struct timespec t = {.tv_sec = 0, .tv_nsec = 1000000};
+        nanosleep(&t, NULL);
+        return true;
+    }
+
+    // One call reads as much as fits (two segments if free space wraps around end of buffer)
+    unsigned int idx = head & (USB_RB_SIZE - 1);
+    unsigned int first = USB_RB_SIZE - idx;
+    if(first > space)
+        first = space;
+    struct iovec iov[2];
+    iov[0].iov_base = &read_buf_arr[idx];
+    iov[0].iov_len = first;
+    iov[1].iov_base = &read_buf_arr[0];
+    iov[1].iov_len = space - first;
+    ssize_t res = readv(client_fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    usb_sim_stats.rx_syscalls++;
+    if(res == 0 || (res == -1 && errno != EINTR && errno != EAGAIN)){
+        // Closed by other side or error
+        return false;
+    }
+    if(res <= 0)
+        return true;
+    atomic_store_explicit(&read_head, head + (unsigned int)res, memory_order_release);
+    usb_sim_stats.rx_bytes += (uint32_t)res;
+    usb_sim_raise_irq();
+    return true;
+}
 
 static void *socket_thread(void *arg){
     while(1){
-        while(client_fd == -1){
+        int fd = -1;
+        while(fd == -1){
             // Wait for a connection
-            client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_addr_len);
+            fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_addr_len);
         }
 
+        // Messages are small. Send them immediately instead of waiting to combine them.
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        // Writers can use the socket once it is configured
+        pthread_mutex_lock(&client_lock);
+        client_fd = fd;
+        pthread_mutex_unlock(&client_lock);
+
         while(client_fd != -1){
             // Wait until there is data ready to be read
             struct pollfd pfd;
             pfd.fd = client_fd;
             pfd.events = POLLIN;
             int res = poll(&pfd, 1, -1);
-            if(res == 0){
-                // Timeout. Shouldn't happen here
+            usb_sim_stats.rx_syscalls++;
+            if(res <= 0){
+                // Timeout (shouldn't happen here) or interrupted
                 continue;
             }
-            if((pfd.revents & POLLIN) != 0){
-                // Have data
-                socket_has_data = true;
-                
-                // Clear this event
-                pfd.revents &= ~POLLIN;
-            }
 
-            if(pfd.revents != 0){
-                // Any other events would be errors
-                socket_has_data = false;
-                close(client_fd);
-                client_fd = -1;
-            }
+            // Read data (or detect closed connection; read returns 0)
+            // Writers shut down the socket on errors, which also ends poll
+            if(atomic_load(&write_failed) || !usb_socket_read())
+                usb_socket_disconnect();
         }
     }
     return NULL;
@@ -248,48 +372,34 @@ bool usb_setup_socket(FILE *f, int port){
         return false;
     }
     client_fd = -1;
-    socket_has_data = false;
 
     // Success
     return true;
 }
 
 void usb_sim_interrupts(void){
-    if(socket_has_data){
-        socket_has_data = false;
-
-        unsigned int avail;
-        if(ioctl(client_fd, FIONREAD, &avail) == -1){
-            // Assume connection loss
-            return;
-        }
-        if(avail == 0)
-            return; // Shouldn't happen, but just in case
-
-        uint8_t b;
-        for(unsigned int i = 0; i < avail; ++i){
-            if(read(client_fd, &b, 1) == -1){
-                // Assume connection loss
-                return;
-            }
-            // Write data into the read buffer
-            if(!cb_write(&read_buf, b))
-                break;
-        }
-
-        // Give the semaphore b/c there's now data in the read buffer
-        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-        xSemaphoreGiveFromISR(avail_to_read_sem, &xHigherPriorityTaskWoken);
-        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-    }
+    // Nothing here. Socket thread raises a simulated interrupt when data arrives (see usb_sim_irq_handler).
 }
 
 void usb_init(void){
     // Buffers setup
     write_buf_pos = 0;
-    cb_init(&read_buf, read_buf_arr, USB_RB_SIZE);
+    atomic_init(&read_head, 0);
+    atomic_init(&read_tail, 0);
+    atomic_init(&irq_pending, false);
+    atomic_init(&write_failed, false);
+    atomic_init(&closed_pending, false);
     avail_to_read_sem = xSemaphoreCreateBinary();
 
+    // Simulated interrupt handler. All signals blocked while handling (same as tick interrupt).
+    // Restart system calls the interrupted task was making (eg socket writes)
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = usb_sim_irq_handler;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    sigaction(USB_SIM_IRQ_SIGNAL, &sa, NULL);
+
     // Parallel threads are used for read / write from / to socket
     // This prevents unexpected blocking behavior with RTOS threads
     // Things go poorly when RTOS threads invoke syscalls (blocks entire program)
@@ -310,18 +420,36 @@ void usb_init(void){
 
 void usb_process(void){
     xSemaphoreTake(avail_to_read_sem, portMAX_DELAY);
+    if(atomic_exchange(&closed_pending, false))
+        app_handle_uart_closed();
 }
 
 unsigned int usb_avail(void){
-    return CB_AVAIL_READ(&read_buf);
+    return atomic_load_explicit(&read_head, memory_order_acquire) - atomic_load_explicit(&read_tail, memory_order_relaxed);
 }
 
 uint8_t usb_read(void){
     uint8_t b;
-    cb_read(&read_buf, &b);
+    usb_read_multiple(&b, 1);
     return b;
 }
 
+unsigned int usb_read_multiple(uint8_t *buf, unsigned int len){
+    // No lock needed. Socket thread only adds data after head; this only removes data before head.
+    unsigned int tail = atomic_load_explicit(&read_tail, memory_order_relaxed);
+    unsigned int avail = atomic_load_explicit(&read_head, memory_order_acquire) - tail;
+    if(len > avail)
+        len = avail;
+    unsigned int idx = tail & (USB_RB_SIZE - 1);
+    unsigned int first = USB_RB_SIZE - idx;
+    if(first > len)
+        first = len;
+    memcpy(buf, &read_buf_arr[idx], first);
+    memcpy(&buf[first], &read_buf_arr[0], len - first);
+    atomic_store_explicit(&read_tail, tail + len, memory_order_release);
+    return len;
+}
+
 void usb_write(uint8_t b){
     write_buf[write_buf_pos] = b;
     write_buf_pos++;
@@ -329,50 +457,75 @@ void usb_write(uint8_t b){
         usb_flush();
 }
 
-static void do_write(int, uint8_t*, unsigned int);
+static void usb_send(const uint8_t*, unsigned int);
 
 void usb_flush(void){
-    do_write(client_fd, write_buf, write_buf_pos);
-    write_buf_pos = 0;
+    if(write_buf_pos > 0)
+        usb_send(NULL, 0);
 }
 
-static void do_write(int fd, uint8_t *buf, unsigned int count){
-    if(client_fd == -1)
+void usb_write_multiple(const uint8_t *buf, unsigned int len){
+    if(len > USB_WB_SIZE - write_buf_pos){
+        // Does not fit. Send buffered data and this data together.
+        usb_send(buf, len);
         return;
-    
-    // Have to mask SIGPIPE to prevent program termination when client disconnects
-    // The (more recent) POSIX standard way to do this is MSG_NOSIGPIPE in send syscall
-    // But macOS / *BSD seem to not support this (yet?). They use a sockoption, but that
-    // doesn't work for write call only send?
-    // And windows doesn't have SIGPIPE at all (one of the few cases windows is sane!)
-    // So instead of trying to prevent SIGPIPE with sigaction (Liunx specific), signal 
-    // (undefined behavior on Linux with multiple threads), etc just use pthreads masking
-    sigset_t set_mask_pipe;
-    sigemptyset(&set_mask_pipe);
-    sigaddset(&set_mask_pipe, SIGPIPE);
-    sigset_t old_set;
-    pthread_sigmask(SIG_BLOCK, &set_mask_pipe, &old_set);
-    
-    ssize_t res = write(fd, buf, count);
-    if(res == -1 && errno == EPIPE){
-        // Other side disconnected
-        socket_has_data = false;
-        close(client_fd);
-        client_fd = -1;
     }
+    memcpy(&write_buf[write_buf_pos], buf, len);
+    write_buf_pos += len;
+}
 
-    // After write call, have to handle the SIGPIPE if it is pending, otherwise it will be
-    // Sent elsewhere later
-    sigset_t set_pending;
-    sigpending(&set_pending);
-    if(sigismember(&set_pending, SIGPIPE)){
-        // Got a SIGPIPE. Must handle it before unmasking!
-        int res;
-        sigwait(&set_mask_pipe, &res);
+/**
+ * Send buffered data followed by more data using a single system call (unless the socket accepts less than all of it)
+ * Write buffer is empty after this
+ * @param buf Data to send after buffered data (NULL if len is 0)
+ * @param len Number of bytes of data to send after buffered data
+ */
+static void usb_send(const uint8_t *buf, unsigned int len){
+    struct iovec iov[2];
+    iov[0].iov_base = write_buf;
+    iov[0].iov_len = write_buf_pos;
+    iov[1].iov_base = (void*)buf;
+    iov[1].iov_len = len;
+    unsigned int remaining = write_buf_pos + len;
+    write_buf_pos = 0;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+    pthread_mutex_lock(&client_lock);
+    while(remaining > 0 && client_fd != -1 && !atomic_load(&write_failed)){
+        ssize_t res = sendmsg(client_fd, &msg, USB_SEND_FLAGS);
+        usb_sim_stats.tx_syscalls++;
+        if(res == -1){
+            if(errno == EINTR)
+                continue;
+            // Other side disconnected (EPIPE) or other error
+            // Shutdown wakes socket thread, which closes the socket
+            atomic_store(&write_failed, true);
+            shutdown(client_fd, SHUT_RDWR);
+            break;
+        }
+        usb_sim_stats.tx_bytes += (uint32_t)res;
+        remaining -= (unsigned int)res;
+
+        // Partial send. Skip what was sent.
+        size_t sent = (size_t)res;
+        while(msg.msg_iovlen > 0 && sent >= msg.msg_iov[0].iov_len){
+            sent -= msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if(msg.msg_iovlen > 0){
+            msg.msg_iov[0].iov_base = (uint8_t*)msg.msg_iov[0].iov_base + sent;
+            msg.msg_iov[0].iov_len -= sent;
+        }
     }
+    pthread_mutex_unlock(&client_lock);
+}
 
-    // Unmask
-    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+void usb_sim_get_stats(usb_sim_stats_t *stats){
+    *stats = usb_sim_stats;
 }
 
 #endif // CONTROL_BOARD_SIM_LINUX || CONTROL_BOARD_SIM_MACOS
@@ -400,18 +553,44 @@ static circular_buffer read_buf;
 static SemaphoreHandle_t avail_to_read_sem;
 
 // Socket & thread stuff
+// Client socket is only closed by the socket thread. Readers and writers hold client_lock while using the socket so
+// it is not closed while in use. On errors, writers only set write_failed.
+// When a connection is closed, closed_pending is set and reported by usb_process (like CDC line state changes).
 static WSADATA wsa;
 static SOCKET server_sock;
 static SOCKET client_sock;
+static CRITICAL_SECTION client_lock;
+static volatile bool write_failed;
+static volatile bool closed_pending;
 static bool socket_has_data;
 static HANDLE sock_thread_handle;
 
+// I/O statistics
+static volatile usb_sim_stats_t usb_sim_stats;
+
+/**
+ * Close client socket and report closed connection (socket thread only)
+ */
+static void usb_socket_disconnect(void){
+    EnterCriticalSection(&client_lock);
+    socket_has_data = false;
+    closesocket(client_sock);
+    client_sock = INVALID_SOCKET;
+    LeaveCriticalSection(&client_lock);
+    write_failed = false;
+    closed_pending = true;
+}
+
 static DWORD WINAPI socket_thread(void *arg){
     while(1){
-        while(client_sock == INVALID_SOCKET){
+        SOCKET sock = INVALID_SOCKET;
+        while(sock == INVALID_SOCKET){
             // Wait for a connection
-            client_sock = accept(server_sock, NULL, NULL);
+            sock = accept(server_sock, NULL, NULL);
         }
+        EnterCriticalSection(&client_lock);
+        client_sock = sock;
+        LeaveCriticalSection(&client_lock);
 
         while(client_sock != INVALID_SOCKET){
             // Wait until there is data ready to be read
@@ -419,6 +598,7 @@ static DWORD WINAPI socket_thread(void *arg){
             pfd.fd = client_sock;
             pfd.events = POLLIN;
             int res = WSAPoll(&pfd, 1, -1);
+            usb_sim_stats.rx_syscalls++;
             if(res == 0){
                 // Timeout. Shouldn't happen here
                 continue;
@@ -431,11 +611,9 @@ static DWORD WINAPI socket_thread(void *arg){
                 pfd.revents &= ~POLLIN;
             }
 
-            if(pfd.revents != 0){
-                // Any other events would be errors
-                socket_has_data = false;
-                closesocket(client_sock);
-                client_sock = INVALID_SOCKET;
+            if(pfd.revents != 0 || write_failed){
+                // Any other events would be errors (writers shut down the socket on errors)
+                usb_socket_disconnect();
             }
         }
     }
@@ -486,27 +664,32 @@ bool usb_setup_socket(FILE *f, int port){
 }
 
 void usb_sim_interrupts(void){
+    if(closed_pending){
+        // Wake usb_process to report closed connection
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        xSemaphoreGiveFromISR(avail_to_read_sem, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
     if(socket_has_data){
         socket_has_data = false;
 
-        u_long avail;
-        if(ioctlsocket(client_sock, FIONREAD, &avail) == SOCKET_ERROR){
-            // Assume connection loss
+        // One call reads as much as fits in the read buffer. The rest stays in the socket
+        // (and will be read later) instead of being read and discarded.
+        uint8_t buf[USB_RB_SIZE];
+        unsigned int space = CB_AVAIL_WRITE(&read_buf);
+        if(space == 0)
+            return;
+        EnterCriticalSection(&client_lock);
+        int res = recv(client_sock, (char*)buf, space, 0);
+        LeaveCriticalSection(&client_lock);
+        usb_sim_stats.rx_syscalls++;
+        if(res == SOCKET_ERROR || res == 0){
+            // Assume connection loss (poll in socket thread detects and closes)
             return;
         }
-        if(avail == 0)
-            return; // Shouldn't happen, but just in case
-
-        uint8_t b;
-        for(u_long i = 0; i < avail; ++i){
-            if(recv(client_sock, &b, 1, 0) == SOCKET_ERROR){
-                // Assume connection loss
-                return;
-            }
-            // Write data into the read buffer
-            if(!cb_write(&read_buf, b))
-                break;
-        }
+        cb_write_multiple(&read_buf, buf, res);
+        usb_sim_stats.rx_bytes += res;
+        usb_sim_stats.rx_irqs++;
 
         // Give the semaphore b/c there's now data in the read buffer
         BaseType_t xHigherPriorityTaskWoken = pdFALSE;
@@ -520,6 +703,9 @@ void usb_init(void){
     write_buf_pos = 0;
     cb_init(&read_buf, read_buf_arr, USB_RB_SIZE);
     avail_to_read_sem = xSemaphoreCreateBinary();
+    InitializeCriticalSection(&client_lock);
+    write_failed = false;
+    closed_pending = false;
 
     // Create thread for socket!
     sock_thread_handle = CreateThread(NULL, 0, socket_thread, NULL, 0, NULL);
@@ -529,6 +715,10 @@ void usb_init(void){
 
 void usb_process(void){
     xSemaphoreTake(avail_to_read_sem, portMAX_DELAY);
+    if(closed_pending){
+        closed_pending = false;
+        app_handle_uart_closed();
+    }
 }
 
 unsigned int usb_avail(void){
@@ -541,6 +731,14 @@ uint8_t usb_read(void){
     return b;
 }
 
+unsigned int usb_read_multiple(uint8_t *buf, unsigned int len){
+    // Read buffer is written from usb_sim_interrupts (tick hook)
+    taskENTER_CRITICAL();
+    len = cb_read_multiple(&read_buf, buf, len);
+    taskEXIT_CRITICAL();
+    return len;
+}
+
 void usb_write(uint8_t b){
     write_buf[write_buf_pos] = b;
     write_buf_pos++;
@@ -548,23 +746,57 @@ void usb_write(uint8_t b){
         usb_flush();
 }
 
-static void do_write(int, uint8_t*, unsigned int);
+static void usb_send(const uint8_t*, unsigned int);
 
 void usb_flush(void){
-    do_write(client_sock, write_buf, write_buf_pos);
-    write_buf_pos = 0;
+    if(write_buf_pos > 0)
+        usb_send(NULL, 0);
 }
 
-static void do_write(int fd, uint8_t *buf, unsigned int count){
-    if(client_sock == INVALID_SOCKET)
+void usb_write_multiple(const uint8_t *buf, unsigned int len){
+    if(len > USB_WB_SIZE - write_buf_pos){
+        // Does not fit. Send buffered data and this data together.
+        usb_send(buf, len);
         return;
-    
-    if(send(fd, buf, count, 0) == SOCKET_ERROR){
-        // Other side disconnected
-        socket_has_data = false;
-        closesocket(client_sock);
-        client_sock = INVALID_SOCKET;
     }
+    memcpy(&write_buf[write_buf_pos], buf, len);
+    write_buf_pos += len;
+}
+
+/**
+ * Send buffered data followed by more data using a single system call
+ * Write buffer is empty after this
+ * @param buf Data to send after buffered data (NULL if len is 0)
+ * @param len Number of bytes of data to send after buffered data
+ */
+static void usb_send(const uint8_t *buf, unsigned int len){
+    WSABUF bufs[2];
+    bufs[0].buf = (char*)write_buf;
+    bufs[0].len = write_buf_pos;
+    bufs[1].buf = (char*)buf;
+    bufs[1].len = len;
+    write_buf_pos = 0;
+
+    // Blocking socket. Sends all data unless there is an error.
+    EnterCriticalSection(&client_lock);
+    if(client_sock != INVALID_SOCKET && !write_failed){
+        DWORD sent;
+        int res = WSASend(client_sock, bufs, len > 0 ? 2 : 1, &sent, 0, NULL, NULL);
+        usb_sim_stats.tx_syscalls++;
+        if(res == SOCKET_ERROR){
+            // Other side disconnected
+            // Shutdown wakes socket thread, which closes the socket
+            write_failed = true;
+            shutdown(client_sock, SD_BOTH);
+        }else{
+            usb_sim_stats.tx_bytes += sent;
+        }
+    }
+    LeaveCriticalSection(&client_lock);
+}
+
+void usb_sim_get_stats(usb_sim_stats_t *stats){
+    *stats = usb_sim_stats;
 }
 
 #endif // CONTROL_BOARD_SIM_WIN
@@ -19,17 +19,33 @@
 #include <imu.h>
 #include <sensor/bno055.h>
 #include <cmdctrl.h>
+#include <app.h>
+#include <util/seqlock.h>
 #include <FreeRTOS.h>
-#include <semphr.h>
+#include <task.h>
 
 
 static uint8_t imu_which;
-static imu_data_t imu_data;
+static imu_data_t imu_data;                 // Latest data (only used by IMU task)
 
 static imu_data_t new_data;
 static unsigned int read_failures;
 
-SemaphoreHandle_t imu_mutex;
+// Published copies of imu_data (read by other tasks; see imu_get_data)
+static imu_data_t imu_data_pub[2];
+static seqlock_t imu_lock;
+
+// Reset requested by another task (handled by IMU task)
+static volatile bool reset_requested;
+
+
+/**
+ * Publish imu_data for other tasks. Only call from IMU task.
+ */
+static void imu_publish(void){
+    imu_data_pub[seqlock_write_index(&imu_lock)] = imu_data;
+    seqlock_write_publish(&imu_lock);
+}
 
 
 static void calc_accum_angles(void){
@@ -72,8 +88,10 @@ static void calc_accum_angles(void){
     }
 }
 
-void imu_reset_data(void){
-    xSemaphoreTake(imu_mutex, portMAX_DELAY);
+/**
+ * Reset imu_data and publish it. Only call from IMU task.
+ */
+static void imu_reset_data_internal(void){
     imu_data.quat.w = 0;
     imu_data.quat.x = 0;
     imu_data.quat.y = 0;
@@ -88,7 +106,12 @@ void imu_reset_data(void){
     imu_data.accum_angles.pitch = 0;
     imu_data.accum_angles.roll = 0;
     imu_data.accum_angles.yaw = 0;
-    xSemaphoreGive(imu_mutex);
+    imu_publish();
+}
+
+void imu_reset_data(void){
+    // May be called from any task, but only the IMU task writes imu_data
+    reset_requested = true;
 }
 
 void imu_init(void){
@@ -108,10 +131,14 @@ void imu_init(void){
     imu_data.accum_angles.pitch = 0;
     imu_data.accum_angles.roll = 0;
     imu_data.accum_angles.yaw = 0;
+    imu_data.seq = 0;
+    imu_data.timestamp_ms = 0;
+    reset_requested = false;
 
     // Reading imu_data is multiple read operations
-    // Want to ensure a write of imu_data cannot interrupt a read causing mixed data
-    imu_mutex = xSemaphoreCreateMutex();
+    // Other tasks read a published copy (seqlock) so a write cannot interrupt a read causing mixed data
+    seqlock_init(&imu_lock);
+    imu_data_pub[SEQLOCK_INDEX(0)] = imu_data;
 
     // Init code for all supported IMUs
     bno055_init();
@@ -124,7 +151,7 @@ static void imu_configure_if_needed(void){
         read_failures = 0;
 
         // Reset IMU data whenever IMU changes (prevents angle accumulation issues)
-        imu_reset_data();
+        imu_reset_data_internal();
     }
 
     // If no longer sim hijacked, cannot use sim IMU
@@ -133,7 +160,7 @@ static void imu_configure_if_needed(void){
         read_failures = 0;
         
         // Reset IMU data whenever IMU changes (prevents angle accumulation issues)
-        imu_reset_data();
+        imu_reset_data_internal();
     }
 
     // If too many read failures, assume IMU is no longer connected
@@ -142,7 +169,7 @@ static void imu_configure_if_needed(void){
         read_failures = 0;
 
         // Reset IMU data whenever IMU changes (prevents angle accumulation issues)
-        imu_reset_data();
+        imu_reset_data_internal();
     }
 
     // Already an active IMU (no need to configure one)
@@ -166,6 +193,12 @@ bool imu_read(void){
     // Configure IMU if needed
     imu_configure_if_needed();
 
+    // Handle reset requested by other tasks (or IMU driver while configuring)
+    if(reset_requested){
+        reset_requested = false;
+        imu_reset_data_internal();
+    }
+
     // If still no IMU, abort read
     if(imu_which == IMU_NONE){
         return false;
@@ -194,10 +227,15 @@ bool imu_read(void){
         // Calculate accumulated angles after data from IMU exists
         calc_accum_angles();
 
-        // Update imu_data while holding mutex
-        xSemaphoreTake(imu_mutex, portMAX_DELAY);
+        // Update and publish imu_data
+        // seq is not cleared by imu_reset_data, so it keeps increasing across IMU changes
+        new_data.seq = imu_data.seq + 1;
+        new_data.timestamp_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
         imu_data = new_data;
-        xSemaphoreGive(imu_mutex);
+        imu_publish();
+
+        // Control loop may be waiting for new samples
+        app_handle_imu_sample();
 
     }else{
         read_failures++;
@@ -209,16 +247,21 @@ bool imu_read(void){
 imu_data_t imu_get_data(void){
     imu_data_t ret_data;
 
-    // Read under mutex because reading a struct is multiple reads
-    // If reading from one thread and writing imu_data (via imu_read() function) on another thread
-    // imu_data could change part way through the read here.
-    xSemaphoreTake(imu_mutex, portMAX_DELAY);
-    ret_data = imu_data;
-    xSemaphoreGive(imu_mutex);
+    // Reading a struct is multiple reads. If the IMU task publishes new data part way through
+    // the read here, the read is retried (seqlock). Never blocks the reader or the IMU task.
+    uint32_t gen;
+    do{
+        gen = seqlock_read_begin(&imu_lock);
+        ret_data = imu_data_pub[SEQLOCK_INDEX(gen)];
+    }while(seqlock_read_retry(&imu_lock, gen));
 
     return ret_data;
 }
 
+uint32_t imu_get_read_retries(void){
+    return imu_lock.retries;
+}
+
 uint8_t imu_get_sensor(void){
     return imu_which;
 }
\ No newline at end of file
@@ -20,7 +20,9 @@
 #include <app.h>
 #include <util/matrix.h>
 #include <hardware/thruster.h>
+#include <hardware/delay.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include <semphr.h>
 #include <timers.h>
 #include <cmdctrl.h>
@@ -28,6 +30,7 @@
 
 #define _USE_MATH_DEFINES   // Enables things like M_PI on windows
 #include <math.h>
+#include <util/fastmath.h>
 
 #include <debug.h>
 #include <stdio.h>
@@ -50,6 +53,9 @@
 
 #define MAX(a, b)   (a > b ? a : b)
 
+// Iterations used to redistribute saturated thrusters' share with MC_ALLOC_PINV
+#define MC_PINV_ITERATIONS              4
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -70,22 +76,79 @@ static float mc_relscale[6];                                   // Relative DoF s
 static float dof_matrix_arr[8*6];                       // Backing array for DoF matrix
 static matrix dof_matrix;                               // DoF matrix
 
-static float overlap_arrs[8][8];                        // Backing arrays for overlap vectors
-static matrix overlap_vectors[8];                       // overlaps vectors
+// Overlap masks (calculated by mc_recalc)
+// Bit j of overlap_masks[i] is set if thrusters i and j both contribute to at least one DoF
+// A thruster that contributes to no DoFs has a mask of zero
+static uint8_t overlap_masks[8];
+
+// Scaling schedule (calculated by mc_recalc)
+// If overlaps split thrusters into disjoint groups (every thruster in a group overlaps with exactly
+// the thrusters in that group), each group can be scaled independently in a single pass.
+// Otherwise, scaling is done one thruster at a time (max speed first) using overlap_masks.
+static uint8_t scale_groups[8];                         // Mask of thrusters in each group
+static unsigned int scale_group_count;                  // Number of groups
+static bool scale_groups_valid;                         // True if overlaps form disjoint groups
+
+static mc_alloc_t alloc_method;                         // Thrust allocation method
+
+// Pseudo-inverse allocation (calculated by mc_recalc)
+// Least squares thruster speeds for DoF "wrench" w (wrench = dof_matrix^T * speeds) are pinv * w
+// pinv_scale scales DoF speeds (-1.0 to 1.0) to wrench such that full speed in any
+// single DoF results in max speed for at least one thruster
+static float pinv_arr[8*6];
+static float pinv_scale[6];
 
 static bool motors_killed;                              // Motor (watchdog) state
 static TimerHandle_t motor_wdog_timer;                  // Timer to implement motor watchdog
 
 static SemaphoreHandle_t motor_mutex;                   // Ensures motor & watchdog access is thread safe
 
+// Values derived from the vehicle's current orientation (see mc_attitude_get)
+// Modes are applied by the control loop (possibly faster than IMU samples arrive), but orientation
+// only changes when there is a new IMU sample. Thus, these are calculated once per orientation.
+// Only used by GLOBAL, SASSIST, and OHOLD modes, which are only applied by the control task
+// (cmdctrl_control_tick), so no lock is needed.
+typedef struct {
+    quaternion_t quat;              // Orientation these values were calculated for
+    quaternion_t grav_rot;          // Pitch & roll compensation quaternion (see mc_grav_rot)
+    float axis_x[3];                // <1, 0, 0> rotated by grav_rot
+    float axis_y[3];                // <0, 1, 0> rotated by grav_rot
+    float axis_z[3];                // <0, 0, 1> rotated by grav_rot
+    float pitch_axis[3];            // World pitch axis in vehicle frame (GLOBAL mode pitch speed)
+    float yaw_axis[3];              // World yaw axis in vehicle frame (GLOBAL mode yaw speed)
+    float twist_yaw;                // Yaw (degrees) from twist about z axis (OHOLD / SASSIST yaw speed)
+} mc_attitude_t;
+static mc_attitude_t attitude;
+static bool attitude_valid;
+
 // PID controllers for SASSIST mode
 static pid_controller_t xrot_pid, yrot_pid, zrot_pid, depth_pid;
 
+// Inner loop (angular rate) PID controllers for cascaded attitude control
+// When cascaded control is enabled for an axis, that axis's rotation PID output is a
+// rate setpoint (rad / sec) and the rate PID's output is the speed in the rotation DoF
+static pid_controller_t xrate_pid, yrate_pid, zrate_pid;
+static bool cascade_x, cascade_y, cascade_z;
+
 // Current targets for PIDs
 static euler_t pid_last_target;
 static bool pid_last_yaw_target;
 static float pid_last_depth = -999.0f;
 
+// Measurement for rotation PIDs: vehicle's rotation (radians, vehicle frame) since PIDs were last reset
+// Integrated from IMU angular rates. Used instead of error by rotation PIDs taking derivative of measurement.
+static float rot_meas_x, rot_meas_y, rot_meas_z;
+
+// Time between PID updates (measured, not assumed from control rate)
+#define MC_PID_GAIN_DT          0.02f           // Step (seconds) ki and kd are specified relative to
+#define MC_PID_DT_MAX           0.1f            // Longest dt used (ie after mode was not in use for a while)
+typedef struct {
+    uint32_t timestamp;                         // delay_timestamp of last update
+    TickType_t ticks;                           // RTOS ticks of last update (delay_timestamp only valid for short times)
+    bool valid;                                 // False before first update
+} mc_pid_clock_t;
+static mc_pid_clock_t depth_pid_clock, rot_pid_clock;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -98,37 +161,80 @@ static void mc_wdog_timeout(TimerHandle_t timer);
 void mc_init(void){
     // Initialize matrices
     matrix_init_static(&dof_matrix, dof_matrix_arr, 8, 6);
-    for(unsigned int i = 0; i < 8; ++i)
-        matrix_init_static(&overlap_vectors[i], overlap_arrs[i], 8, 1);
 
     // Initialize pid controllers
     xrot_pid.kP = 0.0f;
     xrot_pid.kI = 0.0f;
     xrot_pid.kD = 0.0f;
+    xrot_pid.kF = 0.0f;
+    xrot_pid.d_tau = 0.0f;
+    xrot_pid.d_on_meas = false;
     xrot_pid.min = -1.0f;
     xrot_pid.max = 1.0f;
     PID_RESET(xrot_pid);
     yrot_pid.kP = 0.0f;
     yrot_pid.kI = 0.0f;
     yrot_pid.kD = 0.0f;
+    yrot_pid.kF = 0.0f;
+    yrot_pid.d_tau = 0.0f;
+    yrot_pid.d_on_meas = false;
     yrot_pid.min = -1.0f;
     yrot_pid.max = 1.0f;
     PID_RESET(yrot_pid);
     zrot_pid.kP = 0.0f;
     zrot_pid.kI = 0.0f;
     zrot_pid.kD = 0.0f;
+    zrot_pid.kF = 0.0f;
+    zrot_pid.d_tau = 0.0f;
+    zrot_pid.d_on_meas = false;
     zrot_pid.min = -1.0f;
     zrot_pid.max = 1.0f;
     PID_RESET(zrot_pid);
     depth_pid.kP = 0.0f;
     depth_pid.kI = 0.0f;
     depth_pid.kD = 0.0f;
+    depth_pid.kF = 0.0f;
+    depth_pid.d_tau = 0.0f;
+    depth_pid.d_on_meas = false;
     depth_pid.min = -1.0f;
     depth_pid.max = 1.0f;
     PID_RESET(depth_pid);
+    xrate_pid.kP = 0.0f;
+    xrate_pid.kI = 0.0f;
+    xrate_pid.kD = 0.0f;
+    xrate_pid.kF = 0.0f;
+    xrate_pid.d_tau = 0.0f;
+    xrate_pid.d_on_meas = false;
+    xrate_pid.min = -1.0f;
+    xrate_pid.max = 1.0f;
+    PID_RESET(xrate_pid);
+    yrate_pid.kP = 0.0f;
+    yrate_pid.kI = 0.0f;
+    yrate_pid.kD = 0.0f;
+    yrate_pid.kF = 0.0f;
+    yrate_pid.d_tau = 0.0f;
+    yrate_pid.d_on_meas = false;
+    yrate_pid.min = -1.0f;
+    yrate_pid.max = 1.0f;
+    PID_RESET(yrate_pid);
+    zrate_pid.kP = 0.0f;
+    zrate_pid.kI = 0.0f;
+    zrate_pid.kD = 0.0f;
+    zrate_pid.kF = 0.0f;
+    zrate_pid.d_tau = 0.0f;
+    zrate_pid.d_on_meas = false;
+    zrate_pid.min = -1.0f;
+    zrate_pid.max = 1.0f;
+    PID_RESET(zrate_pid);
+
+    // Single loop attitude control by default
+    cascade_x = false;
+    cascade_y = false;
+    cascade_z = false;
 
     // Create required RTOS objects
     motor_mutex = xSemaphoreCreateMutex();
+    attitude_valid = false;
     motor_wdog_timer = xTimerCreate(
         "mwdog_tim",
         pdMS_TO_TICKS(MOTOR_WDOG_PERIOD_MS),
@@ -140,6 +246,9 @@ void mc_init(void){
     // Motors killed at startup
     motors_killed = true;
 
+    // Default to DoF matrix allocation
+    alloc_method = MC_ALLOC_DOF;
+
     // Default all motors to non-inverted
     for(unsigned int i = 0; i < 8; ++i){
         mc_invert[i] = false;
@@ -163,6 +272,26 @@ void mc_set_relscale(float *reldof){
     }
 }
 
+void mc_set_alloc(mc_alloc_t alloc){
+    alloc_method = alloc;
+}
+
+void mc_set_cascade(bool xrot, bool yrot, bool zrot){
+    // Rate PIDs have stale state if they were not in use
+    if(xrot && !cascade_x){
+        PID_RESET(xrate_pid);
+    }
+    if(yrot && !cascade_y){
+        PID_RESET(yrate_pid);
+    }
+    if(zrot && !cascade_z){
+        PID_RESET(zrate_pid);
+    }
+    cascade_x = xrot;
+    cascade_y = yrot;
+    cascade_z = zrot;
+}
+
 void mc_set_dof_matrix(unsigned int thruster_num, float *row_data){
     matrix_set_row(&dof_matrix, thruster_num - 1, row_data);
 }
@@ -170,39 +299,100 @@ void mc_set_dof_matrix(unsigned int thruster_num, float *row_data){
 void mc_recalc(void){
     // Called when done updating DoF matrix
 
-    // Construct contribution  matrix (used to calculate overlap vectors)
-    float contribution_arr[8*6];
-    matrix contribution_matrix;
-    matrix_init_static(&contribution_matrix, contribution_arr, 8, 6);
-    for(size_t row = 0; row < contribution_matrix.rows; ++row){
-        for(size_t col = 0; col < contribution_matrix.cols; ++col){
-            float dof_item;
-            matrix_get_item(&dof_item, &dof_matrix, row, col);
-            matrix_set_item(&contribution_matrix, row, col, (dof_item != 0) ? 1 : 0);
+    // Contribution of each thruster (bit d set if thruster contributes to DoF d)
+    uint8_t contribution[8];
+    for(unsigned int i = 0; i < 8; ++i){
+        contribution[i] = 0;
+        for(unsigned int d = 0; d < 6; ++d){
+            if(dof_matrix_arr[i * 6 + d] != 0)
+                contribution[i] |= (1 << d);
         }
     }
 
-    // Construct overlap vectors
-    float rowdata[8];
-    float v_arr[6];
-    matrix v;
-    matrix_init_static(&v, v_arr, 6, 1);
-    for(size_t r = 0; r < contribution_matrix.rows; ++r){
-        matrix_init_static(&overlap_vectors[r], overlap_arrs[r], contribution_matrix.rows, 1);
-
-        // v = contribution_matrix row r transposed
-        matrix_get_row(rowdata, &contribution_matrix, r);
-        matrix_set_col(&v, 0, rowdata);
+    // Thrusters overlap if they contribute to any of the same DoFs
+    for(unsigned int i = 0; i < 8; ++i){
+        overlap_masks[i] = 0;
+        for(unsigned int j = 0; j < 8; ++j){
+            if(contribution[i] & contribution[j])
+                overlap_masks[i] |= (1 << j);
+        }
+    }
 
-        matrix_mul(&overlap_vectors[r], &contribution_matrix, &v);
+    // Build scaling schedule
+    // Groups are disjoint if every thruster has the same mask as all thrusters it overlaps with
+    scale_groups_valid = true;
+    scale_group_count = 0;
+    uint8_t grouped = 0;
+    for(unsigned int i = 0; i < 8; ++i){
+        if(overlap_masks[i] == 0 || (grouped & (1 << i)))
+            continue;
+        for(unsigned int j = 0; j < 8; ++j){
+            if((overlap_masks[i] & (1 << j)) && overlap_masks[j] != overlap_masks[i])
+                scale_groups_valid = false;
+        }
+        scale_groups[scale_group_count++] = overlap_masks[i];
+        grouped |= overlap_masks[i];
+    }
 
-        for(size_t row = 0; row < overlap_vectors[r].rows; ++row){
-            for(size_t col = 0; col < overlap_vectors[r].cols; ++col){
-                float item;
-                matrix_get_item(&item, &overlap_vectors[r], row, col);
-                matrix_set_item(&overlap_vectors[r], row, col, (item != 0) ? 1 : 0);
+    // Pseudo-inverse: pinv = D * (D^T * D + lambda * I)^-1 where D is DoF matrix
+    // Small lambda keeps this well defined when some DoFs are not controllable
+    // (those DoFs will have all zeros in pinv)
+    // Inverse found by Gauss-Jordan elimination on [N | I]
+    float n[6][12];
+    float trace = 0.0f;
+    for(unsigned int r = 0; r < 6; ++r){
+        for(unsigned int c = 0; c < 6; ++c){
+            float sum = 0.0f;
+            for(unsigned int i = 0; i < 8; ++i)
+                sum += dof_matrix_arr[i * 6 + r] * dof_matrix_arr[i * 6 + c];
+            n[r][c] = sum;
+            n[r][c + 6] = (r == c) ? 1.0f : 0.0f;
+        }
+        trace += n[r][r];
+    }
+    float lambda = (trace > 0.0f) ? (1e-6f * trace) : 1.0f;
+    for(unsigned int r = 0; r < 6; ++r)
+        n[r][r] += lambda;
+    for(unsigned int c = 0; c < 6; ++c){
+        // Partial pivoting (N is symmetric positive definite, but pivoting is cheap)
+        unsigned int p = c;
+        for(unsigned int r = c + 1; r < 6; ++r){
+            if(fabsf(n[r][c]) > fabsf(n[p][c]))
+                p = r;
+        }
+        if(p != c){
+            for(unsigned int k = 0; k < 12; ++k){
+                float tmp = n[c][k];
+                n[c][k] = n[p][k];
+                n[p][k] = tmp;
             }
         }
+        float pivot = n[c][c];
+        for(unsigned int k = 0; k < 12; ++k)
+            n[c][k] /= pivot;
+        for(unsigned int r = 0; r < 6; ++r){
+            if(r == c)
+                continue;
+            float f = n[r][c];
+            for(unsigned int k = 0; k < 12; ++k)
+                n[r][k] -= f * n[c][k];
+        }
+    }
+    for(unsigned int i = 0; i < 8; ++i){
+        for(unsigned int c = 0; c < 6; ++c){
+            float sum = 0.0f;
+            for(unsigned int k = 0; k < 6; ++k)
+                sum += dof_matrix_arr[i * 6 + k] * n[k][c + 6];
+            pinv_arr[i * 6 + c] = sum;
+        }
+    }
+
+    // Scale so that full speed in one DoF gives max speed for the most used thruster
+    for(unsigned int c = 0; c < 6; ++c){
+        float mval = 0.0f;
+        for(unsigned int i = 0; i < 8; ++i)
+            mval = MAX(mval, fabsf(pinv_arr[i * 6 + c]));
+        pinv_scale[c] = (mval > 0.0f) ? (1.0f / mval) : 0.0f;
     }
 }
 
@@ -255,50 +445,12 @@ bool mc_wdog_is_killed(void){
 /// Extra math code (not in angles.c or matrix.c)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Rotate a vector (x, y, z) buy a quaternion q
-static inline void rotate_vector(float *dx, float *dy, float *dz, float sx, float sy, float sz, quaternion_t *q){
-    quaternion_t qv;
-    qv.w = 0.0f;
-    qv.x = sx;
-    qv.y = sy;
-    qv.z = sz;    
-    
-    quaternion_t qconj;
-    quat_conjugate(&qconj, q);
-
-    quaternion_t qr;
-    quat_multiply(&qr, &qv, &qconj);
-    quat_multiply(&qr, q, &qr);
-    *dx = qr.x;
-    *dy = qr.y;
-    *dz = qr.z;
-}
-
-// Rotate a vector (x, y, z) buy a the inverse of q
-static inline void rotate_vector_inv(float *dx, float *dy, float *dz, float sx, float sy, float sz, quaternion_t *q){
-    quaternion_t qv;
-    qv.w = 0.0f;
-    qv.x = sx;
-    qv.y = sy;
-    qv.z = sz;    
-    
-    quaternion_t qconj;
-    quat_conjugate(&qconj, q);
-
-    quaternion_t qr;
-    quat_multiply(&qr, &qv, q);
-    quat_multiply(&qr, &qconj, &qr);
-    *dx = qr.x;
-    *dy = qr.y;
-    *dz = qr.z;
-}
-
 // Quaternion rotation from vector a to vector b
 static inline void quat_between(quaternion_t *dest, float ax, float ay, float az, float bx, float by, float bz){
     float dot = ax*bx + ay*by + az*bz;
     float a_len2 = ax*ax + ay*ay + az*az;
     float b_len2 = bx*bx + by*by + bz*bz;
-    float p = sqrtf(a_len2 * b_len2);
+    float p = fmath_sqrt(a_len2 * b_len2);
     float cross_x = ay*bz - az*by;
     float cross_y = az*bx - ax*bz;
     float cross_z = ax*by - ay*bx;
@@ -475,10 +627,10 @@ static inline void mc_grav_rot(quaternion_t *qrot, const quaternion_t *qcurr){
     float grav_z = -qcurr->w*qcurr->w + qcurr->x*qcurr->x + qcurr->y*qcurr->y - qcurr->z*qcurr->z;
     
     // Make sure this is a unit vector
-    float grav_mag = sqrtf(grav_x*grav_x + grav_y*grav_y + grav_z*grav_z);
-    grav_x /= grav_mag;
-    grav_y /= grav_mag;
-    grav_z /= grav_mag;
+    float grav_inv_mag = fmath_inv_sqrt(grav_x*grav_x + grav_y*grav_y + grav_z*grav_z);
+    grav_x *= grav_inv_mag;
+    grav_y *= grav_inv_mag;
+    grav_z *= grav_inv_mag;
 
     // Get angle from <0, 0, -1> to <grav_x, grav_y, grav_z>
     quat_between(qrot, 0.0f, 0.0f, -1.0f, grav_x, grav_y, grav_z);
@@ -505,42 +657,115 @@ static inline void mc_euler_to_split_quat(quaternion_t *qpitch, quaternion_t *qr
     euler_to_quat(qyaw, &e_yaw);
 }
 
+// Get values derived from the current orientation (qcurr)
+// These are only recalculated when qcurr changes
+static void mc_attitude_get(mc_attitude_t *dest, const quaternion_t *qcurr){
+    if(!attitude_valid || memcmp(&attitude.quat, qcurr, sizeof(quaternion_t)) != 0){
+        attitude.quat = *qcurr;
+
+        // Translation axes (pitch and roll compensated)
+        // Rotated unit axes are the columns of the rotation matrix
+        float rot[3][3];
+        mc_grav_rot(&attitude.grav_rot, qcurr);
+        quat_to_rotmat(rot, &attitude.grav_rot);
+        rotmat_col(attitude.axis_x, rot, 0);
+        rotmat_col(attitude.axis_y, rot, 1);
+        rotmat_col(attitude.axis_z, rot, 2);
+
+        // Rotation axes (see mc_set_global)
+        quaternion_t q_pitch, q_roll, q_yaw;
+        float rot_pitch[3][3], rot_roll[3][3];
+        euler_t e_base;
+        mc_baseline_euler(&e_base, qcurr);
+        mc_euler_to_split_quat(&q_pitch, &q_roll, &q_yaw, e_base);
+        quat_to_rotmat(rot_pitch, &q_pitch);
+        quat_to_rotmat(rot_roll, &q_roll);
+        const float x_axis[3] = {1.0f, 0.0f, 0.0f};
+        const float z_axis[3] = {0.0f, 0.0f, 1.0f};
+        rotmat_rotate_inv(attitude.pitch_axis, rot_roll, x_axis);
+        rotmat_rotate_inv(attitude.yaw_axis, rot_pitch, z_axis);
+        rotmat_rotate_inv(attitude.yaw_axis, rot_roll, attitude.yaw_axis);
+
+        // Yaw from twist (see mc_set_ohold)
+        quaternion_t twist;
+        quat_twist(&twist, qcurr, 0, 0, 1);
+        attitude.twist_yaw = fmath_atan2(-2.0f * (twist.x*twist.y - twist.w*twist.z), 1.0f - 2.0f * (twist.x*twist.x + twist.z*twist.z));
+        attitude.twist_yaw *= 180.0f / M_PI;
+
+        attitude_valid = true;
+    }
+    *dest = attitude;
+}
+
+
 
+/**
+ * Apply tuning to a PID controller
+ * @param pid PID to tune
+ * @param tune Tuning (ki and kd relative to MC_PID_GAIN_DT step)
+ */
+static void mc_pid_tune(pid_controller_t *pid, const mc_pid_tune_t *tune){
+    pid->kP = tune->kp;
+    pid->kI = tune->ki / MC_PID_GAIN_DT;
+    pid->kD = tune->kd * MC_PID_GAIN_DT;
+    pid->kF = tune->kf;
+    pid->max = tune->limit;
+    pid->min = -tune->limit;
+    pid->invert = tune->invert;
+    pid->d_tau = tune->d_filter;
+    pid->d_on_meas = tune->d_on_meas;
+}
 
-void mc_sassist_tune_xrot(float kp, float ki, float kd, float limit, bool invert){
-    xrot_pid.kP = kp;
-    xrot_pid.kI = ki;
-    xrot_pid.kD = kd;
-    xrot_pid.max = limit;
-    xrot_pid.min = -limit;
-    xrot_pid.invert = invert;
+/**
+ * Get time since last PID update (seconds) and mark a new update
+ * @param clock Clock for a group of PIDs updated together
+ * @return dt (seconds). Limited to MC_PID_DT_MAX.
+ */
+static float mc_pid_dt(mc_pid_clock_t *clock){
+    uint32_t now = delay_timestamp();
+    TickType_t ticks = xTaskGetTickCount();
+    float dt;
+    if(!clock->valid){
+        dt = MC_PID_GAIN_DT;
+    }else if((ticks - clock->ticks) * portTICK_PERIOD_MS >= (TickType_t)(MC_PID_DT_MAX * 1000)){
+        dt = MC_PID_DT_MAX;
+    }else{
+        dt = delay_elapsed_us(clock->timestamp, now) * 1e-6f;
+        if(dt > MC_PID_DT_MAX)
+            dt = MC_PID_DT_MAX;
+    }
+    clock->timestamp = now;
+    clock->ticks = ticks;
+    clock->valid = true;
+    return dt;
 }
 
-void mc_sassist_tune_yrot(float kp, float ki, float kd, float limit, bool invert){
-    yrot_pid.kP = kp;
-    yrot_pid.kI = ki;
-    yrot_pid.kD = kd;
-    yrot_pid.max = limit;
-    yrot_pid.min = -limit;
-    yrot_pid.invert = invert;
+void mc_sassist_tune_xrot(const mc_pid_tune_t tune){
+    mc_pid_tune(&xrot_pid, &tune);
 }
 
-void mc_sassist_tune_zrot(float kp, float ki, float kd, float limit, bool invert){
-    zrot_pid.kP = kp;
-    zrot_pid.kI = ki;
-    zrot_pid.kD = kd;
-    zrot_pid.max = limit;
-    zrot_pid.min = -limit;
-    zrot_pid.invert = invert;
+void mc_sassist_tune_yrot(const mc_pid_tune_t tune){
+    mc_pid_tune(&yrot_pid, &tune);
 }
 
-void mc_sassist_tune_depth(float kp, float ki, float kd, float limit, bool invert){
-    depth_pid.kP = kp;
-    depth_pid.kI = ki;
-    depth_pid.kD = kd;
-    depth_pid.max = limit;
-    depth_pid.min = -limit;
-    depth_pid.invert = invert;
+void mc_sassist_tune_zrot(const mc_pid_tune_t tune){
+    mc_pid_tune(&zrot_pid, &tune);
+}
+
+void mc_sassist_tune_depth(const mc_pid_tune_t tune){
+    mc_pid_tune(&depth_pid, &tune);
+}
+
+void mc_sassist_tune_xrate(const mc_pid_tune_t tune){
+    mc_pid_tune(&xrate_pid, &tune);
+}
+
+void mc_sassist_tune_yrate(const mc_pid_tune_t tune){
+    mc_pid_tune(&yrate_pid, &tune);
+}
+
+void mc_sassist_tune_zrate(const mc_pid_tune_t tune){
+    mc_pid_tune(&zrate_pid, &tune);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -578,6 +803,89 @@ void mc_set_raw(float *speeds_noinv){
     xSemaphoreGive(motor_mutex);
 }
 
+/**
+ * Calculate thruster speeds from DoF values (speeds = mat * target)
+ * Same result as matrix_mul, but fixed size (8x6) so there are no size checks or
+ * index calculations and each row is fully unrolled
+ * @param speeds Thruster speeds (8 elements)
+ * @param mat 8x6 matrix (row major; eg dof_matrix_arr)
+ * @param target DoF values (6 elements)
+ */
+#if defined(CONTROL_BOARD_GENERIC_DOF_MUL)
+// Generic matrix functions (previous implementation). Host tests build both to compare results and time.
+static inline void mc_mul_8x6(float speeds[8], const float *mat, const float target[6]){
+    matrix mat_m, target_m, speeds_m;
+    matrix_init_static(&mat_m, (float*)mat, 8, 6);
+    matrix_init_static(&target_m, (float*)target, 6, 1);
+    matrix_init_static(&speeds_m, speeds, 8, 1);
+    matrix_mul(&speeds_m, &mat_m, &target_m);
+}
+#else
+static inline void mc_mul_8x6(float speeds[8], const float *mat, const float target[6]){
+    const float t0 = target[0], t1 = target[1], t2 = target[2];
+    const float t3 = target[3], t4 = target[4], t5 = target[5];
+    const float *row = mat;
+    for(unsigned int i = 0; i < 8; ++i, row += 6){
+        // Sum starts from zero like matrix_mul (so a sum of negative zeros is positive zero)
+        speeds[i] = 0.0f + row[0] * t0 + row[1] * t1 + row[2] * t2 + row[3] * t3 + row[4] * t4 + row[5] * t5;
+    }
+}
+#endif
+
+/**
+ * Calculate thruster speeds from DoF speeds using pseudo-inverse allocation
+ * Thrusters that would exceed max speed are held at max speed and the part of the wrench
+ * they could not provide is redistributed to the other thrusters (fixed number of iterations).
+ * If speeds still exceed max speed after that, all speeds are scaled down together.
+ * @param speeds Thruster speeds (8 elements)
+ * @param target DoF speeds (6 elements)
+ */
+static void mc_alloc_pinv(float speeds[8], const float target[6]){
+    float w[6];
+    for(unsigned int c = 0; c < 6; ++c)
+        w[c] = pinv_scale[c] * target[c];
+    mc_mul_8x6(speeds, pinv_arr, w);
+
+    uint8_t saturated = 0;
+    for(unsigned int iter = 0; iter < MC_PINV_ITERATIONS; ++iter){
+        // Hold thrusters that exceed max speed at max speed
+        bool clamped = false;
+        for(unsigned int i = 0; i < 8; ++i){
+            if(fabsf(speeds[i]) > 1.0f){
+                speeds[i] = copysignf(1.0f, speeds[i]);
+                saturated |= (1 << i);
+                clamped = true;
+            }
+        }
+        if(!clamped)
+            break;
+
+        // Wrench not provided (w - D^T * speeds)
+        float e[6];
+        for(unsigned int c = 0; c < 6; ++c){
+            e[c] = w[c];
+            for(unsigned int i = 0; i < 8; ++i)
+                e[c] -= dof_matrix_arr[i * 6 + c] * speeds[i];
+        }
+
+        // Redistribute to thrusters that are not saturated
+        float ds[8];
+        mc_mul_8x6(ds, pinv_arr, e);
+        for(unsigned int i = 0; i < 8; ++i){
+            if(!(saturated & (1 << i)))
+                speeds[i] += ds[i];
+        }
+    }
+
+    float mval = 0.0f;
+    for(unsigned int i = 0; i < 8; ++i)
+        mval = MAX(mval, fabsf(speeds[i]));
+    if(mval > 1.0f){
+        for(unsigned int i = 0; i < 8; ++i)
+            speeds[i] /= mval;
+    }
+}
+
 void mc_set_local(const mc_local_target_t target){
 
     // Shorthand names (will be optimized out by compiler)
@@ -588,10 +896,7 @@ void mc_set_local(const mc_local_target_t target){
     float yrot = target.yrot;
     float zrot = target.zrot;
 
-    float target_arr[6];
-    matrix target_mat;
-    matrix_init_static(&target_mat, target_arr, 6, 1);
-    matrix_set_col(&target_mat, 0, (float[]){x, y, z, xrot, yrot, zrot});
+    float target_arr[6] = {x, y, z, xrot, yrot, zrot};
 
     // Limit input speeds to correct range
     for(size_t i = 0; i < 6; ++i){
@@ -602,45 +907,68 @@ void mc_set_local(const mc_local_target_t target){
     }
 
     float speed_arr[8];
-    matrix speed_vec;
-    matrix_init_static(&speed_vec, speed_arr, 8, 1);
 
     // Base speed calculation
-    matrix_mul(&speed_vec, &dof_matrix, &target_mat);
-
-    // Scale motor speeds down as needed
-    // Note: If "bad" values get passed into mc_set_local (eg nan) due to some math or user input
-    //       error / bug, then this may become an infinite loop and deadlock the device
-    //       To avoid this, the max number of iterations is limited.
-    //       This should be done after no more than 8 iterations (scaling down each thruster individually if no overlap)
-    //       (actually 6, but 8 is close enough; 6 because only 6DoFs so if 8 thrusters at least 2 overlap)
-    //       If this loop exceeds 8 iterations, then an input was invalid. Thus, speed should not be passed
-    //       to raw mode.
-    //       This iteration counter break out of loop is not intended to ever be used. Values should be checked
-    //       before passing to this function ideally, but a deadlock bug is a severe issue. Thus, make sure it
-    //       can't be triggered by other (probably more minor) bugs.
-    unsigned int iteration_count = 0;
-    while(true){
-        iteration_count++;
-        if(iteration_count == 9)
-            break;
-        size_t idxrow, idxcol;
-        float mval;
-        matrix_absmax(&mval, &idxrow, &idxcol, &speed_vec);
-        if(mval <= 1)
-            break;
-        for(size_t i = 0; i < overlap_vectors[idxrow].rows; ++i){
-            float cval;
-            matrix_get_item(&cval, &overlap_vectors[idxrow], i, 0);
-            if(cval == 1){
-                matrix_get_item(&cval, &speed_vec, i, 0);
-                cval /= mval;
-                matrix_set_item(&speed_vec, i, 0, cval);
+    if(alloc_method == MC_ALLOC_PINV)
+        mc_alloc_pinv(speed_arr, target_arr);
+    else
+        mc_mul_8x6(speed_arr, dof_matrix_arr, target_arr);
+
+    // If "bad" values get passed into mc_set_local (eg nan) due to some math or user input error / bug
+    // the speeds will not be valid. They should not be passed to raw mode.
+    for(unsigned int i = 0; i < 8; ++i){
+        if(!isfinite(speed_arr[i]))
+            return;
+    }
+
+    // Scale motor speeds down as needed (pseudo-inverse allocation already handles this)
+    // Any thruster with a speed over 1 is scaled down to 1 and all thrusters it overlaps with
+    // are scaled by the same factor (maintaining the ratio of speeds in each DoF)
+    if(alloc_method == MC_ALLOC_PINV){
+        // Speeds are already limited by mc_alloc_pinv
+    }else if(scale_groups_valid){
+        // Disjoint groups: scale each group by the max speed in the group
+        for(unsigned int g = 0; g < scale_group_count; ++g){
+            uint8_t mask = scale_groups[g];
+            float mval = 0.0f;
+            for(unsigned int i = 0; i < 8; ++i){
+                if((mask & (1 << i)) && fabsf(speed_arr[i]) > mval)
+                    mval = fabsf(speed_arr[i]);
+            }
+            if(mval > 1){
+                for(unsigned int i = 0; i < 8; ++i){
+                    if(mask & (1 << i))
+                        speed_arr[i] /= mval;
+                }
+            }
+        }
+    }else{
+        // Groups are not disjoint (scaling one group may change the max of another)
+        // Repeatedly scale down overlaps of the thruster with the max speed
+        // Each iteration scales a different thruster to exactly 1, so this
+        // takes no more than 8 iterations. If it does not finish in 8 iterations,
+        // speeds are not passed to raw mode.
+        unsigned int iteration_count;
+        for(iteration_count = 0; iteration_count < 8; ++iteration_count){
+            unsigned int idx = 0;
+            float mval = fabsf(speed_arr[0]);
+            for(unsigned int i = 1; i < 8; ++i){
+                if(fabsf(speed_arr[i]) > mval){
+                    mval = fabsf(speed_arr[i]);
+                    idx = i;
+                }
+            }
+            if(mval <= 1)
+                break;
+            uint8_t mask = overlap_masks[idx];
+            for(unsigned int i = 0; i < 8; ++i){
+                if(mask & (1 << i))
+                    speed_arr[i] /= mval;
             }
         }
+        if(iteration_count == 8)
+            return;
     }
-    if(iteration_count == 9)
-        return;
 
     // Speed array already contains motor speeds in order
     // Because dof matrix rows are in order
@@ -657,27 +985,25 @@ void mc_set_global(const mc_global_target_t target, const quaternion_t curr_quat
     const float roll_spd = target.roll_spd;
     const float yaw_spd = target.yaw_spd;
 
+    // Values derived from current orientation
+    mc_attitude_t att;
+    mc_attitude_get(&att, &curr_quat);
+
     // -----------------------------------------------------------------------------------------------------------------
     // Translation
     // -----------------------------------------------------------------------------------------------------------------
-    // Use gravity vectors to construct pitch and roll compensation quaternion
-    quaternion_t qrot;
-    mc_grav_rot(&qrot, &curr_quat);
-
     // Compute each translation component separately and upscale
+    // Each component is the speed times its axis rotated by the pitch and roll compensation quaternion
     // Upscaling ensures largest magnitude of each component equals the speed of the component
     // Note that tx, ty, and tz vectors are in vehicle DoFs
     float tx_x, tx_y, tx_z;
-    rotate_vector(&tx_x, &tx_y, &tx_z, x, 0.0f, 0.0f, &qrot);
-    mc_upscale_vec(&tx_x, &tx_y, &tx_z, tx_x, tx_y, tx_z, x);
+    mc_upscale_vec(&tx_x, &tx_y, &tx_z, x * att.axis_x[0], x * att.axis_x[1], x * att.axis_x[2], x);
 
     float ty_x, ty_y, ty_z;
-    rotate_vector(&ty_x, &ty_y, &ty_z, 0.0f, y, 0.0f, &qrot);
-    mc_upscale_vec(&ty_x, &ty_y, &ty_z, ty_x, ty_y, ty_z, y);
+    mc_upscale_vec(&ty_x, &ty_y, &ty_z, y * att.axis_y[0], y * att.axis_y[1], y * att.axis_y[2], y);
 
     float tz_x, tz_y, tz_z;
-    rotate_vector(&tz_x, &tz_y, &tz_z, 0.0f, 0.0f, z, &qrot);
-    mc_upscale_vec(&tz_x, &tz_y, &tz_z, tz_x, tz_y, tz_z, z);
+    mc_upscale_vec(&tz_x, &tz_y, &tz_z, z * att.axis_z[0], z * att.axis_z[1], z * att.axis_z[2], z);
     
     // Combine each translation component
     float lx = tx_x + ty_x + tz_x;
@@ -695,12 +1021,6 @@ void mc_set_global(const mc_global_target_t target, const quaternion_t curr_quat
     // -----------------------------------------------------------------------------------------------------------------
     // Rotation
     // -----------------------------------------------------------------------------------------------------------------
-    // Get split pitch, roll, and yaw quaternions
-    quaternion_t q_pitch, q_roll, q_yaw;
-    euler_t e_base;
-    mc_baseline_euler(&e_base, &curr_quat);
-    mc_euler_to_split_quat(&q_pitch, &q_roll, &q_yaw, e_base);
-
     // Compute each rotation component seperately
     // s_roll, s_pitch, s_yaw are in zero rotation frame
     // Ie: s_yaw = <0, 0, yaw_spd> means rotation about world z to change vehicle yaw
@@ -709,21 +1029,20 @@ void mc_set_global(const mc_global_target_t target, const quaternion_t curr_quat
     // Roll is already in vehicle frame (last rotation applied)
     float w_roll_y = roll_spd;
 
-    // w_pitch = q_roll_inv * s_pitch * q_roll
+    // w_pitch = q_roll_inv * s_pitch * q_roll = pitch_spd * pitch_axis
     // s_pitch = <pitch_spd, 0, 0>
     // Note: In gimbal lock scenarios (pitch = +/-90 deg) changing vehicle pitch
     //       is ambiguous. This will use the "zero roll" solution
     //       However, this may cause discontinuous motion when moving through gimbal lock positions
-    float s_pitch_x = pitch_spd, s_pitch_y = 0.0f, s_pitch_z = 0.0f;
-    float w_pitch_x, w_pitch_y, w_pitch_z;
-    rotate_vector_inv(&w_pitch_x, &w_pitch_y, &w_pitch_z, s_pitch_x, s_pitch_y, s_pitch_z, &q_roll);
+    float w_pitch_x = pitch_spd * att.pitch_axis[0];
+    float w_pitch_y = pitch_spd * att.pitch_axis[1];
+    float w_pitch_z = pitch_spd * att.pitch_axis[2];
 
-    // w_yaw = q_roll_inv * q_pitch_inv * s_yaw * q_pitch * q_roll
+    // w_yaw = q_roll_inv * q_pitch_inv * s_yaw * q_pitch * q_roll = yaw_spd * yaw_axis
     // s_yaw = <0, 0, yaw_spd>
-    float s_yaw_x = 0.0f, s_yaw_y = 0.0f, s_yaw_z = yaw_spd;
-    float w_yaw_x, w_yaw_y, w_yaw_z;
-    rotate_vector_inv(&w_yaw_x, &w_yaw_y, &w_yaw_z, s_yaw_x, s_yaw_y, s_yaw_z, &q_pitch);
-    rotate_vector_inv(&w_yaw_x, &w_yaw_y, &w_yaw_z, w_yaw_x, w_yaw_y, w_yaw_z, &q_roll);
+    float w_yaw_x = yaw_spd * att.yaw_axis[0];
+    float w_yaw_y = yaw_spd * att.yaw_axis[1];
+    float w_yaw_z = yaw_spd * att.yaw_axis[2];
 
     // Scale up each group as needed
     // Note: not needed for w_roll because only one component
@@ -755,15 +1074,21 @@ void mc_set_global(const mc_global_target_t target, const quaternion_t curr_quat
     mc_set_local(local_target);
 }
 
-void mc_set_sassist(const mc_sassist_target_t target, const quaternion_t curr_quat, const float curr_depth){
+void mc_set_sassist(const mc_sassist_target_t target, const quaternion_t curr_quat, const gyro_data_t curr_gyro, const float curr_depth){
     
 
+    float dt = mc_pid_dt(&depth_pid_clock);
+
     // Reset PID controllers when targets change significantlly
+    // Feed-forward input is the rate the target depth changes (m / sec; zero after reset)
+    float target_rate = 0.0f;
     if(fabsf(pid_last_depth - target.target_depth) > 0.01){
         PID_RESET(depth_pid);
+    }else if(dt > 0.0f){
+        target_rate = (target.target_depth - pid_last_depth) / dt;
     }
     
-    float z = -pid_calculate(&depth_pid, curr_depth - target.target_depth);
+    float z = pid_calculate(&depth_pid, target.target_depth, curr_depth, target_rate, dt);
     pid_last_depth = target.target_depth;
 
     const mc_ohold_target_t ohold_target = {
@@ -775,10 +1100,10 @@ void mc_set_sassist(const mc_sassist_target_t target, const quaternion_t curr_qu
         .use_yaw_pid = target.use_yaw_pid
     };
 
-    mc_set_ohold(ohold_target, curr_quat);
+    mc_set_ohold(ohold_target, curr_quat, curr_gyro);
 }
 
-void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat){
+void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat, const gyro_data_t curr_gyro){
 
     // Shorthand names (will be optimized out by compiler)
     const float x = target.x;
@@ -793,32 +1118,25 @@ void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat){
     float base_yrot = 0.0f;
     float base_zrot = 0.0f;
 
-    // Use gravity vectors to construct pitch and roll compensation quaternion
-    // Used for x/y translation, but also for yaw speed if not using yaw target PID
-    quaternion_t qrot;
-    mc_grav_rot(&qrot, &curr_quat);
+    // Values derived from current orientation
+    // Pitch and roll compensated axes are used for x/y translation, but also for yaw speed if not using yaw target PID
+    mc_attitude_t att;
+    mc_attitude_get(&att, &curr_quat);
 
     // -----------------------------------------------------------------------------------------------------------------
     // Handle Open-Loop Yaw control (no yaw PID / yaw target, but instead a yaw speed)
     // -----------------------------------------------------------------------------------------------------------------
     if(!use_yaw_pid){
-        // Get twist part of current quaternion about z axis
-        quaternion_t curr_twist;
-        quat_twist(&curr_twist, &curr_quat, 0, 0, 1);
-
-        // Extract yaw from twist quaternion.
+        // Yaw extracted from twist part of current quaternion about z axis
         // Doing this with twist quat ensures the extracted yaw is not "offset by 180"
         // as it could be with converting curr_quat directly to euler angles
         // Eg: Consider pitch = 115, roll = 0, yaw = 0
         //     This is improper. The proper representation is pitch = 65, roll = -180, yaw = -180
         //     But we need a yaw of zero, not 180!
-        float curr_yaw = atan2f(-2.0f * (curr_twist.x*curr_twist.y - curr_twist.w*curr_twist.z), 1.0f - 2.0f * (curr_twist.x*curr_twist.x + curr_twist.z*curr_twist.z));
-        curr_yaw *= 180.0f / M_PI;
-        target_euler.yaw = curr_yaw;
+        target_euler.yaw = att.twist_yaw;
 
         // Same as yaw speed in GLOBAL mode
-        rotate_vector(&base_xrot, &base_yrot, &base_zrot, 0.0f, 0.0f, yaw_spd, &qrot);
-        mc_upscale_vec(&base_xrot, &base_yrot, &base_zrot, base_xrot, base_yrot, base_zrot, yaw_spd);
+        mc_upscale_vec(&base_xrot, &base_yrot, &base_zrot, yaw_spd * att.axis_z[0], yaw_spd * att.axis_z[1], yaw_spd * att.axis_z[2], yaw_spd);
     }
     // -----------------------------------------------------------------------------------------------------------------
 
@@ -852,8 +1170,8 @@ void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat){
     quat_multiply(&q_d, &q_c_conj, &target_quat);
 
     // Convert q_d to axis angle
-    float mag = sqrtf(q_d.x*q_d.x + q_d.y*q_d.y + q_d.z*q_d.z);
-    float theta = 2.0f * atan2f(mag, q_d.w);
+    float mag = fmath_sqrt(q_d.x*q_d.x + q_d.y*q_d.y + q_d.z*q_d.z);
+    float theta = 2.0f * fmath_atan2(mag, q_d.w);
     float ax = q_d.x;
     float ay = q_d.y;
     float az = q_d.z;
@@ -894,12 +1212,47 @@ void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat){
         PID_RESET(xrot_pid);
         PID_RESET(yrot_pid);
         PID_RESET(zrot_pid);
+        PID_RESET(xrate_pid);
+        PID_RESET(yrate_pid);
+        PID_RESET(zrate_pid);
+        rot_meas_x = 0.0f;
+        rot_meas_y = 0.0f;
+        rot_meas_z = 0.0f;
+    }
+
+    // Gyro is deg / sec in vehicle frame (same frame as errors above)
+    float w_x = curr_gyro.x * (M_PI / 180.0f);
+    float w_y = curr_gyro.y * (M_PI / 180.0f);
+    float w_z = curr_gyro.z * (M_PI / 180.0f);
+    if(!use_yaw_pid){
+        // Rotation about world z is commanded by yaw speed (open loop), not the PIDs
+        // Remove it from measured rate so the PIDs do not resist it
+        float w_yaw = w_x * att.axis_z[0] + w_y * att.axis_z[1] + w_z * att.axis_z[2];
+        w_x -= w_yaw * att.axis_z[0];
+        w_y -= w_yaw * att.axis_z[1];
+        w_z -= w_yaw * att.axis_z[2];
     }
 
     // Use PID controllers to calculate current outputs
-    float xrot = pid_calculate(&xrot_pid, e_x);
-    float yrot = pid_calculate(&yrot_pid, e_y);
-    float zrot = pid_calculate(&zrot_pid, e_z);
+    // Measurement is rotation since reset. Setpoint is measurement + error, so the PID error is exactly the
+    // orientation error and derivative of measurement is the vehicle's angular rate.
+    // Rotation PIDs have no feed-forward input (targets are steps; PIDs are reset when they change)
+    float dt = mc_pid_dt(&rot_pid_clock);
+    rot_meas_x += w_x * dt;
+    rot_meas_y += w_y * dt;
+    rot_meas_z += w_z * dt;
+    float xrot = pid_calculate(&xrot_pid, rot_meas_x + e_x, rot_meas_x, 0.0f, dt);
+    float yrot = pid_calculate(&yrot_pid, rot_meas_y + e_y, rot_meas_y, 0.0f, dt);
+    float zrot = pid_calculate(&zrot_pid, rot_meas_z + e_z, rot_meas_z, 0.0f, dt);
+
+    // Cascaded control: outputs above are rate setpoints for inner rate loops
+    // Feed-forward input is the rate setpoint
+    if(cascade_x)
+        xrot = pid_calculate(&xrate_pid, xrot, w_x, xrot, dt);
+    if(cascade_y)
+        yrot = pid_calculate(&yrate_pid, yrot, w_y, yrot, dt);
+    if(cascade_z)
+        zrot = pid_calculate(&zrate_pid, zrot, w_z, zrot, dt);
 
     // Store old targets (used to determine when to reset PIDs)
     pid_last_target = target_euler;
@@ -926,16 +1279,13 @@ void mc_set_ohold(const mc_ohold_target_t target, const quaternion_t curr_quat){
     // Upscaling ensures largest magnitude of each component equals the speed of the component
     // Note that tx, ty, and tz vectors are in vehicle DoFs
     float tx_x, tx_y, tx_z;
-    rotate_vector(&tx_x, &tx_y, &tx_z, x, 0.0f, 0.0f, &qrot);
-    mc_upscale_vec(&tx_x, &tx_y, &tx_z, tx_x, tx_y, tx_z, x);
+    mc_upscale_vec(&tx_x, &tx_y, &tx_z, x * att.axis_x[0], x * att.axis_x[1], x * att.axis_x[2], x);
 
     float ty_x, ty_y, ty_z;
-    rotate_vector(&ty_x, &ty_y, &ty_z, 0.0f, y, 0.0f, &qrot);
-    mc_upscale_vec(&ty_x, &ty_y, &ty_z, ty_x, ty_y, ty_z, y);
+    mc_upscale_vec(&ty_x, &ty_y, &ty_z, y * att.axis_y[0], y * att.axis_y[1], y * att.axis_y[2], y);
 
     float tz_x, tz_y, tz_z;
-    rotate_vector(&tz_x, &tz_y, &tz_z, 0.0f, 0.0f, z, &qrot);
-    mc_upscale_vec(&tz_x, &tz_y, &tz_z, tz_x, tz_y, tz_z, z);
+    mc_upscale_vec(&tz_x, &tz_y, &tz_z, z * att.axis_z[0], z * att.axis_z[1], z * att.axis_z[2], z);
     
     // Combine each translation component
     float lx = tx_x + ty_x + tz_x;
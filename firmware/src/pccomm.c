@@ -19,6 +19,8 @@
 #include <pccomm.h>
 #include <hardware/usb.h>
 #include <util/conversions.h>
+#include <util/crc16.h>
+#include <string.h>
 #include <FreeRTOS.h>
 #include <semphr.h>
 
@@ -31,62 +33,126 @@ uint8_t pccomm_read_buf[PCCOMM_MAX_MSG_LEN + 4];
 unsigned int pccomm_read_len = 0;
 uint16_t pccomm_read_crc = 0;
 
+pccomm_stats_t pccomm_stats = {0};
+
+// Queue of received messages (parsed, but not yet handled)
+// The message currently being parsed is always built in rx_queue[rx_queue_write]
+// and is only added to the queue (write index advanced) once it is complete and valid
+typedef struct {
+    uint8_t data[PCCOMM_MAX_MSG_LEN + 4];
+    unsigned int len;
+} rx_msg_t;
+static rx_msg_t rx_queue[PCCOMM_RX_QUEUE_LEN];
+static unsigned int rx_queue_write = 0;
+static unsigned int rx_queue_read = 0;
+static unsigned int rx_queue_count = 0;
+
 static uint16_t curr_msg_id = 0;
 
-// Used in pccomm_write to ensure pccomm_write call is thread safe
-static SemaphoreHandle_t msg_write_mutex;
+// Chunk of data read from usb that has not been parsed yet
+#define READ_CHUNK_SIZE     64
+static uint8_t read_chunk[READ_CHUNK_SIZE];
+static unsigned int read_chunk_pos = 0;
+static unsigned int read_chunk_len = 0;
 
+// Complete (escaped) frame being written. Worst case every byte of id, payload, and CRC is escaped.
+// Only used while holding msg_write_mutex
+#define WRITE_FRAME_SIZE    (2 + 2 * (PCCOMM_MAX_MSG_LEN + 4))
+static uint8_t write_frame[WRITE_FRAME_SIZE];
+
+// Used in pccomm_writev to ensure pccomm_writev call is thread safe
+static SemaphoreHandle_t msg_write_mutex;
 
-#define crc16_ccitt_false(data, len)      crc16_ccitt_false_partial((data), (len), 0xFFFF)  
 
 void pccomm_init(void){
     msg_write_mutex = xSemaphoreCreateMutex();
 }
 
 /**
- * Calculate 16-bit CRC (CCITT-FALSE) of the given data
- * @param data Data to calculate crc of
+ * Find the first special byte (START_BYTE, END_BYTE, ESCAPE_BYTE) in data
+ * Special bytes are the only bytes >= 253, so each word is checked at once:
+ * a byte is special if its MSB is set and its low 7 bits are >= 0x7D
+ * (adding 3 to the low 7 bits carries into the MSB position)
+ * @param data Data to search
  * @param len Length of data
- * @param initial Initial value to use in calc. Useful for fragmented data sets. 65535 for "default"
- * @return uint16_t Calculated crc
+ * @return unsigned int Index of first special byte (len if there is none)
  */
-uint16_t crc16_ccitt_false_partial(uint8_t *data, unsigned int len, uint16_t initial){
-    uint16_t crc = initial;
+static unsigned int find_special_byte(const uint8_t *data, unsigned int len){
     unsigned int pos = 0;
-    while(pos < len){
-        uint8_t b = data[pos];
-        for(int i = 0; i < 8; ++i){
-            uint8_t bit = ((b >> (7 - i) & 1) == 1);
-            uint8_t c15 = ((crc >> 15 & 1) == 1);
-            crc <<= 1;
-            if(c15 ^ bit){
-                crc ^= 0x1021;
-            }
-        }
-        pos++;
+    while(len - pos >= 4){
+        uint32_t w;
+        memcpy(&w, &data[pos], 4);
+        if((((w & 0x7F7F7F7FUL) + 0x03030303UL) & w & 0x80808080UL) != 0)
+            break;
+        pos += 4;
     }
-    return crc;
+    while(pos < len && data[pos] < START_BYTE)
+        pos++;
+    return pos;
 }
 
-bool pccomm_read_and_parse(void){
-    if(!usb_initialized)
-        return false;
-
+/**
+ * Parse available data from usb. Complete, valid messages are added to rx_queue.
+ * Stops when there is no more data or when rx_queue is full (remaining data is
+ * left in usb buffers until there is space in the queue).
+ */
+static void pccomm_parse(void){
     // Messages can be read & parsed over multiple calls
     // Thus, need to keep  track of current state and current message
     static bool parse_started = false;
     static bool parse_escaped = false;
+    static bool parse_truncated = false;
 
-    // Read available bytes one at a time and parse them
+    // Data is read from usb in chunks, then parsed
+    // Runs of normal data bytes are copied at once. Only special bytes
+    // (and the byte after an escape) go through the state machine one at a time.
     uint8_t byte;
-    while(usb_avail()){        
-        // Read the next available character
-        byte = usb_read();
+    rx_msg_t *curr = &rx_queue[rx_queue_write];
+    while(1){
+        if(rx_queue_count == PCCOMM_RX_QUEUE_LEN){
+            // No space to parse another message into
+            if(read_chunk_pos != read_chunk_len || usb_avail())
+                pccomm_stats.rx_queue_full++;
+            break;
+        }
 
-        // If message queue is full, discard bytes
-        // Allow normal code to run for start byte because it will zero len
-        if(byte != START_BYTE && pccomm_read_len == PCCOMM_MAX_MSG_LEN)
+        if(read_chunk_pos == read_chunk_len){
+            // Parsed the entire chunk. Get more data.
+            read_chunk_pos = 0;
+            read_chunk_len = usb_read_multiple(read_chunk, READ_CHUNK_SIZE);
+            if(read_chunk_len == 0)
+                break;
+        }
+
+        if(!parse_escaped){
+            // Find run of normal data bytes
+            unsigned int run = find_special_byte(&read_chunk[read_chunk_pos], read_chunk_len - read_chunk_pos);
+            if(parse_started){
+                // Copy data bytes. If message buffer is full, discard bytes.
+                unsigned int count = PCCOMM_MAX_MSG_LEN - curr->len;
+                if(run < count)
+                    count = run;
+                else if(run > count)
+                    parse_truncated = true;
+                memcpy(&curr->data[curr->len], &read_chunk[read_chunk_pos], count);
+                curr->len += count;
+            }
+            // When not started, data bytes are just skipped
+            read_chunk_pos += run;
+            if(read_chunk_pos == read_chunk_len)
+                continue;
+        }
+
+        // Next byte is either a special byte or an escaped byte
+        byte = read_chunk[read_chunk_pos++];
+
+        // If message buffer is full, discard escaped (data) bytes
+        // Unescaped special bytes are never data, so they are always handled
+        if(parse_escaped && curr->len == PCCOMM_MAX_MSG_LEN){
+            parse_truncated = true;
+            parse_escaped = false;
             continue;
+        }
 
         // Parse the meaning of this byte
         if(parse_escaped){
@@ -94,17 +160,19 @@ bool pccomm_read_and_parse(void){
             // Handle **valid** escape sequences (only special bytes can be escaped)
             // Ignore invalid escape sequences
             if(byte == START_BYTE || byte == END_BYTE || byte == ESCAPE_BYTE)
-                pccomm_read_buf[pccomm_read_len++] = byte;
+                curr->data[curr->len++] = byte;
             
             // Handled the byte after an escape byte. No longer escaped
             parse_escaped = false;
         }else if(parse_started){
             // If a start byte was previously received, handle this byte
+            // Only special bytes get here (data bytes are copied in runs above)
             switch(byte){
             case START_BYTE:
                 // Handle start byte (special meaning when not escaped)
                 // Discard old data when a start byte received
-                pccomm_read_len = 0;
+                curr->len = 0;
+                parse_truncated = false;
                 break;
             case END_BYTE:
                 // Handle end byte (special meaning when not escaped)
@@ -112,21 +180,32 @@ bool pccomm_read_and_parse(void){
 
                 parse_started = false;
 
-                if(pccomm_read_len < 4){
+                if(parse_truncated){
+                    // Message too long. Data was discarded. Invalid message.
+                    pccomm_stats.rx_truncated++;
+                }else if(curr->len < 4){
                     // Too short to contain message id and crc bits. Invalid message.
+                    pccomm_stats.rx_invalid++;
                 }else{
                     // Calculate CRC of read data. Exclude last two bytes.
                     // Last two bytes are the CRC (big endian) appended to the original data
                     // First two bytes are message ID. These are INCLUDED in CRC calc.
-                    uint16_t calc_crc = crc16_ccitt_false(pccomm_read_buf, pccomm_read_len - 2);
-                    pccomm_read_crc = conversions_data_to_int16(&pccomm_read_buf[pccomm_read_len - 2], false);
+                    uint16_t calc_crc = crc16_ccitt_false(curr->data, curr->len - 2);
+                    uint16_t read_crc = conversions_data_to_int16(&curr->data[curr->len - 2], false);
 
-                    if(pccomm_read_crc == calc_crc){
-                        // This is a complete, valid message
-                        return true;
+                    if(read_crc == calc_crc){
+                        // This is a complete, valid message. Add it to the queue.
+                        pccomm_stats.rx_msgs++;
+                        rx_queue_count++;
+                        if(rx_queue_count > pccomm_stats.rx_queue_max)
+                            pccomm_stats.rx_queue_max = rx_queue_count;
+                        rx_queue_write++;
+                        if(rx_queue_write == PCCOMM_RX_QUEUE_LEN)
+                            rx_queue_write = 0;
+                        curr = &rx_queue[rx_queue_write];
                     }else{
                         // Got a complete message, but it is invalid. Ignore it.
-                        parse_started = false;
+                        pccomm_stats.rx_invalid++;
                     }
                 }
                 break;
@@ -134,70 +213,110 @@ bool pccomm_read_and_parse(void){
                 // Handle escape byte (special meaning when not escaped)
                 parse_escaped = true;
                 break;
-            default:
-                // Handle normal bytes (these are just data)
-                pccomm_read_buf[pccomm_read_len++] = byte;
-                break;
             }
         }else if(byte == START_BYTE){
             // Received a start byte. Start parsing. Discard old data.
             parse_started = true;
-            pccomm_read_len = 0;
+            parse_truncated = false;
+            curr->len = 0;
         }
     }
+}
+
+bool pccomm_read_and_parse(void){
+    if(!usb_initialized)
+        return false;
+
+    // Parse as much data as possible into the queue
+    pccomm_parse();
+
+    if(rx_queue_count == 0)
+        return false;
+
+    // Move oldest queued message into pccomm_read_buf for handling
+    rx_msg_t *next = &rx_queue[rx_queue_read];
+    memcpy(pccomm_read_buf, next->data, next->len);
+    pccomm_read_len = next->len;
+    pccomm_read_crc = conversions_data_to_int16(&pccomm_read_buf[pccomm_read_len - 2], false);
+    rx_queue_count--;
+    rx_queue_read++;
+    if(rx_queue_read == PCCOMM_RX_QUEUE_LEN)
+        rx_queue_read = 0;
+    return true;
+}
+
+/**
+ * Escape data into a frame being written, updating the frame's CRC at the same time
+ * Runs of bytes that do not need escaping are copied at once
+ * @param data Data to escape
+ * @param len Length of data
+ * @param dest Where to write escaped data (must have space for 2 * len bytes)
+ * @param crc CRC to update (CRC of data before escaping). NULL to skip CRC calculation.
+ * @return Number of bytes written to dest
+ */
+static unsigned int pccomm_escape(const uint8_t *data, unsigned int len, uint8_t *dest, uint16_t *crc){
+    unsigned int pos = 0;
+    unsigned int out = 0;
+    while(pos < len){
+        unsigned int run = find_special_byte(&data[pos], len - pos);
+        memcpy(&dest[out], &data[pos], run);
+        if(crc != NULL)
+            *crc = crc16_ccitt_false_partial(&data[pos], run + ((pos + run < len) ? 1 : 0), *crc);
+        out += run;
+        pos += run;
+        if(pos < len){
+            dest[out++] = ESCAPE_BYTE;
+            dest[out++] = data[pos++];
+        }
+    }
+    return out;
+}
 
-    return false;
+bool pccomm_write(uint8_t *msg, unsigned int len){
+    pccomm_frag_t frag = {.data = msg, .len = len};
+    return pccomm_writev(&frag, 1);
 }
 
-void pccomm_write(uint8_t *msg, unsigned int len){
+bool pccomm_writev(const pccomm_frag_t *frags, unsigned int count){
     if(!usb_initialized)
-        return;
+        return true;
+
+    unsigned int len = 0;
+    for(unsigned int i = 0; i < count; ++i)
+        len += frags[i].len;
 
     // This function could be called from multiple threads
     // Thus, it is necessary to prevent message interleaving
     // This is done using a mutex for priority inheritance
     xSemaphoreTake(msg_write_mutex, portMAX_DELAY);
 
-    // Write start byte
-    usb_write(START_BYTE);
-    
-    // Write message id (big endian). Escape it as needed.
-    uint16_t msg_id = curr_msg_id;
-    curr_msg_id++;
-    uint8_t id_buf[2];
-    conversions_int16_to_data(msg_id, id_buf, false);
-    if(id_buf[0] == START_BYTE || id_buf[0] == END_BYTE || id_buf[0] == ESCAPE_BYTE)
-        usb_write(ESCAPE_BYTE);
-    usb_write(id_buf[0]);
-    if(id_buf[1] == START_BYTE || id_buf[1] == END_BYTE || id_buf[1] == ESCAPE_BYTE)
-        usb_write(ESCAPE_BYTE);
-    usb_write(id_buf[1]);
-
-    // Write each byte of msg (escaping it if necessary)
-    for(unsigned int i = 0; i < len; ++i){
-        if(msg[i] == START_BYTE || msg[i] == END_BYTE || msg[i] == ESCAPE_BYTE)
-            usb_write(ESCAPE_BYTE);
-        usb_write(msg[i]);
+    if(len > PCCOMM_MAX_MSG_LEN){
+        // Frame would not fit in write_frame
+        pccomm_stats.tx_dropped++;
+        xSemaphoreGive(msg_write_mutex);
+        return false;
     }
 
-    // Calculate CRC and write it. CRC INCLUDES MESSAGE ID BYTES!!!
-    // Each byte of the CRC must also be escaped if it matches a special byte.
-    uint16_t crc = crc16_ccitt_false(id_buf, 2);
-    crc = crc16_ccitt_false_partial(msg, len, crc);
-    uint8_t high_byte = (crc >> 8) & 0xFF;
-    uint8_t low_byte = crc & 0xFF;
-    if(high_byte == START_BYTE || high_byte == END_BYTE || high_byte == ESCAPE_BYTE)
-        usb_write(ESCAPE_BYTE);
-    usb_write(high_byte);
-    if(low_byte == START_BYTE || low_byte == END_BYTE || low_byte == ESCAPE_BYTE)
-        usb_write(ESCAPE_BYTE);
-    usb_write(low_byte);
-
-    // Write end byte
-    usb_write(END_BYTE);
+    // Frame is start byte, then escaped message id (big endian), payload, and CRC, then end byte
+    // CRC INCLUDES MESSAGE ID BYTES!!!
+    unsigned int pos = 0;
+    uint16_t crc = 0xFFFF;
+    write_frame[pos++] = START_BYTE;
+    uint8_t id_buf[2];
+    conversions_int16_to_data(curr_msg_id, id_buf, false);
+    curr_msg_id++;
+    pos += pccomm_escape(id_buf, 2, &write_frame[pos], &crc);
+    for(unsigned int i = 0; i < count; ++i)
+        pos += pccomm_escape(frags[i].data, frags[i].len, &write_frame[pos], &crc);
+    uint8_t crc_buf[2];
+    conversions_int16_to_data(crc, crc_buf, false);
+    pos += pccomm_escape(crc_buf, 2, &write_frame[pos], NULL);
+    write_frame[pos++] = END_BYTE;
 
     // Write the message now
+    usb_write_multiple(write_frame, pos);
     usb_flush();
 
     xSemaphoreGive(msg_write_mutex);
+    return true;
 }
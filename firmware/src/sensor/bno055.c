@@ -245,7 +245,11 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #define WRITE_BUF_SIZE          16
-#define READ_BUF_SIZE           16
+#define READ_BUF_SIZE           32
+
+// Burst read covers accel data through quaternion data registers (includes mag & euler registers, which are not used)
+#define BURST_START             BNO055_ACCEL_DATA_X_LSB_ADDR
+#define BURST_LEN               (BNO055_QUATERNION_DATA_Z_MSB_ADDR - BURST_START + 1)
 
 // Need to ensure only one thread perfoming I2C comms with this sensor at a time
 static SemaphoreHandle_t trans_mutex;
@@ -258,6 +262,15 @@ static uint8_t read_buf[READ_BUF_SIZE];
 static uint8_t remap = REMAP_P1;
 static uint8_t sign = SIGN_P1;
 
+// Read all data in one transaction (instead of one transaction each for quaternion, gyro, and accel)
+static bool burst_read = true;
+
+// Number of I2C transactions attempted (including retries)
+static uint32_t trans_count;
+
+// Data read statistics (see bno055_get_read_stats)
+static uint32_t stats_samples, stats_transactions, stats_failures;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -265,13 +278,27 @@ static uint8_t sign = SIGN_P1;
 /// BNO055 Functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#define bno055_perform(x)           i2c_perform_retries((x), 20, 5)
+/**
+ * Perform a transaction with this sensor (retries on failure)
+ * Counts attempted transactions. Only call while holding trans_mutex.
+ * @param t Transaction to perform
+ * @return true on success; false if all retries fail
+ */
+static bool bno055_perform(i2c_trans *t){
+    unsigned int attempts;
+    bool success = i2c_perform_retries(t, 30, &attempts);
+    trans_count += attempts;
+    return success;
+}
 
 void bno055_init(void){
     trans_mutex = xSemaphoreCreateMutex();
     trans.address = BNO055_ADDR;
     trans.write_buf = write_buf;
     trans.read_buf = read_buf;
+
+    // IMU reads are performed before other sensors' transactions
+    trans.priority = I2C_PRIO_HIGH;
 }
 
 
@@ -588,7 +615,48 @@ bool bno055_set_axis(uint8_t mode){
 
 
 
-static inline bool bno055_read_internal(imu_data_t *data){
+/**
+ * Decode a signed 16-bit little endian value from a BNO055 data register pair
+ */
+static inline int16_t bno055_decode16(const uint8_t *buf){
+    return (int16_t)(((uint16_t)buf[1]) << 8 | ((uint16_t)buf[0]));
+}
+
+static inline bool bno055_read_burst(imu_data_t *data){
+    // Read accel, mag, gyro, euler, and quaternion data registers in a single transaction
+    // Ignore failure if cmdctrl_sim_hijacked since real data wouldn't be used anyway
+    trans.write_buf[0] = BNO055_ACCEL_DATA_X_LSB_ADDR;
+    trans.write_count = 1;
+    trans.read_count = BURST_LEN;
+    if(!bno055_perform(&trans) && !cmdctrl_sim_hijacked){
+        return false;
+    }
+
+    // Orientation Quaternion
+    uint8_t *buf = &trans.read_buf[BNO055_QUATERNION_DATA_W_LSB_ADDR - BURST_START];
+    data->quat.w = bno055_decode16(&buf[0]) / 16384.0f;
+    data->quat.x = bno055_decode16(&buf[2]) / 16384.0f;
+    data->quat.y = bno055_decode16(&buf[4]) / 16384.0f;
+    data->quat.z = bno055_decode16(&buf[6]) / 16384.0f;
+
+    // Raw gyroscope data
+    buf = &trans.read_buf[BNO055_GYRO_DATA_X_LSB_ADDR - BURST_START];
+    data->raw_gyro.x = bno055_decode16(&buf[0]) / 16.0f;
+    data->raw_gyro.y = bno055_decode16(&buf[2]) / 16.0f;
+    data->raw_gyro.z = bno055_decode16(&buf[4]) / 16.0f;
+
+    // Raw accelerometer data
+    buf = &trans.read_buf[BNO055_ACCEL_DATA_X_LSB_ADDR - BURST_START];
+    data->raw_accel.x = bno055_decode16(&buf[0]) / 100.0f;
+    data->raw_accel.y = bno055_decode16(&buf[2]) / 100.0f;
+    data->raw_accel.z = bno055_decode16(&buf[4]) / 100.0f;
+
+    // Success
+    return true;
+}
+
+static inline bool bno055_read_separate(imu_data_t *data){
+    // Read quaternion, gyro, and accel data using one transaction each
     int16_t tmp16;
 
     // Read Orientation Quaternion
@@ -640,6 +708,19 @@ static inline bool bno055_read_internal(imu_data_t *data){
     return true;
 }
 
+static inline bool bno055_read_internal(imu_data_t *data){
+    uint32_t start_count = trans_count;
+    bool success = burst_read ? bno055_read_burst(data) : bno055_read_separate(data);
+
+    // Statistics (trans_count is only modified while holding trans_mutex)
+    stats_transactions += trans_count - start_count;
+    if(success)
+        stats_samples++;
+    else
+        stats_failures++;
+    return success;
+}
+
 bool bno055_read(imu_data_t *data){
     // Take I2C bus at beginning of each function communicating with sensor.
     // This also ensures accesses to trans are thread safe and prevents unexpected
@@ -655,6 +736,27 @@ bool bno055_read(imu_data_t *data){
 
 
 
+void bno055_set_burst_read(bool enable){
+    // Hold trans_mutex so mode does not change part way through a read
+    xSemaphoreTake(trans_mutex, portMAX_DELAY);
+    burst_read = enable;
+    xSemaphoreGive(trans_mutex);
+}
+
+bool bno055_get_burst_read(void){
+    return burst_read;
+}
+
+void bno055_get_read_stats(uint32_t *samples, uint32_t *transactions, uint32_t *failures){
+    xSemaphoreTake(trans_mutex, portMAX_DELAY);
+    *samples = stats_samples;
+    *transactions = stats_transactions;
+    *failures = stats_failures;
+    xSemaphoreGive(trans_mutex);
+}
+
+
+
 static inline bool bno055_read_calibration_status_internal(uint8_t *status){
     // Read CALIB_STAT
     trans.write_buf[0] = BNO055_CALIB_STAT_ADDR;
@@ -23,6 +23,7 @@
 #include <cmdctrl.h>
 #include <calibration.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include <semphr.h>
 
 #define MS5837_ADDR                     0x76
@@ -54,7 +55,37 @@ static i2c_trans trans;
 static uint8_t write_buf[WRITE_BUF_SIZE];
 static uint8_t read_buf[READ_BUF_SIZE];
 
-#define ms5837_perform(x)           i2c_perform_retries((x), 20, 5)
+#define ms5837_perform(x)           i2c_perform_retries((x), 30, NULL)
+
+// Number of pressure (D1) conversions between temperature (D2) conversions
+// Temperature changes slowly, so it does not need to be converted as often
+#define MS5837_TEMP_INTERVAL        10
+
+// Conversion in progress
+#define CONV_NONE                   0
+#define CONV_D1                     1
+#define CONV_D2                     2
+
+// Result of ms5837_step
+#define MS5837_STEP_SAMPLE          0       // New pressure sample calculated
+#define MS5837_STEP_WAIT            1       // Pending conversion not complete
+#define MS5837_STEP_WAIT_NEXT       2       // Conversion started (no sample yet)
+#define MS5837_STEP_FAIL            3       // Communication error
+
+// Max conversion time (us) for each OSR (datasheet p2)
+static const uint16_t conv_time_us[] = {600, 1170, 2280, 4540, 9040, 18080};
+
+// Oversampling ratio for pressure (D1) and temperature (D2) conversions (MS5837_OSR_xyz)
+static uint8_t osr_d1 = MS5837_OSR_1024;
+static uint8_t osr_d2 = MS5837_OSR_1024;
+
+// Conversion state (only accessed while holding trans_mutex)
+static uint8_t pending = CONV_NONE;         // Conversion in progress
+static TickType_t pending_start;            // When pending conversion started
+static TickType_t pending_ticks;            // Time pending conversion takes
+static uint32_t d1, d2;                     // Latest ADC results
+static bool d2_valid = false;               // If d2 is from the currently configured sensor
+static unsigned int conv_since_d2;          // D1 conversions since last D2 conversion
 
 // Note: Size of 8 is important because of how crc code works
 static uint16_t prom_data[8];
@@ -86,6 +117,9 @@ void ms5837_init(void){
     trans.address = MS5837_ADDR;
     trans.write_buf = write_buf;
     trans.read_buf = read_buf;
+
+    // Depth sensor reads wait for IMU reads
+    trans.priority = I2C_PRIO_LOW;
 }
 
 
@@ -98,6 +132,10 @@ static bool ms5837_configure_internal(void){
     if(!ms5837_perform(&trans))
         return false;
     vTaskDelay(pdMS_TO_TICKS(10));
+
+    // Reset aborts any conversion in progress
+    pending = CONV_NONE;
+    d2_valid = false;
     
     // Read all PROM bytes
     for(unsigned int i = 0; i < 7; ++i){
@@ -131,72 +169,86 @@ bool ms5837_configure(void){
 
 
 
-static bool ms5837_read_internal(depth_data_t *data){
-    uint32_t d1, d2;
+/**
+ * Fill data using simulator depth (used when sim hijacked instead of sensor data)
+ */
+static void ms5837_sim_data(depth_data_t *data){
+    data->pressure_pa = 101325.0f - (9777.23005f * cmdctrl_sim_depth);
+    data->temperature_c = 25;
+    data->depth_m = cmdctrl_sim_depth;
+}
 
-    // Convert D1
-    trans.write_buf[0] = MS5837_CMD_CONVERT_D1_OSR1024;
+/**
+ * Start next conversion (D2 if temperature is needed, otherwise D1)
+ * @return true on success; false on error
+ */
+static bool ms5837_start_conversion(void){
+    uint8_t conv;
+    uint8_t osr;
+    if(!d2_valid || conv_since_d2 >= MS5837_TEMP_INTERVAL){
+        conv = CONV_D2;
+        osr = osr_d2;
+    }else{
+        conv = CONV_D1;
+        osr = osr_d1;
+    }
+    trans.write_buf[0] = ((conv == CONV_D1) ? MS5837_CMD_CONVERT_D1_OSR256 : MS5837_CMD_CONVERT_D2_OSR256) + 2 * osr;
     trans.write_count = 1;
     trans.read_count = 0;
-    if(!ms5837_perform(&trans)){
-        if(cmdctrl_sim_hijacked){
-            // Ignore read failures if sim hijacked
-            data->pressure_pa = 101325.0f - (9777.23005f * cmdctrl_sim_depth);
-            data->temperature_c = 25;
-            data->depth_m = cmdctrl_sim_depth;
-            return true;
-        }
+    if(!ms5837_perform(&trans))
         return false;
-    }
-    vTaskDelay(pdMS_TO_TICKS(20));          // Ensure conversion completes before reading ADC
+    pending = conv;
+    pending_start = xTaskGetTickCount();
 
-    // Read ADC (D1 data)
-    trans.write_buf[0] = MS5837_CMD_ADC_READ;
-    trans.write_count = 1;
-    trans.read_count = 3;
-    if(!ms5837_perform(&trans)){
-        if(cmdctrl_sim_hijacked){
-            // Ignore read failures if sim hijacked
-            data->pressure_pa = 101325.0f - (9777.23005f * cmdctrl_sim_depth);
-            data->temperature_c = 25;
-            data->depth_m = cmdctrl_sim_depth;
-            return true;
-        }
-        return false;
+    // Conversion may have started at the end of the current tick, so wait an extra tick
+    pending_ticks = pdMS_TO_TICKS((conv_time_us[osr] + 999) / 1000) + 1;
+    return true;
+}
+
+/**
+ * Advance conversion state machine. Only call while holding trans_mutex.
+ * Reads the pending conversion (if complete) and starts the next one.
+ * @param data Where to store data if a new pressure sample is calculated
+ * @param wait Set to number of ticks until pending conversion is complete (if not complete)
+ * @return MS5837_STEP_xyz result
+ */
+static int ms5837_step(depth_data_t *data, TickType_t *wait){
+    if(pending == CONV_NONE){
+        return ms5837_start_conversion() ? MS5837_STEP_WAIT_NEXT : MS5837_STEP_FAIL;
     }
-    d1 = (trans.read_buf[0] << 16) | (trans.read_buf[1] << 8) | trans.read_buf[2];
 
-    // Convert D2
-    trans.write_buf[0] = MS5837_CMD_CONVERT_D2_OSR1024;
-    trans.write_count = 1;
-    trans.read_count = 0;
-    if(!ms5837_perform(&trans)){
-        if(cmdctrl_sim_hijacked){
-            // Ignore read failures if sim hijacked
-            data->pressure_pa = 101325.0f - (9777.23005f * cmdctrl_sim_depth);
-            data->temperature_c = 25;
-            data->depth_m = cmdctrl_sim_depth;
-            return true;
-        }
-        return false;
+    TickType_t elapsed = xTaskGetTickCount() - pending_start;
+    if(elapsed < pending_ticks){
+        *wait = pending_ticks - elapsed;
+        return MS5837_STEP_WAIT;
     }
-    vTaskDelay(pdMS_TO_TICKS(20));          // Ensure conversion completes before reading ADC
 
-    // Read ADC
+    // Read ADC (result of pending conversion)
+    uint8_t conv = pending;
+    pending = CONV_NONE;
     trans.write_buf[0] = MS5837_CMD_ADC_READ;
     trans.write_count = 1;
     trans.read_count = 3;
-    if(!ms5837_perform(&trans)){
-        if(cmdctrl_sim_hijacked){
-            // Ignore read failures if sim hijacked
-            data->pressure_pa = 101325.0f - (9777.23005f * cmdctrl_sim_depth);
-            data->temperature_c = 25;
-            data->depth_m = cmdctrl_sim_depth;
-            return true;
-        }
-        return false;
+    if(!ms5837_perform(&trans))
+        return MS5837_STEP_FAIL;
+    uint32_t adc = (trans.read_buf[0] << 16) | (trans.read_buf[1] << 8) | trans.read_buf[2];
+    if(conv == CONV_D1){
+        d1 = adc;
+        conv_since_d2++;
+    }else{
+        d2 = adc;
+        d2_valid = true;
+        conv_since_d2 = 0;
+    }
+
+    // Start next conversion now so it runs while the sensor is not in use (pipelined)
+    if(!ms5837_start_conversion())
+        return MS5837_STEP_FAIL;
+
+    if(conv != CONV_D1){
+        // Only temperature updated. Need another pressure conversion for a sample.
+        return MS5837_STEP_WAIT_NEXT;
     }
-    d2 = (trans.read_buf[0] << 16) | (trans.read_buf[1] << 8) | trans.read_buf[2];
 
     ////////////////////////////////////////////////////////////////////////////
     // Calculate values (as described on pages 11-12 of sensor datasheet)
@@ -213,7 +265,7 @@ static bool ms5837_read_internal(depth_data_t *data){
     int64_t OFF2 = 0;
     int64_t SENS2 = 0;
 
-    // Calculate temperature
+    // Calculate temperature (using most recent temperature conversion)
     dT = d2 - ((uint32_t)prom_data[5]) * 256l;
     TEMP = 2000l + ((int64_t)dT) * prom_data[6] / 8388608LL;
     
@@ -255,34 +307,75 @@ static bool ms5837_read_internal(depth_data_t *data){
     // P in mbar * 10
     // TEMP in celsius * 100
     // 1mbar = 100Pa -> P * 10 = Pa
-    if(cmdctrl_sim_hijacked){
-        // Use data from simulator not depth sensor
-        data->pressure_pa = 101325.0f - (9777.23005f * cmdctrl_sim_depth);
-        data->temperature_c = 25;
-        data->depth_m = cmdctrl_sim_depth;
-    }else{
-        data->pressure_pa = P * 10.0f;
-        data->temperature_c = TEMP / 100.0f;
+    data->pressure_pa = P * 10.0f;
+    data->temperature_c = TEMP / 100.0f;
 
-        // Negative for below surface of water
-        data->depth_m = (calibration_ms5837.atm_pressure - (P * 10.0f)) / (calibration_ms5837.fluid_density * 9.80665f);
-    }
+    // Negative for below surface of water
+    data->depth_m = (calibration_ms5837.atm_pressure - (P * 10.0f)) / (calibration_ms5837.fluid_density * 9.80665f);
 
     ////////////////////////////////////////////////////////////////////////////
 
-    return true;
+    return MS5837_STEP_SAMPLE;
 }
 
 bool ms5837_read(depth_data_t *data){
-    // Take I2C bus at beginning of each function communicating with sensor.
-    // This also ensures accesses to trans are thread safe and prevents unexpected
-    // interleaving of messages to the same sensor (if multiple threads call
-    // functions of the same sensor).
-    if(xSemaphoreTake(trans_mutex, portMAX_DELAY) == pdFALSE){
-        return false;
+    // Conversions take several ms. Sensor (and I2C bus) is not held while waiting for a conversion,
+    // and the next conversion is started as soon as a result is read. Thus, if called at least one
+    // conversion time after the previous call, this does not wait.
+    while(1){
+        // Take I2C bus at beginning of each function communicating with sensor.
+        // This also ensures accesses to trans are thread safe and prevents unexpected
+        // interleaving of messages to the same sensor (if multiple threads call
+        // functions of the same sensor).
+        if(xSemaphoreTake(trans_mutex, portMAX_DELAY) == pdFALSE){
+            return false;
+        }
+        TickType_t wait = 0;
+        int res = ms5837_step(data, &wait);
+        if(res == MS5837_STEP_FAIL){
+            // Start over (wait for new temperature) next time
+            pending = CONV_NONE;
+            d2_valid = false;
+        }
+        xSemaphoreGive(trans_mutex);
+
+        switch(res){
+        case MS5837_STEP_SAMPLE:
+            if(cmdctrl_sim_hijacked){
+                // Use data from simulator not depth sensor
+                ms5837_sim_data(data);
+            }
+            return true;
+        case MS5837_STEP_FAIL:
+            if(cmdctrl_sim_hijacked){
+                // Ignore read failures if sim hijacked
+                ms5837_sim_data(data);
+                return true;
+            }
+            return false;
+        case MS5837_STEP_WAIT:
+            vTaskDelay(wait);
+            break;
+        case MS5837_STEP_WAIT_NEXT:
+            // Next call to ms5837_step waits for the conversion that was just started
+            break;
+        }
     }
-    bool ret = ms5837_read_internal(data);
+}
+
+bool ms5837_set_osr(uint8_t d1_osr, uint8_t d2_osr){
+    if(d1_osr > MS5837_OSR_8192 || d2_osr > MS5837_OSR_8192)
+        return false;
+
+    // Used starting with the next conversion
+    xSemaphoreTake(trans_mutex, portMAX_DELAY);
+    osr_d1 = d1_osr;
+    osr_d2 = d2_osr;
     xSemaphoreGive(trans_mutex);
-    return ret;
+    return true;
 }
 
+void ms5837_get_osr(uint8_t *d1_osr, uint8_t *d2_osr){
+    *d1_osr = osr_d1;
+    *d2_osr = osr_d2;
+}
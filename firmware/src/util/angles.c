@@ -2,6 +2,7 @@
 
 #define _USE_MATH_DEFINES   // Enables things like M_PI on windows
 #include <math.h>
+#include <util/fastmath.h>
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -37,12 +38,10 @@ void euler_rad2deg(euler_t *dest, const euler_t *src){
 void euler_to_quat(quaternion_t *dest, const euler_t *src){
     euler_t src_rad;
     euler_deg2rad(&src_rad, src);
-    float cr = cosf(src_rad.roll / 2.0f);
-    float sr = sinf(src_rad.roll / 2.0f);
-    float cp = cosf(src_rad.pitch / 2.0f);
-    float sp = sinf(src_rad.pitch / 2.0f);
-    float cy = cosf(src_rad.yaw / 2.0f);
-    float sy = sinf(src_rad.yaw / 2.0f);
+    float cr, sr, cp, sp, cy, sy;
+    fmath_sincos(src_rad.roll / 2.0f, &sr, &cr);
+    fmath_sincos(src_rad.pitch / 2.0f, &sp, &cp);
+    fmath_sincos(src_rad.yaw / 2.0f, &sy, &cy);
     dest->w = cy * cp * cr - sy * sp * sr;
     dest->x = cy * cr * sp - sy * cp * sr;
     dest->y = cy * cp * sr + sy * cr * sp;
@@ -96,21 +95,22 @@ void quat_conjugate(quaternion_t *dest, const quaternion_t *src){
 }
 
 void quat_magnitude(float *dest, const quaternion_t *src){
-    *dest = sqrtf(src->w*src->w + src->x*src->x + src->y*src->y + src->z*src->z);
+    *dest = fmath_sqrt(src->w*src->w + src->x*src->x + src->y*src->y + src->z*src->z);
 }
 
 void quat_normalize(quaternion_t *dest, const quaternion_t *src){
-    float mag = sqrtf(src->w*src->w + src->x*src->x + src->y*src->y + src->z*src->z);
+    float mag2 = src->w*src->w + src->x*src->x + src->y*src->y + src->z*src->z;
     dest->w = src->w;
     dest->x = src->x;
     dest->y = src->y;
     dest->z = src->z;
-    if(mag == 0.0f)
+    if(mag2 == 0.0f)
         return;
-    dest->w /= mag;
-    dest->x /= mag;
-    dest->y /= mag;
-    dest->z /= mag;
+    float inv_mag = fmath_inv_sqrt(mag2);
+    dest->w *= inv_mag;
+    dest->x *= inv_mag;
+    dest->y *= inv_mag;
+    dest->z *= inv_mag;
 }
 
 void quat_dot(float *dest, const quaternion_t *a, const quaternion_t *b){
@@ -124,7 +124,7 @@ void quat_to_euler(euler_t *dest, const quaternion_t *src){
         sin_pitch = 1.0f;
     if(sin_pitch < -1.0f)
         sin_pitch = -1.0f;
-    dest->pitch = asinf(sin_pitch);
+    dest->pitch = fmath_asin(sin_pitch);
 
     float pitchdeg = 180.0f * dest->pitch / ((float)M_PI);
     if(fabsf(90.0f - fabsf(pitchdeg)) < 0.1f){
@@ -136,15 +136,58 @@ void quat_to_euler(euler_t *dest, const quaternion_t *src){
         // However, note that putting this all into yaw
         // is important for how stability assist math works
         // (see mc_set_sassist in motor_control.c)
-        dest->yaw = 2.0f * atan2f(src->y, src->w);
+        dest->yaw = 2.0f * fmath_atan2(src->y, src->w);
         dest->roll = 0.0f;
     }else{
         float roll_numer = 2.0f * (src->w*src->y - src->x*src->z);
         float roll_denom = 1.0f - 2.0f * (src->x*src->x + src->y*src->y);
-        dest->roll = atan2f(roll_numer, roll_denom);
+        dest->roll = fmath_atan2(roll_numer, roll_denom);
 
         float yaw_numer = -2.0f * (src->x*src->y - src->w*src->z);
         float yaw_denom = 1.0f - 2.0f * (src->x*src->x + src->z*src->z);
-        dest->yaw = atan2f(yaw_numer, yaw_denom);
+        dest->yaw = fmath_atan2(yaw_numer, yaw_denom);
     }
 }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Rotation matrix operations
+////////////////////////////////////////////////////////////////////////////////
+
+void quat_to_rotmat(float dest[3][3], const quaternion_t *src){
+    // Expanded form of src * v * src^*
+    // Does not assume src is normalized (matches quaternion product exactly)
+    float ww = src->w*src->w, xx = src->x*src->x, yy = src->y*src->y, zz = src->z*src->z;
+    float xy = src->x*src->y, xz = src->x*src->z, yz = src->y*src->z;
+    float wx = src->w*src->x, wy = src->w*src->y, wz = src->w*src->z;
+    dest[0][0] = ww + xx - yy - zz;
+    dest[0][1] = 2.0f * (xy - wz);
+    dest[0][2] = 2.0f * (xz + wy);
+    dest[1][0] = 2.0f * (xy + wz);
+    dest[1][1] = ww - xx + yy - zz;
+    dest[1][2] = 2.0f * (yz - wx);
+    dest[2][0] = 2.0f * (xz - wy);
+    dest[2][1] = 2.0f * (yz + wx);
+    dest[2][2] = ww - xx - yy + zz;
+}
+
+void rotmat_col(float dest[3], const float m[3][3], unsigned int col){
+    dest[0] = m[0][col];
+    dest[1] = m[1][col];
+    dest[2] = m[2][col];
+}
+
+void rotmat_rotate(float dest[3], const float m[3][3], const float src[3]){
+    float x = src[0], y = src[1], z = src[2];
+    dest[0] = m[0][0]*x + m[0][1]*y + m[0][2]*z;
+    dest[1] = m[1][0]*x + m[1][1]*y + m[1][2]*z;
+    dest[2] = m[2][0]*x + m[2][1]*y + m[2][2]*z;
+}
+
+void rotmat_rotate_inv(float dest[3], const float m[3][3], const float src[3]){
+    float x = src[0], y = src[1], z = src[2];
+    dest[0] = m[0][0]*x + m[1][0]*y + m[2][0]*z;
+    dest[1] = m[0][1]*x + m[1][1]*y + m[2][1]*z;
+    dest[2] = m[0][2]*x + m[1][2]*y + m[2][2]*z;
+}
@@ -17,6 +17,7 @@
  */
 
 #include <util/circular_buffer.h>
+#include <string.h>
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -51,4 +52,40 @@ bool cb_read(volatile circular_buffer *cb, uint8_t *dest){
     if(cb->read_pos == cb->size)
         cb->read_pos = 0;
     return true;
-}
\ No newline at end of file
+}
+
+unsigned int cb_write_multiple(volatile circular_buffer *cb, const uint8_t *src, unsigned int len){
+    if(len > CB_AVAIL_WRITE(cb))
+        len = CB_AVAIL_WRITE(cb);
+    
+    // At most two contiguous copies (before and after wrap)
+    unsigned int first = cb->size - cb->write_pos;
+    if(first > len)
+        first = len;
+    memcpy((uint8_t*)&cb->array[cb->write_pos], src, first);
+    memcpy((uint8_t*)&cb->array[0], &src[first], len - first);
+
+    cb->write_pos += len;
+    if(cb->write_pos >= cb->size)
+        cb->write_pos -= cb->size;
+    cb->count += len;
+    return len;
+}
+
+unsigned int cb_read_multiple(volatile circular_buffer *cb, uint8_t *dest, unsigned int len){
+    if(len > CB_AVAIL_READ(cb))
+        len = CB_AVAIL_READ(cb);
+
+    // At most two contiguous copies (before and after wrap)
+    unsigned int first = cb->size - cb->read_pos;
+    if(first > len)
+        first = len;
+    memcpy(dest, (uint8_t*)&cb->array[cb->read_pos], first);
+    memcpy(&dest[first], (uint8_t*)&cb->array[0], len - first);
+
+    cb->read_pos += len;
+    if(cb->read_pos >= cb->size)
+        cb->read_pos -= cb->size;
+    cb->count -= len;
+    return len;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2022 Marcus Behel
+ * 
+ * This file is part of AUVControlBoard-Firmware.
+ * 
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU 
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your 
+ * option) any later version.
+ * 
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even 
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see 
+ * <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+#include <util/fastmath.h>
+
+#if defined(CONTROL_BOARD_FAST_MATH)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Macros
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define FMATH_PI            3.14159265358979f
+#define FMATH_PI_2          1.57079632679490f
+#define FMATH_2_PI          0.63661977236758f
+
+// pi/2 split in two parts so range reduction stays accurate (Cody-Waite)
+#define FMATH_PI_2_HI       1.5707963705062866f
+#define FMATH_PI_2_LO       -4.3711388286737929e-8f
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+float fmath_atan2(float y, float x){
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float mx = (ax > ay) ? ax : ay;
+    float mn = (ax > ay) ? ay : ax;
+    if(mx == 0.0f)
+        return 0.0f;
+
+    // atan(a) for a in [0, 1] (Abramowitz & Stegun 4.4.49, |error| <= 1e-5)
+    float a = mn / mx;
+    float s = a * a;
+    float r = a * (0.9998660f + s * (-0.3302995f + s * (0.1801410f + s * (-0.0851330f + s * 0.0208351f))));
+
+    // Move result to correct octant / quadrant
+    if(ay > ax)
+        r = FMATH_PI_2 - r;
+    if(x < 0.0f)
+        r = FMATH_PI - r;
+    if(y < 0.0f)
+        r = -r;
+    return r;
+}
+
+float fmath_asin(float x){
+    if(x > 1.0f)
+        x = 1.0f;
+    if(x < -1.0f)
+        x = -1.0f;
+    return fmath_atan2(x, fmath_sqrt((1.0f - x) * (1.0f + x)));
+}
+
+void fmath_sincos(float x, float *s, float *c){
+    // x = r + q * (pi / 2) with r in [-pi/4, pi/4]
+    float qf = x * FMATH_2_PI;
+    int q = (int)((qf >= 0.0f) ? (qf + 0.5f) : (qf - 0.5f));
+    float r = (x - q * FMATH_PI_2_HI) - q * FMATH_PI_2_LO;
+
+    // Taylor series (truncation error < 4e-7 on [-pi/4, pi/4])
+    float r2 = r * r;
+    float sr = r + r * r2 * (-1.6666667e-1f + r2 * (8.3333333e-3f + r2 * -1.9841270e-4f));
+    float cr = 1.0f + r2 * (-0.5f + r2 * (4.1666667e-2f + r2 * (-1.3888889e-3f + r2 * 2.4801587e-5f)));
+
+    // Quadrant
+    switch(q & 3){
+    case 0:
+        *s = sr;
+        *c = cr;
+        break;
+    case 1:
+        *s = cr;
+        *c = -sr;
+        break;
+    case 2:
+        *s = -sr;
+        *c = -cr;
+        break;
+    default:
+        *s = -cr;
+        *c = sr;
+        break;
+    }
+}
+
+float fmath_sqrt(float x){
+#if defined(__ARM_FP)
+    // Single instruction (newlib sqrtf may call library code to set errno)
+    float r;
+    __asm__ ("vsqrt.f32 %0, %1" : "=t"(r) : "t"(x));
+    return r;
+#else
+    return __builtin_sqrtf(x);
+#endif
+}
+
+float fmath_inv_sqrt(float x){
+    return 1.0f / fmath_sqrt(x);
+}
+
+#endif // CONTROL_BOARD_FAST_MATH
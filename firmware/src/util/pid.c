@@ -19,20 +19,43 @@
 #include <util/pid.h>
 
 
-float pid_calculate(pid_controller_t *pid, float curr_err){
+float pid_calculate(pid_controller_t *pid, float setpoint, float meas, float ff, float dt){
     #define MIN(a, b)       ((a < b) ? a : b)
     #define MAX(a, b)       ((a > b) ? a : b)
 
-    // Proportional gain
-    float output = pid->kP * curr_err;
+    float curr_err = setpoint - meas;
 
-    // Integral gain
-    pid->integral += curr_err;
-    output += pid->kI * pid->integral;
+    // Derivative (no previous value on first calculation after reset)
+    float d_raw = 0.0f;
+    if(pid->has_last && dt > 0.0f){
+        if(pid->d_on_meas)
+            d_raw = -(meas - pid->last_meas) / dt;
+        else
+            d_raw = (curr_err - pid->last_error) / dt;
+    }
 
-    // Derivative gain
-    output += pid->kD * (curr_err - pid->last_error);
+    // First order low pass filter on derivative
+    if(pid->has_last && pid->d_tau > 0.0f){
+        pid->deriv += (dt / (pid->d_tau + dt)) * (d_raw - pid->deriv);
+    }else{
+        pid->deriv = d_raw;
+    }
     pid->last_error = curr_err;
+    pid->last_meas = meas;
+    pid->has_last = true;
+
+    // Proportional, derivative, and feed-forward
+    float output = pid->kP * curr_err + pid->kD * pid->deriv + pid->kF * ff;
+
+    // Integral (conditional integration anti-windup)
+    // Only accumulate if output would not be saturated or error is driving it out of saturation
+    float integral = pid->integral + curr_err * dt;
+    float output_i = output + pid->kI * integral;
+    bool windup = (output_i > pid->max && pid->kI * curr_err > 0.0f) ||
+            (output_i < pid->min && pid->kI * curr_err < 0.0f);
+    if(!windup)
+        pid->integral = integral;
+    output += pid->kI * pid->integral;
 
     // Limit output range
     output = MAX(pid->min, MIN(output, pid->max));
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2022 Marcus Behel
+ * 
+ * This file is part of AUVControlBoard-Firmware.
+ * 
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU 
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your 
+ * option) any later version.
+ * 
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even 
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for 
+ * more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see 
+ * <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+
+#include <util/seqlock.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC only targets x86 here (stores and loads are not reordered with each other). Only need compiler barrier.
+#define SEQLOCK_BARRIER()       _ReadWriteBarrier()
+#else
+#define SEQLOCK_BARRIER()       __sync_synchronize()
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+void seqlock_init(seqlock_t *lock){
+    lock->gen = 0;
+    lock->retries = 0;
+}
+
+unsigned int seqlock_write_index(seqlock_t *lock){
+    return SEQLOCK_INDEX(lock->gen + 1);
+}
+
+void seqlock_write_publish(seqlock_t *lock){
+    // Buffer contents must be written before it is published
+    SEQLOCK_BARRIER();
+    lock->gen++;
+    SEQLOCK_BARRIER();
+}
+
+uint32_t seqlock_read_begin(seqlock_t *lock){
+    uint32_t gen = lock->gen;
+
+    // Buffer must not be read before gen
+    SEQLOCK_BARRIER();
+    return gen;
+}
+
+bool seqlock_read_retry(seqlock_t *lock, uint32_t gen){
+    // Buffer must be read before checking gen again
+    SEQLOCK_BARRIER();
+    if(lock->gen != gen){
+        // Not atomic with multiple readers. Only used as a statistic.
+        lock->retries++;
+        return true;
+    }
+    return false;
+}
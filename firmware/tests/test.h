@@ -0,0 +1,119 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdlib.h>
+
+// Minimal test helpers for host tests (SimCB builds only; run with ctest)
+// A failed check prints where it failed and is counted. Tests keep running after a failed check.
+// Test programs define run_tests (returns TEST_RESULT(); nonzero if any check failed) and optionally run_bench,
+// then use TEST_MAIN (or TEST_RTOS_MAIN in test_rtos.h). Run with argument "bench" to run the benchmark instead.
+
+static unsigned int test_failures = 0;
+
+#define CHECK(cond)                                                                                 \
+    do{                                                                                             \
+        if(!(cond)){                                                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                \
+            test_failures++;                                                                        \
+        }                                                                                           \
+    }while(0)
+
+#define CHECK_NEAR(a, b, tol)                                                                       \
+    do{                                                                                             \
+        double check_a_ = (a), check_b_ = (b);                                                      \
+        if(!(fabs(check_a_ - check_b_) <= (tol))){                                                  \
+            fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed (%g vs %g)\n",                        \
+                __FILE__, __LINE__, #a, #b, check_a_, check_b_);                                    \
+            test_failures++;                                                                        \
+        }                                                                                           \
+    }while(0)
+
+#define TEST_RESULT()       (test_failures == 0 ? 0 : 1)
+
+
+/**
+ * Deterministic pseudo random number generator (xorshift32) so failures are reproducible
+ * @param state Generator state (nonzero)
+ * @return Next pseudo random value
+ */
+static inline uint32_t test_rand(uint32_t *state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ * Pseudo random float in range [lo, hi]
+ * @param state Generator state (nonzero)
+ * @param lo Min value
+ * @param hi Max value
+ * @return Pseudo random value
+ */
+static inline float test_randf(uint32_t *state, float lo, float hi){
+    return lo + (hi - lo) * ((float)(test_rand(state) >> 8) / (float)(1 << 24));
+}
+
+/**
+ * Monotonic time for benchmarks
+ * @return Time in seconds
+ */
+static inline double test_time(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+// Runs tests or benchmark (returns exit code of test program)
+typedef int (*test_fn_t)(void);
+
+/**
+ * Select what a test program runs based on its arguments
+ * @param argc Argument count (from main)
+ * @param argv Arguments (from main)
+ * @param run_tests Runs tests
+ * @param run_bench Runs benchmark (NULL if there is none)
+ * @return run_bench if the first argument is "bench"; otherwise run_tests
+ */
+static inline test_fn_t test_select(int argc, char **argv, test_fn_t run_tests, test_fn_t run_bench){
+    if(argc > 1 && strcmp(argv[1], "bench") == 0){
+        if(run_bench == NULL){
+            fprintf(stderr, "No benchmark\n");
+            exit(1);
+        }
+        return run_bench;
+    }
+    return run_tests;
+}
+
+// Define main for a test program (run_bench may be NULL)
+#define TEST_MAIN(run_tests, run_bench)                                                             \
+    int main(int argc, char **argv){                                                                \
+        return test_select(argc, argv, (run_tests), (run_bench))();                                 \
+    }
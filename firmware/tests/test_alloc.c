@@ -0,0 +1,271 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Pseudo-inverse thrust allocation tests (motor control)
+// Checks the wrench (D^T * speeds, where D is the DoF matrix) produced by MC_ALLOC_PINV: exact and decoupled when no
+// thruster saturates, never worse than uniformly scaling the unconstrained solution when thrusters saturate, and
+// speeds always within limits.
+
+#include "test.h"
+#include "test_rtos.h"
+#include "test_fw.h"
+#include <motor_control.h>
+#include <cmdctrl.h>
+
+typedef struct {
+    const char *name;
+    float dof[8 * 6];
+} vehicle_t;
+
+static const vehicle_t vehicles[] = {
+    // SW8 (iface/vehicle.py)
+    {"SW8", {
+        -1,     +1,      0,      0,      0,     -1,
+        +1,     +1,      0,      0,      0,     +1,
+        -1,     -1,      0,      0,      0,     +1,
+        +1,     -1,      0,      0,      0,     -1,
+         0,      0,     -1,     +1,     -1,      0,
+         0,      0,     -1,     +1,     +1,      0,
+         0,      0,     -1,     -1,     -1,      0,
+         0,      0,     -1,     -1,     +1,      0,
+    }},
+
+    // Vectored horizontal thrusters with unequal vertical thruster positions (DoFs coupled)
+    {"Vectored", {
+        0.707,  0.707,  0,      0,      0,      0.8,
+        0.707, -0.707,  0,      0,      0,     -0.6,
+       -0.707,  0.707,  0,      0,      0,     -0.6,
+       -0.707, -0.707,  0,      0,      0,      0.8,
+        0,      0,      1,      0.5,    1,      0,
+        0,      0,      1,     -0.5,    0.7,    0,
+        0,      0,      1,      0.5,   -0.7,    0,
+        0,      0,      1,     -0.5,   -1,      0,
+    }},
+
+    // Six thrusters (two unused). Pitch is not controllable.
+    {"Six (no pitch)", {
+        1,      0,      0,      0,      0,      1,
+        1,      0,      0,      0,      0,     -1,
+        0,      1,      0,      0,      0,      0,
+        0,      0,      1,      1,      0,      0,
+        0,      0,      1,     -1,      0,      0,
+        0,      0.5,    0.5,    0,      0,      0,
+        0,      0,      0,      0,      0,      0,
+        0,      0,      0,      0,      0,      0,
+    }},
+};
+
+#define VEHICLE_COUNT       (sizeof(vehicles) / sizeof(vehicles[0]))
+
+static uint32_t seed = 0xA110C;
+static const vehicle_t *vehicle;
+
+// Wrench produced per unit target in each DoF (measured; zero if DoF is not controllable)
+static float gain[6];
+
+
+static void set_vehicle(const vehicle_t *v){
+    vehicle = v;
+    for(unsigned int t = 0; t < 8; ++t)
+        mc_set_dof_matrix(t + 1, (float*)&v->dof[t * 6]);
+    mc_recalc();
+}
+
+/**
+ * Calculate thruster speeds for a target with the current allocation method
+ * @param speeds Where to store speeds
+ * @param target Target (x, y, z, xrot, yrot, zrot)
+ */
+static void allocate(float speeds[8], const float target[6]){
+    mc_wdog_feed();
+    mc_set_local((mc_local_target_t){target[0], target[1], target[2], target[3], target[4], target[5]});
+    memcpy(speeds, cmdctrl_sim_speeds, 8 * sizeof(float));
+}
+
+static void wrench(float w[6], const float speeds[8]){
+    for(unsigned int c = 0; c < 6; ++c){
+        w[c] = 0.0f;
+        for(unsigned int i = 0; i < 8; ++i)
+            w[c] += vehicle->dof[i * 6 + c] * speeds[i];
+    }
+}
+
+/**
+ * Wrench error relative to requested wrench
+ * @param speeds Thruster speeds
+ * @param target Target (requested wrench is gain * target)
+ * @return Norm of error divided by norm of requested wrench
+ */
+static float wrench_error(const float speeds[8], const float target[6]){
+    float w[6];
+    wrench(w, speeds);
+    float err = 0.0f, norm = 0.0f;
+    for(unsigned int c = 0; c < 6; ++c){
+        float req = gain[c] * target[c];
+        err += (w[c] - req) * (w[c] - req);
+        norm += req * req;
+    }
+    return (norm > 0.0f) ? sqrtf(err / norm) : 0.0f;
+}
+
+/**
+ * Uniformly scaled unconstrained solution (allocation without redistribution)
+ * @param speeds Where to store speeds
+ * @param target Target
+ */
+static void allocate_uniform(float speeds[8], const float target[6]){
+    // Allocation is linear when nothing saturates, so unconstrained solution is a sum of scaled unit solutions
+    float unit[8];
+    float s[8] = {0};
+    for(unsigned int c = 0; c < 6; ++c){
+        float t[6] = {0};
+        t[c] = 0.1f;
+        allocate(unit, t);
+        for(unsigned int i = 0; i < 8; ++i)
+            s[i] += unit[i] * target[c] * 10.0f;
+    }
+    float mval = 1.0f;
+    for(unsigned int i = 0; i < 8; ++i)
+        mval = fmaxf(mval, fabsf(s[i]));
+    for(unsigned int i = 0; i < 8; ++i)
+        speeds[i] = s[i] / mval;
+}
+
+static void measure_gain(void){
+    for(unsigned int c = 0; c < 6; ++c){
+        float t[6] = {0}, s[8], w[6];
+        t[c] = 1.0f;
+        allocate(s, t);
+        wrench(w, s);
+        gain[c] = w[c];
+    }
+}
+
+static void test_unsaturated(void){
+    for(unsigned int c = 0; c < 6; ++c){
+        // Full speed in one DoF gives max speed for the most used thruster (and no other DoF)
+        float t[6] = {0}, s[8], w[6];
+        t[c] = 1.0f;
+        allocate(s, t);
+        wrench(w, s);
+        float mval = 0.0f;
+        for(unsigned int i = 0; i < 8; ++i)
+            mval = fmaxf(mval, fabsf(s[i]));
+        bool controllable = false;
+        for(unsigned int i = 0; i < 8; ++i)
+            controllable = controllable || vehicle->dof[i * 6 + c] != 0.0f;
+        if(controllable && strcmp(vehicle->name, "Six (no pitch)") != 0)
+            CHECK_NEAR(mval, 1.0, 1e-4);
+        if(!controllable)
+            CHECK_NEAR(mval, 0.0, 1e-6);
+        for(unsigned int d = 0; d < 6; ++d){
+            if(d != c)
+                CHECK_NEAR(w[d], 0.0, 1e-4);
+        }
+        CHECK(gain[c] >= 0.0f);
+    }
+
+    // Small targets do not saturate. Wrench is exactly as requested.
+    for(unsigned int trial = 0; trial < 500; ++trial){
+        float t[6], s[8];
+        for(unsigned int c = 0; c < 6; ++c)
+            t[c] = test_randf(&seed, -0.15f, 0.15f);
+        allocate(s, t);
+        CHECK(wrench_error(s, t) < 1e-4);
+    }
+}
+
+static void test_saturated(void){
+    unsigned int saturated = 0;
+    for(unsigned int trial = 0; trial < 2000; ++trial){
+        float t[6], s[8], u[8];
+        for(unsigned int c = 0; c < 6; ++c)
+            t[c] = test_randf(&seed, -1.0f, 1.0f);
+        allocate(s, t);
+        allocate_uniform(u, t);
+        bool sat = false;
+        for(unsigned int i = 0; i < 8; ++i){
+            CHECK(isfinite(s[i]) && fabsf(s[i]) <= 1.0f + 1e-6f);
+            sat = sat || fabsf(s[i]) >= 1.0f - 1e-6f;
+        }
+        if(sat)
+            saturated++;
+        CHECK(wrench_error(s, t) <= wrench_error(u, t) + 1e-4);
+    }
+    CHECK(saturated > 100);
+}
+
+static int run_tests(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    mc_set_alloc(MC_ALLOC_PINV);
+    for(unsigned int v = 0; v < VEHICLE_COUNT; ++v){
+        set_vehicle(&vehicles[v]);
+        measure_gain();
+        test_unsaturated();
+        test_saturated();
+    }
+    return TEST_RESULT();
+}
+
+static int run_bench(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    printf("%-16s %22s %22s %12s %12s\n", "Vehicle", "PINV error (mean/max)", "Uniform (mean/max)", "PINV ns", "DOF ns");
+    for(unsigned int v = 0; v < VEHICLE_COUNT; ++v){
+        set_vehicle(&vehicles[v]);
+        mc_set_alloc(MC_ALLOC_PINV);
+        measure_gain();
+
+        // Wrench error for random targets
+        const unsigned int trials = 5000;
+        double err_sum = 0.0, err_max = 0.0, uni_sum = 0.0, uni_max = 0.0;
+        for(unsigned int trial = 0; trial < trials; ++trial){
+            float t[6], s[8];
+            for(unsigned int c = 0; c < 6; ++c)
+                t[c] = test_randf(&seed, -1.0f, 1.0f);
+            allocate(s, t);
+            float e = wrench_error(s, t);
+            err_sum += e;
+            err_max = fmax(err_max, e);
+            allocate_uniform(s, t);
+            e = wrench_error(s, t);
+            uni_sum += e;
+            uni_max = fmax(uni_max, e);
+        }
+
+        // Time per call (includes setting speeds)
+        double ns[2];
+        for(unsigned int m = 0; m < 2; ++m){
+            mc_set_alloc(m == 0 ? MC_ALLOC_PINV : MC_ALLOC_DOF);
+            mc_wdog_feed();
+            const unsigned int reps = 200000;
+            double start = test_time();
+            for(unsigned int r = 0; r < reps; ++r){
+                float f = (r & 1023) / 512.0f - 1.0f;
+                mc_set_local((mc_local_target_t){f, -f, 0.5f * f, 0.3f, -0.7f * f, f});
+            }
+            ns[m] = (test_time() - start) / reps * 1e9;
+        }
+        printf("%-16s %10.4f / %-9.4f %10.4f / %-9.4f %12.0f %12.0f\n", vehicles[v].name,
+                err_sum / trials, err_max, uni_sum / trials, uni_max, ns[0], ns[1]);
+    }
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
@@ -0,0 +1,323 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Orientation cache tests (motor control GLOBAL and OHOLD modes)
+// Values derived from orientation are cached between IMU samples. Results must not depend on whether the
+// cached values were used, and GLOBAL mode must match the original (uncached, quaternion product) calculation.
+
+#include "test.h"
+#include "test_rtos.h"
+#include "test_fw.h"
+#include <motor_control.h>
+#include <cmdctrl.h>
+#include <util/angles.h>
+
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+static uint32_t seed = 0xA771;
+
+// SW8 (iface/vehicle.py)
+static float sw8[8][6] = {
+    {-1,     +1,      0,      0,      0,     -1},
+    {+1,     +1,      0,      0,      0,     +1},
+    {-1,     -1,      0,      0,      0,     +1},
+    {+1,     -1,      0,      0,      0,     -1},
+    { 0,      0,     -1,     +1,     -1,      0},
+    { 0,      0,     -1,     +1,     +1,      0},
+    { 0,      0,     -1,     -1,     -1,      0},
+    { 0,      0,     -1,     -1,     +1,      0},
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Reference: GLOBAL mode as calculated before orientation values were cached (rotation by quaternion products)
+/// Relative DoF scale factors are all 1.0 in these tests, so DoF downscaling is omitted.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ref_rotate(float d[3], float sx, float sy, float sz, const quaternion_t *q, bool inv){
+    quaternion_t qv = {.w = 0.0f, .x = sx, .y = sy, .z = sz};
+    quaternion_t qconj, qr;
+    quat_conjugate(&qconj, q);
+    if(inv){
+        quat_multiply(&qr, &qv, q);
+        quat_multiply(&qr, &qconj, &qr);
+    }else{
+        quat_multiply(&qr, &qv, &qconj);
+        quat_multiply(&qr, q, &qr);
+    }
+    d[0] = qr.x;
+    d[1] = qr.y;
+    d[2] = qr.z;
+}
+
+static void ref_upscale(float d[3], float v){
+    float m = MAX(fabsf(d[0]), MAX(fabsf(d[1]), fabsf(d[2])));
+    for(unsigned int i = 0; i < 3; ++i)
+        d[i] = (fabsf(v) < 1e-4f) ? 0.0f : d[i] / m * fabsf(v);
+}
+
+static void ref_downscale(float d[3]){
+    float m = MAX(fabsf(d[0]), MAX(fabsf(d[1]), fabsf(d[2])));
+    if(m > 1.0f){
+        for(unsigned int i = 0; i < 3; ++i)
+            d[i] /= m;
+    }
+}
+
+static float ref_restrict(float a){
+    while(a > 180.0f)
+        a -= 360.0f;
+    while(a < -180.0f)
+        a += 360.0f;
+    return a;
+}
+
+static mc_local_target_t ref_global(const mc_global_target_t t, const quaternion_t *q){
+    // Pitch and roll compensation (rotation from <0, 0, -1> to gravity vector)
+    float gx = 2.0f * (-q->x*q->z + q->w*q->y);
+    float gy = 2.0f * (-q->w*q->x - q->y*q->z);
+    float gz = -q->w*q->w + q->x*q->x + q->y*q->y - q->z*q->z;
+    float gm = sqrtf(gx*gx + gy*gy + gz*gz);
+    gx /= gm; gy /= gm; gz /= gm;
+    float dot = -gz;
+    quaternion_t qrot = {.w = dot + 1.0f, .x = gy, .y = -gx, .z = 0.0f};
+    if(dot == -1.0f)
+        qrot.w = 0.0f;
+    quat_normalize(&qrot, &qrot);
+
+    float tx[3], ty[3], tz[3];
+    ref_rotate(tx, t.x, 0, 0, &qrot, false);
+    ref_upscale(tx, t.x);
+    ref_rotate(ty, 0, t.y, 0, &qrot, false);
+    ref_upscale(ty, t.y);
+    ref_rotate(tz, 0, 0, t.z, &qrot, false);
+    ref_upscale(tz, t.z);
+    float l[3] = {tx[0] + ty[0] + tz[0], tx[1] + ty[1] + tz[1], tx[2] + ty[2] + tz[2]};
+    ref_downscale(l);
+
+    // Baseline euler angles (minimal roll) split into pitch and roll quaternions
+    euler_t e, alt;
+    quat_to_euler(&e, q);
+    alt = e;
+    if(e.is_deg){
+        alt.pitch = ref_restrict(180.0f - e.pitch);
+        alt.roll = ref_restrict(e.roll - 180.0f);
+    }else{
+        alt.pitch = M_PI - e.pitch;
+        alt.roll = e.roll - M_PI;
+        while(alt.pitch > M_PI) alt.pitch -= 2.0f * M_PI;
+        while(alt.pitch < -M_PI) alt.pitch += 2.0f * M_PI;
+        while(alt.roll > M_PI) alt.roll -= 2.0f * M_PI;
+        while(alt.roll < -M_PI) alt.roll += 2.0f * M_PI;
+    }
+    if(fabsf(alt.roll) < fabsf(e.roll))
+        e = alt;
+    euler_t e_pitch = {.is_deg = e.is_deg, .pitch = e.pitch, .roll = 0.0f, .yaw = 0.0f};
+    euler_t e_roll = {.is_deg = e.is_deg, .pitch = 0.0f, .roll = e.roll, .yaw = 0.0f};
+    quaternion_t q_pitch, q_roll;
+    euler_to_quat(&q_pitch, &e_pitch);
+    euler_to_quat(&q_roll, &e_roll);
+
+    float w_pitch[3], w_yaw[3];
+    ref_rotate(w_pitch, t.pitch_spd, 0, 0, &q_roll, true);
+    ref_rotate(w_yaw, 0, 0, t.yaw_spd, &q_pitch, true);
+    ref_rotate(w_yaw, w_yaw[0], w_yaw[1], w_yaw[2], &q_roll, true);
+    ref_upscale(w_pitch, t.pitch_spd);
+    ref_upscale(w_yaw, t.yaw_spd);
+    float r[3] = {w_pitch[0] + w_yaw[0], w_pitch[1] + t.roll_spd + w_yaw[1], w_pitch[2] + w_yaw[2]};
+    ref_downscale(r);
+
+    return (mc_local_target_t){l[0], l[1], l[2], r[0], r[1], r[2]};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static void random_quat(quaternion_t *q){
+    euler_t e = {
+        .pitch = test_randf(&seed, -180.0f, 180.0f),
+        .roll = test_randf(&seed, -180.0f, 180.0f),
+        .yaw = test_randf(&seed, -180.0f, 180.0f),
+        .is_deg = true
+    };
+    euler_to_quat(q, &e);
+}
+
+static mc_global_target_t random_global(void){
+    mc_global_target_t t;
+    t.x = test_randf(&seed, -1.0f, 1.0f);
+    t.y = test_randf(&seed, -1.0f, 1.0f);
+    t.z = test_randf(&seed, -1.0f, 1.0f);
+    t.pitch_spd = test_randf(&seed, -1.0f, 1.0f);
+    t.roll_spd = test_randf(&seed, -1.0f, 1.0f);
+    t.yaw_spd = test_randf(&seed, -1.0f, 1.0f);
+    return t;
+}
+
+static void get_speeds(float speeds[8]){
+    memcpy(speeds, cmdctrl_sim_speeds, 8 * sizeof(float));
+}
+
+static void test_global(void){
+    for(unsigned int trial = 0; trial < 2000; ++trial){
+        quaternion_t q, other;
+        random_quat(&q);
+        random_quat(&other);
+        if(trial & 1){
+            // Orientation differing only in some components
+            other = (quaternion_t){.w = q.w, .x = q.y, .y = q.x, .z = q.z};
+        }
+        mc_global_target_t t = random_global();
+
+        // New orientation (calculated)
+        float fresh[8], cached[8], expected[8];
+        mc_wdog_feed();
+        mc_set_global(t, other);
+        mc_set_global(t, q);
+        get_speeds(fresh);
+
+        // Same orientation with another target, then this target (cached)
+        mc_set_global(random_global(), q);
+        mc_set_global(t, q);
+        get_speeds(cached);
+
+        // Original calculation
+        mc_set_local(ref_global(t, &q));
+        get_speeds(expected);
+
+        for(unsigned int i = 0; i < 8; ++i){
+            CHECK(fresh[i] == cached[i]);
+            CHECK_NEAR(fresh[i], expected[i], 1e-3);
+        }
+    }
+}
+
+static void test_ohold(void){
+    // Proportional only (outputs do not depend on PID state or time between updates)
+    mc_pid_tune_t tune = {.kp = 1.0f, .limit = 1.0f};
+    mc_sassist_tune_xrot(tune);
+    mc_sassist_tune_yrot(tune);
+    mc_sassist_tune_zrot(tune);
+    gyro_data_t gyro = {0};
+
+    for(unsigned int trial = 0; trial < 2000; ++trial){
+        euler_t e = {
+            .pitch = test_randf(&seed, -80.0f, 80.0f),
+            .roll = test_randf(&seed, -80.0f, 80.0f),
+            .yaw = test_randf(&seed, -179.0f, 179.0f),
+            .is_deg = true
+        };
+        quaternion_t q, other;
+        euler_to_quat(&q, &e);
+        random_quat(&other);
+        bool use_yaw_pid = (trial & 1) != 0;
+        mc_ohold_target_t t = {
+            .x = test_randf(&seed, -1.0f, 1.0f),
+            .y = test_randf(&seed, -1.0f, 1.0f),
+            .z = test_randf(&seed, -1.0f, 1.0f),
+            .yaw_spd = test_randf(&seed, -1.0f, 1.0f),
+            .target_euler = {
+                .pitch = test_randf(&seed, -80.0f, 80.0f),
+                .roll = test_randf(&seed, -80.0f, 80.0f),
+                .yaw = test_randf(&seed, -179.0f, 179.0f),
+                .is_deg = true
+            },
+            .use_yaw_pid = use_yaw_pid
+        };
+
+        float fresh[8], cached[8];
+        mc_wdog_feed();
+        mc_set_ohold(t, other, gyro);
+        mc_set_ohold(t, q, gyro);
+        get_speeds(fresh);
+        mc_set_ohold(t, q, gyro);
+        get_speeds(cached);
+        for(unsigned int i = 0; i < 8; ++i)
+            CHECK(fresh[i] == cached[i]);
+
+        // Holding current orientation gives no rotation (or translation)
+        // Without yaw PID, the yaw held is the current yaw from the cache. This is only the euler yaw when level.
+        mc_ohold_target_t hold = {.target_euler = e, .use_yaw_pid = use_yaw_pid};
+        if(!use_yaw_pid){
+            hold.target_euler.pitch = 0.0f;
+            hold.target_euler.roll = 0.0f;
+            euler_t level = hold.target_euler;
+            euler_to_quat(&q, &level);
+            hold.target_euler.yaw = 0.0f;
+        }
+        mc_set_ohold(hold, other, gyro);
+        mc_set_ohold(hold, q, gyro);
+        get_speeds(fresh);
+        for(unsigned int i = 0; i < 8; ++i)
+            CHECK_NEAR(fresh[i], 0.0, 2e-3);
+    }
+}
+
+static void setup(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    for(unsigned int t = 0; t < 8; ++t)
+        mc_set_dof_matrix(t + 1, sw8[t]);
+    mc_recalc();
+}
+
+static int run_tests(void){
+    setup();
+    test_global();
+    test_ohold();
+    return TEST_RESULT();
+}
+
+static int run_bench(void){
+    setup();
+    mc_pid_tune_t tune = {.kp = 1.0f, .limit = 1.0f};
+    mc_sassist_tune_xrot(tune);
+    mc_sassist_tune_yrot(tune);
+    mc_sassist_tune_zrot(tune);
+    gyro_data_t gyro = {0};
+
+    // Speeds are re-applied more often than IMU samples arrive (same orientation) and on each IMU sample (new one)
+    const unsigned int count = 64;
+    quaternion_t quats[64];
+    for(unsigned int i = 0; i < count; ++i)
+        random_quat(&quats[i]);
+    mc_global_target_t gt = random_global();
+    mc_ohold_target_t ot = {.x = 0.3f, .y = -0.5f, .z = 0.2f, .yaw_spd = 0.4f,
+            .target_euler = {.pitch = 10.0f, .roll = -5.0f, .yaw = 0.0f, .is_deg = true}, .use_yaw_pid = false};
+
+    const unsigned int reps = 200000;
+    for(unsigned int mode = 0; mode < 2; ++mode){
+        for(unsigned int change = 0; change < 2; ++change){
+            mc_wdog_feed();
+            double start = test_time();
+            for(unsigned int r = 0; r < reps; ++r){
+                const quaternion_t *q = &quats[change ? (r % count) : 0];
+                if(mode == 0)
+                    mc_set_global(gt, *q);
+                else
+                    mc_set_ohold(ot, *q, gyro);
+            }
+            double ns = (test_time() - start) / reps * 1e9;
+            printf("%-6s %-22s %8.0f ns per update\n", mode == 0 ? "GLOBAL" : "OHOLD",
+                    change ? "(new orientation)" : "(same orientation)", ns);
+        }
+    }
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Cascaded attitude control tests (motor control OHOLD mode)
+// Attitude of a simple rigid body (angular acceleration proportional to the rotation produced by thrusters, linear
+// damping, optional constant disturbance torque) is held in OHOLD mode with single loop and with cascaded control.
+// The model runs in real time (PIDs use time between updates), so each simulation takes a few seconds.
+
+#include "test.h"
+#include "test_rtos.h"
+#include "test_fw.h"
+#include <motor_control.h>
+#include <cmdctrl.h>
+#include <util/angles.h>
+#include <hardware/delay.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#define STEP_MS             10          // Control period
+#define ACCEL               6.0f        // Angular acceleration (rad / s^2) for full speed rotation
+#define DAMPING             0.5f        // Angular velocity damping (1 / s)
+
+// SW8 (iface/vehicle.py)
+static float sw8[8][6] = {
+    {-1,     +1,      0,      0,      0,     -1},
+    {+1,     +1,      0,      0,      0,     +1},
+    {-1,     -1,      0,      0,      0,     +1},
+    {+1,     -1,      0,      0,      0,     -1},
+    { 0,      0,     -1,     +1,     -1,      0},
+    { 0,      0,     -1,     +1,     +1,      0},
+    { 0,      0,     -1,     -1,     -1,      0},
+    { 0,      0,     -1,     -1,     +1,      0},
+};
+
+// Rotation about each axis produced per unit local speed (measured)
+static float gain[3];
+
+typedef struct {
+    float final_err;            // Angle (deg) from target at end
+    float max_late_err;         // Max angle (deg) from target in last half of simulation
+    float overshoot;            // Max angle (deg) past target, measured along initial error direction
+    float settle;               // Time (seconds) until error stays below 2 deg
+    float trace[32];            // Error (deg) every 0.25 seconds (first 8 seconds)
+} result_t;
+
+
+/**
+ * Rotation (xrot, yrot, zrot) produced by current thruster speeds
+ * @param rot Where to store rotation
+ */
+static void thruster_rotation(float rot[3]){
+    for(unsigned int c = 0; c < 3; ++c){
+        rot[c] = 0.0f;
+        for(unsigned int i = 0; i < 8; ++i)
+            rot[c] += sw8[i][3 + c] * cmdctrl_sim_speeds[i];
+    }
+}
+
+static void measure_gain(void){
+    for(unsigned int c = 0; c < 3; ++c){
+        float t[6] = {0}, rot[3];
+        t[3 + c] = 1.0f;
+        mc_wdog_feed();
+        mc_set_local((mc_local_target_t){t[0], t[1], t[2], t[3], t[4], t[5]});
+        thruster_rotation(rot);
+        gain[c] = rot[c];
+    }
+}
+
+static float angle_between(const quaternion_t *a, const quaternion_t *b){
+    float dot;
+    quat_dot(&dot, a, b);
+    dot = fminf(fabsf(dot), 1.0f);
+    return 2.0f * acosf(dot) * 180.0f / M_PI;
+}
+
+/**
+ * Hold target orientation (starting level and at rest) in OHOLD mode
+ * @param target Target orientation
+ * @param disturbance Constant disturbance (angular acceleration in vehicle frame; rad / s^2)
+ * @param duration Time to simulate (seconds)
+ * @param res Where to store result
+ */
+static void simulate(euler_t target, const float disturbance[3], float duration, result_t *res){
+    quaternion_t q = {.w = 1.0f, .x = 0.0f, .y = 0.0f, .z = 0.0f};
+    quaternion_t qt;
+    euler_to_quat(&qt, &target);
+    float w[3] = {0.0f, 0.0f, 0.0f};
+    float u[3] = {0.0f, 0.0f, 0.0f};
+    memset(res, 0, sizeof(result_t));
+    res->settle = -1.0f;
+
+    // Initial error direction (axis of rotation from start to target)
+    quaternion_t q_err;
+    quat_multiply(&q_err, &(quaternion_t){q.w, -q.x, -q.y, -q.z}, &qt);
+    float axis_mag = sqrtf(q_err.x * q_err.x + q_err.y * q_err.y + q_err.z * q_err.z);
+    float axis[3] = {q_err.x / axis_mag, q_err.y / axis_mag, q_err.z / axis_mag};
+
+    mc_ohold_target_t t = {.x = 0.0f, .y = 0.0f, .z = 0.0f, .yaw_spd = 0.0f, .target_euler = target, .use_yaw_pid = true};
+    uint32_t last = delay_timestamp();
+    float time = 0.0f, next_trace = 0.25f;
+    while(time < duration){
+        vTaskDelay(pdMS_TO_TICKS(STEP_MS));
+        uint32_t now = delay_timestamp();
+        float dt = delay_elapsed_us(last, now) * 1e-6f;
+        last = now;
+        time += dt;
+
+        // Rigid body (vehicle frame angular velocity)
+        for(unsigned int c = 0; c < 3; ++c)
+            w[c] += dt * (ACCEL * u[c] + disturbance[c] - DAMPING * w[c]);
+        quaternion_t dq = {.w = 0.0f, .x = w[0] * dt * 0.5f, .y = w[1] * dt * 0.5f, .z = w[2] * dt * 0.5f};
+        quat_multiply(&dq, &q, &dq);
+        q.w += dq.w;
+        q.x += dq.x;
+        q.y += dq.y;
+        q.z += dq.z;
+        quat_normalize(&q, &q);
+
+        // Controller
+        gyro_data_t gyro = {w[0] * 180.0f / M_PI, w[1] * 180.0f / M_PI, w[2] * 180.0f / M_PI};
+        mc_wdog_feed();
+        mc_set_ohold(t, q, gyro);
+        thruster_rotation(u);
+        for(unsigned int c = 0; c < 3; ++c)
+            u[c] /= gain[c];
+
+        // Error and overshoot (rotation past target along initial direction)
+        float err = angle_between(&q, &qt);
+        quat_multiply(&q_err, &(quaternion_t){q.w, -q.x, -q.y, -q.z}, &qt);
+        float sign = (q_err.w < 0.0f) ? -1.0f : 1.0f;
+        float along = sign * (q_err.x * axis[0] + q_err.y * axis[1] + q_err.z * axis[2]);
+        if(along < 0.0f)
+            res->overshoot = fmaxf(res->overshoot, 2.0f * asinf(fminf(-along, 1.0f)) * 180.0f / M_PI);
+        if(err >= 2.0f)
+            res->settle = -1.0f;
+        else if(res->settle < 0.0f)
+            res->settle = time;
+        if(time > duration / 2.0f)
+            res->max_late_err = fmaxf(res->max_late_err, err);
+        if(time >= next_trace && next_trace <= 8.0f){
+            res->trace[(unsigned int)(next_trace / 0.25f + 0.5f) - 1] = err;
+            next_trace += 0.25f;
+        }
+        res->final_err = err;
+    }
+}
+
+static void setup(bool cascade){
+    // Outer loop: angle error (rad) to rotation speed (single loop) or rate setpoint (rad / s; cascaded)
+    // ki and kd are relative to a 0.02 second step (see mc_pid_tune_t)
+    mc_pid_tune_t single = {.kp = 1.5f, .ki = 0.01f, .kd = 30.0f, .limit = 1.0f, .d_on_meas = true, .d_filter = 0.0f};
+    mc_pid_tune_t outer = {.kp = 2.5f, .ki = 0.0f, .kd = 0.0f, .limit = 2.0f};
+    mc_pid_tune_t inner = {.kp = 1.5f, .ki = 0.1f, .kd = 0.0f, .kf = DAMPING / ACCEL, .limit = 1.0f};
+    mc_pid_tune_t rot = cascade ? outer : single;
+    mc_sassist_tune_xrot(rot);
+    mc_sassist_tune_yrot(rot);
+    mc_sassist_tune_zrot(rot);
+    mc_sassist_tune_xrate(inner);
+    mc_sassist_tune_yrate(inner);
+    mc_sassist_tune_zrate(inner);
+    mc_set_cascade(cascade, cascade, cascade);
+}
+
+static const euler_t target = {.pitch = 25.0f, .roll = -20.0f, .yaw = 40.0f, .is_deg = true};
+
+static const float no_disturbance[3] = {0.0f, 0.0f, 0.0f};
+static const float disturbance[3] = {0.8f, -0.5f, 0.6f};
+
+static void setup_vehicle(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    for(unsigned int t = 0; t < 8; ++t)
+        mc_set_dof_matrix(t + 1, sw8[t]);
+    mc_recalc();
+    measure_gain();
+}
+
+static int run_tests(void){
+    setup_vehicle();
+    result_t single, cascaded;
+
+    // Single loop control still holds attitude
+    setup(false);
+    simulate(target, no_disturbance, 3.0f, &single);
+    CHECK(single.final_err < 5.0f);
+
+    // Cascaded control settles quickly without overshoot and holds attitude more tightly (same output limits)
+    setup(true);
+    simulate(target, no_disturbance, 3.0f, &cascaded);
+    CHECK(cascaded.final_err < 0.5f);
+    CHECK(cascaded.overshoot < 2.0f);
+    CHECK(cascaded.settle > 0.0f && cascaded.settle < 2.5f);
+    CHECK(cascaded.max_late_err < single.max_late_err);
+
+    // Inner loop integral rejects constant disturbance
+    setup(true);
+    simulate(target, disturbance, 3.0f, &cascaded);
+    CHECK(cascaded.final_err < 0.5f);
+    CHECK(cascaded.overshoot < 2.0f);
+    CHECK(cascaded.settle > 0.0f && cascaded.settle < 2.5f);
+
+    return TEST_RESULT();
+}
+
+static int run_bench(void){
+    setup_vehicle();
+    for(unsigned int cascade = 0; cascade < 2; ++cascade){
+        for(unsigned int d = 0; d < 2; ++d){
+            result_t res;
+            setup(cascade);
+            simulate(target, d ? disturbance : no_disturbance, 4.0f, &res);
+            printf("%-8s %-16s final %5.2f deg, overshoot %5.2f deg, settle (< 2 deg) %5.2f s\n    ",
+                    cascade ? "Cascaded" : "Single", d ? "(disturbance)" : "(no disturbance)",
+                    res.final_err, res.overshoot, res.settle);
+            for(unsigned int i = 0; i < 16; ++i)
+                printf("%5.1f ", res.trace[i]);
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
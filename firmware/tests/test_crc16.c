@@ -0,0 +1,108 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// CRC16 backend tests
+// Built once for each CRC16_IMPL. Checks the selected implementation against the bitwise reference.
+
+#include "test.h"
+#include <util/crc16.h>
+
+#if CRC16_IMPL == CRC16_IMPL_BITWISE
+#define IMPL_NAME   "BITWISE"
+#elif CRC16_IMPL == CRC16_IMPL_TABLE
+#define IMPL_NAME   "TABLE"
+#elif CRC16_IMPL == CRC16_IMPL_SLICE4
+#define IMPL_NAME   "SLICE4"
+#endif
+
+static uint8_t data[4096];
+
+
+static void test_check_value(void){
+    // Standard check value for CRC-16/CCITT-FALSE
+    const uint8_t check[] = "123456789";
+    CHECK(crc16_ccitt_false(check, 9) == 0x29B1);
+    CHECK(crc16_ccitt_false_bitwise(check, 9, 0xFFFF) == 0x29B1);
+    CHECK(crc16_ccitt_false(check, 0) == 0xFFFF);
+}
+
+static void test_random_equivalence(void){
+    // Every length up to a few slices, every alignment, random initial values
+    uint32_t seed = 0x1234567;
+    for(unsigned int i = 0; i < sizeof(data); ++i)
+        data[i] = test_rand(&seed);
+    for(unsigned int len = 0; len <= 64; ++len){
+        for(unsigned int offset = 0; offset < 4; ++offset){
+            uint16_t initial = test_rand(&seed);
+            CHECK(crc16_ccitt_false_partial(&data[offset], len, initial) ==
+                    crc16_ccitt_false_bitwise(&data[offset], len, initial));
+        }
+    }
+    for(unsigned int i = 0; i < 2000; ++i){
+        unsigned int offset = test_rand(&seed) % 64;
+        unsigned int len = test_rand(&seed) % (sizeof(data) - offset);
+        uint16_t initial = test_rand(&seed);
+        CHECK(crc16_ccitt_false_partial(&data[offset], len, initial) ==
+                crc16_ccitt_false_bitwise(&data[offset], len, initial));
+    }
+}
+
+static void test_partial(void){
+    // CRC of fragments (as used by pccomm for scatter-gather writes) matches CRC of whole
+    uint16_t whole = crc16_ccitt_false(data, 96);
+    for(unsigned int split = 0; split <= 96; ++split){
+        uint16_t crc = crc16_ccitt_false_partial(data, split, 0xFFFF);
+        crc = crc16_ccitt_false_partial(&data[split], 96 - split, crc);
+        CHECK(crc == whole);
+    }
+}
+
+static int run_bench(void){
+    // Typical message sizes (short command and max size message)
+    const unsigned int sizes[] = {16, 96, sizeof(data)};
+    for(unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s){
+        unsigned int len = sizes[s];
+        volatile uint16_t sink = 0;
+
+        unsigned int reps = (64u * 1024 * 1024) / len;
+        double start = test_time();
+        for(unsigned int i = 0; i < reps; ++i)
+            sink ^= crc16_ccitt_false_partial(data, len, sink);
+        double impl_time = test_time() - start;
+
+        reps /= 8;
+        start = test_time();
+        for(unsigned int i = 0; i < reps; ++i)
+            sink ^= crc16_ccitt_false_bitwise(data, len, sink);
+        double ref_time = (test_time() - start) * 8;
+
+        double total = (64.0 * 1024 * 1024 / len) * len;
+        printf("%-8s %5u byte blocks: %8.1f MB/s (bitwise %6.1f MB/s)\n", IMPL_NAME, len,
+                total / impl_time / 1e6, total / ref_time / 1e6);
+    }
+    return 0;
+}
+
+static int run_tests(void){
+    test_check_value();
+    test_random_equivalence();
+    test_partial();
+    return TEST_RESULT();
+}
+
+TEST_MAIN(run_tests, run_bench)
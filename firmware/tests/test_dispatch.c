@@ -0,0 +1,364 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Message dispatch tests (cmdctrl)
+// Every message in the protocol is sent by name and by compact opcode with an incorrect length. Each must be
+// recognized (acknowledged with an invalid arguments error), so the handler table, hash chains and opcode table are
+// complete. Unknown names and opcodes, messages that must be exactly their name, queries, PIDTN argument
+// validation and control loop settings are also checked, as is that handling and acknowledging motion commands
+// does not allocate.
+
+#include "test.h"
+#include "test_rtos.h"
+#include "test_fw.h"
+#include <util/conversions.h>
+#include <cmdctrl.h>
+#include <FreeRTOS.h>
+
+#define ACK_ERR_NONE            0
+#define ACK_ERR_UNKNOWN_MSG     1
+#define ACK_ERR_INVALID_ARGS    2
+
+#define OP_ACK                  0xE0
+
+// Message length is not fixed (handler checks length)
+#define LEN_ANY                 -1
+
+// Message must be exactly the name
+#define LEN_NAME                -2
+
+// Messages as documented in messages.md (name, length including name, compact opcode or 0 if none)
+typedef struct {
+    const char *name;
+    int len;
+    uint8_t op;
+} msg_def_t;
+
+static const msg_def_t msgs[] = {
+    {"RAW",             35,         0x80},
+    {"LOCAL",           29,         0x81},
+    {"GLOBAL",          30,         0x82},
+    {"SASSIST1",        32,         0x83},
+    {"SASSIST2",        32,         0x84},
+    {"OHOLD1",          30,         0x85},
+    {"OHOLD2",          30,         0x86},
+    {"WDGF",            LEN_NAME,   0x87},
+    {"TPWM",            10,         0x90},
+    {"TINV",            5,          0x91},
+    {"RELDOF",          30,         0x92},
+    {"MMATS",           30,         0x93},
+    {"MMATU",           LEN_ANY,    0x94},
+    {"PIDTN",           LEN_ANY,    0x95},
+    {"ALLOC",           6,          0x96},
+    {"CTRLRATE",        10,         0x97},
+    {"CTRLSYNC",        9,          0x98},
+    {"CASC",            7,          0x99},
+    {"SSTAT",           LEN_NAME,   0xA0},
+    {"IMUR",            LEN_NAME,   0xA1},
+    {"IMUW",            LEN_NAME,   0xA2},
+    {"IMUP",            5,          0xA3},
+    {"DEPTHR",          LEN_NAME,   0xA4},
+    {"DEPTHP",          7,          0xA5},
+    {"DEPTHSTAT",       LEN_NAME,   0xA6},
+    {"BNO055A",         8,          0xB0},
+    {"SCBNO055R",       LEN_NAME,   0xB1},
+    {"SCBNO055E",       LEN_NAME,   0xB2},
+    {"SCBNO055S",       23,         0xB3},
+    {"BNO055CS",        LEN_NAME,   0xB4},
+    {"BNO055CV",        LEN_NAME,   0xB5},
+    {"BNO055RST",       LEN_NAME,   0xB6},
+    {"BNO055BURST",     12,         0xB7},
+    {"BNO055STAT",      LEN_NAME,   0xB8},
+    {"MS5837CALG",      LEN_NAME,   0xC0},
+    {"MS5837CALS",      18,         0xC1},
+    {"MS5837OSR",       11,         0xC2},
+    {"RESET\x0D\x1E",   LEN_NAME,   0x00},
+    {"RSTWHY",          LEN_NAME,   0xD0},
+    {"SIMHIJACK",       10,         0xD1},
+    {"SIMDAT",          26,         0xD2},
+    {"CBVER",           LEN_NAME,   0xD3},
+    {"PCSTAT",          LEN_NAME,   0xD4},
+    {"COMPACT",         8,          0xD5},
+    {"HEAPSTAT",        LEN_NAME,   0xD6},
+    {"CTRLSTAT",        LEN_NAME,   0xD7},
+    {"I2CDMA",          7,          0xD8},
+    {"I2CSTAT",         LEN_NAME,   0xD9},
+    {"I2CDEV",          7,          0xDA},
+    {"SIMIOSTAT",       LEN_NAME,   0xDB},
+};
+
+#define MSG_COUNT       (sizeof(msgs) / sizeof(msgs[0]))
+
+// Queries without side effects (safe to handle in tests)
+static const char *queries[] = {"SSTAT", "CBVER", "PCSTAT", "HEAPSTAT", "CTRLSTAT", "I2CSTAT", "SIMIOSTAT"};
+
+
+/**
+ * Build a message with an incorrect length (one extra byte)
+ * @param def Message definition (length must be fixed)
+ * @param compact true to use compact opcode instead of name
+ * @param buf Where to build message
+ * @return Length of message
+ */
+static unsigned int build_bad_len(const msg_def_t *def, bool compact, uint8_t *buf){
+    unsigned int name_len = strlen(def->name);
+    unsigned int args_len = def->len - name_len + 1;
+    unsigned int pos = 0;
+    if(compact){
+        buf[pos++] = def->op;
+    }else{
+        memcpy(buf, def->name, name_len);
+        pos = name_len;
+    }
+    memset(&buf[pos], 0, args_len);
+    return pos + args_len;
+}
+
+static void test_all_recognized(void){
+    uint8_t msg[128];
+    for(unsigned int i = 0; i < MSG_COUNT; ++i){
+        const msg_def_t *def = &msgs[i];
+        if(def->len < 0)
+            continue;
+        unsigned int len = build_bad_len(def, false, msg);
+        int ack = test_fw_ack(msg, len, NULL, NULL);
+        if(ack != ACK_ERR_INVALID_ARGS)
+            fprintf(stderr, "Named %s: ACK %d\n", def->name, ack);
+        CHECK(ack == ACK_ERR_INVALID_ARGS);
+
+        if(def->op == 0)
+            continue;
+        len = build_bad_len(def, true, msg);
+        ack = test_fw_ack(msg, len, NULL, NULL);
+        if(ack != ACK_ERR_INVALID_ARGS)
+            fprintf(stderr, "Compact %s: ACK %d\n", def->name, ack);
+        CHECK(ack == ACK_ERR_INVALID_ARGS);
+
+        // ACK for compact message uses compact format
+        uint8_t written[128];
+        CHECK(test_fw_last_written(written) > 0 && written[0] == OP_ACK);
+    }
+}
+
+static void test_unknown(void){
+    // Too short, unknown names, and names of messages that must be exactly their name (with extra data)
+    const char *names[] = {"", "A", "RA", "XYZ", "RAX", "SSTATX", "CBVER1", "WDGFF", "HEAPSTAT\x00"};
+    const unsigned int lens[] = {0, 1, 2, 3, 3, 6, 6, 5, 9};
+    for(unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        CHECK(test_fw_ack((const uint8_t*)names[i], lens[i], NULL, NULL) == ACK_ERR_UNKNOWN_MSG);
+
+    // Opcodes not assigned to any message (includes opcodes only sent by the control board)
+    for(unsigned int op = 0x80; op <= 252; ++op){
+        bool used = false;
+        for(unsigned int i = 0; i < MSG_COUNT; ++i){
+            if(msgs[i].op == op)
+                used = true;
+        }
+        if(used)
+            continue;
+        uint8_t msg[4] = {op, 0, 0, 0};
+        CHECK(test_fw_ack(msg, 4, NULL, NULL) == ACK_ERR_UNKNOWN_MSG);
+    }
+}
+
+static void test_queries(void){
+    for(unsigned int i = 0; i < sizeof(queries) / sizeof(queries[0]); ++i){
+        const msg_def_t *def = NULL;
+        for(unsigned int j = 0; j < MSG_COUNT; ++j){
+            if(strcmp(msgs[j].name, queries[i]) == 0)
+                def = &msgs[j];
+        }
+        uint8_t named_data[128], compact_data[128];
+        unsigned int named_len, compact_len;
+        CHECK(test_fw_ack((const uint8_t*)def->name, strlen(def->name), named_data, &named_len) == ACK_ERR_NONE);
+        CHECK(test_fw_ack(&def->op, 1, compact_data, &compact_len) == ACK_ERR_NONE);
+        CHECK(named_len == compact_len);
+    }
+
+    // PCSTAT response size (see messages.md)
+    unsigned int len;
+    uint8_t data[128];
+    CHECK(test_fw_ack((const uint8_t*)"PCSTAT", 6, data, &len) == ACK_ERR_NONE);
+    CHECK(len == 24);
+}
+
+static void test_ctrl_settings(void){
+    // Control loop settings changed by cmdctrl (this task) and used by the control task (cmdctrl_control_tick)
+    uint8_t rate[10] = "CTRLRATE", sync[9] = "CTRLSYNC";
+    uint8_t data[128];
+    unsigned int len;
+    conversions_int16_to_data(100, &rate[8], true);
+    CHECK(test_fw_ack(rate, sizeof(rate), NULL, NULL) == ACK_ERR_NONE);
+    CHECK(cmdctrl_control_period_ms() == 10);
+    CHECK(!cmdctrl_control_imu_sync());
+    for(unsigned int i = 0; i < 3; ++i)
+        cmdctrl_control_tick(false);
+    CHECK(test_fw_ack((const uint8_t*)"CTRLSTAT", 8, data, &len) == ACK_ERR_NONE);
+    CHECK(conversions_data_to_int32(&data[0], true) == 10000);
+    CHECK(conversions_data_to_int32(&data[4], true) == 3);
+
+    // Statistics reset by next tick after a change
+    sync[8] = 1;
+    CHECK(test_fw_ack(sync, sizeof(sync), NULL, NULL) == ACK_ERR_NONE);
+    CHECK(cmdctrl_control_imu_sync());
+    cmdctrl_control_tick(false);
+    CHECK(test_fw_ack((const uint8_t*)"CTRLSTAT", 8, data, &len) == ACK_ERR_NONE);
+    CHECK(conversions_data_to_int32(&data[0], true) == 0);
+    CHECK(conversions_data_to_int32(&data[4], true) == 1);
+    sync[8] = 0;
+    CHECK(test_fw_ack(sync, sizeof(sync), NULL, NULL) == ACK_ERR_NONE);
+
+    // Same arguments in compact form
+    uint8_t compact_rate[3] = {0x97};
+    conversions_int16_to_data(50, &compact_rate[1], true);
+    CHECK(test_fw_ack(compact_rate, sizeof(compact_rate), NULL, NULL) == ACK_ERR_NONE);
+    CHECK(cmdctrl_control_period_ms() == 20);
+}
+
+/**
+ * Send PIDTN and get the ACK error code
+ * @param which PID to tune
+ * @param vals kp, ki, kd, limit, kf, d_filter
+ * @param extended true for extended form (kf, d_filter, d_on_meas)
+ * @return ACK error code
+ */
+static int pidtn(char which, const float vals[6], bool extended){
+    uint8_t msg[32];
+    memcpy(msg, "PIDTN", 5);
+    msg[5] = which;
+    for(unsigned int i = 0; i < 4; ++i)
+        conversions_float_to_data(vals[i], &msg[6 + 4 * i], true);
+    msg[22] = 0;
+    conversions_float_to_data(vals[4], &msg[23], true);
+    conversions_float_to_data(vals[5], &msg[27], true);
+    msg[31] = 1;
+    return test_fw_ack(msg, extended ? 32 : 23, NULL, NULL);
+}
+
+static void test_pidtn(void){
+    const float good[6] = {1.0f, 0.1f, 0.01f, 1.0f, 0.0f, 0.05f};
+    const char *which = "XYZDxyz";
+    for(unsigned int w = 0; w < 7; ++w){
+        CHECK(pidtn(which[w], good, false) == ACK_ERR_NONE);
+        CHECK(pidtn(which[w], good, true) == ACK_ERR_NONE);
+
+        // Non-finite values
+        for(unsigned int i = 0; i < 6; ++i){
+            float bad[6];
+            memcpy(bad, good, sizeof(bad));
+            bad[i] = (i & 1) ? INFINITY : NAN;
+            CHECK(pidtn(which[w], bad, true) == ACK_ERR_INVALID_ARGS);
+        }
+
+        // Negative filter time constant
+        float bad[6];
+        memcpy(bad, good, sizeof(bad));
+        bad[5] = -0.1f;
+        CHECK(pidtn(which[w], bad, true) == ACK_ERR_INVALID_ARGS);
+
+        // Feed-forward only for PIDs with a feed-forward input (not rotation PIDs)
+        memcpy(bad, good, sizeof(bad));
+        bad[4] = 0.5f;
+        CHECK(pidtn(which[w], bad, true) == ((which[w] == 'X' || which[w] == 'Y' || which[w] == 'Z') ?
+                ACK_ERR_INVALID_ARGS : ACK_ERR_NONE));
+    }
+}
+
+static void test_no_alloc(void){
+    // Motion commands as sent every control cycle (named and compact), plus ACKs with errors for every message
+    uint8_t raw[35] = "RAW", local[29] = "LOCAL", compact_local[25] = {0x81};
+    uint8_t wdgf[1] = {0x87};
+    uint8_t bad[MSG_COUNT][128];
+    unsigned int bad_len[MSG_COUNT];
+    memset(&raw[3], 0, sizeof(raw) - 3);
+    memset(&local[5], 0, sizeof(local) - 5);
+    for(unsigned int i = 0; i < MSG_COUNT; ++i)
+        bad_len[i] = msgs[i].len < 0 ? 0 : build_bad_len(&msgs[i], false, bad[i]);
+    cmdctrl_sim_hijacked = true;
+
+    // Once first so anything allocated on first use is not counted
+    HeapStats_t before, after;
+    for(unsigned int rep = 0; rep < 2; ++rep){
+        if(rep == 1)
+            vPortGetHeapStats(&before);
+        for(unsigned int cycle = 0; cycle < 50; ++cycle){
+            CHECK(test_fw_ack(raw, sizeof(raw), NULL, NULL) == ACK_ERR_NONE);
+            CHECK(test_fw_ack(local, sizeof(local), NULL, NULL) == ACK_ERR_NONE);
+            CHECK(test_fw_ack(compact_local, sizeof(compact_local), NULL, NULL) == ACK_ERR_NONE);
+            CHECK(test_fw_ack((const uint8_t*)"WDGF", 4, NULL, NULL) == ACK_ERR_NONE);
+            CHECK(test_fw_ack(wdgf, sizeof(wdgf), NULL, NULL) == ACK_ERR_NONE);
+        }
+        for(unsigned int i = 0; i < MSG_COUNT; ++i){
+            if(bad_len[i] != 0)
+                CHECK(test_fw_ack(bad[i], bad_len[i], NULL, NULL) == ACK_ERR_INVALID_ARGS);
+        }
+    }
+    vPortGetHeapStats(&after);
+    CHECK(after.xNumberOfSuccessfulAllocations == before.xNumberOfSuccessfulAllocations);
+    CHECK(after.xNumberOfSuccessfulFrees == before.xNumberOfSuccessfulFrees);
+    cmdctrl_sim_hijacked = false;
+}
+
+static int run_tests(void){
+    test_fw_init();
+    test_all_recognized();
+    test_unknown();
+    test_queries();
+    test_ctrl_settings();
+    test_pidtn();
+    test_no_alloc();
+    return TEST_RESULT();
+}
+
+static int run_bench(void){
+    test_fw_init();
+
+    // Time to dispatch and acknowledge each message (incorrect length, so handler is not run)
+    const unsigned int reps = 20000;
+    double worst = 0.0, total = 0.0;
+    const char *worst_name = "";
+    unsigned int count = 0;
+    uint8_t msg[128];
+    for(unsigned int i = 0; i < MSG_COUNT; ++i){
+        if(msgs[i].len < 0)
+            continue;
+        unsigned int len = build_bad_len(&msgs[i], false, msg);
+        double start = test_time();
+        for(unsigned int r = 0; r < reps; ++r)
+            test_fw_handle(r, msg, len);
+        double t = (test_time() - start) / reps * 1e9;
+        total += t;
+        count++;
+        if(t > worst){
+            worst = t;
+            worst_name = msgs[i].name;
+        }
+    }
+
+    // Unknown message (searches a whole hash chain)
+    double start = test_time();
+    for(unsigned int r = 0; r < reps; ++r)
+        test_fw_handle(r, (const uint8_t*)"XYZW", 4);
+    double unknown = (test_time() - start) / reps * 1e9;
+
+    printf("Dispatch + ACK (ns per message): average %.0f, worst %.0f (%s), unknown message %.0f\n",
+            total / count, worst, worst_name, unknown);
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
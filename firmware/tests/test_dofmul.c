@@ -0,0 +1,220 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// DoF matrix multiply tests (motor control, mc_mul_8x6)
+// Built with the fixed-size 8x6 kernel (test_dofmul_fixed) and with the generic matrix functions it replaced
+// (test_dofmul_generic, CONTROL_BOARD_GENERIC_DOF_MUL). Property test: for example vehicles and random DoF matrices
+// (with zeros, as in real vehicles) and random targets, LOCAL mode speeds with MC_ALLOC_DOF must be bit-identical to
+// matrix_mul computed here.
+
+#include "test.h"
+#include "test_rtos.h"
+#include "test_fw.h"
+#include <motor_control.h>
+#include <cmdctrl.h>
+#include <util/matrix.h>
+#include <util/angles.h>
+
+#define TRIALS_PER_MATRIX       500
+
+#if defined(CONTROL_BOARD_GENERIC_DOF_MUL)
+#define KERNEL_NAME             "generic matrix_mul"
+#else
+#define KERNEL_NAME             "fixed 8x6"
+#endif
+
+static uint32_t seed = 0xD0F8;
+
+// SW8 (iface/vehicle.py)
+static const float sw8[8 * 6] = {
+    -1,     +1,      0,      0,      0,     -1,
+    +1,     +1,      0,      0,      0,     +1,
+    -1,     -1,      0,      0,      0,     +1,
+    +1,     -1,      0,      0,      0,     -1,
+     0,      0,     -1,     +1,     -1,      0,
+     0,      0,     -1,     +1,     +1,      0,
+     0,      0,     -1,     -1,     -1,      0,
+     0,      0,     -1,     -1,     +1,      0,
+};
+
+// Six thrusters (two unused; all zero rows)
+static const float six[8 * 6] = {
+    1,      0,      0,      0,      0,      1,
+    1,      0,      0,      0,      0,     -1,
+    0,      1,      0,      0,      0,      0,
+    0,      0,      1,      1,      0,      0,
+    0,      0,      1,     -1,      0,      0,
+    0,      0.5,    0.5,    0,      0,      0,
+    0,      0,      0,      0,      0,      0,
+    0,      0,      0,      0,      0,      0,
+};
+
+static float dof_arr[8 * 6];
+
+
+static void set_dof(const float *dof){
+    memcpy(dof_arr, dof, sizeof(dof_arr));
+    for(unsigned int t = 0; t < 8; ++t)
+        mc_set_dof_matrix(t + 1, &dof_arr[t * 6]);
+    mc_recalc();
+}
+
+static void random_dof(void){
+    for(unsigned int i = 0; i < 8 * 6; ++i)
+        dof_arr[i] = (test_rand(&seed) & 1) ? 0.0f : test_randf(&seed, -1.0f, 1.0f);
+    set_dof(dof_arr);
+}
+
+/**
+ * Reference speeds (DoF matrix * target) using matrix_mul
+ * @param speeds Where to store speeds
+ * @param target Target (x, y, z, xrot, yrot, zrot)
+ * @return Max magnitude of speeds
+ */
+static float ref_mul(float speeds[8], float target[6]){
+    matrix dof_m, target_m, speeds_m;
+    matrix_init_static(&dof_m, dof_arr, 8, 6);
+    matrix_init_static(&target_m, target, 6, 1);
+    matrix_init_static(&speeds_m, speeds, 8, 1);
+    matrix_mul(&speeds_m, &dof_m, &target_m);
+    float mval = 0.0f;
+    for(unsigned int i = 0; i < 8; ++i)
+        mval = fmaxf(mval, fabsf(speeds[i]));
+    return mval;
+}
+
+/**
+ * Check LOCAL mode speeds against reference for a target (scaled down first so no thruster speed is limited)
+ * @param target Target (x, y, z, xrot, yrot, zrot); modified if scaled
+ * @return true if speeds match
+ */
+static bool check_target(float target[6]){
+    float expected[8];
+    float mval = ref_mul(expected, target);
+    if(mval > 1.0f){
+        for(unsigned int c = 0; c < 6; ++c)
+            target[c] /= mval * 1.01f;
+        ref_mul(expected, target);
+    }
+    mc_wdog_feed();
+    mc_set_local((mc_local_target_t){target[0], target[1], target[2], target[3], target[4], target[5]});
+    return memcmp(expected, cmdctrl_sim_speeds, sizeof(expected)) == 0;
+}
+
+static void test_matrix(void){
+    unsigned int mismatches = 0;
+    for(unsigned int trial = 0; trial < TRIALS_PER_MATRIX; ++trial){
+        float target[6];
+        for(unsigned int c = 0; c < 6; ++c)
+            target[c] = test_randf(&seed, -1.0f, 1.0f);
+        if(!check_target(target))
+            mismatches++;
+    }
+
+    // All negative (rows of zeros sum negative zeros) and all zero targets
+    float neg[6] = {-0.1f, -0.2f, -0.3f, -0.1f, -0.2f, -0.3f};
+    float zero[6] = {0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f};
+    if(!check_target(neg))
+        mismatches++;
+    if(!check_target(zero))
+        mismatches++;
+
+    if(mismatches > 0)
+        fprintf(stderr, "%u of %u targets do not match\n", mismatches, TRIALS_PER_MATRIX + 2);
+    CHECK(mismatches == 0);
+}
+
+static int run_tests(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    mc_set_alloc(MC_ALLOC_DOF);
+
+    set_dof(sw8);
+    test_matrix();
+    set_dof(six);
+    test_matrix();
+    for(unsigned int m = 0; m < 20; ++m){
+        random_dof();
+        test_matrix();
+    }
+    return TEST_RESULT();
+}
+
+static int run_bench(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    mc_set_alloc(MC_ALLOC_DOF);
+    set_dof(sw8);
+    mc_pid_tune_t tune = {.kp = 1.0f, .limit = 1.0f};
+    mc_sassist_tune_xrot(tune);
+    mc_sassist_tune_yrot(tune);
+    mc_sassist_tune_zrot(tune);
+    mc_sassist_tune_depth(tune);
+
+    // New orientation each update (as on each IMU sample)
+    quaternion_t quats[64];
+    for(unsigned int i = 0; i < 64; ++i){
+        euler_t e = {
+            .pitch = test_randf(&seed, -30.0f, 30.0f),
+            .roll = test_randf(&seed, -30.0f, 30.0f),
+            .yaw = test_randf(&seed, -180.0f, 180.0f),
+            .is_deg = true
+        };
+        euler_to_quat(&quats[i], &e);
+    }
+    gyro_data_t gyro = {0};
+    const euler_t hold = {.pitch = 10.0f, .roll = -5.0f, .yaw = 30.0f, .is_deg = true};
+
+    static const char *modes[] = {"RAW", "LOCAL", "GLOBAL", "SASSIST", "OHOLD"};
+    const unsigned int reps = 200000;
+    printf("DoF multiply: %s\n", KERNEL_NAME);
+    for(unsigned int mode = 0; mode < 5; ++mode){
+        mc_wdog_feed();
+        double start = test_time();
+        for(unsigned int r = 0; r < reps; ++r){
+            float f = (r & 1023) / 512.0f - 1.0f;
+            const quaternion_t q = quats[r % 64];
+            switch(mode){
+            case 0:{
+                float speeds[8] = {f, -f, 0.5f * f, 0.3f, -0.7f * f, f, 0.1f, -0.2f};
+                mc_set_raw(speeds);
+                break;
+            }
+            case 1:
+                mc_set_local((mc_local_target_t){f, -f, 0.5f * f, 0.3f, -0.7f * f, f});
+                break;
+            case 2:
+                mc_set_global((mc_global_target_t){f, -f, 0.5f * f, 0.3f, -0.7f * f, f}, q);
+                break;
+            case 3:
+                mc_set_sassist((mc_sassist_target_t){.x = f, .y = -f, .yaw_spd = 0.3f, .target_euler = hold,
+                        .target_depth = -1.0f, .use_yaw_pid = true}, q, gyro, -1.0f + 0.1f * f);
+                break;
+            case 4:
+                mc_set_ohold((mc_ohold_target_t){.x = f, .y = -f, .z = 0.5f * f, .yaw_spd = 0.3f,
+                        .target_euler = hold, .use_yaw_pid = true}, q, gyro);
+                break;
+            }
+        }
+        double ns = (test_time() - start) / reps * 1e9;
+        printf("%-8s %8.0f ns per update\n", modes[mode], ns);
+    }
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Fast math tests (util/fastmath)
+// Always built with CONTROL_BOARD_FAST_MATH. Checks the approximations against the standard library using the
+// error bounds documented in fastmath.h.
+
+#include "test.h"
+#include <util/fastmath.h>
+
+#define PI_F        3.14159265358979f
+
+static uint32_t seed = 0xFA57;
+
+
+static void test_atan2(void){
+    double max_err = 0.0;
+    for(unsigned int i = 0; i < 200000; ++i){
+        float y = test_randf(&seed, -10.0f, 10.0f);
+        float x = test_randf(&seed, -10.0f, 10.0f);
+        max_err = fmax(max_err, fabs(fmath_atan2(y, x) - atan2(y, x)));
+    }
+    CHECK(max_err <= 1.2e-5);
+
+    // Axes and special cases
+    CHECK(fmath_atan2(0.0f, 0.0f) == 0.0f);
+    CHECK_NEAR(fmath_atan2(0.0f, 1.0f), 0.0, 1e-6);
+    CHECK_NEAR(fmath_atan2(1.0f, 0.0f), PI_F / 2.0f, 1e-6);
+    CHECK_NEAR(fmath_atan2(-1.0f, 0.0f), -PI_F / 2.0f, 1e-6);
+    CHECK_NEAR(fmath_atan2(0.0f, -1.0f), PI_F, 1e-6);
+    CHECK_NEAR(fmath_atan2(1.0f, 1.0f), PI_F / 4.0f, 1.2e-5);
+    CHECK_NEAR(fmath_atan2(-1e-6f, -1.0f), -PI_F, 1e-5);
+}
+
+static void test_asin(void){
+    double max_err = 0.0;
+    for(unsigned int i = 0; i < 200000; ++i){
+        float x = test_randf(&seed, -1.0f, 1.0f);
+        max_err = fmax(max_err, fabs(fmath_asin(x) - asin(x)));
+    }
+    CHECK(max_err <= 1.2e-5);
+
+    // Out of range values are clamped (rounding may make sin of pitch slightly larger than 1)
+    CHECK_NEAR(fmath_asin(1.0f), PI_F / 2.0f, 1e-6);
+    CHECK_NEAR(fmath_asin(-1.0f), -PI_F / 2.0f, 1e-6);
+    CHECK_NEAR(fmath_asin(1.0001f), PI_F / 2.0f, 1e-6);
+    CHECK_NEAR(fmath_asin(-1.0001f), -PI_F / 2.0f, 1e-6);
+    CHECK(fmath_asin(0.0f) == 0.0f);
+}
+
+static void test_sincos(void){
+    // Documented range (half angles of euler angles in radians are well within this)
+    double max_err = 0.0;
+    for(unsigned int i = 0; i < 200000; ++i){
+        float x = test_randf(&seed, -2.0f * PI_F, 2.0f * PI_F);
+        float s, c;
+        fmath_sincos(x, &s, &c);
+        max_err = fmax(max_err, fmax(fabs(s - sin(x)), fabs(c - cos(x))));
+    }
+    CHECK(max_err <= 5e-7);
+
+    // Larger angles are less accurate, but still usable
+    max_err = 0.0;
+    for(unsigned int i = 0; i < 200000; ++i){
+        float x = test_randf(&seed, -100.0f, 100.0f);
+        float s, c;
+        fmath_sincos(x, &s, &c);
+        max_err = fmax(max_err, fmax(fabs(s - sin(x)), fabs(c - cos(x))));
+    }
+    CHECK(max_err <= 1e-5);
+
+    // Quadrant boundaries
+    const float angles[] = {0.0f, PI_F / 2.0f, PI_F, -PI_F / 2.0f, -PI_F, PI_F / 4.0f, -3.0f * PI_F / 4.0f};
+    for(unsigned int i = 0; i < sizeof(angles) / sizeof(angles[0]); ++i){
+        float s, c;
+        fmath_sincos(angles[i], &s, &c);
+        CHECK_NEAR(s, sin(angles[i]), 5e-7);
+        CHECK_NEAR(c, cos(angles[i]), 5e-7);
+    }
+}
+
+static void test_sqrt(void){
+    for(unsigned int i = 0; i < 200000; ++i){
+        float x = test_randf(&seed, 0.0f, 1000.0f);
+        CHECK(fmath_sqrt(x) == sqrtf(x));
+        if(x > 0.0f)
+            CHECK(fmath_inv_sqrt(x) == 1.0f / sqrtf(x));
+    }
+    CHECK(fmath_sqrt(0.0f) == 0.0f);
+}
+
+
+static float inputs[1024];
+static float inputs2[1024];
+
+#define BENCH(name, expr)                                                                           \
+    do{                                                                                             \
+        volatile float sink = 0.0f;                                                                 \
+        const unsigned int reps = 10000000;                                                         \
+        double start = test_time();                                                                 \
+        for(unsigned int r = 0; r < reps; ++r){                                                     \
+            float x = inputs[r & 1023], y = inputs2[r & 1023];                                      \
+            (void)y;                                                                                \
+            sink += (expr);                                                                         \
+        }                                                                                           \
+        printf("%-16s %6.2f ns\n", name, (test_time() - start) / reps * 1e9);                       \
+    }while(0)
+
+static inline float fsin(float x){
+    float s, c;
+    fmath_sincos(x, &s, &c);
+    return s + c;
+}
+
+static int run_bench(void){
+    // Note that the approximations are meant for the control board's FPU. On a PC, the standard library
+    // functions may be faster.
+    for(unsigned int i = 0; i < 1024; ++i){
+        inputs[i] = test_randf(&seed, -1.0f, 1.0f);
+        inputs2[i] = test_randf(&seed, -1.0f, 1.0f);
+    }
+    BENCH("fmath_atan2", fmath_atan2(y, x));
+    BENCH("atan2f", atan2f(y, x));
+    BENCH("fmath_asin", fmath_asin(x));
+    BENCH("asinf", asinf(x));
+    BENCH("fmath_sincos", fsin(x * 3.0f));
+    BENCH("sinf + cosf", sinf(x * 3.0f) + cosf(x * 3.0f));
+    BENCH("fmath_inv_sqrt", fmath_inv_sqrt(x + 2.0f));
+    BENCH("1 / sqrtf", 1.0f / sqrtf(x + 2.0f));
+    return 0;
+}
+
+static int run_tests(void){
+    test_atan2();
+    test_asin();
+    test_sincos();
+    test_sqrt();
+    return TEST_RESULT();
+}
+
+TEST_MAIN(run_tests, run_bench)
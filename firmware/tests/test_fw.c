@@ -0,0 +1,132 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "test_fw.h"
+#include <app.h>
+#include <cmdctrl.h>
+#include <pccomm.h>
+#include <motor_control.h>
+#include <hardware/usb.h>
+#include <util/crc16.h>
+#include <string.h>
+
+#define START_BYTE          253
+#define END_BYTE            254
+#define ESCAPE_BYTE         255
+
+// Compact protocol ACK opcode (see cmdctrl.c)
+#define OP_ACK              0xE0
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Fake USB layer and app callbacks
+////////////////////////////////////////////////////////////////////////////////
+
+bool usb_initialized = true;
+
+// Frames written since last test_fw_handle (only the last frame is kept)
+static uint8_t tx_frame[256];
+static unsigned int tx_frame_len;
+
+void usb_init(void){}
+void usb_process(void){}
+unsigned int usb_avail(void){ return 0; }
+uint8_t usb_read(void){ return 0; }
+unsigned int usb_read_multiple(uint8_t *buf, unsigned int len){ (void)buf; (void)len; return 0; }
+void usb_write(uint8_t b){ (void)b; }
+void usb_flush(void){}
+void usb_sim_interrupts(void){}
+void usb_sim_get_stats(usb_sim_stats_t *stats){ memset(stats, 0, sizeof(*stats)); }
+
+void usb_write_multiple(const uint8_t *buf, unsigned int len){
+    // pccomm writes each frame at once
+    if(len <= sizeof(tx_frame)){
+        memcpy(tx_frame, buf, len);
+        tx_frame_len = len;
+    }
+}
+
+// Defined by SimCB's main.c (false so debug_halt exits immediately)
+bool simcb_interactive = false;
+
+void app_handle_uart_closed(void){}
+void app_handle_imu_sample(void){}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Harness
+////////////////////////////////////////////////////////////////////////////////
+
+void test_fw_init(void){
+    pccomm_init();
+    mc_init();
+    cmdctrl_init();
+}
+
+void test_fw_handle(uint16_t msg_id, const uint8_t *msg, unsigned int len){
+    pccomm_read_buf[0] = msg_id >> 8;
+    pccomm_read_buf[1] = msg_id & 0xFF;
+    memcpy(&pccomm_read_buf[2], msg, len);
+    uint16_t crc = crc16_ccitt_false(pccomm_read_buf, len + 2);
+    pccomm_read_buf[len + 2] = crc >> 8;
+    pccomm_read_buf[len + 3] = crc & 0xFF;
+    pccomm_read_len = len + 4;
+    pccomm_read_crc = crc;
+    tx_frame_len = 0;
+    cmdctrl_handle_message();
+}
+
+int test_fw_last_written(uint8_t *msg){
+    if(tx_frame_len < 2 || tx_frame[0] != START_BYTE || tx_frame[tx_frame_len - 1] != END_BYTE)
+        return -1;
+    uint8_t raw[256];
+    unsigned int len = 0;
+    for(unsigned int i = 1; i < tx_frame_len - 1; ++i){
+        if(tx_frame[i] == ESCAPE_BYTE)
+            i++;
+        raw[len++] = tx_frame[i];
+    }
+    if(len < 4 || crc16_ccitt_false(raw, len - 2) != ((raw[len - 2] << 8) | raw[len - 1]))
+        return -1;
+    memcpy(msg, &raw[2], len - 4);
+    return len - 4;
+}
+
+int test_fw_ack(const uint8_t *msg, unsigned int len, uint8_t *data, unsigned int *data_len){
+    static uint16_t msg_id = 0;
+    msg_id++;
+    test_fw_handle(msg_id, msg, len);
+
+    // A, C, K (or compact opcode), [message_id], [error_code], [data]
+    uint8_t ack[256];
+    int ack_len = test_fw_last_written(ack);
+    unsigned int pos;
+    if(ack_len >= 6 && memcmp(ack, "ACK", 3) == 0)
+        pos = 3;
+    else if(ack_len >= 4 && ack[0] == OP_ACK)
+        pos = 1;
+    else
+        return -1;
+    if(((ack[pos] << 8) | ack[pos + 1]) != msg_id)
+        return -1;
+    if(data != NULL)
+        memcpy(data, &ack[pos + 3], ack_len - pos - 3);
+    if(data_len != NULL)
+        *data_len = ack_len - pos - 3;
+    return ack[pos + 2];
+}
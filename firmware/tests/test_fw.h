@@ -0,0 +1,57 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Harness for host tests of firmware modules linked together (test_firmware library)
+// Replaces the parts of SimCB that talk to the outside world: USB (TCP socket) is a capture buffer and
+// app.c callbacks do nothing. Messages are handed to cmdctrl directly (no framing) and the last message
+// written to the PC can be read back.
+
+/**
+ * Initialize firmware modules used by tests (pccomm, motor control, cmdctrl). Call from a task.
+ */
+void test_fw_init(void);
+
+/**
+ * Handle a message as if it was received from the PC
+ * @param msg_id Message ID
+ * @param msg Message payload (starting with name or opcode)
+ * @param len Length of payload
+ */
+void test_fw_handle(uint16_t msg_id, const uint8_t *msg, unsigned int len);
+
+/**
+ * Get the last message written to the PC since test_fw_handle was called
+ * @param msg Where to store payload (unescaped, without message ID and CRC); at least 100 bytes
+ * @return Length of payload; -1 if nothing was written
+ */
+int test_fw_last_written(uint8_t *msg);
+
+/**
+ * Handle a message and get the ACK for it
+ * @param msg Message payload (starting with name or opcode)
+ * @param len Length of payload
+ * @param data Where to store ACK data (may be NULL); at least 100 bytes
+ * @param data_len Where to store length of ACK data (may be NULL)
+ * @return ACK error code; -1 if not acknowledged (or ACK is malformed / for wrong message ID)
+ */
+int test_fw_ack(const uint8_t *msg, unsigned int len, uint8_t *data, unsigned int *data_len);
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// I2C transaction layer tests (hardware/i2c)
+// Uses SimCB's fake I2C bus with fake devices attached (i2c_sim_attach) and an I2C task running i2c_process.
+// Checks priority ordering of queued transactions, device statistics, retries, and the circuit breaker
+// (trip after consecutive failures, rejections while open, a single probe after the open time, close on success).
+
+#include "test.h"
+#include "test_rtos.h"
+#include <hardware/i2c.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <stdint.h>
+
+#define ADDR_OK             0x28        // Always acknowledges. Read data is write data + 1.
+#define ADDR_FLAKY          0x76        // Fails while flaky_fail is true
+#define ADDR_RETRY          0x40        // Fails retry_failures times, then succeeds
+#define ADDR_MISSING        0x10        // Not attached
+
+// Same as i2c.c
+#define BREAKER_THRESHOLD   16
+#define BREAKER_OPEN_MS     200
+
+// Order transactions were performed in (first write byte of each transaction with ADDR_OK)
+static uint8_t order[32];
+static volatile unsigned int order_count = 0;
+
+static volatile bool flaky_fail = false;
+static volatile unsigned int retry_failures = 0;
+
+static volatile unsigned int done_count = 0;
+
+
+static bool dev_ok(i2c_trans *trans){
+    if(trans->write_count > 0 && order_count < sizeof(order))
+        order[order_count++] = trans->write_buf[0];
+    for(unsigned int i = 0; i < trans->read_count; ++i)
+        trans->read_buf[i] = (trans->write_count > 0 ? trans->write_buf[0] : 0) + 1 + i;
+    return true;
+}
+
+static bool dev_flaky(i2c_trans *trans){
+    (void)trans;
+    return !flaky_fail;
+}
+
+static bool dev_retry(i2c_trans *trans){
+    (void)trans;
+    if(retry_failures > 0){
+        retry_failures--;
+        return false;
+    }
+    return true;
+}
+
+static void i2c_task(void *arg){
+    (void)arg;
+    while(1)
+        i2c_process();
+}
+
+static void trans_done(i2c_trans *trans, bool success){
+    (void)trans;
+    (void)success;
+    done_count++;
+}
+
+/**
+ * Wait for submitted transactions to finish
+ * @param count Number of transactions (done_count value) to wait for
+ * @return true if finished; false if timed out
+ */
+static bool wait_done(unsigned int count){
+    for(unsigned int i = 0; i < 1000 && done_count < count; ++i)
+        vTaskDelay(pdMS_TO_TICKS(1));
+    return done_count >= count;
+}
+
+static void test_basic(void){
+    uint8_t wr[2] = {0x10, 0x20}, rd[4] = {0};
+    i2c_trans trans = {.address = ADDR_OK, .write_buf = wr, .write_count = 2, .read_buf = rd, .read_count = 4,
+            .priority = I2C_PRIO_NORMAL};
+    uint32_t count = i2c_get_transaction_count();
+    CHECK(i2c_perform(&trans));
+    CHECK(rd[0] == 0x11 && rd[3] == 0x14);
+    CHECK(i2c_get_transaction_count() == count + 1);
+
+    i2c_device_stats_t stats;
+    CHECK(i2c_get_device_stats(ADDR_OK, &stats));
+    CHECK(stats.transactions == 1 && stats.failures == 0 && stats.rejected == 0);
+    CHECK(stats.avg_latency_us > 0 && stats.max_latency_us >= stats.avg_latency_us);
+
+    // Device that does not acknowledge
+    i2c_trans missing = {.address = ADDR_MISSING, .write_buf = wr, .write_count = 1, .priority = I2C_PRIO_NORMAL};
+    CHECK(!i2c_perform(&missing));
+    CHECK(i2c_get_device_stats(ADDR_MISSING, &stats));
+    CHECK(stats.transactions == 1 && stats.failures == 1 && !stats.breaker_open);
+
+    // No statistics for devices never used
+    CHECK(!i2c_get_device_stats(0x55, &stats));
+
+    // No DMA or interrupts on SimCB
+    uint32_t isr_count, isr_time;
+    CHECK(!i2c_set_dma(true));
+    CHECK(i2c_set_dma(false));
+    CHECK(!i2c_get_dma());
+    i2c_get_isr_stats(&isr_count, &isr_time);
+    CHECK(isr_count == 0 && isr_time == 0);
+}
+
+static void test_priority(void){
+    // First transaction starts immediately (I2C task has higher priority). Others queue while it is performed.
+    static const uint8_t prios[] = {
+        I2C_PRIO_LOW, I2C_PRIO_LOW, I2C_PRIO_NORMAL, I2C_PRIO_HIGH, I2C_PRIO_NORMAL, I2C_PRIO_HIGH, I2C_PRIO_LOW
+    };
+    static const uint8_t expected[] = {0, 3, 5, 2, 4, 1, 6};
+    const unsigned int n = sizeof(prios);
+    static uint8_t wr[7];
+    static i2c_trans trans[7];
+    memset(trans, 0, sizeof(trans));
+    order_count = 0;
+    done_count = 0;
+    for(unsigned int i = 0; i < n; ++i){
+        wr[i] = i;
+        trans[i] = (i2c_trans){.address = ADDR_OK, .write_buf = &wr[i], .write_count = 1, .priority = prios[i],
+                .done = trans_done};
+        CHECK(i2c_submit(&trans[i]));
+    }
+
+    // Transaction can not be queued twice
+    CHECK(!i2c_submit(&trans[n - 1]));
+
+    CHECK(wait_done(n));
+    CHECK(order_count == n);
+    for(unsigned int i = 0; i < n; ++i)
+        CHECK(order[i] == expected[i]);
+
+    // Finished transaction can be submitted again
+    done_count = 0;
+    CHECK(i2c_submit(&trans[0]));
+    CHECK(wait_done(1));
+}
+
+static void test_retries(void){
+    uint8_t wr = 0;
+    i2c_trans trans = {.address = ADDR_RETRY, .write_buf = &wr, .write_count = 1, .priority = I2C_PRIO_NORMAL};
+    unsigned int attempts;
+    retry_failures = 2;
+    CHECK(i2c_perform_retries(&trans, 100, &attempts));
+    CHECK(attempts == 3);
+
+    i2c_device_stats_t stats;
+    CHECK(i2c_get_device_stats(ADDR_RETRY, &stats));
+    CHECK(stats.transactions == 3 && stats.failures == 2 && stats.retries == 2);
+
+    // No attempt started after timeout (delays 1, 2, 4, 8, 16, 16, ... ms)
+    retry_failures = 1000;
+    TickType_t start = xTaskGetTickCount();
+    CHECK(!i2c_perform_retries(&trans, 20, &attempts));
+    CHECK(attempts >= 3 && attempts <= 5);
+    CHECK((xTaskGetTickCount() - start) <= pdMS_TO_TICKS(30));
+    retry_failures = 0;
+    CHECK(i2c_perform(&trans));
+}
+
+static void test_breaker(void){
+    uint8_t wr = 0;
+    i2c_trans trans = {.address = ADDR_FLAKY, .write_buf = &wr, .write_count = 1, .priority = I2C_PRIO_NORMAL};
+    i2c_device_stats_t stats;
+    flaky_fail = true;
+
+    // Trips after threshold consecutive failures
+    for(unsigned int i = 0; i < BREAKER_THRESHOLD - 1; ++i)
+        CHECK(!i2c_perform(&trans));
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(!stats.breaker_open && stats.breaker_trips == 0);
+    CHECK(!i2c_perform(&trans));
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(stats.breaker_open && stats.breaker_trips == 1);
+    CHECK(stats.transactions == BREAKER_THRESHOLD && stats.failures == BREAKER_THRESHOLD);
+
+    // Rejected while open (bus not used), even if device would succeed. Retries stop early.
+    flaky_fail = false;
+    uint32_t count = i2c_get_transaction_count();
+    unsigned int attempts;
+    CHECK(!i2c_perform(&trans));
+    CHECK(!i2c_perform_retries(&trans, 100, &attempts));
+    CHECK(attempts == 1);
+    CHECK(i2c_get_transaction_count() == count);
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(stats.rejected == 2 && stats.transactions == BREAKER_THRESHOLD);
+
+    // Other devices are not affected
+    uint8_t ok_wr = 0;
+    i2c_trans ok = {.address = ADDR_OK, .write_buf = &ok_wr, .write_count = 1, .priority = I2C_PRIO_NORMAL};
+    CHECK(i2c_perform(&ok));
+
+    // After open time, a single probe is performed (others queued with it rejected). Failed probe stays open.
+    flaky_fail = true;
+    vTaskDelay(pdMS_TO_TICKS(BREAKER_OPEN_MS + 10));
+    static uint8_t probe_wr[4];
+    static i2c_trans probes[4];
+    done_count = 0;
+    ok.done = trans_done;
+    CHECK(i2c_submit(&ok));
+    for(unsigned int i = 0; i < 4; ++i){
+        probes[i] = (i2c_trans){.address = ADDR_FLAKY, .write_buf = &probe_wr[i], .write_count = 1,
+                .priority = I2C_PRIO_NORMAL, .done = trans_done};
+        CHECK(i2c_submit(&probes[i]));
+    }
+    CHECK(wait_done(5));
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(stats.transactions == BREAKER_THRESHOLD + 1);
+    CHECK(stats.rejected == 2 + 3);
+    CHECK(stats.breaker_open && stats.breaker_trips == 1);
+
+    // Open time restarts after failed probe
+    flaky_fail = false;
+    vTaskDelay(pdMS_TO_TICKS(BREAKER_OPEN_MS / 2));
+    CHECK(!i2c_perform(&trans));
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(stats.transactions == BREAKER_THRESHOLD + 1 && stats.rejected == 6);
+
+    // Successful probe closes breaker
+    vTaskDelay(pdMS_TO_TICKS(BREAKER_OPEN_MS / 2 + 10));
+    CHECK(i2c_perform(&trans));
+    CHECK(i2c_perform(&trans));
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(!stats.breaker_open && stats.breaker_trips == 1);
+    CHECK(stats.transactions == BREAKER_THRESHOLD + 3 && stats.rejected == 6);
+
+    // Failures count from zero again after closing
+    flaky_fail = true;
+    for(unsigned int i = 0; i < BREAKER_THRESHOLD - 1; ++i)
+        CHECK(!i2c_perform(&trans));
+    CHECK(i2c_get_device_stats(ADDR_FLAKY, &stats));
+    CHECK(!stats.breaker_open);
+    flaky_fail = false;
+}
+
+static int run_tests(void){
+    i2c_sim_attach(ADDR_OK, dev_ok);
+    i2c_sim_attach(ADDR_FLAKY, dev_flaky);
+    i2c_sim_attach(ADDR_RETRY, dev_retry);
+    i2c_init();
+    xTaskCreate(i2c_task, "i2c", 1024, NULL, 2, NULL);
+
+    test_basic();
+    test_priority();
+    test_retries();
+    test_breaker();
+    return TEST_RESULT();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Benchmark
+////////////////////////////////////////////////////////////////////////////////
+
+// Similar to BNO055 and MS5837 traffic: 33 byte IMU transaction every 10ms and back-to-back 17 byte housekeeping
+// transactions from several clients.
+#define BENCH_IMU_READS         200
+#define BENCH_IMU_PERIOD_MS     10
+#define BENCH_CLIENTS           3
+
+static volatile bool bench_running = false;
+static volatile unsigned int bench_clients_running = 0;
+
+static void housekeeping_task(void *arg){
+    uint8_t wr = 0x80, rd[16];
+    i2c_trans trans = {.address = ADDR_OK, .write_buf = &wr, .write_count = 1, .read_buf = rd, .read_count = 16,
+            .priority = (uint8_t)(uintptr_t)arg};
+    while(bench_running){
+        // Fails if not started within queue timeout. Keep going (real clients would retry).
+        i2c_perform(&trans);
+    }
+    bench_clients_running--;
+    vTaskDelete(NULL);
+}
+
+static void bench_latency(const char *name, uint8_t housekeeping_prio){
+    uint8_t wr = 0x00, rd[32];
+    i2c_trans imu = {.address = ADDR_OK, .write_buf = &wr, .write_count = 1, .read_buf = rd, .read_count = 32,
+            .priority = I2C_PRIO_HIGH};
+
+    bench_running = true;
+    for(unsigned int i = 0; i < BENCH_CLIENTS; ++i){
+        bench_clients_running++;
+        xTaskCreate(housekeeping_task, "hk", 1024, (void*)(uintptr_t)housekeeping_prio, 1, NULL);
+    }
+
+    double total = 0.0, max = 0.0;
+    unsigned int failures = 0;
+    TickType_t wake = xTaskGetTickCount();
+    for(unsigned int i = 0; i < BENCH_IMU_READS; ++i){
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(BENCH_IMU_PERIOD_MS));
+        double start = test_time();
+        if(!i2c_perform(&imu))
+            failures++;
+        double latency = test_time() - start;
+        total += latency;
+        if(latency > max)
+            max = latency;
+    }
+
+    bench_running = false;
+    while(bench_clients_running > 0)
+        vTaskDelay(pdMS_TO_TICKS(10));
+
+    printf("%-36s avg %5.1f ms  max %5.1f ms  failed %u/%u\n", name, total / BENCH_IMU_READS * 1e3, max * 1e3,
+            failures, BENCH_IMU_READS);
+}
+
+static int run_bench(void){
+    i2c_sim_attach(ADDR_OK, dev_ok);
+    i2c_init();
+    xTaskCreate(i2c_task, "i2c", 1024, NULL, 2, NULL);
+
+    printf("IMU latency (33 byte transaction every %d ms, %d housekeeping clients)\n", BENCH_IMU_PERIOD_MS,
+            BENCH_CLIENTS);
+    bench_latency("Housekeeping HIGH (FIFO with IMU)", I2C_PRIO_HIGH);
+    bench_latency("Housekeeping LOW", I2C_PRIO_LOW);
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
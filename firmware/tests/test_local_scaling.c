@@ -0,0 +1,216 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Local mode speed scaling tests (motor control)
+// Property test: for random DoF matrices (structured like real vehicles and fully random) and random targets,
+// mc_set_local must produce the same thruster speeds as the original implementation (overlap vectors and repeated
+// max-first scaling using matrix functions), which is reimplemented here as a reference.
+
+#include "test.h"
+#include "test_rtos.h"
+#include "test_fw.h"
+#include <motor_control.h>
+#include <cmdctrl.h>
+#include <util/matrix.h>
+
+#define TRIALS_PER_MATRIX       200
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reference implementation
+////////////////////////////////////////////////////////////////////////////////
+
+static float ref_dof_arr[8 * 6];
+static matrix ref_dof;
+static float ref_overlap_arrs[8][8];
+static matrix ref_overlap[8];
+
+static void ref_recalc(void){
+    matrix_init_static(&ref_dof, ref_dof_arr, 8, 6);
+
+    float contribution_arr[8 * 6];
+    matrix contribution;
+    matrix_init_static(&contribution, contribution_arr, 8, 6);
+    for(unsigned int i = 0; i < 8 * 6; ++i)
+        contribution_arr[i] = (ref_dof_arr[i] != 0) ? 1 : 0;
+
+    float rowdata[8];
+    float v_arr[6];
+    matrix v;
+    matrix_init_static(&v, v_arr, 6, 1);
+    for(unsigned int r = 0; r < 8; ++r){
+        matrix_init_static(&ref_overlap[r], ref_overlap_arrs[r], 8, 1);
+        matrix_get_row(rowdata, &contribution, r);
+        matrix_set_col(&v, 0, rowdata);
+        matrix_mul(&ref_overlap[r], &contribution, &v);
+        for(unsigned int i = 0; i < 8; ++i)
+            ref_overlap_arrs[r][i] = (ref_overlap_arrs[r][i] != 0) ? 1 : 0;
+    }
+}
+
+/**
+ * Calculate thruster speeds for local mode target
+ * @param speeds Where to store speeds
+ * @param target Target (x, y, z, xrot, yrot, zrot)
+ * @return false if no speeds would be set
+ */
+static bool ref_local(float speeds[8], const float target[6]){
+    float target_arr[6];
+    matrix target_mat;
+    matrix_init_static(&target_mat, target_arr, 6, 1);
+    for(unsigned int i = 0; i < 6; ++i)
+        target_arr[i] = fmaxf(-1.0f, fminf(1.0f, target[i]));
+
+    matrix speed_vec;
+    matrix_init_static(&speed_vec, speeds, 8, 1);
+    matrix_mul(&speed_vec, &ref_dof, &target_mat);
+
+    for(unsigned int iteration = 0; iteration < 8; ++iteration){
+        size_t idxrow, idxcol;
+        float mval;
+        matrix_absmax(&mval, &idxrow, &idxcol, &speed_vec);
+        if(mval <= 1)
+            return true;
+        for(unsigned int i = 0; i < 8; ++i){
+            if(ref_overlap_arrs[idxrow][i] == 1)
+                speeds[i] /= mval;
+        }
+    }
+    float mval;
+    size_t idxrow, idxcol;
+    matrix_absmax(&mval, &idxrow, &idxcol, &speed_vec);
+    return mval <= 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Tests
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t seed = 0x5CA1E;
+
+static void set_matrix(const float *arr){
+    memcpy(ref_dof_arr, arr, sizeof(ref_dof_arr));
+    ref_recalc();
+    for(unsigned int t = 0; t < 8; ++t)
+        mc_set_dof_matrix(t + 1, (float*)&arr[t * 6]);
+    mc_recalc();
+}
+
+/**
+ * Compare mc_set_local to reference for random targets with the current matrix
+ * @return Number of trials where speeds were scaled down
+ */
+static unsigned int compare_random_targets(void){
+    unsigned int scaled = 0;
+    for(unsigned int trial = 0; trial < TRIALS_PER_MATRIX; ++trial){
+        float target[6];
+        for(unsigned int i = 0; i < 6; ++i){
+            // Some DoFs unused, some beyond the valid range (clamped)
+            target[i] = (test_rand(&seed) % 4 == 0) ? 0.0f : test_randf(&seed, -1.5f, 1.5f);
+        }
+
+        float expected[8];
+        bool expect_set = ref_local(expected, target);
+
+        // Speeds are unchanged if mc_set_local does not set them
+        for(unsigned int i = 0; i < 8; ++i)
+            cmdctrl_sim_speeds[i] = NAN;
+        mc_wdog_feed();
+        mc_set_local((mc_local_target_t){target[0], target[1], target[2], target[3], target[4], target[5]});
+
+        bool set = !isnan(cmdctrl_sim_speeds[0]);
+        CHECK(set == expect_set);
+        if(!set || !expect_set)
+            continue;
+        float unscaled_max = 0.0f;
+        for(unsigned int i = 0; i < 8; ++i){
+            CHECK_NEAR(cmdctrl_sim_speeds[i], expected[i], 1e-6);
+            CHECK(fabsf(cmdctrl_sim_speeds[i]) <= 1.0f + 1e-6f);
+            float u = 0.0f;
+            for(unsigned int d = 0; d < 6; ++d)
+                u += ref_dof_arr[i * 6 + d] * fmaxf(-1.0f, fminf(1.0f, target[d]));
+            unscaled_max = fmaxf(unscaled_max, fabsf(u));
+        }
+        if(unscaled_max > 1.0f)
+            scaled++;
+    }
+    return scaled;
+}
+
+static void test_vehicle(void){
+    // SW8 (iface/vehicle.py): vertical and horizontal thrusters form two disjoint groups
+    const float sw8[8 * 6] = {
+        -1, +1,  0,  0,  0, -1,
+        +1, +1,  0,  0,  0, +1,
+        -1, -1,  0,  0,  0, +1,
+        +1, -1,  0,  0,  0, -1,
+         0,  0, -1, +1, -1,  0,
+         0,  0, -1, +1, +1,  0,
+         0,  0, -1, -1, -1,  0,
+         0,  0, -1, -1, +1,  0,
+    };
+    set_matrix(sw8);
+    CHECK(compare_random_targets() > 0);
+}
+
+static void test_block_matrices(void){
+    // Random partition of DoFs into blocks. Each thruster drives all DoFs of one block (or none).
+    // Overlaps form disjoint groups (single pass scaling).
+    unsigned int scaled = 0;
+    for(unsigned int m = 0; m < 200; ++m){
+        unsigned int block_of_dof[6];
+        unsigned int blocks = 1 + test_rand(&seed) % 4;
+        for(unsigned int d = 0; d < 6; ++d)
+            block_of_dof[d] = test_rand(&seed) % blocks;
+        float arr[8 * 6];
+        for(unsigned int t = 0; t < 8; ++t){
+            unsigned int block = test_rand(&seed) % (blocks + 1);
+            for(unsigned int d = 0; d < 6; ++d)
+                arr[t * 6 + d] = (block_of_dof[d] == block) ? test_randf(&seed, 0.2f, 1.2f) * ((test_rand(&seed) & 1) ? 1 : -1) : 0.0f;
+        }
+        set_matrix(arr);
+        scaled += compare_random_targets();
+    }
+    CHECK(scaled > 0);
+}
+
+static void test_random_matrices(void){
+    // Sparse random matrices. Overlaps usually do not form disjoint groups (max-first scaling).
+    unsigned int scaled = 0;
+    for(unsigned int m = 0; m < 200; ++m){
+        float arr[8 * 6];
+        unsigned int density = 1 + test_rand(&seed) % 4;
+        for(unsigned int i = 0; i < 8 * 6; ++i)
+            arr[i] = (test_rand(&seed) % 5 < density) ? test_randf(&seed, -1.5f, 1.5f) : 0.0f;
+        set_matrix(arr);
+        scaled += compare_random_targets();
+    }
+    CHECK(scaled > 0);
+}
+
+static int run_tests(void){
+    test_fw_init();
+    cmdctrl_sim_hijacked = true;
+    test_vehicle();
+    test_block_matrices();
+    test_random_matrices();
+    return TEST_RESULT();
+}
+
+TEST_RTOS_MAIN(run_tests, NULL, 1)
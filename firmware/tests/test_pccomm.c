@@ -0,0 +1,423 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// PC communication framing tests
+// Frames written by pccomm_writev are compared to a simple reference encoder. Streams of valid and invalid frames
+// are parsed by pccomm_read_and_parse (fed through a fake USB layer in chunks of various sizes) and by a simple
+// byte at a time reference parser. Both must produce the same messages and statistics.
+
+#include "test.h"
+#include "test_rtos.h"
+#include <pccomm.h>
+#include <hardware/usb.h>
+#include <util/crc16.h>
+#include <stdlib.h>
+
+#define START_BYTE          253
+#define END_BYTE            254
+#define ESCAPE_BYTE         255
+
+#define STREAM_SIZE         (256 * 1024)
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Fake USB layer
+////////////////////////////////////////////////////////////////////////////////
+
+bool usb_initialized = true;
+
+static uint8_t *rx_data;                // Data to be "received"
+static unsigned int rx_len;
+static unsigned int rx_pos;
+static unsigned int rx_chunk;           // Max bytes returned by one read (as if data arrived in pieces)
+
+static uint8_t tx_data[1024];           // Data "sent" (since last tx_reset)
+static unsigned int tx_len;
+
+unsigned int usb_avail(void){
+    return rx_len - rx_pos;
+}
+
+uint8_t usb_read(void){
+    return rx_data[rx_pos++];
+}
+
+unsigned int usb_read_multiple(uint8_t *buf, unsigned int len){
+    unsigned int count = usb_avail();
+    if(count > len)
+        count = len;
+    if(count > rx_chunk)
+        count = rx_chunk;
+    memcpy(buf, &rx_data[rx_pos], count);
+    rx_pos += count;
+    return count;
+}
+
+void usb_write(uint8_t b){
+    tx_data[tx_len++] = b;
+}
+
+void usb_write_multiple(const uint8_t *buf, unsigned int len){
+    memcpy(&tx_data[tx_len], buf, len);
+    tx_len += len;
+}
+
+void usb_flush(void){}
+
+static void rx_set(uint8_t *data, unsigned int len, unsigned int chunk){
+    rx_data = data;
+    rx_len = len;
+    rx_pos = 0;
+    rx_chunk = chunk;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reference encoder and parser (one byte at a time)
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int ref_escape(const uint8_t *data, unsigned int len, uint8_t *dest){
+    unsigned int out = 0;
+    for(unsigned int i = 0; i < len; ++i){
+        if(data[i] == START_BYTE || data[i] == END_BYTE || data[i] == ESCAPE_BYTE)
+            dest[out++] = ESCAPE_BYTE;
+        dest[out++] = data[i];
+    }
+    return out;
+}
+
+/**
+ * Build a complete frame
+ * @param dest Where to write frame (must have space for 2 * (len + 4) + 2 bytes)
+ * @param id Message ID
+ * @param payload Message payload
+ * @param len Length of payload
+ * @param good_crc false to write an incorrect CRC
+ * @return Length of frame
+ */
+static unsigned int ref_frame(uint8_t *dest, uint16_t id, const uint8_t *payload, unsigned int len, bool good_crc){
+    uint8_t raw[256];
+    raw[0] = id >> 8;
+    raw[1] = id & 0xFF;
+    memcpy(&raw[2], payload, len);
+    uint16_t crc = crc16_ccitt_false(raw, len + 2);
+    if(!good_crc)
+        crc ^= 0x0100;
+    raw[len + 2] = crc >> 8;
+    raw[len + 3] = crc & 0xFF;
+    unsigned int pos = 0;
+    dest[pos++] = START_BYTE;
+    pos += ref_escape(raw, len + 4, &dest[pos]);
+    dest[pos++] = END_BYTE;
+    return pos;
+}
+
+typedef struct {
+    bool started;
+    bool escaped;
+    bool truncated;
+    uint8_t buf[PCCOMM_MAX_MSG_LEN + 4];
+    unsigned int len;
+    uint32_t msgs;
+    uint32_t invalid;
+    uint32_t truncated_count;
+} ref_parser_t;
+
+/**
+ * Parse one byte with the reference parser
+ * @param p Parser state
+ * @param byte Byte to parse
+ * @return true if p->buf now holds a complete, valid message
+ */
+static bool ref_parse(ref_parser_t *p, uint8_t byte){
+    if(p->escaped){
+        // Invalid escape sequences are ignored
+        p->escaped = false;
+        if(p->len == PCCOMM_MAX_MSG_LEN)
+            p->truncated = true;
+        else if(byte == START_BYTE || byte == END_BYTE || byte == ESCAPE_BYTE)
+            p->buf[p->len++] = byte;
+    }else if(byte == START_BYTE){
+        p->started = true;
+        p->truncated = false;
+        p->len = 0;
+    }else if(!p->started){
+        // Ignore data outside a frame
+    }else if(byte == ESCAPE_BYTE){
+        p->escaped = true;
+    }else if(byte == END_BYTE){
+        p->started = false;
+        if(p->truncated){
+            p->truncated_count++;
+        }else if(p->len < 4 || crc16_ccitt_false(p->buf, p->len - 2) != ((p->buf[p->len - 2] << 8) | p->buf[p->len - 1])){
+            p->invalid++;
+        }else{
+            p->msgs++;
+            return true;
+        }
+    }else if(p->len == PCCOMM_MAX_MSG_LEN){
+        p->truncated = true;
+    }else{
+        p->buf[p->len++] = byte;
+    }
+    return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Tests
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t stream[STREAM_SIZE];
+static uint32_t seed = 0xC0FFEE;
+
+// Random payload byte (special bytes are common so escaping is well tested)
+static uint8_t rand_byte(void){
+    uint32_t r = test_rand(&seed);
+    if((r & 3) == 0)
+        return START_BYTE + ((r >> 2) % 3);
+    return r >> 8;
+}
+
+static void test_write(void){
+    uint16_t id = 0;
+    for(unsigned int i = 0; i < 500; ++i){
+        uint8_t payload[PCCOMM_MAX_MSG_LEN];
+        unsigned int len = test_rand(&seed) % (PCCOMM_MAX_MSG_LEN + 1);
+        for(unsigned int j = 0; j < len; ++j)
+            payload[j] = rand_byte();
+
+        // Random split into fragments (including empty fragments)
+        pccomm_frag_t frags[4];
+        unsigned int pos = 0;
+        for(unsigned int f = 0; f < 4; ++f){
+            unsigned int flen = (f == 3) ? (len - pos) : (test_rand(&seed) % (len - pos + 1));
+            frags[f].data = &payload[pos];
+            frags[f].len = flen;
+            pos += flen;
+        }
+
+        uint8_t expected[2 * (PCCOMM_MAX_MSG_LEN + 4) + 2];
+        unsigned int expected_len = ref_frame(expected, id++, payload, len, true);
+        tx_len = 0;
+        CHECK(pccomm_writev(frags, 4));
+        CHECK(tx_len == expected_len && memcmp(tx_data, expected, expected_len) == 0);
+    }
+
+    // Too long messages are not sent (and do not use a message ID)
+    uint8_t payload[PCCOMM_MAX_MSG_LEN + 1] = {0};
+    uint32_t dropped = pccomm_stats.tx_dropped;
+    tx_len = 0;
+    CHECK(!pccomm_write(payload, PCCOMM_MAX_MSG_LEN + 1));
+    CHECK(tx_len == 0);
+    CHECK(pccomm_stats.tx_dropped == dropped + 1);
+    uint8_t expected[2 * (PCCOMM_MAX_MSG_LEN + 4) + 2];
+    unsigned int expected_len = ref_frame(expected, id++, payload, PCCOMM_MAX_MSG_LEN, true);
+    CHECK(pccomm_write(payload, PCCOMM_MAX_MSG_LEN));
+    CHECK(tx_len == expected_len && memcmp(tx_data, expected, expected_len) == 0);
+}
+
+/**
+ * Generate a stream of valid and invalid frames with garbage between some of them
+ * @return Length of stream
+ */
+static unsigned int gen_stream(void){
+    unsigned int len = 0;
+    while(len < STREAM_SIZE - 512){
+        uint8_t payload[PCCOMM_MAX_MSG_LEN + 32];
+        unsigned int kind = test_rand(&seed) % 16;
+        unsigned int plen = test_rand(&seed) % (PCCOMM_MAX_MSG_LEN - 2 + 1);
+        if(kind == 0)
+            plen = PCCOMM_MAX_MSG_LEN - 4 + 1 + test_rand(&seed) % 32;      // Too long
+        for(unsigned int i = 0; i < plen; ++i)
+            payload[i] = rand_byte();
+        unsigned int start = len;
+        len += ref_frame(&stream[len], test_rand(&seed), payload, plen, kind != 1);
+        switch(kind){
+        case 2:
+            // Frame cut off (next start byte restarts parsing)
+            len = start + 1 + (test_rand(&seed) % (len - start - 1));
+            if(stream[len - 1] == ESCAPE_BYTE)
+                len--;
+            break;
+        case 3:
+            // Garbage between frames (no start bytes)
+            for(unsigned int i = 0; i < 16; ++i)
+                stream[len++] = test_rand(&seed) % START_BYTE;
+            break;
+        case 4:
+            // Too short
+            stream[len++] = START_BYTE;
+            stream[len++] = 1;
+            stream[len++] = END_BYTE;
+            break;
+        case 5:
+            // Invalid escape sequence after start byte (escaped byte is ignored, so frame is still valid)
+            memmove(&stream[start + 3], &stream[start + 1], len - start - 1);
+            stream[start + 1] = ESCAPE_BYTE;
+            stream[start + 2] = 7;
+            len += 2;
+            break;
+        }
+    }
+    return len;
+}
+
+static void test_parse(void){
+    static ref_parser_t ref;
+    const unsigned int chunks[] = {1, 2, 3, 5, 13, 64, STREAM_SIZE};
+    for(unsigned int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c){
+        unsigned int len = gen_stream();
+        pccomm_stats_t start = pccomm_stats;
+        ref_parser_t ref_start = ref;
+
+        // Reference results (complete messages in order)
+        static uint8_t ref_msgs[STREAM_SIZE];
+        unsigned int ref_msgs_len = 0;
+        for(unsigned int i = 0; i < len; ++i){
+            if(ref_parse(&ref, stream[i])){
+                ref_msgs[ref_msgs_len++] = ref.len;
+                memcpy(&ref_msgs[ref_msgs_len], ref.buf, ref.len);
+                ref_msgs_len += ref.len;
+            }
+        }
+
+        // Parse the same data in chunks. Compare messages as they are read.
+        rx_set(stream, len, chunks[c]);
+        unsigned int ref_pos = 0;
+        bool match = true;
+        while(pccomm_read_and_parse()){
+            if(ref_pos >= ref_msgs_len || ref_msgs[ref_pos] != pccomm_read_len ||
+                    memcmp(&ref_msgs[ref_pos + 1], pccomm_read_buf, pccomm_read_len) != 0){
+                match = false;
+                break;
+            }
+            ref_pos += 1 + pccomm_read_len;
+        }
+        CHECK(match);
+        CHECK(ref_pos == ref_msgs_len);
+        CHECK(usb_avail() == 0);
+        CHECK(pccomm_stats.rx_msgs - start.rx_msgs == ref.msgs - ref_start.msgs);
+        CHECK(pccomm_stats.rx_invalid - start.rx_invalid == ref.invalid - ref_start.invalid);
+        CHECK(pccomm_stats.rx_truncated - start.rx_truncated == ref.truncated_count - ref_start.truncated_count);
+        CHECK(ref.msgs - ref_start.msgs > 100);
+    }
+
+    // More messages than the queue holds at once
+    unsigned int len = 0;
+    uint8_t payload[4];
+    for(unsigned int i = 0; i < 3 * PCCOMM_RX_QUEUE_LEN; ++i){
+        memcpy(payload, &i, 4);
+        len += ref_frame(&stream[len], i, payload, 4, true);
+    }
+    rx_set(stream, len, STREAM_SIZE);
+    uint32_t queue_full = pccomm_stats.rx_queue_full;
+    unsigned int count = 0;
+    while(pccomm_read_and_parse()){
+        CHECK(pccomm_read_len == 8 && memcmp(&pccomm_read_buf[2], &count, 4) == 0);
+        count++;
+    }
+    CHECK(count == 3 * PCCOMM_RX_QUEUE_LEN);
+    CHECK(pccomm_stats.rx_queue_full > queue_full);
+    CHECK(pccomm_stats.rx_queue_max == PCCOMM_RX_QUEUE_LEN);
+}
+
+static int run_tests(void){
+    pccomm_init();
+    test_write();
+    test_parse();
+    return TEST_RESULT();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// Benchmark
+////////////////////////////////////////////////////////////////////////////////
+
+static int run_bench(void){
+    pccomm_init();
+
+    // Typical command stream: raw / local speed commands (floats), watchdog feeds, and queries
+    unsigned int len = 0;
+    unsigned int count = 0;
+    while(len < STREAM_SIZE - 256){
+        uint8_t payload[64];
+        unsigned int plen;
+        switch(count % 4){
+        case 0:
+            memcpy(payload, "RAW", 3);
+            for(unsigned int i = 0; i < 8; ++i){
+                float f = test_randf(&seed, -1.0f, 1.0f);
+                memcpy(&payload[3 + 4 * i], &f, 4);
+            }
+            plen = 35;
+            break;
+        case 1:
+            memcpy(payload, "LOCAL", 5);
+            for(unsigned int i = 0; i < 6; ++i){
+                float f = test_randf(&seed, -1.0f, 1.0f);
+                memcpy(&payload[5 + 4 * i], &f, 4);
+            }
+            plen = 29;
+            break;
+        case 2:
+            memcpy(payload, "WDGF", 4);
+            plen = 4;
+            break;
+        default:
+            memcpy(payload, "SSTAT", 5);
+            plen = 5;
+            break;
+        }
+        len += ref_frame(&stream[len], count++, payload, plen, true);
+    }
+
+    const unsigned int reps = 20;
+    unsigned int parsed = 0;
+    double start = test_time();
+    for(unsigned int r = 0; r < reps; ++r){
+        rx_set(stream, len, 64);
+        while(pccomm_read_and_parse())
+            parsed++;
+    }
+    double chunk_time = test_time() - start;
+
+    // Byte at a time (as the parser used to read from USB)
+    static ref_parser_t ref;
+    unsigned int ref_parsed = 0;
+    start = test_time();
+    for(unsigned int r = 0; r < reps; ++r){
+        rx_set(stream, len, 1);
+        while(usb_avail()){
+            if(ref_parse(&ref, usb_read()))
+                ref_parsed++;
+        }
+    }
+    double byte_time = test_time() - start;
+
+    if(parsed != count * reps || ref_parsed != count * reps){
+        fprintf(stderr, "Parsed wrong number of messages\n");
+        return 1;
+    }
+    double total = (double)len * reps;
+    printf("Chunked parser:      %7.1f MB/s  %6.2f M msgs/s\n", total / chunk_time / 1e6, parsed / chunk_time / 1e6);
+    printf("Byte at a time:      %7.1f MB/s  %6.2f M msgs/s\n", total / byte_time / 1e6, ref_parsed / byte_time / 1e6);
+    return 0;
+}
+
+TEST_RTOS_MAIN(run_tests, run_bench, 1)
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// PID controller tests (util/pid)
+// Step responses of a PID controlling a simple plant, plus checks of each part of the controller (dt scaling,
+// anti-windup, derivative filter, derivative on measurement, feed-forward).
+
+#include "test.h"
+#include <util/pid.h>
+
+
+static pid_controller_t make_pid(float kp, float ki, float kd, float limit){
+    pid_controller_t pid = {
+        .kP = kp, .kI = ki, .kD = kd, .kF = 0.0f,
+        .min = -limit, .max = limit,
+        .invert = false, .d_tau = 0.0f, .d_on_meas = false
+    };
+    PID_RESET(pid);
+    return pid;
+}
+
+/**
+ * Closed loop step response of a first order plant (x' = (gain * u - x) / tau)
+ * @param pid PID controller (copied, not modified)
+ * @param dt Loop period (seconds)
+ * @param duration Time to simulate (seconds)
+ * @param samples Where to store x every 0.1 seconds (duration / 0.1 elements)
+ * @return Max value of x (overshoot if greater than 1)
+ */
+static float step_response(pid_controller_t pid, float dt, float duration, float *samples){
+    const float gain = 2.0f, tau = 0.5f;
+    float x = 0.0f, max = 0.0f;
+    unsigned int steps = (unsigned int)(duration / dt + 0.5f);
+    unsigned int per_sample = (unsigned int)(0.1f / dt + 0.5f);
+    for(unsigned int i = 0; i < steps; ++i){
+        float u = pid_calculate(&pid, 1.0f, x, 0.0f, dt);
+        x += dt * (gain * u - x) / tau;
+        max = fmaxf(max, x);
+        if(samples != NULL && (i + 1) % per_sample == 0)
+            samples[(i + 1) / per_sample - 1] = x;
+    }
+    return max;
+}
+
+static void test_step_response(void){
+    // Converges to setpoint without steady state error and with little overshoot
+    pid_controller_t pid = make_pid(1.0f, 2.0f, 0.05f, 1.0f);
+    float samples[50];
+    float max = step_response(pid, 0.02f, 5.0f, samples);
+    CHECK_NEAR(samples[49], 1.0, 1e-3);
+    CHECK(max < 1.1f);
+
+    // Response does not depend on loop rate (much)
+    float samples_fast[50], samples_slow[50];
+    step_response(pid, 0.005f, 5.0f, samples_fast);
+    step_response(pid, 0.05f, 5.0f, samples_slow);
+    for(unsigned int i = 0; i < 50; ++i){
+        CHECK_NEAR(samples_fast[i], samples[i], 0.02);
+        CHECK_NEAR(samples_slow[i], samples[i], 0.05);
+    }
+}
+
+static void test_dt(void){
+    // Integral is error * time
+    const float dts[] = {0.001f, 0.01f, 0.02f, 0.1f};
+    for(unsigned int d = 0; d < 4; ++d){
+        pid_controller_t pid = make_pid(0.0f, 2.0f, 0.0f, 100.0f);
+        float out = 0.0f;
+        unsigned int steps = (unsigned int)(1.0f / dts[d] + 0.5f);
+        for(unsigned int i = 0; i < steps; ++i)
+            out = pid_calculate(&pid, 0.5f, 0.0f, 0.0f, dts[d]);
+        CHECK_NEAR(out, 2.0 * 0.5 * 1.0, 1e-4);
+    }
+
+    // Derivative is rate of change of error
+    for(unsigned int d = 0; d < 4; ++d){
+        pid_controller_t pid = make_pid(0.0f, 0.0f, 0.5f, 100.0f);
+        float out = 0.0f;
+        for(unsigned int i = 0; i < 10; ++i)
+            out = pid_calculate(&pid, 3.0f * dts[d] * i, 0.0f, 0.0f, dts[d]);
+        CHECK_NEAR(out, 0.5 * 3.0, 1e-3);
+    }
+
+    // No derivative on first calculation after reset (no previous error)
+    pid_controller_t pid = make_pid(0.0f, 0.0f, 1.0f, 100.0f);
+    CHECK(pid_calculate(&pid, 5.0f, 0.0f, 0.0f, 0.01f) == 0.0f);
+    pid_calculate(&pid, 5.0f, 0.0f, 0.0f, 0.01f);
+    PID_RESET(pid);
+    CHECK(pid_calculate(&pid, -5.0f, 0.0f, 0.0f, 0.01f) == 0.0f);
+}
+
+static void test_anti_windup(void){
+    // Error that can not be corrected (output saturated) must not wind up the integral
+    pid_controller_t pid = make_pid(0.5f, 1.0f, 0.0f, 1.0f);
+    for(unsigned int i = 0; i < 1000; ++i)
+        CHECK_NEAR(pid_calculate(&pid, 10.0f, 0.0f, 0.0f, 0.01f), 1.0, 1e-6);
+    CHECK(pid.kI * pid.integral <= 1.0f);
+
+    // Once error changes sign, output leaves saturation immediately
+    float out = pid_calculate(&pid, -1.0f, 0.0f, 0.0f, 0.01f);
+    CHECK(out < 0.5f);
+
+    // Integral unwinds while saturated if error opposes it
+    pid = make_pid(0.0f, 1.0f, 0.0f, 1.0f);
+    pid.integral = 5.0f;
+    float i0 = pid.integral;
+    pid_calculate(&pid, -1.0f, 0.0f, 0.0f, 0.01f);
+    CHECK(pid.integral < i0);
+
+    // Step response with a large step (saturated for a long time) does not overshoot much
+    pid = make_pid(0.5f, 2.0f, 0.0f, 0.6f);
+    float x = 0.0f, max = 0.0f;
+    for(unsigned int i = 0; i < 2000; ++i){
+        float u = pid_calculate(&pid, 1.0f, x, 0.0f, 0.01f);
+        x += 0.01f * (2.0f * u - x) / 0.5f;
+        max = fmaxf(max, x);
+    }
+    CHECK_NEAR(x, 1.0, 1e-3);
+    CHECK(max < 1.05f);
+}
+
+static void test_derivative_filter(void){
+    // Single sample spike in measurement: filtered derivative is attenuated by dt / (tau + dt)
+    const float dt = 0.01f, tau = 0.09f;
+    pid_controller_t raw = make_pid(0.0f, 0.0f, 1.0f, 1000.0f);
+    pid_controller_t filt = raw;
+    filt.d_tau = tau;
+    pid_calculate(&raw, 0.0f, 0.0f, 0.0f, dt);
+    pid_calculate(&filt, 0.0f, 0.0f, 0.0f, dt);
+    float d_raw = pid_calculate(&raw, 0.0f, 1.0f, 0.0f, dt);
+    float d_filt = pid_calculate(&filt, 0.0f, 1.0f, 0.0f, dt);
+    CHECK_NEAR(d_raw, -1.0 / dt, 1e-2);
+    CHECK_NEAR(d_filt, d_raw * dt / (tau + dt), 1e-2);
+
+    // Filtered derivative of a ramp converges to the slope
+    filt = make_pid(0.0f, 0.0f, 1.0f, 1000.0f);
+    filt.d_tau = tau;
+    float out = 0.0f;
+    for(unsigned int i = 0; i < 200; ++i)
+        out = pid_calculate(&filt, 0.0f, -2.0f * dt * i, 0.0f, dt);
+    CHECK_NEAR(out, 2.0, 1e-3);
+
+    // Noisy measurement: filtered derivative varies much less than unfiltered
+    uint32_t seed = 0xD1F;
+    raw = make_pid(0.0f, 0.0f, 1.0f, 1e6f);
+    filt = raw;
+    filt.d_tau = tau;
+    double var_raw = 0.0, var_filt = 0.0;
+    for(unsigned int i = 0; i < 2000; ++i){
+        float meas = test_randf(&seed, -0.01f, 0.01f);
+        float a = pid_calculate(&raw, 0.0f, meas, 0.0f, dt);
+        float b = pid_calculate(&filt, 0.0f, meas, 0.0f, dt);
+        if(i >= 100){
+            var_raw += a * a;
+            var_filt += b * b;
+        }
+    }
+    CHECK(var_filt < var_raw / 5.0);
+}
+
+static void test_d_on_meas(void){
+    // Setpoint step: derivative on error kicks, derivative on measurement does not
+    pid_controller_t err = make_pid(1.0f, 0.0f, 0.1f, 1000.0f);
+    pid_controller_t meas = err;
+    meas.d_on_meas = true;
+    pid_calculate(&err, 0.0f, 0.0f, 0.0f, 0.01f);
+    pid_calculate(&meas, 0.0f, 0.0f, 0.0f, 0.01f);
+    CHECK_NEAR(pid_calculate(&err, 1.0f, 0.0f, 0.0f, 0.01f), 1.0 + 0.1 * 1.0 / 0.01, 1e-3);
+    CHECK_NEAR(pid_calculate(&meas, 1.0f, 0.0f, 0.0f, 0.01f), 1.0, 1e-6);
+
+    // Same derivative when measurement moves and setpoint does not
+    CHECK_NEAR(pid_calculate(&err, 1.0f, 0.5f, 0.0f, 0.01f), 0.5 - 0.1 * 0.5 / 0.01, 1e-3);
+    CHECK_NEAR(pid_calculate(&meas, 1.0f, 0.5f, 0.0f, 0.01f), 0.5 - 0.1 * 0.5 / 0.01, 1e-3);
+}
+
+static void test_feed_forward(void){
+    pid_controller_t pid = make_pid(0.0f, 0.0f, 0.0f, 1.0f);
+    pid.kF = 0.5f;
+    CHECK_NEAR(pid_calculate(&pid, 0.0f, 0.0f, 1.2f, 0.01f), 0.6, 1e-6);
+    CHECK_NEAR(pid_calculate(&pid, 0.0f, 0.0f, -1.0f, 0.01f), -0.5, 1e-6);
+
+    // Output (including feed-forward) is limited, then inverted
+    CHECK_NEAR(pid_calculate(&pid, 0.0f, 0.0f, 10.0f, 0.01f), 1.0, 1e-6);
+    pid.invert = true;
+    CHECK_NEAR(pid_calculate(&pid, 0.0f, 0.0f, 1.2f, 0.01f), -0.6, 1e-6);
+    CHECK_NEAR(pid_calculate(&pid, 0.0f, 0.0f, 10.0f, 0.01f), -1.0, 1e-6);
+
+    // Feed-forward of the plant input needed for a ramp setpoint removes lag (integrator plant, P only)
+    pid_controller_t p = make_pid(2.0f, 0.0f, 0.0f, 10.0f);
+    pid_controller_t pf = p;
+    pf.kF = 1.0f;
+    float x = 0.0f, xf = 0.0f;
+    for(unsigned int i = 0; i < 500; ++i){
+        float sp = 0.5f * 0.01f * i;
+        x += 0.01f * pid_calculate(&p, sp, x, 0.5f, 0.01f);
+        xf += 0.01f * pid_calculate(&pf, sp, xf, 0.5f, 0.01f);
+    }
+    float sp = 0.5f * 0.01f * 499;
+    CHECK_NEAR(sp - x, 0.5 / 2.0, 0.01);
+    CHECK_NEAR(sp - xf, 0.0, 0.01);
+}
+
+static int run_bench(void){
+    pid_controller_t pid = make_pid(1.0f, 0.5f, 0.1f, 1.0f);
+    pid.kF = 0.2f;
+    pid.d_tau = 0.05f;
+    pid.d_on_meas = true;
+    volatile float sink = 0.0f;
+    const unsigned int reps = 20000000;
+    float x = 0.0f;
+    double start = test_time();
+    for(unsigned int i = 0; i < reps; ++i){
+        float u = pid_calculate(&pid, 1.0f, x, 0.1f, 0.02f);
+        x += 0.02f * (u - x);
+        sink += u;
+    }
+    printf("pid_calculate %.2f ns per call\n", (test_time() - start) / reps * 1e9);
+    return 0;
+}
+
+static int run_tests(void){
+    test_step_response();
+    test_dt();
+    test_anti_windup();
+    test_derivative_filter();
+    test_d_on_meas();
+    test_feed_forward();
+    return TEST_RESULT();
+}
+
+TEST_MAIN(run_tests, run_bench)
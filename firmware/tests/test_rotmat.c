@@ -0,0 +1,168 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Rotation matrix tests (util/angles)
+// Rotation matrices must rotate vectors the same way as quaternion products (q * v * q^*), including for
+// quaternions that are not normalized.
+
+#include "test.h"
+#include <util/angles.h>
+
+static uint32_t seed = 0x5107;
+
+
+// v rotated by q (q * v * q^*) or by the inverse rotation (q^* * v * q)
+static void quat_rotate(float dest[3], const quaternion_t *q, const float v[3], bool inv){
+    quaternion_t qv = {.w = 0.0f, .x = v[0], .y = v[1], .z = v[2]};
+    quaternion_t qconj, qr;
+    quat_conjugate(&qconj, q);
+    if(inv){
+        quat_multiply(&qr, &qv, q);
+        quat_multiply(&qr, &qconj, &qr);
+    }else{
+        quat_multiply(&qr, &qv, &qconj);
+        quat_multiply(&qr, q, &qr);
+    }
+    dest[0] = qr.x;
+    dest[1] = qr.y;
+    dest[2] = qr.z;
+}
+
+static void random_quat(quaternion_t *q, bool normalize){
+    q->w = test_randf(&seed, -1.0f, 1.0f);
+    q->x = test_randf(&seed, -1.0f, 1.0f);
+    q->y = test_randf(&seed, -1.0f, 1.0f);
+    q->z = test_randf(&seed, -1.0f, 1.0f);
+    if(normalize)
+        quat_normalize(q, q);
+}
+
+static void random_vec(float v[3]){
+    for(unsigned int i = 0; i < 3; ++i)
+        v[i] = test_randf(&seed, -10.0f, 10.0f);
+}
+
+static void test_rotate(void){
+    for(unsigned int trial = 0; trial < 10000; ++trial){
+        quaternion_t q;
+        float m[3][3], v[3], expected[3], actual[3];
+        random_quat(&q, (trial & 1) == 0);
+        random_vec(v);
+        quat_to_rotmat(m, &q);
+
+        quat_rotate(expected, &q, v, false);
+        rotmat_rotate(actual, m, v);
+        for(unsigned int i = 0; i < 3; ++i)
+            CHECK_NEAR(actual[i], expected[i], 1e-4);
+
+        quat_rotate(expected, &q, v, true);
+        rotmat_rotate_inv(actual, m, v);
+        for(unsigned int i = 0; i < 3; ++i)
+            CHECK_NEAR(actual[i], expected[i], 1e-4);
+
+        // In place
+        memcpy(actual, v, sizeof(v));
+        rotmat_rotate_inv(actual, m, actual);
+        for(unsigned int i = 0; i < 3; ++i)
+            CHECK_NEAR(actual[i], expected[i], 1e-4);
+        quat_rotate(expected, &q, v, false);
+        memcpy(actual, v, sizeof(v));
+        rotmat_rotate(actual, m, actual);
+        for(unsigned int i = 0; i < 3; ++i)
+            CHECK_NEAR(actual[i], expected[i], 1e-4);
+    }
+}
+
+static void test_columns(void){
+    for(unsigned int trial = 0; trial < 10000; ++trial){
+        quaternion_t q;
+        float m[3][3];
+        random_quat(&q, true);
+        quat_to_rotmat(m, &q);
+
+        // Columns are rotated axes
+        for(unsigned int c = 0; c < 3; ++c){
+            float axis[3] = {0.0f, 0.0f, 0.0f}, expected[3], col[3];
+            axis[c] = 1.0f;
+            quat_rotate(expected, &q, axis, false);
+            rotmat_col(col, m, c);
+            for(unsigned int i = 0; i < 3; ++i)
+                CHECK_NEAR(col[i], expected[i], 1e-5);
+        }
+
+        // Orthonormal (m * m^T = I)
+        for(unsigned int r = 0; r < 3; ++r){
+            for(unsigned int c = 0; c < 3; ++c){
+                float dot = m[r][0]*m[c][0] + m[r][1]*m[c][1] + m[r][2]*m[c][2];
+                CHECK_NEAR(dot, (r == c) ? 1.0 : 0.0, 1e-5);
+            }
+        }
+    }
+
+    // Identity
+    quaternion_t q = {.w = 1.0f, .x = 0.0f, .y = 0.0f, .z = 0.0f};
+    float m[3][3];
+    quat_to_rotmat(m, &q);
+    for(unsigned int r = 0; r < 3; ++r){
+        for(unsigned int c = 0; c < 3; ++c)
+            CHECK(m[r][c] == ((r == c) ? 1.0f : 0.0f));
+    }
+}
+
+static int run_bench(void){
+    // Rotating x, y, and z axes by one quaternion (as for pitch and roll compensated axes in motor control)
+    const unsigned int count = 256;
+    static quaternion_t quats[256];
+    for(unsigned int i = 0; i < count; ++i)
+        random_quat(&quats[i], true);
+    const float axes[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    volatile float sink = 0.0f;
+    const unsigned int reps = 2000000;
+
+    double start = test_time();
+    for(unsigned int r = 0; r < reps; ++r){
+        float d[3];
+        for(unsigned int a = 0; a < 3; ++a){
+            quat_rotate(d, &quats[r % count], axes[a], false);
+            sink += d[a];
+        }
+    }
+    double quat_ns = (test_time() - start) / reps * 1e9;
+
+    start = test_time();
+    for(unsigned int r = 0; r < reps; ++r){
+        float m[3][3], d[3];
+        quat_to_rotmat(m, &quats[r % count]);
+        for(unsigned int a = 0; a < 3; ++a){
+            rotmat_col(d, m, a);
+            sink += d[a];
+        }
+    }
+    double mat_ns = (test_time() - start) / reps * 1e9;
+
+    printf("Rotate x, y, z axes: quaternion products %6.1f ns, rotation matrix %6.1f ns\n", quat_ns, mat_ns);
+    return 0;
+}
+
+static int run_tests(void){
+    test_rotate();
+    test_columns();
+    return TEST_RESULT();
+}
+
+TEST_MAIN(run_tests, run_bench)
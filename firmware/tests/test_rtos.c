@@ -0,0 +1,89 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "test_rtos.h"
+#include <FreeRTOS.h>
+#include <task.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Large stack so tests can use local arrays freely (SimCB heap is small)
+#define TEST_TASK_STACK_SIZE    (32 * 1024)
+
+static int (*test_fn)(void);
+static StaticTask_t test_task_tcb;
+static StackType_t test_task_stack[TEST_TASK_STACK_SIZE];
+
+
+static void test_task(void *arg){
+    (void)arg;
+    exit(test_fn());
+}
+
+void test_rtos_run(int (*fn)(void), unsigned int priority){
+    test_fn = fn;
+    xTaskCreateStatic(test_task, "test", TEST_TASK_STACK_SIZE, NULL, priority, test_task_stack, &test_task_tcb);
+    vTaskStartScheduler();
+
+    // Only returns if the scheduler could not be started
+    fprintf(stderr, "Failed to start scheduler\n");
+    exit(1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// FreeRTOS hooks (same as SimCB, but report failures and exit)
+////////////////////////////////////////////////////////////////////////////////
+
+void vAssertCalled(const char *file, unsigned int line){
+    fprintf(stderr, "FreeRTOS assert failed: %s:%u\n", file, line);
+    exit(1);
+}
+
+void vApplicationMallocFailedHook(void){
+    fprintf(stderr, "FreeRTOS malloc failed\n");
+    exit(1);
+}
+
+void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName){
+    (void)xTask;
+    fprintf(stderr, "FreeRTOS stack overflow: %s\n", pcTaskName);
+    exit(1);
+}
+
+void vApplicationTickHook(void){
+    // SimCB simulates interrupts from this hook. Tests have none.
+}
+
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer, StackType_t **ppxIdleTaskStackBuffer,
+        uint32_t *pulIdleTaskStackSize){
+    static StaticTask_t tcb;
+    static StackType_t stack[configMINIMAL_STACK_SIZE];
+    *ppxIdleTaskTCBBuffer = &tcb;
+    *ppxIdleTaskStackBuffer = stack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+void vApplicationGetTimerTaskMemory(StaticTask_t **ppxTimerTaskTCBBuffer, StackType_t **ppxTimerTaskStackBuffer,
+        uint32_t *pulTimerTaskStackSize){
+    static StaticTask_t tcb;
+    static StackType_t stack[configTIMER_TASK_STACK_DEPTH];
+    *ppxTimerTaskTCBBuffer = &tcb;
+    *ppxTimerTaskStackBuffer = stack;
+    *pulTimerTaskStackSize = configTIMER_TASK_STACK_DEPTH;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+// Support for host tests of code that uses FreeRTOS (SimCB FreeRTOS port)
+// Provides the FreeRTOS hooks SimCB's app.c normally provides.
+
+/**
+ * Start the scheduler and run a test function in a task. Does not return.
+ * The program exits with the test function's return value once it returns.
+ * @param fn Test function (returns TEST_RESULT())
+ * @param priority Priority of the test task
+ */
+void test_rtos_run(int (*fn)(void), unsigned int priority);
+
+// Define main for a test program that runs run_tests (or run_bench) in a task at the given priority (see test.h)
+#define TEST_RTOS_MAIN(run_tests, run_bench, priority)                                              \
+    int main(int argc, char **argv){                                                                \
+        test_rtos_run(test_select(argc, argv, (run_tests), (run_bench)), (priority));               \
+        return 1;                                                                                   \
+    }
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2022 Marcus Behel
+ *
+ * This file is part of AUVControlBoard-Firmware.
+ *
+ * AUVControlBoard-Firmware is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * AUVControlBoard-Firmware is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with AUVControlBoard-Firmware. If not, see
+ * <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Sequence lock tests (util/seqlock)
+// One writer thread publishes samples as fast as possible while three reader threads read them. Every sample read
+// must be whole (not mixed from two writes) and each reader must see samples in the order they were written.
+
+#include "test.h"
+#include <util/seqlock.h>
+#include <pthread.h>
+
+#define READERS         3
+#define WRITES          2000000
+#define SAMPLE_WORDS    32
+
+// Every word of a sample is the sample's number (like imu_data_t, large enough that copies take a while)
+typedef struct {
+    uint32_t words[SAMPLE_WORDS];
+} sample_t;
+
+static seqlock_t lock;
+static sample_t buf[2];
+static volatile bool writer_done;
+
+typedef struct {
+    unsigned int reads;
+    unsigned int torn;
+    unsigned int out_of_order;
+    unsigned int distinct;          // Number of different samples seen
+} reader_result_t;
+
+
+static sample_t read_sample(void){
+    sample_t s;
+    uint32_t gen;
+    do{
+        gen = seqlock_read_begin(&lock);
+        s = buf[SEQLOCK_INDEX(gen)];
+    }while(seqlock_read_retry(&lock, gen));
+    return s;
+}
+
+static void write_sample(uint32_t n){
+    sample_t *s = &buf[seqlock_write_index(&lock)];
+    for(unsigned int i = 0; i < SAMPLE_WORDS; ++i)
+        s->words[i] = n;
+    seqlock_write_publish(&lock);
+}
+
+static void *writer(void *arg){
+    (void)arg;
+    for(uint32_t n = 1; n <= WRITES; ++n)
+        write_sample(n);
+    writer_done = true;
+    return NULL;
+}
+
+static void *reader(void *arg){
+    reader_result_t *res = arg;
+    uint32_t last = 0;
+    while(!writer_done){
+        sample_t s = read_sample();
+        res->reads++;
+        bool whole = true;
+        for(unsigned int i = 1; i < SAMPLE_WORDS; ++i)
+            whole = whole && (s.words[i] == s.words[0]);
+        if(!whole)
+            res->torn++;
+        if(s.words[0] < last)
+            res->out_of_order++;
+        if(s.words[0] != last)
+            res->distinct++;
+        last = s.words[0];
+    }
+    return NULL;
+}
+
+static void test_single_thread(void){
+    seqlock_init(&lock);
+    memset(buf, 0, sizeof(buf));
+
+    // Buffer 0 is published initially. Writer always writes the other one.
+    uint32_t gen = seqlock_read_begin(&lock);
+    CHECK(SEQLOCK_INDEX(gen) == 0);
+    CHECK(seqlock_write_index(&lock) == 1);
+    CHECK(!seqlock_read_retry(&lock, gen));
+
+    write_sample(7);
+    CHECK(seqlock_write_index(&lock) == 0);
+    CHECK(read_sample().words[0] == 7);
+    write_sample(8);
+    CHECK(read_sample().words[SAMPLE_WORDS - 1] == 8);
+
+    // Publishing during a read causes a retry (counted)
+    gen = seqlock_read_begin(&lock);
+    write_sample(9);
+    CHECK(seqlock_read_retry(&lock, gen));
+    CHECK(lock.retries == 1);
+    gen = seqlock_read_begin(&lock);
+    CHECK(!seqlock_read_retry(&lock, gen));
+    CHECK(lock.retries == 1);
+}
+
+static void test_concurrent(void){
+    seqlock_init(&lock);
+    memset(buf, 0, sizeof(buf));
+    writer_done = false;
+
+    pthread_t w, r[READERS];
+    reader_result_t res[READERS];
+    memset(res, 0, sizeof(res));
+    for(unsigned int i = 0; i < READERS; ++i)
+        pthread_create(&r[i], NULL, reader, &res[i]);
+    pthread_create(&w, NULL, writer, NULL);
+    pthread_join(w, NULL);
+    for(unsigned int i = 0; i < READERS; ++i)
+        pthread_join(r[i], NULL);
+
+    for(unsigned int i = 0; i < READERS; ++i){
+        CHECK(res[i].torn == 0);
+        CHECK(res[i].out_of_order == 0);
+        CHECK(res[i].reads > 0);
+    }
+    CHECK(read_sample().words[0] == WRITES);
+}
+
+static int run_bench(void){
+    const unsigned int reps = 10000000;
+    volatile uint32_t sink = 0;
+
+    // No contention
+    seqlock_init(&lock);
+    double start = test_time();
+    for(unsigned int i = 0; i < reps; ++i)
+        sink += read_sample().words[0];
+    double read_ns = (test_time() - start) / reps * 1e9;
+    start = test_time();
+    for(unsigned int i = 0; i < reps; ++i)
+        write_sample(i);
+    double write_ns = (test_time() - start) / reps * 1e9;
+    printf("Uncontended:  read %.1f ns, write %.1f ns (%u word samples)\n", read_ns, write_ns, SAMPLE_WORDS);
+
+    // Writer publishing continuously
+    seqlock_init(&lock);
+    writer_done = false;
+    pthread_t w, r[READERS];
+    reader_result_t res[READERS];
+    memset(res, 0, sizeof(res));
+    start = test_time();
+    for(unsigned int i = 0; i < READERS; ++i)
+        pthread_create(&r[i], NULL, reader, &res[i]);
+    pthread_create(&w, NULL, writer, NULL);
+    pthread_join(w, NULL);
+    for(unsigned int i = 0; i < READERS; ++i)
+        pthread_join(r[i], NULL);
+    double elapsed = test_time() - start;
+    unsigned int reads = 0, distinct = 0;
+    for(unsigned int i = 0; i < READERS; ++i){
+        reads += res[i].reads;
+        distinct += res[i].distinct;
+    }
+    printf("Contended:    %u writes, %u reads (%u distinct samples) in %.2f s, %u retries (%.2f per read)\n",
+            WRITES, reads, distinct, elapsed, lock.retries, (double)lock.retries / reads);
+    (void)sink;
+    return 0;
+}
+
+static int run_tests(void){
+    test_single_thread();
+    test_concurrent();
+    return TEST_RESULT();
+}
+
+TEST_MAIN(run_tests, run_bench)
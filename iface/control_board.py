@@ -49,6 +49,51 @@ default_timeout_uart = 0.1
 default_timeout_sim = 0.25
 
 
+## Build lookup table for CRC16 (CCITT-FALSE; poly 0x1021)
+#  Entry i is the CRC (zero initial value) of the single byte i
+def _crc16_ccitt_false_table() -> List[int]:
+    table = []
+    for i in range(256):
+        crc = i << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+        table.append(crc)
+    return table
+
+
+CRC16_TABLE = _crc16_ccitt_false_table()
+
+
+# Compact protocol opcodes for messages sent to the control board (replace the message name)
+COMPACT_OPCODES: Dict[bytes, int] = {
+    b'RAW': 0x80, b'LOCAL': 0x81, b'GLOBAL': 0x82, b'SASSIST1': 0x83, b'SASSIST2': 0x84,
+    b'OHOLD1': 0x85, b'OHOLD2': 0x86, b'WDGF': 0x87,
+    b'TPWM': 0x90, b'TINV': 0x91, b'RELDOF': 0x92, b'MMATS': 0x93, b'MMATU': 0x94, b'PIDTN': 0x95, b'ALLOC': 0x96,
+    b'CTRLRATE': 0x97, b'CTRLSYNC': 0x98, b'CASC': 0x99,
+    b'SSTAT': 0xA0, b'IMUR': 0xA1, b'IMUW': 0xA2, b'IMUP': 0xA3, b'DEPTHR': 0xA4, b'DEPTHP': 0xA5,
+    b'DEPTHSTAT': 0xA6,
+    b'BNO055A': 0xB0, b'SCBNO055R': 0xB1, b'SCBNO055E': 0xB2, b'SCBNO055S': 0xB3,
+    b'BNO055CS': 0xB4, b'BNO055CV': 0xB5, b'BNO055RST': 0xB6, b'BNO055BURST': 0xB7, b'BNO055STAT': 0xB8,
+    b'MS5837CALG': 0xC0, b'MS5837CALS': 0xC1, b'MS5837OSR': 0xC2,
+    b'RSTWHY': 0xD0, b'SIMHIJACK': 0xD1, b'SIMDAT': 0xD2, b'CBVER': 0xD3, b'PCSTAT': 0xD4, b'COMPACT': 0xD5,
+    b'HEAPSTAT': 0xD6, b'CTRLSTAT': 0xD7, b'I2CDMA': 0xD8, b'I2CSTAT': 0xD9,
+    b'I2CDEV': 0xDA, b'SIMIOSTAT': 0xDB,
+}
+
+# Names for compact protocol opcodes of messages sent by the control board
+COMPACT_RESPONSES: Dict[int, bytes] = {
+    0xE0: b'ACK', 0xE1: b'WDGS', 0xE2: b'IMUD', 0xE3: b'DEPTHD', 0xE4: b'HEARTBEAT',
+}
+
+# Compact opcodes grouped by first 3 bytes of message name (all names are at least 3 bytes)
+_COMPACT_LOOKUP: Dict[bytes, List[Tuple[bytes, int]]] = {}
+for _name, _op in COMPACT_OPCODES.items():
+    _COMPACT_LOOKUP.setdefault(_name[:3], []).append((_name, _op))
+
+
 class ControlBoard:
 
     class AckError(IntEnum):
@@ -78,6 +123,10 @@ class ControlBoard:
         SIM = 1
         MS5837 = 2
 
+    class AllocMethod(IntEnum):
+        DOF_MATRIX = 0              # Thruster speeds directly from motor matrix
+        PSEUDO_INVERSE = 1          # Least squares allocation with saturation redistribution
+
     class IMUData:
         def __init__(self):
             self.quat_w: float = 0.0
@@ -112,6 +161,83 @@ class ControlBoard:
             self.atm_pressure = 0.0         # Pa
             self.fluid_density = 0.0        # kg / m^3
 
+    class PCCommStats:
+        def __init__(self):
+            self.rx_msgs = 0                # Valid messages received
+            self.rx_invalid = 0             # Messages discarded (bad CRC or too short)
+            self.rx_truncated = 0           # Messages discarded (too long)
+            self.rx_queue_full = 0          # Times parsing paused because rx queue was full
+            self.rx_queue_max = 0           # Max number of messages in rx queue at once
+            self.tx_dropped = 0             # Messages not sent by control board (too long)
+
+    ## Control board heap statistics
+    class HeapStats:
+        def __init__(self):
+            self.free = 0                   # Bytes currently free in heap
+            self.min_free = 0               # Fewest bytes free in heap since boot
+            self.allocs = 0                 # Successful allocations since boot
+            self.frees = 0                  # Successful frees since boot
+
+    ## BNO055 data read statistics (since startup)
+    class BNO055ReadStats:
+        def __init__(self):
+            self.burst = False              # True if burst reads are enabled
+            self.samples = 0                # Successful data reads
+            self.transactions = 0           # I2C transactions attempted by data reads (including retries)
+            self.failures = 0               # Failed data reads
+
+    ## Depth sensor status
+    class DepthStats:
+        def __init__(self):
+            self.rate = 0.0                 # Achieved sample rate (Hz). Zero if no recent samples.
+            self.samples = 0                # Samples read since startup
+
+    ## Fixed rate control loop statistics (since control rate last set)
+    class ControlStats:
+        def __init__(self):
+            self.period_us = 0              # Nominal control loop period (0 if synchronized to IMU samples)
+            self.ticks = 0                  # Control loop iterations
+            self.overruns = 0               # Iterations that started late (missed deadline)
+            self.max_jitter_us = 0          # Max difference between actual and nominal period
+            self.avg_jitter_us = 0          # Average difference between actual and nominal period
+            self.max_exec_us = 0            # Max time to apply speeds in one iteration
+            self.imu_stale = 0              # Iterations that reused an already used IMU sample
+            self.imu_skipped = 0            # IMU samples never used
+            self.depth_stale = 0            # Iterations that reused an already used depth sample
+            self.depth_skipped = 0          # Depth samples never used
+            self.imu_retries = 0            # IMU data reads retried due to concurrent update (since startup)
+            self.depth_retries = 0          # Depth data reads retried due to concurrent update (since startup)
+
+    ## I2C bus statistics (since startup)
+    class I2CStats:
+        def __init__(self):
+            self.dma = False                # True if DMA transfers are enabled
+            self.transactions = 0           # I2C transactions performed (including failed)
+            self.isr_count = 0              # I2C (and I2C DMA) interrupts handled
+            self.isr_time_us = 0            # Time spent in I2C (and I2C DMA) interrupt handlers (microseconds)
+
+    ## Statistics for transactions with one I2C device (since startup)
+    class I2CDeviceStats:
+        def __init__(self):
+            self.breaker_open = False       # True if transactions with the device are currently rejected
+            self.transactions = 0           # Transactions performed on the bus (including failed)
+            self.failures = 0               # Transactions performed on the bus that failed
+            self.rejected = 0               # Transactions failed without using the bus (circuit breaker open)
+            self.retries = 0                # Retried transactions
+            self.recoveries = 0             # Bus recoveries after failed transactions with the device
+            self.breaker_trips = 0          # Times circuit breaker opened
+            self.avg_latency_us = 0         # Average time from queued to finished (microseconds)
+            self.max_latency_us = 0         # Max time from queued to finished (microseconds)
+
+    ## SimCB socket I/O statistics (since startup)
+    class SimIOStats:
+        def __init__(self):
+            self.rx_syscalls = 0            # System calls made to wait for and read data from the socket
+            self.rx_bytes = 0               # Bytes read from the socket
+            self.rx_irqs = 0                # Simulated interrupts for received data
+            self.tx_syscalls = 0            # System calls made to send data to the socket
+            self.tx_bytes = 0               # Bytes sent to the socket
+
     ## Representation of motor matrix using nested lists
     class MotorMatrix:
         def __init__(self):
@@ -147,7 +273,9 @@ class ControlBoard:
     #  @param port Serial port to communicate with control board by
     #  @param debug Debug messages for interface code
     #  @param suppress_dbg_msg Suppress debug messages from control board itself
-    def __init__(self, port: str, debug = False, suppress_dbg_msg = False):
+    #  @param compact Use compact protocol (if the control board supports it)
+    def __init__(self, port: str, debug = False, suppress_dbg_msg = False, compact = True):
+        self.__compact = False
         self.__imu_data = self.IMUData()
         self.__depth_data = self.DepthData()
         self.__last_wdog_feed = 0
@@ -162,12 +290,15 @@ class ControlBoard:
         else:
             self.__ser = None
         self.__stop = False
-        self.__ack_conds: Dict[int, threading.Condition] = {}
+        self.__ack_conds: Dict[int, threading.Event] = {}
         self.__ack_errrs: Dict[int, int] = {}
         self.__ack_results: Dict[int, bytes] = {}
         self.__read_thread = threading.Thread(target=self.__read_task, daemon=True)
         self.__read_thread.start()
 
+        # Negotiate protocol format (older firmware will not recognize this and stays with names)
+        self.set_compact(compact)
+
     ## Cleanup on destruction
     def __del__(self):
         self.__stop = True
@@ -196,32 +327,24 @@ class ControlBoard:
     #  @param msg The data to calculate CRC of
     #  @param initial Initial CRC value to use (use 65535 by default)
     def __crc16_ccitt_false(self, msg: bytes, initial = 0xFFFF):
-        crc = initial
-        pos = 0
-        while pos < len(msg):
-            b = msg[pos]
-            for i in range(8):
-                bit = ((b >> (7 - i) & 1) == 1)
-                c15 = ((crc >> 15 & 1) == 1)
-                crc <<= 1
-                crc &= 0xFFFF
-                if c15 ^ bit:
-                    crc ^= 0x1021
-                    crc &= 0xFFFF
-            pos += 1
-        return crc & 0xFFFF
+        crc = initial & 0xFFFF
+        table = CRC16_TABLE
+        for b in msg:
+            crc = ((crc << 8) & 0xFFFF) ^ table[(crc >> 8) ^ b]
+        return crc
 
     ## Handle an acknowledge message
     #  @param msg_id ID of the message being acknowledged
     #  @param error_code Result of message being acknowledged
     def __handle_ack(self, msg_id: int, error_code: int, result: bytes):
-        # Find a threading.Condition for the message being acknowledged
-        # and set its result
-        if msg_id in self.__ack_conds:
-            with self.__ack_conds[msg_id]:
-                self.__ack_errrs[msg_id] = error_code
-                self.__ack_results[msg_id] = result
-                self.__ack_conds[msg_id].notify_all()
+        # Find a threading.Event for the message being acknowledged
+        # and set its result. Event stays set, so the ack is not missed if it
+        # arrives before the sender starts waiting.
+        ev = self.__ack_conds.get(msg_id)
+        if ev is not None:
+            self.__ack_errrs[msg_id] = error_code
+            self.__ack_results[msg_id] = result
+            ev.set()
 
     ## Handle a message read from control board
     #  @param msg_id ID of the message
@@ -230,6 +353,10 @@ class ControlBoard:
         if self.__debug:
             print("Read: ({}) {}".format(msg_id, msg))
         
+        # Replace compact protocol opcode with message name
+        if len(msg) > 0 and msg[0] in COMPACT_RESPONSES:
+            msg = COMPACT_RESPONSES[msg[0]] + msg[1:]
+
         if msg.startswith(b'ACK'):
             # Handle acknowledge messages
             # A, C, K, [id], [error_code]
@@ -255,7 +382,7 @@ class ControlBoard:
                 else:
                     print("Watchdog killed motors.")
         elif msg.startswith(b'IMUD'):
-            if len(msg) == 35:
+            if len(msg) >= 32:
                 self.__imu_parse(msg[4:])
         elif msg.startswith(b'DEPTHD'):
             if len(msg) == 18:
@@ -336,7 +463,7 @@ class ControlBoard:
     def __prepare_for_ack(self, msg_id: int):
         self.__ack_errrs[msg_id] = 0
         self.__ack_results[msg_id] = b''
-        self.__ack_conds[msg_id] = threading.Condition()
+        self.__ack_conds[msg_id] = threading.Event()
 
     ## Wait to receive ack from control board
     #  @param msg_id ID of message to wait for ack
@@ -346,13 +473,12 @@ class ControlBoard:
         res = None
         if timeout == -1.0:
             timeout = self.default_timeout()
-        with self.__ack_conds[msg_id]:
-            if self.__ack_conds[msg_id].wait(timeout):
-                ec = self.AckError(self.__ack_errrs[msg_id])
-                res = self.__ack_results[msg_id]
-            else:
-                ec = self.AckError.TIMEOUT
-                res = b''
+        if self.__ack_conds[msg_id].wait(timeout):
+            ec = self.AckError(self.__ack_errrs[msg_id])
+            res = self.__ack_results[msg_id]
+        else:
+            ec = self.AckError.TIMEOUT
+            res = b''
         del self.__ack_conds[msg_id]
         del self.__ack_errrs[msg_id]
         del self.__ack_results[msg_id]
@@ -363,12 +489,12 @@ class ControlBoard:
         global default_timeout_uart
         return default_timeout_uart
 
-    ## Write one byte via serial
-    #  @param b Single byte to write
-    def _write_one(self, b: bytes):
+    ## Write data via serial
+    #  @param data Bytes to write
+    def _write(self, data: bytes):
         # if self.__debug:
-        #     print("WB: {}".format(b))
-        self.__ser.write(b)
+        #     print("WB: {}".format(data))
+        self.__ser.write(data)
     
     ## Read one byte via serial
     #  @return Single byte read (bytes object)
@@ -402,26 +528,36 @@ class ControlBoard:
         if self.__debug:
             print("WRITE: ({}) {}".format(msg_id, msg))
 
+        # Replace message name with opcode if using compact protocol
+        if self.__compact:
+            for name, op in _COMPACT_LOOKUP.get(msg[:3], []):
+                if msg.startswith(name):
+                    msg = bytes([op]) + msg[len(name):]
+                    break
+
+        # Encoded message is written all at once (one write per message, not per byte)
+        frame = bytearray()
+
         # Write start byte
-        self._write_one(START_BYTE)
+        frame.extend(START_BYTE)
 
         # Write message ID (unsigned 16-bit int big endian). Escape as needed.
         id_dat = struct.pack(">H", msg_id)
         b = id_dat[0:1]
         if b == START_BYTE or b == END_BYTE or b == ESCAPE_BYTE:
-            self._write_one(ESCAPE_BYTE)
-        self._write_one(b)
+            frame.extend(ESCAPE_BYTE)
+        frame.extend(b)
         b = id_dat[1:2]
         if b == START_BYTE or b == END_BYTE or b == ESCAPE_BYTE:
-            self._write_one(ESCAPE_BYTE)
-        self._write_one(b)
+            frame.extend(ESCAPE_BYTE)
+        frame.extend(b)
 
         # Write each byte of msg (escaping it as necessary)
         for i in range(len(msg)):
             b = msg[i:i+1]
             if b == START_BYTE or b == END_BYTE or b == ESCAPE_BYTE:
-                self._write_one(ESCAPE_BYTE)
-            self._write_one(b)
+                frame.extend(ESCAPE_BYTE)
+            frame.extend(b)
         
         # Calculate CRC and write it. CRC INCLUDES MESSAGE ID BYTES.
         # Each byte of CRC must also be escaped
@@ -429,14 +565,15 @@ class ControlBoard:
         high_byte = ((crc >> 8) & 0xFF).to_bytes(1, 'little')
         low_byte = (crc & 0xFF).to_bytes(1, 'little')
         if high_byte == START_BYTE or high_byte == END_BYTE or high_byte == ESCAPE_BYTE:
-            self._write_one(ESCAPE_BYTE)
-        self._write_one(high_byte)
+            frame.extend(ESCAPE_BYTE)
+        frame.extend(high_byte)
         if low_byte == START_BYTE or low_byte == END_BYTE or low_byte == ESCAPE_BYTE:
-            self._write_one(ESCAPE_BYTE)
-        self._write_one(low_byte)
+            frame.extend(ESCAPE_BYTE)
+        frame.extend(low_byte)
 
         # Write end byte
-        self._write_one(END_BYTE)
+        frame.extend(END_BYTE)
+        self._write(bytes(frame))
 
         return msg_id
 
@@ -467,6 +604,97 @@ class ControlBoard:
         return ack, cb_ver_str, fw_ver_str
 
 
+    ## Select compact protocol (single byte opcodes instead of message names)
+    #  Messages are sent with names if the control board does not support compact protocol
+    #  @param enable True to use compact protocol, False to use message names
+    def set_compact(self, enable: bool, timeout: float = -1.0) -> AckError:
+        msg_id = self.__write_msg(b'COMPACT' + (b'\x01' if enable else b'\x00'), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        self.__compact = enable and ack == self.AckError.NONE
+        return ack
+
+    ## Check if compact protocol is in use
+    def is_compact(self) -> bool:
+        return self.__compact
+
+    ## Get PC communication statistics (counted by control board since boot)
+    def get_pccomm_stats(self, timeout: float = -1.0) -> Tuple[AckError, PCCommStats]:
+        msg_id = self.__write_msg(b'PCSTAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.PCCommStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        stats.rx_msgs, stats.rx_invalid, stats.rx_truncated, stats.rx_queue_full, stats.rx_queue_max = struct.unpack_from("<IIIII", res, 0)
+        if len(res) >= 24:
+            # Older firmware does not count dropped messages
+            stats.tx_dropped, = struct.unpack_from("<I", res, 20)
+        return ack, stats
+
+    ## Get heap statistics (allocation counts should not change during normal operation)
+    def get_heap_stats(self, timeout: float = -1.0) -> Tuple[AckError, HeapStats]:
+        msg_id = self.__write_msg(b'HEAPSTAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.HeapStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        stats.free, stats.min_free, stats.allocs, stats.frees = struct.unpack_from("<IIII", res, 0)
+        return ack, stats
+
+    ## Get fixed rate control loop timing statistics
+    def get_control_stats(self, timeout: float = -1.0) -> Tuple[AckError, ControlStats]:
+        msg_id = self.__write_msg(b'CTRLSTAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.ControlStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        stats.period_us, stats.ticks, stats.overruns, stats.max_jitter_us, stats.avg_jitter_us, stats.max_exec_us, \
+            stats.imu_stale, stats.imu_skipped, stats.depth_stale, stats.depth_skipped, \
+            stats.imu_retries, stats.depth_retries = struct.unpack_from("<IIIIIIIIIIII", res, 0)
+        return ack, stats
+
+    ## Select whether I2C data transfers use DMA (only supported on v2; others acknowledge enable with INVALID_CMD)
+    #  @param enable True to use DMA, False to use an interrupt per byte (default)
+    def set_i2c_dma(self, enable: bool, timeout: float = -1.0) -> AckError:
+        msg_id = self.__write_msg(b'I2CDMA' + (b'\x01' if enable else b'\x00'), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
+    ## Get I2C bus statistics (transactions and interrupt load)
+    def get_i2c_stats(self, timeout: float = -1.0) -> Tuple[AckError, I2CStats]:
+        msg_id = self.__write_msg(b'I2CSTAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.I2CStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        dma, stats.transactions, stats.isr_count, stats.isr_time_us = struct.unpack_from("<BIII", res, 0)
+        stats.dma = dma != 0
+        return ack, stats
+
+    ## Get statistics for transactions with an I2C device (INVALID_ARGS if device never used)
+    #  @param address I2C address of the device (0x28 = BNO055, 0x76 = MS5837)
+    def get_i2c_device_stats(self, address: int, timeout: float = -1.0) -> Tuple[AckError, I2CDeviceStats]:
+        msg_id = self.__write_msg(b'I2CDEV' + bytes([address & 0xFF]), True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.I2CDeviceStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        breaker_open, stats.transactions, stats.failures, stats.rejected, stats.retries, stats.recoveries, \
+            stats.breaker_trips, stats.avg_latency_us, stats.max_latency_us = struct.unpack_from("<BIIIIIIII", res, 0)
+        stats.breaker_open = breaker_open != 0
+        return ack, stats
+
+    ## Get SimCB socket I/O statistics (INVALID_CMD if not SimCB)
+    def get_simio_stats(self, timeout: float = -1.0) -> Tuple[AckError, SimIOStats]:
+        msg_id = self.__write_msg(b'SIMIOSTAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.SimIOStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        stats.rx_syscalls, stats.rx_bytes, stats.rx_irqs, stats.tx_syscalls, stats.tx_bytes = \
+            struct.unpack_from("<IIIII", res, 0)
+        return ack, stats
+
+
     ## Set the motor matrix defining the vehicle's thruster configuration
     #  @param matrix Motor matrix object containing configuration to set
     def set_motor_matrix(self, matrix: MotorMatrix, timeout: float = -1.0) -> AckError:
@@ -562,6 +790,52 @@ class ControlBoard:
         ack, _ = self.__wait_for_ack(msg_id, timeout)
         return ack
 
+    ## Set thrust allocation method (how DoF speeds become thruster speeds)
+    #  @param method Allocation method (AllocMethod enum)
+    #  @return Error code (AckError enum) from control board (or timeout)
+    def set_alloc_method(self, method: AllocMethod, timeout: float = -1.0) -> AckError:
+        msg = bytearray()
+        msg.extend(b'ALLOC')
+        msg.append(int(method))
+        msg_id = self.__write_msg(bytes(msg), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
+    ## Set rate of the fixed rate control loop (closed loop modes are updated at this rate)
+    #  @param rate Rate in Hz (1 to 500). Period is rounded to a whole number of ms.
+    #  @return Error code (AckError enum) from control board (or timeout)
+    def set_control_rate(self, rate: int, timeout: float = -1.0) -> AckError:
+        msg = bytearray()
+        msg.extend(b'CTRLRATE')
+        msg.extend(struct.pack("<H", rate))
+        msg_id = self.__write_msg(bytes(msg), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
+    ## Synchronize control loop to IMU samples
+    #  @param enable True to run the control loop each time there is a new IMU sample. False to use fixed rate.
+    #  @return Error code (AckError enum) from control board (or timeout)
+    def set_control_imu_sync(self, enable: bool, timeout: float = -1.0) -> AckError:
+        msg_id = self.__write_msg(b'CTRLSYNC' + (b'\x01' if enable else b'\x00'), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
+    ## Select cascaded attitude control (angle PID then gyro rate PID) per axis
+    #  Rate PIDs are tuned using tune_pid_xrate, tune_pid_yrate, and tune_pid_zrate
+    #  @param xrot True to use cascaded control for x rotation
+    #  @param yrot True to use cascaded control for y rotation
+    #  @param zrot True to use cascaded control for z rotation
+    #  @return Error code (AckError enum) from control board (or timeout)
+    def set_cascade(self, xrot: bool, yrot: bool, zrot: bool, timeout: float = -1.0) -> AckError:
+        msg = bytearray()
+        msg.extend(b'CASC')
+        msg.append(1 if xrot else 0)
+        msg.append(1 if yrot else 0)
+        msg.append(1 if zrot else 0)
+        msg_id = self.__write_msg(bytes(msg), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
     ## Set axis configuration for BNO055 IMU
     #  @param axis Axis configuration (see BNO055 datasheet) P0-P7 (BNO055Axis enum)
     #  @return Error code (AckError enum) from control board (or timeout)
@@ -705,6 +979,17 @@ class ControlBoard:
         ack, res = self.__wait_for_ack(msg_id, timeout)
         return ack
 
+    ## Get depth sensor status (achieved sample rate)
+    #  @return AckError, DepthStats
+    def get_depth_stats(self, timeout: float = -1.0) -> Tuple[AckError, DepthStats]:
+        msg_id = self.__write_msg(b'DEPTHSTAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.DepthStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        stats.rate, stats.samples = struct.unpack_from("<fI", res, 0)
+        return ack, stats
+
     ## Get current depth data. Current data is latest of either periodically received
     #  status messages or data received from a read_depth_once call.
     #  @return DepthData object containing latest data
@@ -713,97 +998,106 @@ class ControlBoard:
 
 
 
-    ## Tune xrot PID
-    #  @param kp Proportional gain
-    #  @param ki Integral gain
-    #  @param kd Derivative gain
-    #  @param kf Feed-forward gain
-    #  @param limit Max output of PID (controls max speed in sassist mode)
-    #  @param invert True to reverse direction of PID output
-    #  @return AckError
-    def tune_pid_xrot(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0) -> AckError:
+    ## Send PID tuning (PIDTN). Extended form only sent if extended parameters are used.
+    def __tune_pid(self, which: bytes, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float, kf: float, d_filter: float, d_on_meas: bool) -> AckError:
         msg = bytearray()
         limit = abs(limit)
         if limit > 1.0:
             limit = 1.0
-        msg.extend(b'PIDTNX')
+        msg.extend(b'PIDTN')
+        msg.extend(which)
         msg.extend(struct.pack("<f", kp))
         msg.extend(struct.pack("<f", ki))
         msg.extend(struct.pack("<f", kd))
         msg.extend(struct.pack("<f", limit))
         msg.append(1 if invert else 0)
+        if kf != 0.0 or d_filter != 0.0 or d_on_meas:
+            msg.extend(struct.pack("<f", kf))
+            msg.extend(struct.pack("<f", d_filter))
+            msg.append(1 if d_on_meas else 0)
         msg_id = self.__write_msg(bytes(msg), True)
         ack, _ = self.__wait_for_ack(msg_id, timeout)
         return ack
 
+    ## Tune xrot PID
+    #  ki and kd are relative to a 20ms step (scaled by measured time between PID updates)
+    #  @param kp Proportional gain
+    #  @param ki Integral gain
+    #  @param kd Derivative gain
+    #  @param limit Max output of PID (controls max speed in sassist mode)
+    #  @param invert True to reverse direction of PID output
+    #  @param kf Feed-forward gain (must be 0; rotation PIDs have no feed-forward input)
+    #  @param d_filter Time constant (seconds) of derivative low pass filter (0 = no filter)
+    #  @param d_on_meas True to take derivative of measurement instead of error
+    #  @return AckError
+    def tune_pid_xrot(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'X', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
+
     ## Tune yrot PID
+    #  ki and kd are relative to a 20ms step (scaled by measured time between PID updates)
     #  @param kp Proportional gain
     #  @param ki Integral gain
     #  @param kd Derivative gain
-    #  @param kf Feed-forward gain
     #  @param limit Max output of PID (controls max speed in sassist mode)
     #  @param invert True to reverse direction of PID output
+    #  @param kf Feed-forward gain (must be 0; rotation PIDs have no feed-forward input)
+    #  @param d_filter Time constant (seconds) of derivative low pass filter (0 = no filter)
+    #  @param d_on_meas True to take derivative of measurement instead of error
     #  @return AckError
-    def tune_pid_yrot(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0) -> AckError:
-        msg = bytearray()
-        limit = abs(limit)
-        if limit > 1.0:
-            limit = 1.0
-        msg.extend(b'PIDTNY')
-        msg.extend(struct.pack("<f", kp))
-        msg.extend(struct.pack("<f", ki))
-        msg.extend(struct.pack("<f", kd))
-        msg.extend(struct.pack("<f", limit))
-        msg.append(1 if invert else 0)
-        msg_id = self.__write_msg(bytes(msg), True)
-        ack, _ = self.__wait_for_ack(msg_id, timeout)
-        return ack
+    def tune_pid_yrot(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'Y', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
 
     ## Tune zrot PID
+    #  ki and kd are relative to a 20ms step (scaled by measured time between PID updates)
     #  @param kp Proportional gain
     #  @param ki Integral gain
     #  @param kd Derivative gain
-    #  @param kf Feed-forward gain
     #  @param limit Max output of PID (controls max speed in sassist mode)
     #  @param invert True to reverse direction of PID output
+    #  @param kf Feed-forward gain (must be 0; rotation PIDs have no feed-forward input)
+    #  @param d_filter Time constant (seconds) of derivative low pass filter (0 = no filter)
+    #  @param d_on_meas True to take derivative of measurement instead of error
     #  @return AckError
-    def tune_pid_zrot(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0) -> AckError:
-        msg = bytearray()
-        limit = abs(limit)
-        if limit > 1.0:
-            limit = 1.0
-        msg.extend(b'PIDTNZ')
-        msg.extend(struct.pack("<f", kp))
-        msg.extend(struct.pack("<f", ki))
-        msg.extend(struct.pack("<f", kd))
-        msg.extend(struct.pack("<f", limit))
-        msg.append(1 if invert else 0)
-        msg_id = self.__write_msg(bytes(msg), True)
-        ack, _ = self.__wait_for_ack(msg_id, timeout)
-        return ack
+    def tune_pid_zrot(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'Z', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
 
     ## Tune depth PID
+    #  ki and kd are relative to a 20ms step (scaled by measured time between PID updates)
     #  @param kp Proportional gain
     #  @param ki Integral gain
     #  @param kd Derivative gain
-    #  @param kf Feed-forward gain
     #  @param limit Max output of PID (controls max speed in sassist mode)
     #  @param invert True to reverse direction of PID output
+    #  @param kf Feed-forward gain (multiplies rate target depth changes, m / sec)
+    #  @param d_filter Time constant (seconds) of derivative low pass filter (0 = no filter)
+    #  @param d_on_meas True to take derivative of measurement instead of error
     #  @return AckError
-    def tune_pid_depth(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0) -> AckError:
-        msg = bytearray()
-        limit = abs(limit)
-        if limit > 1.0:
-            limit = 1.0
-        msg.extend(b'PIDTND')
-        msg.extend(struct.pack("<f", kp))
-        msg.extend(struct.pack("<f", ki))
-        msg.extend(struct.pack("<f", kd))
-        msg.extend(struct.pack("<f", limit))
-        msg.append(1 if invert else 0)
-        msg_id = self.__write_msg(bytes(msg), True)
-        ack, _ = self.__wait_for_ack(msg_id, timeout)
-        return ack
+    def tune_pid_depth(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'D', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
+
+    ## Tune xrot rate PID (inner loop of cascaded attitude control, see set_cascade)
+    #  Setpoint is xrot PID output (rad / sec). Measurement is IMU gyro rate.
+    #  Feed-forward input (multiplied by kf) is the setpoint.
+    #  Parameters are the same as tune_pid_xrot
+    #  @return AckError
+    def tune_pid_xrate(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'x', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
+
+    ## Tune yrot rate PID (inner loop of cascaded attitude control, see set_cascade)
+    #  Setpoint is yrot PID output (rad / sec). Measurement is IMU gyro rate.
+    #  Feed-forward input (multiplied by kf) is the setpoint.
+    #  Parameters are the same as tune_pid_yrot
+    #  @return AckError
+    def tune_pid_yrate(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'y', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
+
+    ## Tune zrot rate PID (inner loop of cascaded attitude control, see set_cascade)
+    #  Setpoint is zrot PID output (rad / sec). Measurement is IMU gyro rate.
+    #  Feed-forward input (multiplied by kf) is the setpoint.
+    #  Parameters are the same as tune_pid_zrot
+    #  @return AckError
+    def tune_pid_zrate(self, kp: float, ki: float, kd: float, limit: float, invert: bool, timeout: float = -1.0, kf: float = 0.0, d_filter: float = 0.0, d_on_meas: bool = False) -> AckError:
+        return self.__tune_pid(b'z', kp, ki, kd, limit, invert, timeout, kf, d_filter, d_on_meas)
 
 
 
@@ -1158,6 +1452,27 @@ class ControlBoard:
         ack, _ = self.__wait_for_ack(msg_id, timeout)
         return ack
 
+    ## Select whether BNO055 data is read in a single I2C transaction (burst read)
+    #  @param enable True to use burst reads (default). False to use one transaction each for quaternion, gyro, and accel.
+    #  @return Error code (AckError enum) from control board (or timeout)
+    def set_bno055_burst_read(self, enable: bool, timeout: float = -1.0) -> AckError:
+        msg_id = self.__write_msg(b'BNO055BURST' + (b'\x01' if enable else b'\x00'), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
+    ## Get BNO055 data read statistics (since startup)
+    #  Average I2C transactions per sample is transactions / samples
+    #  @return AckError, BNO055ReadStats
+    def get_bno055_read_stats(self, timeout: float = -1.0) -> Tuple[AckError, BNO055ReadStats]:
+        msg_id = self.__write_msg(b'BNO055STAT', True)
+        ack, res = self.__wait_for_ack(msg_id, timeout)
+        stats = ControlBoard.BNO055ReadStats()
+        if ack != self.AckError.NONE:
+            return ack, stats
+        burst, stats.samples, stats.transactions, stats.failures = struct.unpack_from("<BIII", res, 0)
+        stats.burst = burst != 0
+        return ack, stats
+
     ## Read the BNO055 calibration constants stored on the control board
     #  @return AckError, valid (True / False), calibration data
     def read_stored_bno055_calibration(self, timeout: float = -1.0) -> Tuple[AckError, bool, BNO055Calibration]:
@@ -1237,12 +1552,30 @@ class ControlBoard:
         ack, _ = self.__wait_for_ack(msg_id, timeout)
         return ack
 
+    ## Set MS5837 oversampling ratio (OSR) for pressure and temperature conversions
+    #  Higher OSR has lower noise, but conversions take longer (max 18ms at 8192)
+    #  @param pressure_osr Pressure OSR (256, 512, 1024, 2048, 4096, or 8192)
+    #  @param temperature_osr Temperature OSR (256, 512, 1024, 2048, 4096, or 8192)
+    #  @return AckError
+    def ms5837_set_osr(self, pressure_osr: int = 1024, temperature_osr: int = 1024, timeout: float = -1.0) -> AckError:
+        # Invalid OSRs are sent as 0xFF (control board responds with INVALID_ARGS)
+        osrs = [256, 512, 1024, 2048, 4096, 8192]
+        msg = bytearray()
+        msg.extend(b'MS5837OSR')
+        msg.append(osrs.index(pressure_osr) if pressure_osr in osrs else 0xFF)
+        msg.append(osrs.index(temperature_osr) if temperature_osr in osrs else 0xFF)
+        msg_id = self.__write_msg(bytes(msg), True)
+        ack, _ = self.__wait_for_ack(msg_id, timeout)
+        return ack
+
 # Used to interface with SimCB binaries (or simulator's cboard port)
 class SimCboard(ControlBoard):
-    def __init__(self, port: int, debug = False, suppress_dbg_msg = False):
+    def __init__(self, port: int, debug = False, suppress_dbg_msg = False, compact = True):
         self.__socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         self.__socket.connect(("127.0.0.1", port))
-        super().__init__("", debug, suppress_dbg_msg)
+        # Messages are small. Send them immediately instead of waiting to combine them.
+        self.__socket.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        super().__init__("", debug, suppress_dbg_msg, compact)
     
     def __del__(self):
         try:
@@ -1250,12 +1583,12 @@ class SimCboard(ControlBoard):
         except:
             pass
 
-    ## Write one byte via tcp
-    #  @param b Single byte to write
-    def _write_one(self, b: bytes):
+    ## Write data via tcp
+    #  @param data Bytes to write
+    def _write(self, data: bytes):
         # if self.__debug:
-        #     print("WB: {}".format(b))
-        self.__socket.sendall(b)
+        #     print("WB: {}".format(data))
+        self.__socket.sendall(data)
     
     ## Read one byte via tcp
     #  @return Single byte read (bytes object)
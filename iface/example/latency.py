@@ -0,0 +1,58 @@
+################################################################################
+# Copyright 2022-2023 Marcus Behel
+#
+# This file is part of AUVControlBoard.
+#
+# AUVControlBoard is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# AUVControlBoard is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with AUVControlBoard.  If not, see <https://www.gnu.org/licenses/>.
+################################################################################
+# Measure round trip latency (time from sending a command until its
+# acknowledgement is received). Mainly useful with SimCB.
+################################################################################
+# Date: October 16, 2026
+# Version: 1.0.0
+################################################################################
+
+if __name__ == "__main__":
+    print("Do not run this script directly. Use launch.py to run it.")
+    exit(1)
+
+from control_board import ControlBoard, Simulator
+import time
+
+
+# Number of round trips to measure
+COUNT = 1000
+
+
+def run(cb: ControlBoard, s: Simulator) -> int:
+    # Version info query has no side effects and a short response
+    times = []
+    start = time.perf_counter()
+    for _ in range(COUNT):
+        t = time.perf_counter()
+        res, _, _ = cb.get_version_info()
+        if res != cb.AckError.NONE:
+            print("Query failed: {}".format(res))
+            return 1
+        times.append(time.perf_counter() - t)
+    total = time.perf_counter() - start
+
+    times.sort()
+    print("Round trips: {}  ({:.1f} per second)".format(COUNT, COUNT / total))
+    print("Min:  {:.3f} ms".format(times[0] * 1000))
+    print("Avg:  {:.3f} ms".format(sum(times) / COUNT * 1000))
+    print("P50:  {:.3f} ms".format(times[COUNT // 2] * 1000))
+    print("P99:  {:.3f} ms".format(times[int(COUNT * 0.99)] * 1000))
+    print("Max:  {:.3f} ms".format(times[-1] * 1000))
+    return 0
@@ -0,0 +1,92 @@
+################################################################################
+# Copyright 2022-2023 Marcus Behel
+#
+# This file is part of AUVControlBoard.
+#
+# AUVControlBoard is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# AUVControlBoard is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with AUVControlBoard.  If not, see <https://www.gnu.org/licenses/>.
+################################################################################
+# Measure message throughput with several threads sending queries at once and
+# the number of socket system calls SimCB makes per message.
+# Syscall counts are only available with SimCB.
+################################################################################
+# Date: October 16, 2026
+# Version: 1.0.0
+################################################################################
+
+if __name__ == "__main__":
+    print("Do not run this script directly. Use launch.py to run it.")
+    exit(1)
+
+from control_board import ControlBoard, Simulator
+import threading
+import time
+
+
+# Number of threads sending queries at the same time
+THREADS = 8
+
+# Number of queries sent by each thread
+COUNT = 1000
+
+
+def run(cb: ControlBoard, s: Simulator) -> int:
+    failures = []
+
+    def sender():
+        # Version info query has no side effects and a short response
+        for _ in range(COUNT):
+            res, _, _ = cb.get_version_info()
+            if res != cb.AckError.NONE:
+                failures.append(res)
+                return
+
+    ack, io_start = cb.get_simio_stats()
+    sim = ack == cb.AckError.NONE
+    ack, pc_start = cb.get_pccomm_stats()
+    if ack != cb.AckError.NONE:
+        print("Failed to get PC communication statistics: {}".format(ack))
+        return 1
+
+    threads = [threading.Thread(target=sender) for _ in range(THREADS)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    total = time.perf_counter() - start
+
+    if len(failures) > 0:
+        print("Query failed: {}".format(failures[0]))
+        return 1
+
+    # Statistics queries are counted too (one PCSTAT, one SIMIOSTAT if SimCB)
+    _, pc_end = cb.get_pccomm_stats()
+    if sim:
+        _, io_end = cb.get_simio_stats()
+    msgs = pc_end.rx_msgs - pc_start.rx_msgs
+
+    print("Messages: {}  ({:.1f} per second)".format(THREADS * COUNT, THREADS * COUNT / total))
+    if not sim:
+        print("Socket statistics not available (not SimCB)")
+        return 0
+    rx_syscalls = io_end.rx_syscalls - io_start.rx_syscalls
+    rx_bytes = io_end.rx_bytes - io_start.rx_bytes
+    rx_irqs = io_end.rx_irqs - io_start.rx_irqs
+    tx_syscalls = io_end.tx_syscalls - io_start.tx_syscalls
+    tx_bytes = io_end.tx_bytes - io_start.tx_bytes
+    print("Received:  {} bytes  {} syscalls  {} interrupts  ({:.2f} syscalls per message)".format(
+        rx_bytes, rx_syscalls, rx_irqs, rx_syscalls / msgs))
+    print("Sent:      {} bytes  {} syscalls  ({:.2f} syscalls per message)".format(
+        tx_bytes, tx_syscalls, tx_syscalls / msgs))
+    return 0
@@ -125,7 +125,8 @@ def main():
             print("Connecting to simulator...", end="")
             s = Simulator(cmd_port)
             print("Done.")
-            cb = SimCboard(cboard_port, args.debug, args.quiet)
+            # Simulator's cboard port emulates the control board itself, so use message names
+            cb = SimCboard(cboard_port, args.debug, args.quiet, False)
             if not configure_vehicle(cb, args.vehicle, True):
                 return 1
             vehicle_tuple = all_vehicles[args.vehicle]
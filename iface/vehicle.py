@@ -74,6 +74,13 @@ class Vehicle(ABC):
         ack = cb.set_reldof(*self.reldof)
         if ack != ControlBoard.AckError.NONE:
             return ack, "set_reldof"
+
+        # Firmware without ALLOC support always uses DOF_MATRIX (the default)
+        ack = cb.set_alloc_method(self.alloc_method)
+        if ack == ControlBoard.AckError.UNKNOWN_MSG and self.alloc_method == ControlBoard.AllocMethod.DOF_MATRIX:
+            ack = ControlBoard.AckError.NONE
+        if ack != ControlBoard.AckError.NONE:
+            return ack, "set_alloc_method"
         
         imu, imu_cfg = self.imu_config
         if imu == ControlBoard.IMUSensors.BNO055:
@@ -144,6 +151,10 @@ class Vehicle(ABC):
     def depth_pid_tuning(self) -> Tuple[float, float, float, float, bool]:
         pass
 
+    @property
+    def alloc_method(self) -> ControlBoard.AllocMethod:
+        return ControlBoard.AllocMethod.DOF_MATRIX
+
     @property
     def simulator_vehicle_id(self) -> str:
         return ""